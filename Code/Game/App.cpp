@@ -12,6 +12,7 @@
 #include "Engine/UI/UISystem.hpp"
 #include "Engine/Develop/Profile.hpp"
 #include "Engine/Core/Job.hpp"
+#include "Engine/Develop/FrameArena.hpp"
 #include <filesystem>
 
 #include "Engine/Script/Py3.hpp"
@@ -63,14 +64,25 @@ void App::Startup()
 	LogStart("logs/default.log");
 
 	g_theJobSystem = new JobSystem();
-	g_theJobSystem->Startup();
+	JobSystemConfig jobConfig;
+	jobConfig.categories[JOB_GENERIC].numThreads = 1;
+	jobConfig.categories[JOB_GENERIC].threadName = "Generic Worker";
+	jobConfig.categories[JOB_IO].numThreads = 1;
+	jobConfig.categories[JOB_IO].threadName = "IO Worker";
+	g_theJobSystem->Startup(jobConfig);
 
 	g_theInput = new InputSystem();
 	const IntVec2 windowRes(g_theWindow->GetClientResolution());
-	g_theRenderer = new RenderContext(g_theWindow->m_hWnd, windowRes.x, windowRes.y);
+	{
+		MEM_TAG_SCOPE("Renderer");
+		g_theRenderer = new RenderContext(g_theWindow->m_hWnd, windowRes.x, windowRes.y);
+	}
 	g_theAudio = new AudioSystem();
 	g_theInput->StartUp();
-	g_theRenderer->Startup();
+	{
+		MEM_TAG_SCOPE("Renderer");
+		g_theRenderer->Startup();
+	}
 	g_theConsole = new DevConsole(g_theRenderer, 72, 144);
 	g_theConsole->Startup();
 	DebugRenderer::Startup(g_theRenderer);
@@ -88,6 +100,18 @@ void App::Startup()
 void App::Shutdown()
 {
 	m_flagQuit = true;
+	// let queued jobs land while everything they may touch is still alive
+	while (!g_theJobSystem->IsFinished()) {
+		if (!g_theJobSystem->TryRunPendingJob()) {
+			for (int i = JOB_MAIN; i < NUM_JOB_TYPES; ++i) {
+				g_theJobSystem->ProcessQueue((JobType)i);
+			}
+			std::this_thread::yield();
+		}
+	}
+	for (int i = 0; i < NUM_JOB_TYPES; ++i) {
+		g_theJobSystem->FinishJobsQueue((JobType)i);
+	}
 	DebugRenderer::Shutdown();
 	if (m_theGame) {
 		m_theGame->Shutdown();
@@ -122,18 +146,21 @@ void App::Shutdown()
 
 	g_theJobSystem->Shutdown();
 
-	while (!g_theJobSystem->IsFinished())
-	{
-		std::this_thread::yield();
-	}
-
 	LogStop();
 
 }
 //////////////////////////////////////////////////////////////////////////
 void App::RunFrame()
 {
-	PROFILE_SCOPE(__FUNCTION__);
+	RunProfiledFrame();
+	// after the frame root closed, the time it takes to write a hitch is in no frame
+	ProfileHitchUpdate();
+}
+//////////////////////////////////////////////////////////////////////////
+void App::RunProfiledFrame()
+{
+	// the root label hitches look for by default
+	PROFILE_SCOPE("App::RunFrame");
 
 	static double lastFrameTime = GetCurrentTimeSeconds();
 	g_theWindow->BeginFrame();
@@ -148,6 +175,12 @@ void App::RunFrame()
 	g_theUI->BeginFrame();
 
 	m_theGame->BeginFrame();
+	g_theJobSystem->BeginFrame();
+	// continuations that hopped back to the main thread, before this frame's jobs touch the game
+	g_theJobSystem->ProcessQueue(JOB_MAIN);
+	// log lines come to the console from the log thread
+	LogDrainConsole();
+	m_theGame->KickoffFrameJobs();
 
 	static double currentTime;
 	currentTime = GetCurrentTimeSeconds();
@@ -160,6 +193,7 @@ void App::RunFrame()
 	DebugRenderer::Update(float(dt));
 
 	m_theGame->Update(float(dt));
+	m_theGame->JoinFrameJobs();
 	m_theGame->Render();
 
 	m_theGame->EndFrame();
@@ -173,6 +207,11 @@ void App::RunFrame()
 	for (int i = 0; i < NUM_JOB_TYPES;++i) {
 		g_theJobSystem->FinishJobsQueue((JobType)i);
 	}
+	// nothing allocates from the arena until the next frame starts
+	GetFrameArena()->EndFrame();
+	MemCheckTagBudgets();
+	ProfileStreamUpdate();
+	ProfileStatsUpdate();
 
 	++m_frameCount;
 	lastFrameTime = currentTime;
@@ -26,6 +26,7 @@ public:
 	bool HandleChar(char charCode);
 
 private:
+	void RunProfiledFrame();
 
 	Game* m_theGame = nullptr;
 	
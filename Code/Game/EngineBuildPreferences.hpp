@@ -20,4 +20,11 @@
 #define MEM_TRACKING MEM_TRACKING_VERBOSE
 #else
 #define MEM_TRACKING MEM_TRACKING_DISABLE
-#endif
\ No newline at end of file
+#endif
+// MEM_TRACKING_VERBOSE captures a callstack about once per this many bytes allocated, 0 for every allocation.
+// Change it at runtime with mem_sample bytes=
+#define MEM_TRACKING_SAMPLE_BYTES 0
+// (If uncommented) Global operator new serves requests up to SMALL_OBJECT_MAX_SIZE from size classes instead of
+// the system heap. It reserves SMALL_OBJECT_REGION_SIZE of address space on the first allocation.
+// Measure with the smallObjectThroughput benchmark ("benchmark" unit tests) before turning it on for a game.
+//#define MEM_SMALL_OBJECT_ALLOCATOR
\ No newline at end of file
@@ -78,11 +78,88 @@ static bool _logmem_cmd(NamedStrings& param)
 	return true;
 }
 
+static bool _mem_sample_cmd(NamedStrings& param)
+{
+	int bytes = param.GetInt("bytes", 0);
+	SetMemTrackingSampleBytes(bytes > 0 ? (size_t)bytes : 0);
+	Log("", "Memory tracking callstack sampling: %s", bytes > 0 ? Stringf("one per %s", GetByteSizeString(bytes).c_str()).c_str() : "every allocation");
+	return true;
+}
+
+static bool _mem_tags_cmd(NamedStrings& param)
+{
+	MemLogTagTable();
+	return true;
+}
+
+static bool _mem_budget_cmd(NamedStrings& param)
+{
+	std::string tagName = param.GetString("tag", "");
+	int bytes = param.GetInt("bytes", 0);
+	// only tags the code registered, a console string would not outlive the command
+	for (int i = 0; i < MemGetNumTags(); ++i) {
+		const MemTag tag{(uint8_t)i};
+		if (tagName == MemGetTagName(tag)) {
+			MemSetTagBudget(tag, bytes > 0 ? (size_t)bytes : 0);
+			Log("", "Budget of %s: %s", tagName.c_str(), bytes > 0 ? GetByteSizeString(bytes).c_str() : "none");
+			return true;
+		}
+	}
+	Log("", "No memory tag %s", tagName.c_str());
+	return false;
+}
+
+#include "Engine/Develop/MemorySnapshot.hpp"
+static bool _mem_snapshot_cmd(NamedStrings& param)
+{
+	std::string name = param.GetString("name", "default");
+	if (!MemTakeSnapshot(name)) {
+		Log("", "Heap snapshots need MEM_TRACKING_VERBOSE");
+		return false;
+	}
+	return true;
+}
+
+static bool _mem_snapshots_cmd(NamedStrings& param)
+{
+	MemListSnapshots();
+	return true;
+}
+
+static bool _mem_diff_cmd(NamedStrings& param)
+{
+	std::string from = param.GetString("from", "");
+	std::string to = param.GetString("to", "");
+	int rows = param.GetInt("rows", 20);
+	if (!MemLogSnapshotDiff(from, to, rows)) {
+		Log("", "No heap snapshots %s and %s to diff", from.c_str(), to.c_str());
+		return false;
+	}
+	return true;
+}
+
+static bool _mem_export_cmd(NamedStrings& param)
+{
+	std::string name = param.GetString("name", "default");
+	std::string file = param.GetString("file", "logs/heap.pb");
+	if (!MemExportSnapshotPprof(name, file)) {
+		return false;
+	}
+	Log("", "Heap snapshot %s written to %s", name.c_str(), file.c_str());
+	return true;
+}
+
 static bool _Log_cmd(NamedStrings& param)
 {
-	std::string filter = param.GetString("filter", "default");
+	std::string filter = param.GetString("filter", "");
 	std::string msg = param.GetString("msg", "nothing");
-	Log(filter.c_str(), msg.c_str());
+	// typed names only reach channels the code already logs to
+	LogChannel channel;
+	if (!LogFindChannel(filter.c_str(), &channel)) {
+		Log("", "No log channel named %s", filter.c_str());
+		return false;
+	}
+	Log(channel, "%s", msg.c_str());
 	return true;
 }
 
@@ -120,6 +197,76 @@ static bool _Log_Flush(NamedStrings& param)
 	return true;
 }
 
+static bool _Log_Channels(NamedStrings& param)
+{
+	LogListChannels();
+	return true;
+}
+
+#include "Engine/Develop/LogSink.hpp"
+static bool _Log_Sink(NamedStrings& param)
+{
+	std::string name = param.GetString("name", "file");
+	std::string filter = param.GetString("filter", "all");
+	bool enable = param.GetBool("on", true);
+	LogSink* sink = LogFindSink(name.c_str());
+	if (!sink) {
+		Log("", "No log sink named %s", name.c_str());
+		return false;
+	}
+	if (filter == "all") {
+		sink->SetAllChannelsEnabled(enable);
+	} else {
+		sink->SetChannelEnabled(LogRegisterChannel(filter.c_str()), enable);
+	}
+	return true;
+}
+
+static bool _Log_Mode(NamedStrings& param)
+{
+	std::string mode = param.GetString("mode", "deferred");
+	LogSetMode(mode == "immediate" ? LOG_MODE_IMMEDIATE : LOG_MODE_DEFERRED);
+	return true;
+}
+
+static bool _Log_Binary(NamedStrings& param)
+{
+	std::string path = param.GetString("file", "logs/default.binlog");
+	LogSetBinaryFile(path == "off" ? "" : path);
+	return true;
+}
+
+static bool _Log_Decode(NamedStrings& param)
+{
+	std::string in = param.GetString("in", "logs/default.binlog");
+	std::string out = param.GetString("out", "logs/decoded.log");
+	if (!LogDecodeBinaryFile(in, out)) {
+		Log("", "Cannot decode %s", in.c_str());
+		return false;
+	}
+	Log("", "Decoded %s to %s", in.c_str(), out.c_str());
+	return true;
+}
+
+static bool _Log_Stats(NamedStrings& param)
+{
+	LogReportStats();
+	return true;
+}
+
+static bool _Log_Policy(NamedStrings& param)
+{
+	std::string filter = param.GetString("filter", "debug");
+	std::string policyName = param.GetString("policy", "drop_newest");
+	LogOverflowPolicy policy = LOG_OVERFLOW_BLOCK;
+	if (!LogParseOverflowPolicy(policyName, &policy)) {
+		Log("", "Unknown log policy %s, use block, drop_newest, drop_oldest or secondary", policyName.c_str());
+		return false;
+	}
+	LogSetChannelPolicy(LogRegisterChannel(filter.c_str()), policy);
+	return true;
+}
+
 static bool _Profile_Report(NamedStrings& param)
 {
 	int frameReveredN = param.GetInt("f", 0);
@@ -127,6 +274,7 @@ static bool _Profile_Report(NamedStrings& param)
 	ProfilerNode* tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), frameReveredN);
 	ShowTreeView(tree, total=="No");
 	ProfileReleaseTree(tree);
+	g_theJobSystem->LogLatencyReport();
 	return true;
 }
 
@@ -140,6 +288,145 @@ static bool _Profile_Report_Flat(NamedStrings& param)
 	return true;
 }
 
+static bool _Profile_Export(NamedStrings& param)
+{
+	std::string path = param.GetString("file", "logs/profile.json");
+	int frames = param.GetInt("frames", 0);
+	if (!ProfileExportChromeTrace(path.c_str(), frames)) {
+		Log("", "Cannot write %s", path.c_str());
+		return false;
+	}
+	Log("", "Profile trace written to %s", path.c_str());
+	return true;
+}
+
+static bool _Profile_Stream(NamedStrings& param)
+{
+	std::string path = param.GetString("file", "logs/profile_stream.json");
+	float seconds = param.GetFloat("seconds", 10.f);
+	if (!ProfileStreamStart(path.c_str(), seconds)) {
+		Log("", "Cannot write %s", path.c_str());
+		return false;
+	}
+	Log("", "Streaming profiler roots to %s for %gs", path.c_str(), seconds);
+	return true;
+}
+
+static bool _Profile_Stream_Stop(NamedStrings& param)
+{
+	ProfileStreamStop();
+	return true;
+}
+
+static bool _Profile_Stats(NamedStrings& param)
+{
+	std::string time = param.GetString("time", "total");
+	int rows = param.GetInt("rows", 30);
+	ShowStatsView(time == "self", rows);
+	return true;
+}
+
+static bool _Profile_Stats_Reset(NamedStrings& param)
+{
+	ProfileStatsReset();
+	return true;
+}
+
+static bool _Profile_Counters(NamedStrings& param)
+{
+	bool enable = param.GetBool("on", true);
+	if (ProfileSetHardwareCounters(enable)) {
+		Log("", "Hardware counters per scope are %s", enable ? "on" : "off");
+	}
+	return true;
+}
+
+static bool _Hitch_Budget(NamedStrings& param)
+{
+	float ms = param.GetFloat("ms", 0.f);
+	std::string label = param.GetString("label", "App::RunFrame");
+	int frames = param.GetInt("frames", 2);
+	ProfileSetHitchBudget(ms, label == "any" ? "" : label.c_str(), frames);
+	if (ms > 0.f) {
+		Log("", "Frames of %s over %.3fms are captured with %d frames around them", label.c_str(), ms, frames);
+	} else {
+		Log("", "Hitch capture is off");
+	}
+	return true;
+}
+
+static bool _Hitches(NamedStrings& param)
+{
+	ShowHitchesView();
+	return true;
+}
+
+static bool _Hitch_Report(NamedStrings& param)
+{
+	int id = param.GetInt("id", 0);
+	int frame = param.GetInt("frame", 0);
+	std::string view = param.GetString("view", "tree");
+	ShowHitchTreeView(id, frame, view == "flat");
+	return true;
+}
+
+static bool _Profile_Report_Tag(NamedStrings& param)
+{
+	int frameReveredN = param.GetInt("f", 0);
+	ProfilerNode* tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), frameReveredN);
+	ShowTagView(tree);
+	ProfileReleaseTree(tree);
+	return true;
+}
+
+#include "Engine/Core/Job.hpp"
+static bool _Job_Report(NamedStrings& param)
+{
+	std::string reset = param.GetString("reset", "No");
+	g_theJobSystem->LogLatencyReport(reset != "No");
+	return true;
+}
+
+#include "Engine/Core/JobTrace.hpp"
+static bool _Job_Trace_Start(NamedStrings& param)
+{
+	JobTraceStart();
+	return true;
+}
+
+static bool _Job_Trace_Stop(NamedStrings& param)
+{
+	JobTraceStop();
+	JobTraceLogSummary();
+	return true;
+}
+
+static bool _Job_Trace_Summary(NamedStrings& param)
+{
+	JobTraceLogSummary();
+	return true;
+}
+
+static bool _Job_Trace_Export(NamedStrings& param)
+{
+	std::string path = param.GetString("file", "logs/jobtrace.json");
+	if (!JobTraceExport(path.c_str())) {
+		Log("", "Cannot write %s", path.c_str());
+		return false;
+	}
+	Log("", "Job trace written to %s", path.c_str());
+	return true;
+}
+
+#include "Engine/Develop/UnitTest.hpp"
+static bool _Run_UnitTest_cmd(NamedStrings& param)
+{
+	std::string filter = param.GetString("filter", ALL_UNIT_TEST);
+	int level = param.GetInt("level", -1);
+	RunUnitTest(filter, level);
+	return true;
+}
+
 // Ghcs proc
 #include "Game/ghcs.hpp"
 static bool _Game_Load_ghcs(NamedStrings& param)
@@ -180,15 +467,45 @@ void Game::Startup()
 	g_Event->SubscribeEventCallback("test_alloc", _alloc_cmd);
 	g_Event->SubscribeEventCallback("test_free", _free_cmd);
 	g_Event->SubscribeEventCallback("logmem", _logmem_cmd);
+	g_Event->SubscribeEventCallback("mem_sample", _mem_sample_cmd);
+	g_Event->SubscribeEventCallback("mem_tags", _mem_tags_cmd);
+	g_Event->SubscribeEventCallback("mem_budget", _mem_budget_cmd);
+	g_Event->SubscribeEventCallback("mem_snapshot", _mem_snapshot_cmd);
+	g_Event->SubscribeEventCallback("mem_snapshots", _mem_snapshots_cmd);
+	g_Event->SubscribeEventCallback("mem_diff", _mem_diff_cmd);
+	g_Event->SubscribeEventCallback("mem_export", _mem_export_cmd);
 
 	g_Event->SubscribeEventCallback("filterall", _Log_Filter_DisableAll);
 	g_Event->SubscribeEventCallback("filternone", _Log_Filter_EnableAll);
 	g_Event->SubscribeEventCallback("filter", _Log_Filter_Enable);
 	g_Event->SubscribeEventCallback("logflush", _Log_Flush);
 	g_Event->SubscribeEventCallback("log", _Log_cmd);
+	g_Event->SubscribeEventCallback("log_channels", _Log_Channels);
+	g_Event->SubscribeEventCallback("log_sink", _Log_Sink);
+	g_Event->SubscribeEventCallback("log_mode", _Log_Mode);
+	g_Event->SubscribeEventCallback("log_binary", _Log_Binary);
+	g_Event->SubscribeEventCallback("log_decode", _Log_Decode);
+	g_Event->SubscribeEventCallback("log_stats", _Log_Stats);
+	g_Event->SubscribeEventCallback("log_policy", _Log_Policy);
 
 	g_Event->SubscribeEventCallback("report", _Profile_Report);
 	g_Event->SubscribeEventCallback("flat_report", _Profile_Report_Flat);
+	g_Event->SubscribeEventCallback("tag_report", _Profile_Report_Tag);
+	g_Event->SubscribeEventCallback("profile_export", _Profile_Export);
+	g_Event->SubscribeEventCallback("profile_stream", _Profile_Stream);
+	g_Event->SubscribeEventCallback("profile_stream_stop", _Profile_Stream_Stop);
+	g_Event->SubscribeEventCallback("profile_stats", _Profile_Stats);
+	g_Event->SubscribeEventCallback("profile_stats_reset", _Profile_Stats_Reset);
+	g_Event->SubscribeEventCallback("profile_counters", _Profile_Counters);
+	g_Event->SubscribeEventCallback("hitch_budget", _Hitch_Budget);
+	g_Event->SubscribeEventCallback("hitches", _Hitches);
+	g_Event->SubscribeEventCallback("hitch_report", _Hitch_Report);
+	g_Event->SubscribeEventCallback("job_report", _Job_Report);
+	g_Event->SubscribeEventCallback("job_trace_start", _Job_Trace_Start);
+	g_Event->SubscribeEventCallback("job_trace_stop", _Job_Trace_Stop);
+	g_Event->SubscribeEventCallback("job_trace_summary", _Job_Trace_Summary);
+	g_Event->SubscribeEventCallback("job_trace_export", _Job_Trace_Export);
+	g_Event->SubscribeEventCallback("unittest", _Run_UnitTest_cmd);
 	
 
 	m_rvsGame = new RVSGame();
@@ -203,6 +520,19 @@ void Game::BeginFrame()
 	g_theConsole->BeginFrame();
 	m_rvsGame->BeginFrame();
 }
+////////////////////////////////
+void Game::KickoffFrameJobs()
+{
+	m_rvsGame->kick_raycast_job();
+}
+
+////////////////////////////////
+void Game::JoinFrameJobs()
+{
+	PROFILE_SCOPE(__FUNCTION__);
+	m_rvsGame->join_raycast_job();
+}
+
 #include "Engine/Develop/Profile.hpp"
 void Game::Update(float deltaSeconds)
 {
@@ -376,6 +706,7 @@ void Game::DoKeyDown(unsigned char keyCode)
 		if (m_num_zone < 1) {
 			m_num_zone = 1;
 		}
+		m_rvsGame->Shutdown();
 		delete m_rvsGame;
 		m_rvsGame = new RVSGame();
 		m_rvsGame->Startup(m_num_zone);
@@ -436,4 +767,4 @@ void Game::mouse_wheel(int delta)
 void Game::ToggleDebugView()
 {
 	m_flagDebug = !m_flagDebug;
-}
+}
\ No newline at end of file
@@ -28,7 +28,9 @@ public:
 	bool IsRunning() const { return m_flagRunning; }
 	void Startup();
 	void BeginFrame();
+	void KickoffFrameJobs();
 	void Update(float deltaSeconds);
+	void JoinFrameJobs();
 	void Render() const;
 
 	void UpdateUI();
@@ -0,0 +1,365 @@
+#include "Engine/Core/EngineCommon.hpp"
+#include "Engine/Develop/UnitTest.hpp"
+#include "Engine/Develop/Log.hpp"
+#include "Engine/Core/Job.hpp"
+#include "Engine/Core/Task.hpp"
+#include "Engine/Core/JobTrace.hpp"
+#include "Engine/Core/Time.hpp"
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+
+// Headless job system benchmarks. Priority 0 keeps them out of the startup run,
+// use the console: unittest filter=benchmark
+#define JOBBENCH_EMPTY_JOB_COUNT 200'000
+#define JOBBENCH_WORK_JOB_COUNT  20'000
+#define JOBBENCH_WORK_MICROSECOND 10.0
+
+class _BenchJob : public Job
+{
+public:
+	_BenchJob(std::atomic<int>& done, double workMicroSecond)
+		: m_done(done)
+		, m_workMicroSecond(workMicroSecond)
+	{
+	}
+
+	void Run() override
+	{
+		if (m_workMicroSecond > 0.0) {
+			const uint64 start = GetCurrentHPC();
+			while (HPCToSeconds(GetCurrentHPC() - start) * 1000000.0 < m_workMicroSecond) {
+				// busy
+			}
+		}
+		++m_done;
+	}
+
+private:
+	std::atomic<int>& m_done;
+	double m_workMicroSecond = 0.0;
+};
+
+////////////////////////////////
+// What the job system did before the work-stealing scheduler: one locked queue, yield-spinning workers.
+// The queue is a plain mutex and deque, as AsyncQueue was back then.
+static double _RunLegacyQueue(std::vector<Job*>& jobs, std::atomic<int>& done, int numThreads)
+{
+	std::mutex pendingLock;
+	std::deque<Job*> pending;
+	std::atomic<bool> running = true;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < numThreads; ++i) {
+		threads.emplace_back([&pendingLock, &pending, &running]() {
+			while (running) {
+				Job* job = nullptr;
+				{
+					std::scoped_lock _(pendingLock);
+					if (!pending.empty()) {
+						job = pending.front();
+						pending.pop_front();
+					}
+				}
+				if (job) {
+					job->Run();
+				} else {
+					std::this_thread::yield();
+				}
+			}
+		});
+	}
+
+	const int total = (int)jobs.size();
+	const uint64 start = GetCurrentHPC();
+	for (auto& each : jobs) {
+		std::scoped_lock _(pendingLock);
+		pending.push_back(each);
+	}
+	while (done.load() < total) {
+		std::this_thread::yield();
+	}
+	const double seconds = HPCToSeconds(GetCurrentHPC() - start);
+	running = false;
+	for (auto& each : threads) {
+		each.join();
+	}
+	return seconds;
+}
+
+////////////////////////////////
+static double _RunJobSystem(std::vector<Job*>& jobs, std::atomic<int>& done)
+{
+	const int total = (int)jobs.size();
+	const uint64 start = GetCurrentHPC();
+	for (auto& each : jobs) {
+		g_theJobSystem->Run(each);
+	}
+	while (done.load() < total) {
+		std::this_thread::yield();
+	}
+	const double seconds = HPCToSeconds(GetCurrentHPC() - start);
+	g_theJobSystem->FinishJobsQueue(JOB_GENERIC);
+	return seconds;
+}
+
+////////////////////////////////
+static void _CompareSchedulers(const char* name, int jobCount, double workMicroSecond)
+{
+	const int numThreads = g_theJobSystem->GetGenericThreadCount();
+	std::atomic<int> legacyDone = 0;
+	std::atomic<int> stealingDone = 0;
+	std::vector<Job*> legacyJobs;
+	std::vector<Job*> stealingJobs;
+	legacyJobs.reserve(jobCount);
+	stealingJobs.reserve(jobCount);
+	for (int i = 0; i < jobCount; ++i) {
+		legacyJobs.push_back(new _BenchJob(legacyDone, workMicroSecond));
+		stealingJobs.push_back(new _BenchJob(stealingDone, workMicroSecond));
+	}
+
+	const double legacySeconds = _RunLegacyQueue(legacyJobs, legacyDone, numThreads);
+	for (auto& each : legacyJobs) {
+		delete each;
+	}
+	const double stealingSeconds = _RunJobSystem(stealingJobs, stealingDone);
+
+	Log("Benchmark", "%s x%d on %d workers: locked queue %.3fms (%.0f jobs/s), work stealing %.3fms (%.0f jobs/s)"
+		, name, jobCount, numThreads
+		, legacySeconds * 1000.0, (double)jobCount / legacySeconds
+		, stealingSeconds * 1000.0, (double)jobCount / stealingSeconds);
+}
+
+UNIT_TEST(jobSystemThroughput, "benchmark", 0)
+{
+	if (!g_theJobSystem || g_theJobSystem->GetGenericThreadCount() <= 0) {
+		return true;
+	}
+	_CompareSchedulers("empty jobs", JOBBENCH_EMPTY_JOB_COUNT, 0.0);
+	_CompareSchedulers("10us jobs", JOBBENCH_WORK_JOB_COUNT, JOBBENCH_WORK_MICROSECOND);
+	return true;
+}
+
+UNIT_TEST(jobCounterWaitsForBatch, "job", 5)
+{
+	constexpr int count = 256;
+	std::atomic<int> done = 0;
+	JobCounter counter;
+	Job* first = new _BenchJob(done, 0.0);
+	Job* last = new _BenchJob(done, 0.0);
+	g_theJobSystem->AddDependency(first, last);
+	for (int i = 0; i < count; ++i) {
+		g_theJobSystem->Run(new _BenchJob(done, 1.0), &counter);
+	}
+	g_theJobSystem->Run(last, &counter);
+	g_theJobSystem->Run(first, &counter);
+	g_theJobSystem->Wait(&counter);
+	CONFIRM(counter.IsDone());
+	CONFIRM(done.load() == count + 2);
+	g_theJobSystem->FinishJobsQueue(JOB_GENERIC);
+	return true;
+}
+
+UNIT_TEST(functionJobRunsInline, "job", 5)
+{
+	constexpr int count = 1024;
+	std::atomic<int> sum = 0;
+	JobCounter counter;
+	for (int i = 0; i < count; ++i) {
+		g_theJobSystem->RunFunction([&sum, i]() { sum += i; }, JOB_GENERIC, &counter);
+	}
+	g_theJobSystem->Wait(&counter);
+	CONFIRM(sum.load() == count * (count - 1) / 2);
+	g_theJobSystem->FinishJobsQueue(JOB_GENERIC);
+	return true;
+}
+
+UNIT_TEST(parallelForCoversRange, "job", 5)
+{
+	constexpr int count = 10000;
+	std::vector<std::atomic<int>> visits(count);
+	g_theJobSystem->ParallelFor(0, count, 0, [&visits](int i) {
+		++visits[i];
+	});
+	for (auto& each : visits) {
+		CONFIRM(each.load() == 1);
+	}
+
+	const long long sum = g_theJobSystem->ParallelReduce(1, count + 1, 64, 0ll
+		, [](int i) { return (long long)i; }
+		, [](long long a, long long b) { return a + b; });
+	CONFIRM(sum == (long long)count * (count + 1) / 2);
+	g_theJobSystem->FinishJobsQueue(JOB_GENERIC);
+	return true;
+}
+
+////////////////////////////////
+// Waits for the counted jobs when the test returns, CONFIRM can leave early while they use its locals
+class _WaitForCounterOnExit
+{
+public:
+	explicit _WaitForCounterOnExit(JobCounter& counter) : m_counter(counter) {}
+	~_WaitForCounterOnExit()
+	{
+		while (!m_counter.IsDone()) {
+			std::this_thread::yield();
+		}
+	}
+
+private:
+	JobCounter& m_counter;
+};
+
+UNIT_TEST(ioJobDoesNotBlockGeneric, "job", 1)
+{
+	if (g_theJobSystem->GetThreadCount(JOB_IO) <= 0 || g_theJobSystem->GetGenericThreadCount() <= 0) {
+		return true;
+	}
+	std::atomic<bool> ioDone = false;
+	std::atomic<bool> genericDone = false;
+	JobCounter ioCounter;
+	_WaitForCounterOnExit waitForIO(ioCounter);
+	g_theJobSystem->RunFunction([&ioDone]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		ioDone = true;
+	}, JOB_IO, &ioCounter);
+
+	const uint64 start = GetCurrentHPC();
+	JobCounter genericCounter;
+	g_theJobSystem->RunFunction([&genericDone]() { genericDone = true; }, JOB_GENERIC, &genericCounter);
+	g_theJobSystem->Wait(&genericCounter);
+	const double genericMS = HPCToSeconds(GetCurrentHPC() - start) * 1000.0;
+	CONFIRM(genericDone.load());
+	CONFIRM(!ioDone.load());
+	CONFIRM(genericMS < 100.0);
+
+	while (!ioCounter.IsDone()) {
+		std::this_thread::yield();
+	}
+	CONFIRM(ioDone.load());
+	g_theJobSystem->FinishJobsQueue(JOB_GENERIC);
+	g_theJobSystem->FinishJobsQueue(JOB_IO);
+	return true;
+}
+
+UNIT_TEST(jobQueueHonorsPriority, "job", 5)
+{
+	// needs a category nobody else is pulling from
+	if (g_theJobSystem->GetThreadCount(JOB_RENDERING) > 0) {
+		return true;
+	}
+	std::vector<int> order;
+	auto makeJob = [&order](int tag, JobPriority priority) {
+		Job* job = new FunctionJob([&order, tag]() { order.push_back(tag); });
+		job->SetCatagory(JOB_RENDERING);
+		job->SetPriority(priority);
+		return job;
+	};
+	g_theJobSystem->Run(makeJob(4, JOB_PRIORITY_LOW));
+	g_theJobSystem->Run(makeJob(3, JOB_PRIORITY_NORMAL));
+	g_theJobSystem->Run(makeJob(2, JOB_PRIORITY_HIGH));
+	Job* late = makeJob(1, JOB_PRIORITY_LOW);
+	late->SetFrameDeadline(1000.0);
+	g_theJobSystem->Run(late);
+	Job* early = makeJob(0, JOB_PRIORITY_LOW);
+	early->SetFrameDeadline(1.0);
+	g_theJobSystem->Run(early);
+
+	CONFIRM(g_theJobSystem->ProcessQueue(JOB_RENDERING) == 5);
+	CONFIRM(order.size() == 5);
+	for (int i = 0; i < 5; ++i) {
+		CONFIRM(order[i] == i);
+	}
+	g_theJobSystem->FinishJobsQueue(JOB_RENDERING);
+	return true;
+}
+
+////////////////////////////////
+static Task<int> _SquareOnGeneric(int value)
+{
+	co_await ResumeOn(JOB_GENERIC);
+	co_return value * value;
+}
+
+////////////////////////////////
+static Task<bool> _TaskPipeline()
+{
+	co_await ResumeOn(JOB_IO);
+	const bool ranOnIO = g_theJobSystem->IsOnThreadOf(JOB_IO);
+
+	std::vector<Task<int>> squares;
+	for (int i = 1; i <= 4; ++i) {
+		squares.push_back(_SquareOnGeneric(i));
+	}
+	co_await WhenAll(squares);
+	int sum = 0;
+	for (auto& each : squares) {
+		sum += each.Get();
+	}
+	const int nine = co_await _SquareOnGeneric(3);
+
+	co_await ResumeOn(JOB_MAIN);
+	const bool ranOnMain = g_theJobSystem->IsOnThreadOf(JOB_MAIN);
+	co_return ranOnIO && ranOnMain && sum == 30 && nine == 9;
+}
+
+UNIT_TEST(taskPipelineHopsCategories, "job", 5)
+{
+	if (g_theJobSystem->GetThreadCount(JOB_IO) <= 0) {
+		return true;
+	}
+	Task<bool> task = _TaskPipeline();
+	task.Start();
+	task.Wait();
+	CONFIRM(task.Get());
+	for (int i = 0; i < NUM_JOB_TYPES; ++i) {
+		g_theJobSystem->FinishJobsQueue((JobType)i);
+	}
+	return true;
+}
+
+////////////////////////////////
+// Engine workers trace their own jobs meanwhile, the test only counts the ones with this name
+class _TracedBenchJob : public _BenchJob
+{
+public:
+	using _BenchJob::_BenchJob;
+	const char* GetName() const override { return "test traced job"; }
+};
+
+UNIT_TEST(jobTraceRecordsEveryJob, "job", 1)
+{
+	constexpr int count = 512;
+	JobTraceStart();
+	JobCounter counter;
+	std::atomic<int> done = 0;
+	for (int i = 0; i < count; ++i) {
+		g_theJobSystem->Run(new _TracedBenchJob(done, 0.0), &counter);
+	}
+	g_theJobSystem->Wait(&counter);
+	JobTraceStop();
+	CONFIRM(done.load() == count);
+	const char* path = "logs/jobtrace_unittest.json";
+	CONFIRM(JobTraceExport(path));
+
+	FILE* fp = nullptr;
+	fopen_s(&fp, path, "r");
+	int numJobEvents = 0;
+	if (fp) {
+		char line[512];
+		while (fgets(line, sizeof(line), fp)) {
+			if (strstr(line, "\"name\":\"test traced job\"") && strstr(line, "\"ph\":\"X\"")) {
+				++numJobEvents;
+			}
+		}
+		fclose(fp);
+	}
+	remove(path);
+	CONFIRM(numJobEvents == count);
+	g_theJobSystem->FinishJobsQueue(JOB_GENERIC);
+	return true;
+}
\ No newline at end of file
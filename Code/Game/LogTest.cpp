@@ -1,7 +1,15 @@
 #include "Engine/Develop/UnitTest.hpp"
 #include "Engine/Develop/Log.hpp"
 #include "Engine/Develop/Profile.hpp"
+#include "Engine/Develop/LogSink.hpp"
+#include "Engine/Core/Time.hpp"
+#include <vector>
+#include <cstdio>
+#include <cstring>
 #define LOG_MESSAGES_PER_THREAD_TEST   (512)
+#define LOG_BENCH_THREADS              (4)
+#define LOG_BENCH_ROUNDS               (40)
+#define LOG_BENCH_CALLS_PER_ROUND      (256)
 
 static void LogTest()
 {
@@ -16,7 +24,7 @@ static void LogTest()
 		} else {
 			LogFilterDisable("debug");
 		}
-		Log("debug", format, hash_id, i);
+		Log("debug", LogRuntimeFormat(format), hash_id, i);
 	}
 }
 
@@ -30,4 +38,298 @@ UNIT_TEST(LogThreadTest, "System", 0)
 		test_thread.detach();
 	}
 	return true;
+}
+
+////////////////////////////////
+template<typename... Args>
+static std::string _FormatDeferred(const char* format, const Args&... args)
+{
+	std::vector<unsigned char> buffer((size_t(0) + ... + LogArgSize(args)) + 1);
+	unsigned char* cursor = buffer.data();
+	((cursor = LogWriteArg(cursor, args)), ...);
+	return LogFormatArgs(format, buffer.data(), (size_t)(cursor - buffer.data()));
+}
+
+UNIT_TEST(logArgsMatchPrintf, "log", 10)
+{
+	char expected[256];
+	snprintf(expected, sizeof(expected), "%d %u %5.2f %-6s| %x %c 100%%", -7, 42u, 3.14159, "ab", 255, 'z');
+	CONFIRM(_FormatDeferred("%d %u %5.2f %-6s| %x %c 100%%", -7, 42u, 3.14159, "ab", 255, 'z') == expected);
+
+	snprintf(expected, sizeof(expected), "[%*d][%.*f]", 6, 12, 3, 0.5);
+	CONFIRM(_FormatDeferred("[%*d][%.*f]", 6, 12, 3, 0.5) == expected);
+
+	// MSVC length modifiers and a 64 bit value passed where the format says %u
+	const unsigned long long big = 1ull << 40;
+	CONFIRM(_FormatDeferred("%I64u %u %lld", big, big, -big) == "1099511627776 1099511627776 -1099511627776");
+
+	// negative ints print at their own width, and h/hh cut them further
+	snprintf(expected, sizeof(expected), "%u %o %x %X %hx %hhx %hd %hhu %hhd", -1, -8, -255, -2, -1, 300, 70000, -1, 200);
+	CONFIRM(_FormatDeferred("%u %o %x %X %hx %hhx %hd %hhu %hhd", -1, -8, -255, -2, -1, 300, 70000, -1, 200) == expected);
+	const short negativeShort = -2;
+	const unsigned int maxUInt = 0xffffffffu;
+	snprintf(expected, sizeof(expected), "%x %d %llx", negativeShort, maxUInt, -1ll);
+	CONFIRM(_FormatDeferred("%x %d %llx", negativeShort, maxUInt, -1ll) == expected);
+
+	const std::string name = "deferred";
+	const char* nullString = nullptr;
+	CONFIRM(_FormatDeferred("%s/%s", name, nullString) == "deferred/(null)");
+	CONFIRM(_FormatDeferred("[%8s]", nullString) == "[  (null)]");
+	CONFIRM(_FormatDeferred("missing %d") == "missing <missing>");
+	return true;
+}
+
+////////////////////////////////
+// Bursts that fit in the thread buffers, the log thread catches up between rounds
+static double _MeasureLogCall(LogMode mode)
+{
+	LogSetMode(mode);
+	std::atomic<uint64> totalHPC = 0;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < LOG_BENCH_THREADS; ++t) {
+		threads.emplace_back([&totalHPC, t]() {
+			for (int round = 0; round < LOG_BENCH_ROUNDS; ++round) {
+				const uint64 start = GetCurrentHPC();
+				for (int i = 0; i < LOG_BENCH_CALLS_PER_ROUND; ++i) {
+					Log("logbench", "worker %d round %d message %d value %.3f", t, round, i, (double)i * 0.5);
+				}
+				totalHPC += GetCurrentHPC() - start;
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+		});
+	}
+	for (auto& each : threads) {
+		each.join();
+	}
+	const double numCalls = (double)LOG_BENCH_THREADS * LOG_BENCH_ROUNDS * LOG_BENCH_CALLS_PER_ROUND;
+	return HPCToSeconds(totalHPC) * 1000000000.0 / numCalls;
+}
+
+////////////////////////////////
+static double _MeasureDisabledLogCall()
+{
+	constexpr int count = 1'000'000;
+	LogFilterDisable("logbench_off");
+	LogFilterDisableAll();
+	const uint64 start = GetCurrentHPC();
+	for (int i = 0; i < count; ++i) {
+		Log(LOG_CHANNEL("logbench_off"), "never written %d", i);
+	}
+	const double seconds = HPCToSeconds(GetCurrentHPC() - start);
+	LogFilterEnableAll();
+	return seconds * 1000000000.0 / (double)count;
+}
+
+UNIT_TEST(logCallCost, "benchmark", 0)
+{
+	const LogMode oldMode = LogGetMode();
+	const double immediateNS = _MeasureLogCall(LOG_MODE_IMMEDIATE);
+	const double deferredNS = _MeasureLogCall(LOG_MODE_DEFERRED);
+	LogSetMode(oldMode);
+	const double disabledNS = _MeasureDisabledLogCall();
+	Log("Benchmark", "Log() from %d threads: immediate %.1fns per call, deferred %.1fns per call, disabled channel %.2fns per call"
+		, LOG_BENCH_THREADS, immediateNS, deferredNS, disabledNS);
+	return true;
+}
+
+UNIT_TEST(logChannelFilters, "log", 5)
+{
+	const LogChannel channel = LOG_CHANNEL("logtest_channel");
+	CONFIRM(LogRegisterChannel("logtest_channel").id == channel.id);
+	CONFIRM(strcmp(LogGetChannelName(channel), "logtest_channel") == 0);
+	CONFIRM(_LogNamedChannel("logtest_channel").id == channel.id);
+	LogChannel found;
+	CONFIRM(LogFindChannel("logtest_channel", &found) && found.id == channel.id);
+	CONFIRM(!LogFindChannel("logtest_never_registered", &found));
+
+	// the same buffer holding another name gets that name's channel
+	char buffer[32] = "logtest_channel";
+	CONFIRM(_LogNamedChannel(buffer).id == channel.id);
+	memcpy(buffer, "logtest_other", sizeof("logtest_other"));
+	CONFIRM(_LogNamedChannel(buffer).id == LOG_CHANNEL("logtest_other").id);
+
+	// every channel is enabled again before anything is confirmed
+	LogFilterDisableAll();
+	const bool disabledByAll = !LogIsChannelEnabled(channel);
+	LogFilterEnable("logtest_channel");
+	const bool enabledAlone = LogIsChannelEnabled(channel) && !LogIsChannelEnabled(LOG_CHANNEL("logtest_other"));
+	LogFilterDisable("logtest_channel");
+	const bool disabledAlone = !LogIsChannelEnabled(channel);
+	LogFilterEnableAll();
+	CONFIRM(disabledByAll);
+	CONFIRM(enabledAlone);
+	CONFIRM(disabledAlone);
+	CONFIRM(LogIsChannelEnabled(channel));
+	return true;
+}
+
+////////////////////////////////
+class _CaptureSink : public LogSink
+{
+public:
+	_CaptureSink() : LogSink("capture", false) {}
+	void Write(const LogMessage* messages, int count) override
+	{
+		++m_numBatches;
+		for (int i = 0; i < count; ++i) {
+			if (Accepts(messages[i])) {
+				m_lines.emplace_back(messages[i].text, messages[i].textSize);
+			}
+		}
+	}
+	std::vector<std::string> m_lines;
+	int m_numBatches = 0;
+};
+
+UNIT_TEST(logSinkGetsItsChannels, "log", 5)
+{
+	constexpr int count = 1000;
+	_CaptureSink* sink = new _CaptureSink();
+	sink->SetChannelEnabled(LOG_CHANNEL("logtest_sink"), true);
+	LogAddSink(sink);
+	const LogMode oldMode = LogGetMode();
+	for (int i = 0; i < count; ++i) {
+		LogSetMode(i % 2 ? LOG_MODE_DEFERRED : LOG_MODE_IMMEDIATE);
+		Log("logtest_sink", "line %d", i);
+		Log("logtest_elsewhere", "not for the capture sink %d", i);
+	}
+	LogSetMode(oldMode);
+	LogFlush();
+	LogRemoveSink(sink);
+	const std::vector<std::string> lines = std::move(sink->m_lines);
+	const int numBatches = sink->m_numBatches;
+	delete sink;
+
+	CONFIRM(lines.size() == count);
+	for (int i = 0; i < count; ++i) {
+		CONFIRM(lines[i] == Stringf("line %d", i));
+	}
+	// the log thread hands the lines over in batches, not one call per line
+	CONFIRM(numBatches < count);
+	return true;
+}
+
+UNIT_TEST(logOverflowPolicyCountsEveryMessage, "log", 1)
+{
+	constexpr int numThreads = 4;
+	constexpr int perThread = 2000;
+	const std::string padding(900, '.');
+	const LogChannel channel = LOG_CHANNEL("logtest_overflow");
+	const LogOverflowPolicy oldPolicy = LogGetChannelPolicy(channel);
+	const LogMode oldMode = LogGetMode();
+	const LogOverflowPolicy policies[] = { LOG_OVERFLOW_BLOCK, LOG_OVERFLOW_DROP_NEWEST, LOG_OVERFLOW_DROP_OLDEST, LOG_OVERFLOW_SECONDARY };
+	const LogMode modes[] = { LOG_MODE_IMMEDIATE, LOG_MODE_DEFERRED };
+	// confirmed once the policy and mode are back
+	bool everyMessageCounted = true;
+	bool policyCountedRight = true;
+	for (LogOverflowPolicy policy : policies) {
+		for (LogMode mode : modes) {
+			LogSetChannelPolicy(channel, policy);
+			LogSetMode(mode);
+			_CaptureSink* sink = new _CaptureSink();
+			sink->SetChannelEnabled(channel, true);
+			LogAddSink(sink);
+			const LogChannelStats before = LogGetChannelStats(channel);
+			std::vector<std::thread> threads;
+			for (int t = 0; t < numThreads; ++t) {
+				threads.emplace_back([&padding, channel]() {
+					for (int i = 0; i < perThread; ++i) {
+						Log(channel, "%d %s", i, padding);
+					}
+				});
+			}
+			for (auto& each : threads) {
+				each.join();
+			}
+			LogFlush();
+			LogRemoveSink(sink);
+			const LogChannelStats after = LogGetChannelStats(channel);
+
+			// whatever did not arrive was counted as dropped
+			everyMessageCounted = everyMessageCounted && sink->m_lines.size() + (after.dropped - before.dropped) == numThreads * perThread;
+			if (policy == LOG_OVERFLOW_BLOCK) {
+				policyCountedRight = policyCountedRight && after.dropped == before.dropped;
+			} else {
+				policyCountedRight = policyCountedRight && after.blocked == before.blocked;
+			}
+			delete sink;
+		}
+	}
+	LogSetChannelPolicy(channel, oldPolicy);
+	LogSetMode(oldMode);
+	CONFIRM(everyMessageCounted);
+	CONFIRM(policyCountedRight);
+	return true;
+}
+
+////////////////////////////////
+// Holds the log thread in Write, once, for the first batch of at least m_holdFrom messages
+class _GateSink : public _CaptureSink
+{
+public:
+	void Write(const LogMessage* messages, int count) override
+	{
+		const int holdFrom = m_holdFrom.load();
+		if (holdFrom && count >= holdFrom) {
+			m_holdFrom = 0;
+			m_holding = true;
+			while (m_holding.load()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+		_CaptureSink::Write(messages, count);
+	}
+	/// False when the log thread never got there
+	bool WaitUntilHolding()
+	{
+		for (int i = 0; i < 5000 && !m_holding.load(); ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return m_holding.load();
+	}
+	std::atomic<int> m_holdFrom = 0;
+	std::atomic<bool> m_holding = false;
+};
+
+UNIT_TEST(logDropOldestWhileSinksWrite, "log", 1)
+{
+	constexpr int numQueued = 300;
+	constexpr int count = 1000;
+	const std::string padding(900, '.');
+	const LogChannel channel = LOG_CHANNEL("logtest_drop_oldest");
+	const LogOverflowPolicy oldPolicy = LogGetChannelPolicy(channel);
+	const LogMode oldMode = LogGetMode();
+	LogSetChannelPolicy(channel, LOG_OVERFLOW_DROP_OLDEST);
+	LogSetMode(LOG_MODE_IMMEDIATE);
+	_GateSink* sink = new _GateSink();
+	sink->SetChannelEnabled(channel, true);
+	LogAddSink(sink);
+
+	// park the log thread so enough piles up for a full batch
+	sink->m_holdFrom = 1;
+	Log(channel, "gate");
+	const bool heldFirst = sink->WaitUntilHolding();
+	for (int i = 0; i < numQueued; ++i) {
+		Log(channel, "queued %d", i);
+	}
+	sink->m_holdFrom = 200;
+	sink->m_holding = false;
+	// the sinks write a full batch now, producers must still be able to evict
+	const bool heldBatch = sink->WaitUntilHolding();
+	for (int i = 0; i < count; ++i) {
+		Log(channel, "%d %s", i, padding);
+	}
+	sink->m_holding = false;
+	LogFlush();
+	LogRemoveSink(sink);
+	const std::string last = Stringf("%d %s", count - 1, padding.c_str());
+	const bool lastArrived = !sink->m_lines.empty() && sink->m_lines.back() == last;
+	delete sink;
+	LogSetChannelPolicy(channel, oldPolicy);
+	LogSetMode(oldMode);
+
+	CONFIRM(heldFirst);
+	CONFIRM(heldBatch);
+	CONFIRM(lastArrived);
+	return true;
 }
\ No newline at end of file
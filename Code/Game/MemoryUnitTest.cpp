@@ -6,7 +6,14 @@
 #include <chrono>
 
 #include "Engine/Develop/Memory.hpp"
+#include "Engine/Develop/FrameArena.hpp"
+#include "Engine/Develop/MemorySnapshot.hpp"
+#include "Engine/Develop/SmallObjectAllocator.hpp"
 #include "Engine/Develop/Profile.hpp"
+#include "Engine/Develop/Log.hpp"
+#include "Engine/Core/Time.hpp"
+#include <thread>
+#include <vector>
 
 using uint = unsigned int;
 using byte = unsigned char;
@@ -89,3 +96,345 @@ UNIT_TEST(memoryTest, "memory", 1)
 	return (pre_allocations == post_allocations);
 }
 #endif
+
+#define BLOCKBENCH_ROUNDS 20'000
+#define BLOCKBENCH_BLOCKS_PER_ROUND 64
+#define SMALLBENCH_LIVE_OBJECTS 4096
+#define SMALLBENCH_OPS 2'000'000
+#define SMALLBENCH_RESIDENT_OBJECTS 200'000
+
+////////////////////////////////
+static int _CountBlocks(BlockAllocator::Block* head)
+{
+	int count = 0;
+	for (; head; head = head->next) {
+		++count;
+	}
+	return count;
+}
+
+UNIT_TEST(blockAllocatorCrossThreadFree, "memory", 1)
+{
+	constexpr int count = 10000;
+	constexpr unsigned int blocksPerChunk = 100;
+	BlockAllocator allocator;
+	allocator.Init(GetTrackedAllocator<char>(), 64, alignof(std::max_align_t), blocksPerChunk);
+
+	// one thread allocates, another frees, both hand their magazines back when they exit
+	AsyncQueue<void*> handoff;
+	std::thread producer([&]() {
+		for (int i = 0; i < count; ++i) {
+			int* block = (int*)allocator.AllocBlock();
+			*block = i;
+			handoff.Push(block);
+		}
+	});
+	int numFreed = 0;
+	bool inOrder = true;
+	std::thread consumer([&]() {
+		void* block = nullptr;
+		while (numFreed < count) {
+			if (handoff.Pop(&block)) {
+				inOrder = inOrder && *(int*)block == numFreed;
+				allocator.FreeBlock(block);
+				++numFreed;
+			} else {
+				std::this_thread::yield();
+			}
+		}
+	});
+	producer.join();
+	consumer.join();
+	CONFIRM(numFreed == count);
+	CONFIRM(inOrder);
+
+	int numChunks = 0;
+	for (BlockAllocator::Chunk* chunk = allocator.m_chunkList; chunk; chunk = chunk->next) {
+		++numChunks;
+	}
+	CONFIRM(_CountBlocks(allocator.m_freeBlocks) == numChunks * (int)blocksPerChunk);
+	allocator.Close();
+	return true;
+}
+
+UNIT_TEST(blockAllocatorGivesSlotsBack, "memory", 5)
+{
+	// far more allocators than magazine slots come and go, Close frees the slot for the next one
+	bool everyOneCached = true;
+	for (int i = 0; i < 200; ++i) {
+		BlockAllocator allocator;
+		allocator.Init(GetTrackedAllocator<char>(), 64, alignof(std::max_align_t), 16);
+		everyOneCached = everyOneCached && allocator.m_magazineSlot >= 0;
+		allocator.Close();
+	}
+
+	// a thread exiting after its allocator is gone leaves the cached blocks alone
+	BlockAllocator* gone = new BlockAllocator();
+	gone->Init(GetTrackedAllocator<char>(), 64, alignof(std::max_align_t), 16);
+	std::atomic<int> step = 0;
+	std::thread worker([&]() {
+		gone->FreeBlock(gone->AllocBlock());
+		step = 1;
+		while (step.load() != 2) {
+			std::this_thread::yield();
+		}
+	});
+	while (step.load() != 1) {
+		std::this_thread::yield();
+	}
+	gone->Close();
+	delete gone;
+	step = 2;
+	worker.join();
+	CONFIRM(everyOneCached);
+	return true;
+}
+
+////////////////////////////////
+static double _RunBlockAllocator(BlockAllocator& allocator, int numThreads)
+{
+	std::vector<std::thread> threads;
+	const uint64 start = GetCurrentHPC();
+	for (int t = 0; t < numThreads; ++t) {
+		threads.emplace_back([&allocator]() {
+			void* blocks[BLOCKBENCH_BLOCKS_PER_ROUND];
+			for (int round = 0; round < BLOCKBENCH_ROUNDS; ++round) {
+				for (auto& each : blocks) {
+					each = allocator.AllocBlock();
+				}
+				for (auto& each : blocks) {
+					allocator.FreeBlock(each);
+				}
+			}
+		});
+	}
+	for (auto& each : threads) {
+		each.join();
+	}
+	return HPCToSeconds(GetCurrentHPC() - start);
+}
+
+UNIT_TEST(blockAllocatorThroughput, "benchmark", 0)
+{
+	const int numThreads = std::max((int)std::thread::hardware_concurrency(), 2);
+	BlockAllocator shared;
+	shared.Init(GetTrackedAllocator<char>(), 64, alignof(std::max_align_t), 256, 0);
+	BlockAllocator cached;
+	cached.Init(GetTrackedAllocator<char>(), 64, alignof(std::max_align_t), 256);
+
+	const double sharedSeconds = _RunBlockAllocator(shared, numThreads);
+	const double cachedSeconds = _RunBlockAllocator(cached, numThreads);
+	const double numOps = 2.0 * numThreads * BLOCKBENCH_ROUNDS * BLOCKBENCH_BLOCKS_PER_ROUND;
+	Log("Benchmark", "BlockAllocator %d threads: shared list %.1fns per op, magazines %.1fns per op"
+		, numThreads, sharedSeconds * 1e9 / numOps, cachedSeconds * 1e9 / numOps);
+	shared.Close();
+	cached.Close();
+	return true;
+}
+
+// the region is only reserved when something asks for it, startup leaves it alone unless operator new uses it
+#if defined(MEM_SMALL_OBJECT_ALLOCATOR)
+static constexpr int SMALL_OBJECT_TEST_PRIORITY = 5;
+#else
+static constexpr int SMALL_OBJECT_TEST_PRIORITY = 1;
+#endif
+
+UNIT_TEST(smallObjectSizeClasses, "memory", SMALL_OBJECT_TEST_PRIORITY)
+{
+	SmallObjectAllocator* allocator = GetSmallObjectAllocator();
+	for (size_t size = 0; size <= SMALL_OBJECT_MAX_SIZE; size += 7) {
+		void* p = allocator->ialloc(size);
+		CONFIRM(allocator->Owns(p));
+		CONFIRM(((uintptr_t)p & (SMALL_OBJECT_ALIGNMENT - 1)) == 0);
+		CONFIRM(allocator->GetClassSize(size) >= size);
+		memset(p, 0xab, size);
+		allocator->ifree(p);
+	}
+	// a freed block is the next one handed out of its class
+	void* first = allocator->ialloc(40);
+	allocator->ifree(first);
+	void* second = allocator->ialloc(33);
+	CONFIRM(first == second);
+	allocator->ifree(second);
+
+	void* big = allocator->ialloc(SMALL_OBJECT_MAX_SIZE + 1);
+	CONFIRM(!allocator->Owns(big));
+	CONFIRM(allocator->GetClassSize(SMALL_OBJECT_MAX_SIZE + 1) == 0);
+	allocator->ifree(big);
+	return true;
+}
+
+////////////////////////////////
+// mostly tiny requests, like nodes, jobs and short vectors
+static size_t _NextSmallObjectSize(uint32_t& state)
+{
+	state = state * 1664525u + 1013904223u;
+	const uint32_t random = state >> 8;
+	return (random & 3) ? 8 + (random >> 2) % 120 : 8 + (random >> 2) % (SMALL_OBJECT_MAX_SIZE - 8);
+}
+
+using SmallAllocFunc = void* (*)(size_t);
+using SmallFreeFunc = void (*)(void*);
+
+////////////////////////////////
+// Every thread keeps a window of live objects and replaces a random one per op
+static double _RunSmallObjects(int numThreads, SmallAllocFunc allocFunc, SmallFreeFunc freeFunc)
+{
+	std::vector<std::thread> threads;
+	const uint64 start = GetCurrentHPC();
+	for (int t = 0; t < numThreads; ++t) {
+		threads.emplace_back([=]() {
+			void* live[SMALLBENCH_LIVE_OBJECTS] = {};
+			uint32_t state = 12345u + t;
+			for (int i = 0; i < SMALLBENCH_OPS; ++i) {
+				state = state * 1664525u + 1013904223u;
+				void*& slot = live[(state >> 8) % SMALLBENCH_LIVE_OBJECTS];
+				freeFunc(slot);
+				slot = allocFunc(_NextSmallObjectSize(state));
+			}
+			for (void* each : live) {
+				freeFunc(each);
+			}
+		});
+	}
+	for (auto& each : threads) {
+		each.join();
+	}
+	return HPCToSeconds(GetCurrentHPC() - start);
+}
+
+////////////////////////////////
+static size_t _GrowResidentWithSmallObjects(SmallAllocFunc allocFunc, SmallFreeFunc freeFunc)
+{
+	std::vector<void*> live;
+	live.reserve(SMALLBENCH_RESIDENT_OBJECTS);
+	uint32_t state = 6789u;
+	const size_t before = GetProcessResidentBytes();
+	for (int i = 0; i < SMALLBENCH_RESIDENT_OBJECTS; ++i) {
+		const size_t size = _NextSmallObjectSize(state);
+		void* p = allocFunc(size);
+		memset(p, 0, size);
+		live.push_back(p);
+	}
+	const size_t after = GetProcessResidentBytes();
+	for (void* each : live) {
+		freeFunc(each);
+	}
+	return after > before ? after - before : 0;
+}
+
+UNIT_TEST(smallObjectThroughput, "benchmark", 0)
+{
+	const int numThreads = std::max((int)std::thread::hardware_concurrency(), 2);
+	SmallAllocFunc classAlloc = [](size_t size) { return GetSmallObjectAllocator()->ialloc(size); };
+	SmallFreeFunc classFree = [](void* p) { GetSmallObjectAllocator()->ifree(p); };
+
+	// resident first, freed malloc pages would hide the growth of whatever runs after
+	const size_t classResident = _GrowResidentWithSmallObjects(classAlloc, classFree);
+	const size_t mallocResident = _GrowResidentWithSmallObjects(::malloc, ::free);
+	Log("Benchmark", "Small objects, %d live: malloc grew resident by %s, size classes by %s (%s committed)"
+		, SMALLBENCH_RESIDENT_OBJECTS, GetByteSizeString(mallocResident).c_str(), GetByteSizeString(classResident).c_str()
+		, GetByteSizeString(GetSmallObjectAllocator()->GetCommittedBytes()).c_str());
+
+	const double mallocSeconds = _RunSmallObjects(numThreads, ::malloc, ::free);
+	const double classSeconds = _RunSmallObjects(numThreads, classAlloc, classFree);
+	const double numOps = 2.0 * numThreads * SMALLBENCH_OPS;
+	Log("Benchmark", "Small objects %d threads: malloc %.1fns per op, size classes %.1fns per op"
+		, numThreads, mallocSeconds * 1e9 / numOps, classSeconds * 1e9 / numOps);
+	return true;
+}
+
+UNIT_TEST(frameArenaBulkRelease, "memory", 5)
+{
+	// small enough that the second frame spills into pages
+	FrameArena arena(1024);
+	void* first = arena.Alloc(24, 64);
+	CONFIRM(((uintptr_t)first & 63) == 0);
+	memset(first, 0x5a, 24);
+
+	arena.EndFrame();
+	unsigned char* big[8];
+	for (auto& each : big) {
+		each = (unsigned char*)arena.Alloc(200);
+		memset(each, 0x33, 200);
+	}
+	CONFIRM(arena.GetUsedBytes() >= 8 * 200);
+	// what frame N allocated lives through frame N+1
+	CONFIRM(arena.IsLive(first));
+	CONFIRM(((unsigned char*)first)[23] == 0x5a);
+	for (auto& each : big) {
+		CONFIRM(arena.IsLive(each));
+	}
+
+	arena.EndFrame();
+	CONFIRM(!arena.IsLive(first));
+	CONFIRM(arena.IsLive(big[0]));
+	arena.EndFrame();
+	CONFIRM(!arena.IsLive(big[0]));
+	CONFIRM(arena.GetUsedBytes() == 0);
+	CONFIRM(arena.GetHighWaterBytes() >= 8 * 200);
+	CONFIRM(arena.GetFrameIndex() == 3);
+	return true;
+}
+
+#if (MEM_TRACKING >= MEM_TRACKING_VERBOSE)
+#define MEMTAG_TEST_ALLOCS 64
+#define MEMTAG_TEST_BYTES 1000
+UNIT_TEST(memTagAccounting, "memory", 5)
+{
+	const MemTag tag = MEM_TAG("UnitTest");
+	CONFIRM(tag.id == MEM_TAG("UnitTest").id);
+	CONFIRM(std::string(MemGetTagName(tag)) == "UnitTest");
+	// the sampling rate, the snapshots and the blocks are put back before anything below is confirmed
+	const size_t oldSampleBytes = GetMemTrackingSampleBytes();
+	SetMemTrackingSampleBytes(0);
+	const MemTagStats before = MemGetTagStats(tag);
+	MemTakeSnapshot("__unittest_before");
+
+	void* blocks[MEMTAG_TEST_ALLOCS];
+	bool tagPushed = false;
+	{
+		MEM_TAG_SCOPE("UnitTest");
+		tagPushed = MemGetCurrentTag().id == tag.id;
+		for (auto& each : blocks) {
+			each = TrackedAlloc(MEMTAG_TEST_BYTES);
+		}
+	}
+	const bool tagPopped = MemGetCurrentTag().id != tag.id;
+	const MemTagStats during = MemGetTagStats(tag);
+
+	// the growth shows up in the diff, charged to the tag
+	MemTakeSnapshot("__unittest_after");
+	std::vector<MemSnapshotDiff> diff;
+	const bool diffed = MemDiffSnapshots("__unittest_before", "__unittest_after", &diff);
+	double taggedBytes = 0.0;
+	for (const MemSnapshotDiff& each : diff) {
+		if (each.tag.id == tag.id) {
+			taggedBytes += each.deltaBytes;
+		}
+	}
+	MemDeleteSnapshot("__unittest_before");
+	MemDeleteSnapshot("__unittest_after");
+
+	for (auto& each : blocks) {
+		TrackedFree(each);
+	}
+	const MemTagStats after = MemGetTagStats(tag);
+	MemSetTagBudget(tag, 1);
+	const size_t budgetBytes = MemGetTagStats(tag).budgetBytes;
+	MemSetTagBudget(tag, 0);
+	SetMemTrackingSampleBytes(oldSampleBytes);
+
+	CONFIRM(tagPushed && tagPopped);
+	CONFIRM(during.liveBytes - before.liveBytes == MEMTAG_TEST_ALLOCS * MEMTAG_TEST_BYTES);
+	CONFIRM(during.liveCount - before.liveCount == MEMTAG_TEST_ALLOCS);
+	CONFIRM(during.totalAllocs - before.totalAllocs == MEMTAG_TEST_ALLOCS);
+	CONFIRM(diffed);
+	CONFIRM(taggedBytes == MEMTAG_TEST_ALLOCS * MEMTAG_TEST_BYTES);
+	CONFIRM(after.liveBytes == before.liveBytes);
+	CONFIRM(after.liveCount == before.liveCount);
+	CONFIRM(after.highWaterBytes >= during.liveBytes);
+	CONFIRM(budgetBytes == 1);
+	return true;
+}
+#endif
\ No newline at end of file
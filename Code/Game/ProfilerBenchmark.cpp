@@ -0,0 +1,518 @@
+#include "Engine/Core/EngineCommon.hpp"
+#include "Engine/Develop/UnitTest.hpp"
+#include "Engine/Develop/Log.hpp"
+#include "Engine/Develop/Profile.hpp"
+#include "Engine/Develop/Memory.hpp"
+#include "Engine/Core/Time.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+// Profiler cost per scope, run with: unittest filter=benchmark
+#define PROFILEBENCH_ROOTS 200
+#define PROFILEBENCH_SCOPES_PER_ROOT 1000
+#define PROFILEBENCH_DEPTH 8
+
+static volatile int s_profileBenchSink = 0;
+
+////////////////////////////////
+static void _NestedScopes(int depth)
+{
+	PROFILE_SCOPE("bench nested");
+	s_profileBenchSink = s_profileBenchSink + 1;
+	if (depth > 1) {
+		_NestedScopes(depth - 1);
+	}
+}
+
+////////////////////////////////
+static void _NestedNoScopes(int depth)
+{
+	s_profileBenchSink = s_profileBenchSink + 1;
+	if (depth > 1) {
+		_NestedNoScopes(depth - 1);
+	}
+}
+
+UNIT_TEST(profilerScopeCost, "benchmark", 0)
+{
+	// the same loops without scopes, taken off the profiled ones
+	uint64 begin = GetCurrentHPC();
+	for (int root = 0; root < PROFILEBENCH_ROOTS; ++root) {
+		for (int i = 0; i < PROFILEBENCH_SCOPES_PER_ROOT; ++i) {
+			s_profileBenchSink = s_profileBenchSink + 1;
+		}
+	}
+	const double emptyWideSeconds = HPCToSeconds(GetCurrentHPC() - begin);
+
+	// wide: a loop of siblings under every root
+	begin = GetCurrentHPC();
+	for (int root = 0; root < PROFILEBENCH_ROOTS; ++root) {
+		PROFILE_SCOPE("bench root");
+		for (int i = 0; i < PROFILEBENCH_SCOPES_PER_ROOT; ++i) {
+			PROFILE_SCOPE("bench leaf");
+			s_profileBenchSink = s_profileBenchSink + 1;
+		}
+	}
+	const double wideSeconds = HPCToSeconds(GetCurrentHPC() - begin);
+
+	begin = GetCurrentHPC();
+	for (int root = 0; root < PROFILEBENCH_ROOTS; ++root) {
+		for (int i = 0; i < PROFILEBENCH_SCOPES_PER_ROOT / PROFILEBENCH_DEPTH; ++i) {
+			_NestedNoScopes(PROFILEBENCH_DEPTH);
+		}
+	}
+	const double emptyNestedSeconds = HPCToSeconds(GetCurrentHPC() - begin);
+
+	// nested: chains PROFILEBENCH_DEPTH deep
+	begin = GetCurrentHPC();
+	for (int root = 0; root < PROFILEBENCH_ROOTS; ++root) {
+		PROFILE_SCOPE("bench root");
+		for (int i = 0; i < PROFILEBENCH_SCOPES_PER_ROOT / PROFILEBENCH_DEPTH; ++i) {
+			_NestedScopes(PROFILEBENCH_DEPTH);
+		}
+	}
+	const double nestedSeconds = HPCToSeconds(GetCurrentHPC() - begin);
+
+	// what a report pays for the last root
+	begin = GetCurrentHPC();
+	ProfilerNode* tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), 0);
+	CONFIRM(tree);
+	ProfileReleaseTree(tree);
+	const double treeSeconds = HPCToSeconds(GetCurrentHPC() - begin);
+
+	const double numScopes = (double)PROFILEBENCH_ROOTS * PROFILEBENCH_SCOPES_PER_ROOT;
+	const double numNestedScopes = (double)PROFILEBENCH_ROOTS * (PROFILEBENCH_SCOPES_PER_ROOT / PROFILEBENCH_DEPTH) * PROFILEBENCH_DEPTH;
+	Log("Benchmark", "Profiler scope: %.1fns wide, %.1fns nested %d deep, tree of %d scopes in %.1fus"
+		, (wideSeconds - emptyWideSeconds) * 1e9 / numScopes
+		, (nestedSeconds - emptyNestedSeconds) * 1e9 / numNestedScopes
+		, PROFILEBENCH_DEPTH
+		, PROFILEBENCH_SCOPES_PER_ROOT / PROFILEBENCH_DEPTH * PROFILEBENCH_DEPTH + 1
+		, treeSeconds * 1e6);
+	return true;
+}
+
+UNIT_TEST(profilerTreeFromEvents, "profiler", 10)
+{
+	{
+		PROFILE_SCOPE("test root");
+		for (int i = 0; i < 3; ++i) {
+			PROFILE_SCOPE("test child");
+			PROFILE_SCOPE("test grandchild");
+		}
+		PROFILE_SCOPE("test last");
+	}
+	ProfilerNode* tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), 0);
+	CONFIRM(tree);
+	CONFIRM(std::string(tree->label) == "test root");
+	int numChildren = 0;
+	for (ProfilerNode* child = tree->m_firstChild; child; child = child->GetNextSibling()) {
+		CONFIRM(child->GetParent() == tree);
+		CONFIRM(child->beginHPC >= tree->beginHPC && child->endHPC <= tree->endHPC);
+		if (numChildren < 3) {
+			CONFIRM(std::string(child->label) == "test child");
+			CONFIRM(child->m_firstChild && !child->m_firstChild->GetNextSibling());
+		}
+		++numChildren;
+	}
+	CONFIRM(numChildren == 4);
+	CONFIRM(std::string(tree->m_lastChild->label) == "test last");
+	ProfileReleaseTree(tree);
+
+	// a paused thread starts no roots
+	ProfilePause();
+	{
+		PROFILE_SCOPE("test paused");
+	}
+	ProfileResume();
+	tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), 0);
+	CONFIRM(tree && std::string(tree->label) == "test root");
+	ProfileReleaseTree(tree);
+	return true;
+}
+
+////////////////////////////////
+static void _DeepScopes(int depth)
+{
+	PROFILE_SCOPE("test deep");
+	if (depth > 1) {
+		_DeepScopes(depth - 1);
+	} else {
+		TrackedFree(TrackedAlloc(16));
+	}
+}
+
+UNIT_TEST(profilerCountersPastMaxDepth, "profiler", 10)
+{
+	// scopes past PROFILER_MAX_DEPTH have no counters, the deepest one that does gets their allocations
+	constexpr int depth = PROFILER_MAX_DEPTH + 4;
+	_DeepScopes(depth);
+#if (MEM_TRACKING > MEM_TRACKING_COUNTING)
+	constexpr unsigned int expectedAllocs = 1;
+#else
+	constexpr unsigned int expectedAllocs = 0;
+#endif
+	ProfilerNode* tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), 0);
+	CONFIRM(tree);
+	int numNodes = 0;
+	bool countersMatch = true;
+	for (ProfilerNode* node = tree; node; node = node->m_firstChild) {
+		++numNodes;
+		const unsigned int expected = numNodes == PROFILER_MAX_DEPTH ? expectedAllocs : 0;
+		countersMatch = countersMatch && node->allocs == expected && node->frees == expected;
+	}
+	ProfileReleaseTree(tree);
+	CONFIRM(numNodes == depth);
+	CONFIRM(countersMatch);
+	return true;
+}
+
+// what TrackAllocation reports, called directly so the test does not need MEM_TRACKING_VERBOSE
+void _NotifyAllocToProfiler(size_t bytes, MemTag tag);
+
+UNIT_TEST(profilerTagsPastTheSlotsGoToOther, "profiler", 5)
+{
+	constexpr int numTags = PROFILER_TAGS_PER_NODE + 2;
+	{
+		PROFILE_SCOPE("test tags");
+		for (int i = 0; i < numTags; ++i) {
+			_NotifyAllocToProfiler(16, MemTag{ (uint8_t)(i + 1) });
+		}
+	}
+	ProfilerNode* tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), 0);
+	CONFIRM(tree);
+	const int nodeTags = tree->numTags;
+	// every real tag keeps its own counts, OTHER has the rest
+	bool realTagsKept = true;
+	for (int i = 0; i < PROFILER_TAGS_PER_NODE - 1; ++i) {
+		realTagsKept = realTagsKept && tree->tagCounters[i].tag == i + 1 && tree->tagCounters[i].allocs == 1;
+	}
+	const ProfilerTagCounters other = tree->tagCounters[PROFILER_TAGS_PER_NODE - 1];
+	ProfileReleaseTree(tree);
+	CONFIRM(nodeTags == PROFILER_TAGS_PER_NODE);
+	CONFIRM(realTagsKept);
+	CONFIRM(other.tag == PROFILER_TAG_OTHER);
+	CONFIRM(other.allocs == numTags - (PROFILER_TAGS_PER_NODE - 1));
+	CONFIRM(other.deltaByte == 16 * (ptrdiff_t)other.allocs);
+	return true;
+}
+
+UNIT_TEST(profilerKeepsExitedThreads, "profiler", 5)
+{
+	std::thread::id workerID;
+	std::thread worker([&workerID]() {
+		workerID = std::this_thread::get_id();
+		PROFILE_SCOPE("test worker");
+	});
+	worker.join();
+	ProfilerNode* tree = RequireReferenceOfProfileTree(workerID, 0);
+	CONFIRM(tree && std::string(tree->label) == "test worker");
+	ProfileReleaseTree(tree);
+	CONFIRM(!RequireReferenceOfProfileTree(workerID, 1));
+	return true;
+}
+
+UNIT_TEST(profilerDropsOverwrittenRoots, "profiler", 1)
+{
+	{
+		PROFILE_SCOPE("test huge");
+		for (size_t i = 0; i < PROFILER_EVENTS_PER_THREAD; ++i) {
+			PROFILE_SCOPE("test filler");
+		}
+	}
+	CONFIRM(!RequireReferenceOfProfileTree(std::this_thread::get_id(), 0));
+	{
+		PROFILE_SCOPE("test after");
+	}
+	ProfilerNode* tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), 0);
+	CONFIRM(tree && std::string(tree->label) == "test after");
+	ProfileReleaseTree(tree);
+	return true;
+}
+
+////////////////////////////////
+static std::string _ReadWholeFile(const char* path)
+{
+	std::string text;
+	FILE* fp = nullptr;
+	fopen_s(&fp, path, "r");
+	if (fp) {
+		char chunk[4096];
+		size_t read;
+		while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+			text.append(chunk, read);
+		}
+		fclose(fp);
+	}
+	return text;
+}
+
+UNIT_TEST(profilerTraceExport, "profiler", 1)
+{
+	const char* path = "logs/profiler_test_trace.json";
+	const bool started = ProfileStreamStart(path, 60.0);
+	{
+		PROFILE_SCOPE("test streamed");
+		PROFILE_SCOPE("test streamed child");
+	}
+	ProfileStreamUpdate();
+	{
+		PROFILE_SCOPE("test streamed later");
+		PROFILE_SCOPE("test \"quoted\" C:\\path");
+	}
+	ProfileStreamStop();
+	const std::string streamed = _ReadWholeFile(path);
+	const bool exported = ProfileExportChromeTrace(path, 1);
+	const std::string trace = _ReadWholeFile(path);
+	remove(path);
+
+	CONFIRM(started && !IsProfileStreaming());
+	CONFIRM(streamed.find("\"name\":\"test streamed child\",\"ph\":\"X\"") != std::string::npos);
+	CONFIRM(streamed.find("\"name\":\"test streamed later\"") != std::string::npos);
+	CONFIRM(streamed.find("]}") != std::string::npos);
+	// labels come out as valid JSON strings
+	CONFIRM(streamed.find("\"name\":\"test \\\"quoted\\\" C:\\\\path\"") != std::string::npos);
+	CONFIRM(exported);
+	CONFIRM(trace.find("\"name\":\"test streamed later\"") != std::string::npos);
+	return true;
+}
+
+////////////////////////////////
+static const ProfilerScopeStats* _FindStats(const std::vector<ProfilerScopeStats>& stats, const char* label)
+{
+	for (const ProfilerScopeStats& each : stats) {
+		if (each.label == label) {
+			return &each;
+		}
+	}
+	return nullptr;
+}
+
+UNIT_TEST(profilerStatsAcrossFrames, "profiler", 5)
+{
+	ProfileStatsReset();
+	// one slow call in fifty, under the p95 and over the p99
+	for (int frame = 0; frame < 200; ++frame) {
+		PROFILE_SCOPE("test stats frame");
+		PROFILE_SCOPE("test stats spin");
+		const uint64 begin = GetCurrentHPC();
+		const uint64 wait = SecondsToHPC(frame % 50 == 49 ? 0.002 : 0.0001);
+		while (GetCurrentHPC() - begin < wait) {
+		}
+	}
+	const std::vector<ProfilerScopeStats> stats = GetProfileStats();
+	ProfileStatsReset();
+	CONFIRM(!_FindStats(GetProfileStats(), "test stats spin"));
+	const ProfilerScopeStats* spin = _FindStats(stats, "test stats spin");
+	const ProfilerScopeStats* frame = _FindStats(stats, "test stats frame");
+	CONFIRM(spin && frame);
+	CONFIRM(spin->count == 200 && frame->count == 200);
+	CONFIRM(spin->inclusive.minMicroSecond >= 100.0);
+	CONFIRM(spin->inclusive.maxMicroSecond >= 2000.0);
+	// the median is not pulled up by the slow calls, the tail is
+	CONFIRM(spin->inclusive.p50MicroSecond < 500.0);
+	CONFIRM(spin->inclusive.p99MicroSecond >= 1900.0);
+	CONFIRM(spin->inclusive.p95MicroSecond < 500.0);
+	CONFIRM(spin->inclusive.meanMicroSecond > spin->inclusive.p50MicroSecond);
+	// the frame does almost nothing but the spin
+	CONFIRM(frame->self.p50MicroSecond < frame->inclusive.p50MicroSecond);
+	CONFIRM(frame->self.maxMicroSecond <= frame->inclusive.maxMicroSecond);
+	return true;
+}
+
+////////////////////////////////
+// However the test returns, turns hitches off, removes the files of the ones it captured and forgets them all
+class _HitchTestCleanup
+{
+public:
+	_HitchTestCleanup()
+	{
+		for (const ProfilerHitchInfo& each : GetProfileHitches()) {
+			m_firstTestID = std::max(m_firstTestID, each.id + 1);
+		}
+	}
+	~_HitchTestCleanup()
+	{
+		ProfileSetHitchBudget(0);
+		for (const ProfilerHitchInfo& each : GetProfileHitches()) {
+			if (each.id >= m_firstTestID && !each.path.empty()) {
+				remove(each.path.c_str());
+			}
+		}
+		ProfileClearHitches();
+	}
+
+private:
+	int m_firstTestID = 0;
+};
+
+UNIT_TEST(profilerCapturesHitch, "profiler", 1)
+{
+	_HitchTestCleanup cleanup;
+	ProfileSetHitchBudget(1.0, "test hitch frame", 2);
+	for (int frame = 0; frame < 6; ++frame) {
+		{
+			PROFILE_SCOPE("test hitch frame");
+			PROFILE_SCOPE("test hitch spin");
+			if (frame == 2) {
+				Log("", "test hitch log line");
+				std::thread worker([]() {
+					PROFILE_SCOPE("test hitch worker");
+				});
+				worker.join();
+			}
+			const uint64 begin = GetCurrentHPC();
+			const uint64 wait = SecondsToHPC(frame == 2 ? 0.003 : 0.0001);
+			while (GetCurrentHPC() - begin < wait) {
+			}
+		}
+		ProfileHitchUpdate();
+	}
+	ProfileSetHitchBudget(0);
+
+	const std::vector<ProfilerHitchInfo> hitches = GetProfileHitches();
+	CONFIRM(!hitches.empty());
+	const ProfilerHitchInfo& hitch = hitches.back();
+	CONFIRM(hitch.label == "test hitch frame");
+	CONFIRM(hitch.milliSecond >= 3.0);
+	CONFIRM(hitch.framesBefore == 2 && hitch.framesAfter == 2);
+	CONFIRM(hitch.numLogLines >= 1);
+	CONFIRM(!hitch.path.empty());
+
+	ProfilerNode* tree = RequireReferenceOfHitchTree(hitch.id, 0);
+	CONFIRM(tree && std::string(tree->m_firstChild->label) == "test hitch spin");
+	CONFIRM(tree->GetTimeMicroSecond() >= 3000.0);
+	ProfileReleaseTree(tree);
+	for (int frame = -2; frame <= 2; ++frame) {
+		tree = RequireReferenceOfHitchTree(hitch.id, frame);
+		CONFIRM(tree);
+		ProfileReleaseTree(tree);
+	}
+	CONFIRM(!RequireReferenceOfHitchTree(hitch.id, -3));
+	CONFIRM(!RequireReferenceOfHitchTree(hitch.id, 3));
+
+	// the other threads and the log of the same time go to the file too
+	std::string trace = _ReadWholeFile(hitch.path.c_str());
+	CONFIRM(trace.find("\"name\":\"test hitch worker\",\"ph\":\"X\"") != std::string::npos);
+	CONFIRM(trace.find("test hitch log line") != std::string::npos);
+	CONFIRM(trace.find("]}") != std::string::npos);
+	return true;
+}
+
+UNIT_TEST(profilerKeepsCapturingHitches, "profiler", 5)
+{
+	// every frame is a hitch that waits for more frames than the test runs, so none is written
+	_HitchTestCleanup cleanup;
+	ProfileClearHitches();
+	ProfileSetHitchBudget(0.001, "test capturing frame", PROFILER_MAX_HITCHES * 2);
+	for (int frame = 0; frame < PROFILER_MAX_HITCHES + 4; ++frame) {
+		{
+			PROFILE_SCOPE("test capturing frame");
+			const uint64 begin = GetCurrentHPC();
+			while (GetCurrentHPC() - begin < SecondsToHPC(0.0001)) {
+			}
+		}
+		ProfileHitchUpdate();
+	}
+	const std::vector<ProfilerHitchInfo> hitches = GetProfileHitches();
+	// the first ones are kept, the ones that did not fit are not captured
+	CONFIRM((int)hitches.size() == PROFILER_MAX_HITCHES);
+	for (int i = 1; i < (int)hitches.size(); ++i) {
+		CONFIRM(hitches[i].id == hitches[0].id + i);
+		CONFIRM(hitches[i].path.empty());
+	}
+	CONFIRM(hitches.back().framesAfter == 4);
+	return true;
+}
+
+////////////////////////////////
+static void _SpinMilliSecond(double milliSecond)
+{
+	const uint64 begin = GetCurrentHPC();
+	while (GetCurrentHPC() - begin < SecondsToHPC(milliSecond / 1000.0)) {
+	}
+}
+
+UNIT_TEST(profilerSkipsHitchWriteFrame, "profiler", 5)
+{
+	_HitchTestCleanup cleanup;
+	ProfileClearHitches();
+	ProfileSetHitchBudget(1.0, "test write frame", 0);
+	{
+		PROFILE_SCOPE("test write frame");
+		_SpinMilliSecond(3.0);
+	}
+	{
+		// writes the hitch above from inside this frame, which goes over the budget too
+		PROFILE_SCOPE("test write frame");
+		ProfileHitchUpdate();
+		_SpinMilliSecond(3.0);
+	}
+	ProfileHitchUpdate();
+	const std::vector<ProfilerHitchInfo> hitches = GetProfileHitches();
+	CONFIRM(hitches.size() == 1);
+	CONFIRM(!hitches[0].path.empty());
+	return true;
+}
+
+UNIT_TEST(profilerHardwareCounters, "profiler", 5)
+{
+	const bool enabled = ProfileSetHardwareCounters(true);
+#if defined(_WIN32)
+	// QueryThreadCycleTime is always there, a Windows build has to count cycles
+	CONFIRM(enabled);
+#endif
+	if (!enabled) {
+		// no counters here, scopes are still timed and read none
+		CONFIRM(!IsProfilingHardwareCounters());
+		{
+			PROFILE_SCOPE("test hardware");
+		}
+		ProfilerNode* tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), 0);
+		CONFIRM(tree && tree->hardwareMask == 0);
+		ProfileReleaseTree(tree);
+		return true;
+	}
+	{
+		PROFILE_SCOPE("test hardware");
+		for (int i = 0; i < 1000; ++i) {
+			PROFILE_SCOPE("test hardware child");
+			s_profileBenchSink = s_profileBenchSink + 1;
+		}
+	}
+	ProfileSetHardwareCounters(false);
+	ProfilerNode* tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), 0);
+	CONFIRM(tree && tree->hardwareMask != 0);
+#if defined(_WIN32)
+	CONFIRM(tree->hardwareMask == (1 << PROFILER_HW_CYCLES));
+#endif
+	// the counters of a scope take in its children
+	for (int counter = 0; counter < NUM_PROFILER_HW_COUNTERS; ++counter) {
+		if (!((tree->hardwareMask >> counter) & 1)) {
+			continue;
+		}
+		uint64 children = 0;
+		for (ProfilerNode* child = tree->m_firstChild; child; child = child->GetNextSibling()) {
+			CONFIRM((child->hardwareMask >> counter) & 1);
+			children += child->hardwareCounters[counter];
+		}
+		CONFIRM(children <= tree->hardwareCounters[counter]);
+	}
+	if ((tree->hardwareMask >> PROFILER_HW_CYCLES) & 1) {
+		CONFIRM(tree->hardwareCounters[PROFILER_HW_CYCLES] > 1000);
+	}
+	if ((tree->hardwareMask >> PROFILER_HW_INSTRUCTIONS) & 1) {
+		CONFIRM(tree->hardwareCounters[PROFILER_HW_INSTRUCTIONS] > 1000);
+	}
+	ProfileReleaseTree(tree);
+
+	// a root that begins after it is turned off reads nothing
+	{
+		PROFILE_SCOPE("test hardware off");
+	}
+	tree = RequireReferenceOfProfileTree(std::this_thread::get_id(), 0);
+	CONFIRM(tree && tree->hardwareMask == 0);
+	ProfileReleaseTree(tree);
+	return true;
+}
@@ -4,6 +4,7 @@
 #include "Engine/Core/VertexUtils.hpp"
 #include "Engine/Renderer/RenderContext.hpp"
 #include "Engine/Develop/DebugRenderer.hpp"
+#include "Engine/Develop/FrameArena.hpp"
 //#include "Engine/Core/WindowContext.hpp"
 #include "Game/Game.hpp"
 #include "Engine/Core/Time.hpp"
@@ -44,7 +45,7 @@ void QuadTree::build_tree(size_t depth)
 
 void QuadTree::display() const
 {
-	std::vector<Vertex_PCU> vert;
+	FrameVector<Vertex_PCU> vert;
 	Vec2 tl = m_box.GetTopLeft();
 	Vec2 bl = m_box.GetBottomLeft();
 	Vec2 br = m_box.GetBottomRight();
@@ -55,7 +56,7 @@ void QuadTree::display() const
 	AddVerticesOfLine2D(vert, br, bl, 0.005f, Rgba::GRAY);
 	AddVerticesOfLine2D(vert, bl, tl, 0.005f, Rgba::GRAY);
 	AddVerticesOfAABB2D(vert, m_box, color);
-	g_theRenderer->DrawVertexArray(vert.size(), vert);
+	g_theRenderer->DrawVertexArray((int)vert.size(), vert.data());
 	
 	if (m_sub[0]) {
 		for (size_t i = 0; i < 4; ++i) {
@@ -112,6 +113,7 @@ void RVSGame::Startup(size_t numPolys)
 {
 	constexpr float radius_min = 0.05f;
 	constexpr float radius_max = 0.1f;
+	MEM_TAG_SCOPE("RVSZones");
 	for (size_t i = 0; i< numPolys;++i) {
 		m_zones.emplace_back(Zone());
 		auto& zone = m_zones[i];
@@ -153,22 +155,51 @@ void RVSGame::BeginFrame()
 	m_qt->reset_tree_flag();
 }
 
-void RVSGame::Update(float deltaSeconds)
+//invisible raycast for 1ms, runs on a generic worker while the main thread updates
+class RaycastStressJob : public Job
 {
-	//invisible raycast for 1ms
-	double max_time = GetCurrentTimeSeconds();
-	Vec2 start, end;
-	max_time += 0.001;
-	size_t count = 0;
-	while(GetCurrentTimeSeconds() < max_time) {
-		start.x = g_rng.GetFloatInRange(-1,1);
-		start.y = g_rng.GetFloatInRange(-1,1);
-		end.x = g_rng.GetFloatInRange(-1,1);
-		end.y = g_rng.GetFloatInRange(-1,1);
-		raycast_to_all(Ray2::FromPoint(start, end));
-		++count;
+public:
+	RaycastStressJob(RVSGame* game, int seed)
+		: m_game(game)
+	{
+		m_rng.Init(seed, 0);
+	}
+
+	void Run() override
+	{
+		double max_time = GetCurrentTimeSeconds();
+		Vec2 start, end;
+		max_time += 0.001;
+		size_t count = 0;
+		while(GetCurrentTimeSeconds() < max_time) {
+			start.x = m_rng.GetFloatInRange(-1,1);
+			start.y = m_rng.GetFloatInRange(-1,1);
+			end.x = m_rng.GetFloatInRange(-1,1);
+			end.y = m_rng.GetFloatInRange(-1,1);
+			m_game->raycast_to_all(Ray2::FromPoint(start, end));
+			++count;
+		}
+		m_game->m_raycast_count = count;
 	}
-	DebugRenderer::Log(Stringf("%6u ray in 1ms", count), 0, Rgba::RED);
+
+private:
+	RVSGame* m_game = nullptr;
+	RNG m_rng;
+};
+
+void RVSGame::kick_raycast_job()
+{
+	g_theJobSystem->Run(new RaycastStressJob(this, m_raycast_seed++), &m_raycast_counter);
+}
+
+void RVSGame::join_raycast_job()
+{
+	g_theJobSystem->Wait(&m_raycast_counter);
+	DebugRenderer::Log(Stringf("%6u ray in 1ms", m_raycast_count), 0, Rgba::RED);
+}
+
+void RVSGame::Update(float deltaSeconds)
+{
 	m_impact = ConvexImpactResult();
 	if(m_raycast_on) {
 		Ray2 ray = Ray2::FromPoint(m_mouse_start, m_mouse_end);
@@ -189,7 +220,7 @@ void RVSGame::Update(float deltaSeconds)
 
 void RVSGame::Render() const
 {
-	std::vector<Vertex_PCU> verts;
+	FrameVector<Vertex_PCU> verts;
 	for (auto each:m_zones) {
 		auto& poly = each.m_poly;
 		auto& position = each.m_position;
@@ -198,7 +229,7 @@ void RVSGame::Render() const
 		}
 		AddVerticesOfLine2D(verts, poly.m_points[poly.m_points.size() - 1], poly.m_points[0], 0.003f, Rgba::TEAL);
 	}
-	g_theRenderer->DrawVertexArray(verts.size(), verts);
+	g_theRenderer->DrawVertexArray((int)verts.size(), verts.data());
 
 
 	/*verts.clear();
@@ -241,7 +272,7 @@ void RVSGame::Render() const
 		AddVerticesOfLine2D(verts, m_mouse_start, m_mouse_end, 0.0035f, m_impact.hit?
 			Rgba::GREEN:
 			Rgba::RED);
-		g_theRenderer->DrawVertexArray(verts.size(), verts);
+		g_theRenderer->DrawVertexArray((int)verts.size(), verts.data());
 
 		
 		if (m_impact.hit) {
@@ -258,6 +289,9 @@ void RVSGame::EndFrame()
 
 void RVSGame::Shutdown()
 {
+	if (m_load_ghcs_task.IsValid()) {
+		m_load_ghcs_task.Wait();
+	}
 	g_Event->UnsubscribeEventCallback("ghcs-load", this, &RVSGame::load_ghcs);
 	g_Event->UnsubscribeEventCallback("ghcs-save", this, &RVSGame::save_ghcs);
 }
@@ -312,16 +346,36 @@ void RVSGame::wheel_down(const Vec2& mouse_pos)
 extern Game* g_game;
 bool RVSGame::load_ghcs(NamedStrings& param)
 {
+	if (m_load_ghcs_task.IsValid() && !m_load_ghcs_task.IsDone()) {
+		DebugRenderer::Log("ghcs-load: still loading");
+		return false;
+	}
+	MEM_TAG_SCOPE("RVSZones");
+	m_load_ghcs_task = load_ghcs_task(param.GetString("path", "Data/Test.ghcs"));
+	m_load_ghcs_task.Start(JOB_IO);
+	return true;
+}
+
+Task<void> RVSGame::load_ghcs_task(std::string path)
+{
+	co_await ResumeOn(JOB_IO);
+	// the tag stack is per thread, no scope may span a co_await
+	MemPushTag(MEM_TAG("RVSZones"));
 	constexpr int buffer_size = 10485760;
-	std::string path = param.GetString("path", "Data/Test.ghcs");
-	byte* buffer = new byte[buffer_size];
-	LoadFileToBuffer(buffer, buffer_size, path.c_str());
-	buffer_reader reader(buffer, buffer_size);
+	std::vector<byte> buffer(buffer_size);
+	LoadFileToBuffer(buffer.data(), buffer_size, path.c_str());
+	MemPopTag();
+
+	co_await ResumeOn(JOB_GENERIC);
+	MemPushTag(MEM_TAG("RVSZones"));
+	buffer_reader reader(buffer.data(), buffer_size);
 	ghcs_header header = parse_ghcs_header(reader);
 	if (header.is_big_endian) {
 		reader.m_reverse = true;
 	}
 
+	std::vector<Zone> new_zones;
+	bool has_zones = false;
 	char fcc[4];
 	while (true) {
 		if (!reader.next_n_byte((byte*)fcc, 4)){
@@ -336,19 +390,22 @@ bool RVSGame::load_ghcs(NamedStrings& param)
 			byte endi = reader.next_basic<byte>();
 			uint32 size = reader.next_basic<uint32>();
 			if (type == ghcs_ConvexPolysChunk) {
-				std::vector<Zone> new_zones;
-				m_zones = parse_convex_poly_chunk(reader);
-				//m_zones = new_zones;
-				_update_quad_tree();
-				g_game->m_num_zone = m_zones.size();
+				new_zones = parse_convex_poly_chunk(reader);
+				has_zones = true;
 			} else {
 				reader.m_ptr += size;
 			}
 		}
 	}
+	MemPopTag();
 
-
-	return true;
+	co_await ResumeOn(JOB_MAIN);
+	if (has_zones) {
+		MEM_TAG_SCOPE("RVSZones");
+		m_zones = std::move(new_zones);
+		_update_quad_tree();
+		g_game->m_num_zone = m_zones.size();
+	}
 }
 
 bool RVSGame::save_ghcs(NamedStrings& param)
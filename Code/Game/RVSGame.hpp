@@ -2,6 +2,8 @@
 #include "Engine/Math/Convex.hpp"
 #include "Engine/Core/EngineCommon.hpp"
 #include "Engine/Math/AABB2.hpp"
+#include "Engine/Core/Job.hpp"
+#include "Engine/Core/Task.hpp"
 
 class Zone
 {
@@ -67,8 +69,12 @@ public:
 	
 	bool load_ghcs(NamedStrings& param);
 	bool save_ghcs(NamedStrings& param);
+	// read on IO, parse on a generic worker, swap the zones in on the main thread
+	Task<void> load_ghcs_task(std::string path);
 
 	void raycast_to_all(const Ray2& ray);
+	void kick_raycast_job();
+	void join_raycast_job();
 	void _update_quad_tree();
 	Zone* get_first_zone_include(const Vec2& position);
 
@@ -84,5 +90,11 @@ public:
 
 	bool m_set_rotation = false;
 	bool m_set_scale = false;
+
+	JobCounter m_raycast_counter;
+	size_t m_raycast_count = 0;
+	int m_raycast_seed = 0;
+
+	Task<void> m_load_ghcs_task;
 };
 
@@ -1,12 +1,17 @@
 #include "Engine/Core/AsyncCircularQueue.hpp"
+#include <cstring>
 
 ////////////////////////////////
 AsyncCircularQueue::AsyncCircularQueue(size_t size)
-	: m_bufferSize(size)
 {
-	m_buffer = new unsigned char[size];
-	m_write = m_buffer;
-	m_read = m_buffer;
+	m_bufferSize = 64;
+	while (m_bufferSize < size) {
+		m_bufferSize <<= 1;
+	}
+	m_mask = m_bufferSize - 1;
+	// zeroed: every header starts out RECORD_NOT_READY
+	m_buffer = new unsigned char[m_bufferSize];
+	memset(m_buffer, 0, m_bufferSize);
 }
 
 ////////////////////////////////
@@ -15,97 +20,171 @@ AsyncCircularQueue::~AsyncCircularQueue()
 	delete[] m_buffer;
 }
 
+////////////////////////////////
+size_t AsyncCircularQueue::_GetRecordSpan(size_t payloadSize)
+{
+	return (sizeof(_Header) + payloadSize + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+}
+
 ////////////////////////////////
 size_t AsyncCircularQueue::GetWritableSpace() const
 {
-	std::ptrdiff_t diff = m_write - m_read;
-	if (diff >= 0) {
-		return m_bufferSize - diff;
-	} else {
-		// diff < 0
-		return (size_t)-diff;
-	}
+	const uint64_t read = m_read.load(std::memory_order_acquire);
+	const uint64_t write = m_write.load(std::memory_order_acquire);
+	return m_bufferSize - (size_t)(write - read);
 }
 
 ////////////////////////////////
 void* AsyncCircularQueue::ReserveForPush(size_t size)
 {
-	static constexpr size_t headerSize = sizeof(_Header);
-	size_t sizeRemain = GetWritableSpace();
-	size_t sizeOfBlockAndNextHeader = size + headerSize * 2;
-
-	std::scoped_lock _(m_lock);
-
-	if (sizeRemain < sizeOfBlockAndNextHeader) {
-		return nullptr;
-	}
-	unsigned char* nextHead = m_write + sizeOfBlockAndNextHeader;
-	if (nextHead > m_buffer + m_bufferSize) {
-		//Create a wrap to head
-		_Header* skip = (_Header*)m_write;
-		skip->size = 0; //skip
-		skip->ready = 1;
-		m_write = m_buffer;
-		sizeRemain = GetWritableSpace();
-	}
-	if (sizeRemain < sizeOfBlockAndNextHeader) {
-		return nullptr;
+	GUARANTEE_OR_DIE(size <= GetMaxRecordSize(), "AsyncCircularQueue record bigger than half the buffer");
+	const uint64_t span = _GetRecordSpan(size);
+	uint64_t write = m_write.load(std::memory_order_relaxed);
+	while (true) {
+		const uint64_t read = m_read.load(std::memory_order_acquire);
+		const uint64_t untilEnd = m_bufferSize - (write & m_mask);
+		// a record never wraps, pad to the end of the buffer with a skip record instead
+		const uint64_t padding = span > untilEnd ? untilEnd : 0;
+		if (write + padding + span - read > m_bufferSize) {
+			return nullptr;
+		}
+		if (m_write.compare_exchange_weak(write, write + padding + span, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+			if (padding > 0) {
+				_Header* skip = _HeaderAt(write);
+				skip->size = (uint32_t)padding;
+				// no wake up here, this may run under m_waitLock and the real record's FinalizePush wakes the consumer
+				skip->state.store(RECORD_SKIP, std::memory_order_release);
+			}
+			_Header* header = _HeaderAt(write + padding);
+			header->size = (uint32_t)size;
+			return header + 1;
+		}
 	}
-	_Header* header = (_Header*)m_write;
-	header->size = (unsigned int)size;
-	header->ready = 0;
-	m_write += sizeOfBlockAndNextHeader;
-	
-	return header + 1;
 }
 
 ////////////////////////////////
 void* AsyncCircularQueue::BlockedReserveForPush(size_t size)
 {
 	void* buf = ReserveForPush(size);
-	while (!buf) {
-
-		std::this_thread::yield();
-		buf = ReserveForPush(size);
+	if (buf) {
+		return buf;
+	}
+	++m_producerWaiters;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	{
+		std::unique_lock lk(m_waitLock);
+		m_producerCV.wait(lk, [this, size, &buf]() {
+			buf = ReserveForPush(size);
+			return buf != nullptr;
+		});
 	}
+	--m_producerWaiters;
 	return buf;
 }
 
 ////////////////////////////////
 void AsyncCircularQueue::FinalizePush(void* pData)
 {
-	_Header* head = ((_Header*)pData) - 1;
-	head->ready = 1;
+	_Header* header = ((_Header*)pData) - 1;
+	header->state.store(RECORD_READY, std::memory_order_release);
+	_NotifyConsumer();
+}
+
+////////////////////////////////
+void AsyncCircularQueue::_NotifyConsumer()
+{
+	// pairs with the fence in WaitForPop: either we see the consumer waiting or it sees our record
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_consumerWaiting.load(std::memory_order_relaxed)) {
+		{
+			std::scoped_lock _(m_waitLock);
+		}
+		m_consumerCV.notify_one();
+	}
 }
 
 ////////////////////////////////
 void* AsyncCircularQueue::ReserveForPop(size_t* outSize)
 {
-	std::scoped_lock _(m_lock);
+	uint64_t read = m_read.load(std::memory_order_relaxed);
 	while (true) {
-		if (m_read == m_write) {
+		if (read == m_write.load(std::memory_order_acquire)) {
 			return nullptr;
 		}
-		_Header* head = (_Header*)m_read;
-		if (head->ready) {
-			if (head->size == 0) {
-				m_read = m_buffer;
-				continue;
-			}
-			*outSize = head->size;
-			return head + 1;
-		} else {
+		_Header* header = _HeaderAt(read);
+		const uint32_t state = header->state.load(std::memory_order_acquire);
+		if (state == RECORD_NOT_READY) {
 			return nullptr;
 		}
+		if (state == RECORD_SKIP) {
+			const uint32_t skipSize = header->size;
+			memset((void*)header, 0, skipSize);
+			read += skipSize;
+			_Release(read);
+			continue;
+		}
+		*outSize = header->size;
+		return header + 1;
 	}
 }
 
 ////////////////////////////////
 void AsyncCircularQueue::FinalizePop(void* pOut)
 {
-	static constexpr size_t headerSize = sizeof(_Header);
-	std::scoped_lock _(m_lock);
 	_Header* header = (_Header*)pOut - 1;
-	GUARANTEE_OR_DIE((void*)m_read == header, "Circular Queue read pointer not matched");
-	m_read = (unsigned char*)((size_t)header + headerSize * 2 + header->size);
+	const uint64_t read = m_read.load(std::memory_order_relaxed);
+	GUARANTEE_OR_DIE(_HeaderAt(read) == header, "Circular Queue read pointer not matched");
+	const size_t span = _GetRecordSpan(header->size);
+	memset((void*)header, 0, span);
+	_Release(read + span);
+}
+
+////////////////////////////////
+void AsyncCircularQueue::_Release(uint64_t newReadPosition)
+{
+	m_read.store(newReadPosition, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_producerWaiters.load(std::memory_order_relaxed) > 0) {
+		{
+			std::scoped_lock _(m_waitLock);
+		}
+		m_producerCV.notify_all();
+	}
 }
+
+////////////////////////////////
+bool AsyncCircularQueue::CanPop() const
+{
+	const uint64_t read = m_read.load(std::memory_order_relaxed);
+	if (read == m_write.load(std::memory_order_acquire)) {
+		return false;
+	}
+	return _HeaderAt(read)->state.load(std::memory_order_acquire) != RECORD_NOT_READY;
+}
+
+////////////////////////////////
+void AsyncCircularQueue::WaitForPop()
+{
+	if (CanPop() || m_wakeRequested.exchange(false)) {
+		return;
+	}
+	m_consumerWaiting = true;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	{
+		std::unique_lock lk(m_waitLock);
+		m_consumerCV.wait(lk, [this]() {
+			return CanPop() || m_wakeRequested.exchange(false);
+		});
+	}
+	m_consumerWaiting = false;
+}
+
+////////////////////////////////
+void AsyncCircularQueue::WakeConsumer()
+{
+	{
+		std::scoped_lock _(m_waitLock);
+		m_wakeRequested = true;
+	}
+	m_consumerCV.notify_one();
+}
\ No newline at end of file
@@ -1,35 +1,131 @@
 #pragma once
 #include "Engine/Core/EngineCommon.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <condition_variable>
 #include <mutex>
 
+// Lock-free MPSC ring of variable size records.
+// Producers reserve with one CAS on the write position, fill the record in place and publish it
+// with FinalizePush. The single consumer reads records in reservation order.
+// Every record starts with an 8 byte header; a record that would straddle the end of the buffer
+// leaves a skip record behind and starts over at the beginning.
 class AsyncCircularQueue
 	//MPSC
 {
 private:
+	enum _RecordState : uint32_t
+	{
+		RECORD_NOT_READY = 0,
+		RECORD_READY,
+		RECORD_SKIP,
+	};
+
 	struct _Header
 	{
-		unsigned int size  : 31;
-		unsigned int ready : 1;
+		std::atomic<uint32_t> state;
+		// payload bytes, or the whole span for a skip record
+		uint32_t size;
 	};
+	static_assert(sizeof(_Header) == 8, "AsyncCircularQueue header must stay 8 bytes");
+	static constexpr size_t RECORD_ALIGN = 8;
+
 public:
+	/// /param size rounded up to a power of two
 	AsyncCircularQueue(size_t size);
 	~AsyncCircularQueue();
 
-	/// /return pointer to write
+	/// /return pointer to write, nullptr if there is no room right now
 	void* ReserveForPush(size_t size);
+	/// Sleeps until the consumer frees enough room
 	void* BlockedReserveForPush(size_t size);
 	/// /param pData buffer you get from this queue
 	void  FinalizePush(void* pData);
+
+	// consumer only
 	/// /param outSize if nothing to read, this is untouched
 	void* ReserveForPop(size_t* outSize);
 	void FinalizePop(void* pOut);
+	/// Hands every ready record of one contiguous run to fn(void* data, size_t size),
+	/// then releases the whole run at once. /return number of records
+	template<typename Fn>
+	int PopRun(Fn&& fn);
+	/// Same, but the run also ends before the first record accept(void* data, size_t size) rejects
+	template<typename Fn, typename Accept>
+	int PopRun(Fn&& fn, Accept&& accept);
+	/// Sleeps until a record is ready or WakeConsumer is called
+	void WaitForPop();
+	void WakeConsumer();
+	/// Whether ReserveForPop would find a record
+	bool CanPop() const;
 
 	size_t GetWritableSpace() const;
+	/// Biggest payload a single record can carry
+	size_t GetMaxRecordSize() const { return m_bufferSize / 2 - sizeof(_Header); }
+
+private:
+	static size_t _GetRecordSpan(size_t payloadSize);
+	_Header* _HeaderAt(uint64_t position) const { return (_Header*)(m_buffer + (position & m_mask)); }
+	void _Release(uint64_t newReadPosition);
+	void _NotifyConsumer();
 
 private:
 	unsigned char* m_buffer = nullptr;
 	size_t m_bufferSize = 0;
-	unsigned char* m_write = nullptr;
-	unsigned char* m_read = nullptr;
-	std::mutex	m_lock;
-};
\ No newline at end of file
+	size_t m_mask = 0;
+	// monotonic byte positions, the offset in the buffer is position & m_mask
+	alignas(64) std::atomic<uint64_t> m_write = 0;
+	alignas(64) std::atomic<uint64_t> m_read = 0;
+
+	alignas(64) std::mutex m_waitLock;
+	std::condition_variable m_consumerCV;
+	std::condition_variable m_producerCV;
+	std::atomic<bool> m_consumerWaiting = false;
+	std::atomic<bool> m_wakeRequested = false;
+	std::atomic<int> m_producerWaiters = 0;
+};
+
+////////////////////////////////
+template<typename Fn>
+int AsyncCircularQueue::PopRun(Fn&& fn)
+{
+	return PopRun(fn, [](void*, size_t) { return true; });
+}
+
+////////////////////////////////
+template<typename Fn, typename Accept>
+int AsyncCircularQueue::PopRun(Fn&& fn, Accept&& accept)
+{
+	uint64_t read = m_read.load(std::memory_order_relaxed);
+	const uint64_t write = m_write.load(std::memory_order_acquire);
+	const uint64_t runStart = read;
+	int count = 0;
+	while (read != write) {
+		_Header* header = _HeaderAt(read);
+		const uint32_t state = header->state.load(std::memory_order_acquire);
+		if (state == RECORD_NOT_READY) {
+			break;
+		}
+		if (state == RECORD_SKIP) {
+			// the run ends at the end of the buffer, the skip goes with it
+			read += header->size;
+			break;
+		}
+		if (!accept((void*)(header + 1), (size_t)header->size)) {
+			break;
+		}
+		fn((void*)(header + 1), (size_t)header->size);
+		read += _GetRecordSpan(header->size);
+		++count;
+		if ((read & m_mask) == 0) {
+			// a record ended right at the end of the buffer, the run stops there too
+			break;
+		}
+	}
+	if (read != runStart) {
+		memset(m_buffer + (runStart & m_mask), 0, (size_t)(read - runStart));
+		_Release(read);
+	}
+	return count;
+}
\ No newline at end of file
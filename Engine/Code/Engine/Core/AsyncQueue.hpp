@@ -1,8 +1,8 @@
 #pragma once
+#include "Engine/Core/MPMCQueue.hpp"
 
-#include <queue>
-#include <mutex>
-
+// Unbounded thread safe FIFO, any number of producers and consumers.
+// Lock-free, see MPMCQueue.
 template<typename T>
 class AsyncQueue
 {
@@ -11,44 +11,34 @@ public:
 	bool Pop(T* out);
 	size_t Size() const;
 	bool Empty() const;
-	std::queue<T> m_queue;
-	std::mutex m_mutex;
+private:
+	MPMCQueue<T> m_queue;
 };
 
 ////////////////////////////////
 template<typename T>
 bool AsyncQueue<T>::Empty() const
 {
-	std::lock_guard _(m_mutex);
-	return m_queue.empty();
+	return m_queue.Empty();
 }
 
 ////////////////////////////////
 template<typename T>
 size_t AsyncQueue<T>::Size() const
 {
-	std::lock_guard _(m_mutex);
-	return m_queue.size();
+	return m_queue.Size();
 }
 
 ////////////////////////////////
 template<typename T>
 bool AsyncQueue<T>::Pop(T* out)
 {
-	std::lock_guard<std::mutex> _(m_mutex);
-	if (m_queue.empty()) {
-		return false;
-	} else {
-		*out = m_queue.front();
-		m_queue.pop();
-		return true;
-	}
+	return m_queue.Pop(out);
 }
 
 ////////////////////////////////
 template<typename T>
 void AsyncQueue<T>::Push(const T& obj)
 {
-	std::lock_guard<std::mutex> _(m_mutex);
-	m_queue.push(obj);
-}
+	m_queue.Push(obj);
+}
\ No newline at end of file
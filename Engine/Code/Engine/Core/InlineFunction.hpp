@@ -0,0 +1,157 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// std::function replacement that keeps callables up to INLINE_SIZE bytes inside itself.
+// Bigger callables still work but go to the heap.
+template<typename Signature, size_t INLINE_SIZE = 48>
+class InlineFunction;
+
+template<typename R, typename... Args, size_t INLINE_SIZE>
+class InlineFunction<R(Args...), INLINE_SIZE>
+{
+private:
+	struct _Ops
+	{
+		R(*invoke)(void* storage, Args&&... args);
+		void(*copy)(void* dst, const void* src);
+		void(*move)(void* dst, void* src);
+		void(*destroy)(void* storage);
+	};
+
+	template<typename F>
+	static constexpr bool _FitsInline = sizeof(F) <= INLINE_SIZE
+		&& alignof(F) <= alignof(std::max_align_t)
+		&& std::is_nothrow_move_constructible_v<F>;
+
+	template<typename F>
+	struct _InlineOps
+	{
+		static R Invoke(void* storage, Args&&... args) { return (*(F*)storage)(std::forward<Args>(args)...); }
+		static void Copy(void* dst, const void* src) { new (dst) F(*(const F*)src); }
+		static void Move(void* dst, void* src) { new (dst) F(std::move(*(F*)src)); ((F*)src)->~F(); }
+		static void Destroy(void* storage) { ((F*)storage)->~F(); }
+		static constexpr _Ops OPS = { Invoke, Copy, Move, Destroy };
+	};
+
+	template<typename F>
+	struct _HeapOps
+	{
+		static R Invoke(void* storage, Args&&... args) { return (**(F**)storage)(std::forward<Args>(args)...); }
+		static void Copy(void* dst, const void* src) { *(F**)dst = new F(**(F* const*)src); }
+		static void Move(void* dst, void* src) { *(F**)dst = *(F**)src; *(F**)src = nullptr; }
+		static void Destroy(void* storage) { delete *(F**)storage; }
+		static constexpr _Ops OPS = { Invoke, Copy, Move, Destroy };
+	};
+
+public:
+	InlineFunction() = default;
+	InlineFunction(std::nullptr_t) {}
+
+	template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineFunction>>>
+	InlineFunction(F&& f)
+	{
+		_Assign(std::forward<F>(f));
+	}
+
+	InlineFunction(const InlineFunction& copyFrom)
+	{
+		if (copyFrom.m_ops) {
+			copyFrom.m_ops->copy(m_storage, copyFrom.m_storage);
+			m_ops = copyFrom.m_ops;
+		}
+	}
+
+	InlineFunction(InlineFunction&& moveFrom) noexcept
+	{
+		if (moveFrom.m_ops) {
+			moveFrom.m_ops->move(m_storage, moveFrom.m_storage);
+			m_ops = moveFrom.m_ops;
+			moveFrom.m_ops = nullptr;
+		}
+	}
+
+	~InlineFunction()
+	{
+		Reset();
+	}
+
+	InlineFunction& operator=(const InlineFunction& copyFrom)
+	{
+		if (this != &copyFrom) {
+			Reset();
+			if (copyFrom.m_ops) {
+				copyFrom.m_ops->copy(m_storage, copyFrom.m_storage);
+				m_ops = copyFrom.m_ops;
+			}
+		}
+		return *this;
+	}
+
+	InlineFunction& operator=(InlineFunction&& moveFrom) noexcept
+	{
+		if (this != &moveFrom) {
+			Reset();
+			if (moveFrom.m_ops) {
+				moveFrom.m_ops->move(m_storage, moveFrom.m_storage);
+				m_ops = moveFrom.m_ops;
+				moveFrom.m_ops = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	InlineFunction& operator=(std::nullptr_t)
+	{
+		Reset();
+		return *this;
+	}
+
+	template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineFunction>>>
+	InlineFunction& operator=(F&& f)
+	{
+		Reset();
+		_Assign(std::forward<F>(f));
+		return *this;
+	}
+
+	R operator()(Args... args) const
+	{
+		return m_ops->invoke(const_cast<unsigned char*>(m_storage), std::forward<Args>(args)...);
+	}
+
+	explicit operator bool() const { return m_ops != nullptr; }
+
+	void Reset()
+	{
+		if (m_ops) {
+			m_ops->destroy(m_storage);
+			m_ops = nullptr;
+		}
+	}
+
+private:
+	template<typename F>
+	void _Assign(F&& f)
+	{
+		using FType = std::decay_t<F>;
+		if constexpr (std::is_pointer_v<FType> || std::is_member_pointer_v<FType>) {
+			if (!f) {
+				return;
+			}
+		}
+		if constexpr (_FitsInline<FType>) {
+			new (m_storage) FType(std::forward<F>(f));
+			m_ops = &_InlineOps<FType>::OPS;
+		} else {
+			*(FType**)m_storage = new FType(std::forward<F>(f));
+			m_ops = &_HeapOps<FType>::OPS;
+		}
+	}
+
+private:
+	alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE < sizeof(void*) ? sizeof(void*) : INLINE_SIZE];
+	const _Ops* m_ops = nullptr;
+};
@@ -1,10 +1,57 @@
 #include "Engine/Core/Job.hpp"
+#include "Engine/Core/WorkStealingDeque.hpp"
+#include "Engine/Core/JobTrace.hpp"
+#include "Engine/Develop/Memory.hpp"
+#include "Engine/Develop/Log.hpp"
 #include <algorithm>
+#include <condition_variable>
 #include "Engine/Core/Time.hpp"
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
 
 //////////////////////////////////////////////////////////////////////////
+struct _JobWorker
+{
+	WorkStealingDeque<Job*> m_deque;
+	std::thread m_thread;
+	JobType m_category = JOB_GENERIC;
+	int m_index = 0;
+	unsigned int m_stealSeed = 0;
+};
+
+// Idle workers park here instead of yield-spinning.
+// m_epoch bumps on every push so a worker never sleeps through work pushed while it was going to sleep
+struct _JobParking
+{
+	std::mutex m_lock;
+	std::condition_variable m_cv;
+	std::atomic<int> m_sleepers = 0;
+	std::atomic<unsigned int> m_epoch = 0;
+};
+
+// Workers of one category only ever take jobs of that category
+struct _JobCategory
+{
+	std::vector<_JobWorker*> m_workers;
+	_JobParking m_parking;
+};
+
 static std::vector<JobQueue*> _JobQueues;
-static std::vector<std::thread> _GeneraicThread;
+static _JobCategory _JobCategories[NUM_JOB_TYPES];
+static thread_local _JobWorker* t_worker = nullptr;
+
+static constexpr int _WORKER_SPIN_COUNT = 64;
+static constexpr int _WORKER_YIELD_COUNT = 16;
+// low priority jobs older than this are served like normal ones, so they starve but never forever
+static constexpr double _LOW_PRIORITY_AGING_SECONDS = 0.1;
+
+////////////////////////////////
+const char* GetJobTypeName(JobType type)
+{
+	static const char* names[NUM_JOB_TYPES] = { "GENERIC", "MAIN", "RENDERING", "IO" };
+	return (type >= 0 && type < NUM_JOB_TYPES) ? names[type] : "UNKNOWN";
+}
 
 ////////////////////////////////
 void DO_NOTHING(Job*)
@@ -18,20 +65,82 @@ JobSystem* g_theJobSystem = nullptr;
 ////////    CLASS JOB                   //////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+static BlockAllocator* _GetJobPool()
+{
+	static BlockAllocator* pool = []() {
+		BlockAllocator* allocator = new BlockAllocator();
+		allocator->Init(GetTrackedAllocator<char>(), JOB_RECORD_SIZE, alignof(std::max_align_t), 256);
+		return allocator;
+	}();
+	return pool;
+}
+
+////////////////////////////////
+void* Job::operator new(size_t size)
+{
+	if (size <= JOB_RECORD_SIZE) {
+		return _GetJobPool()->AllocBlock();
+	}
+	return ::operator new(size);
+}
+
+////////////////////////////////
+void Job::operator delete(void* p, size_t size)
+{
+	if (size <= JOB_RECORD_SIZE) {
+		_GetJobPool()->FreeBlock(p);
+	} else {
+		::operator delete(p);
+	}
+}
+
+////////////////////////////////
+Job::~Job()
+{
+	delete m_moreSuccessors;
+}
+
+////////////////////////////////
 void Job::SetFinishCallback(JobFinishCallback callback)
 {
-	m_callback = callback;
+	m_callback = std::move(callback);
+}
+
+////////////////////////////////
+void Job::SetFrameDeadline(double msIntoFrame)
+{
+	m_deadlineHPC = g_theJobSystem->GetFrameStartHPC() + SecondsToHPC(msIntoFrame * 0.001);
+	// 0 is reserved for no deadline
+	if (m_deadlineHPC == 0) {
+		m_deadlineHPC = 1;
+	}
 }
 
 ////////////////////////////////
 void Job::_AddSuccessor(Job* successor)
 {
-	for (const auto& each : m_successors) {
-		if (each == successor) {
+	const int numInline = std::min(m_numSuccessors, JOB_INLINE_SUCCESSORS);
+	for (int i = 0; i < numInline; ++i) {
+		if (m_successors[i] == successor) {
 			return;
 		}
 	}
-	m_successors.push_back(successor);
+	if (m_moreSuccessors) {
+		for (const auto& each : *m_moreSuccessors) {
+			if (each == successor) {
+				return;
+			}
+		}
+	}
+	if (m_numSuccessors < JOB_INLINE_SUCCESSORS) {
+		m_successors[m_numSuccessors] = successor;
+	} else {
+		if (!m_moreSuccessors) {
+			m_moreSuccessors = new std::vector<Job*>();
+		}
+		m_moreSuccessors->push_back(successor);
+	}
+	++m_numSuccessors;
 	++successor->m_predecessorCount;
 }
 
@@ -41,6 +150,19 @@ void Job::_AddPredecessor(Job* predecessor)
 	predecessor->_AddSuccessor(this);
 }
 
+////////////////////////////////
+static void _WakeWorker(JobType category)
+{
+	_JobParking& parking = _JobCategories[category].m_parking;
+	parking.m_epoch.fetch_add(1);
+	if (parking.m_sleepers.load() > 0) {
+		{
+			std::scoped_lock _(parking.m_lock);
+		}
+		parking.m_cv.notify_one();
+	}
+}
+
 ////////////////////////////////
 bool Job::_TryRun()
 {
@@ -48,18 +170,39 @@ bool Job::_TryRun()
 	if (dec > 0) {
 		return false;
 	}
-	_JobQueues[m_jobtype]->Push(this);
+	m_readyHPC = GetCurrentHPC();
+	// normal jobs released on a worker of the same category stay on that worker,
+	// everything else goes through the category queue where priorities are kept
+	const bool canStayLocal = m_priority == JOB_PRIORITY_NORMAL && m_deadlineHPC == 0
+		&& t_worker && t_worker->m_category == m_jobtype;
+	if (!canStayLocal || !t_worker->m_deque.Push(this)) {
+		_JobQueues[m_jobtype]->Push(this);
+	}
+	if (!_JobCategories[m_jobtype].m_workers.empty()) {
+		_WakeWorker(m_jobtype);
+	}
 	return true;
 }
 
 ////////////////////////////////
-void Job::_Finish()
+void Job::_ReleaseSuccessors()
 {
-	for (auto& each : m_successors) {
-		each->_TryRun();
+	const int numInline = std::min(m_numSuccessors, JOB_INLINE_SUCCESSORS);
+	for (int i = 0; i < numInline; ++i) {
+		m_successors[i]->_TryRun();
+	}
+	if (m_moreSuccessors) {
+		for (auto& each : *m_moreSuccessors) {
+			each->_TryRun();
+		}
 	}
+}
+
+////////////////////////////////
+void Job::_Finish()
+{
 	if (m_callback) {
-		std::invoke(m_callback, this);
+		m_callback(this);
 	}
 }
 
@@ -67,31 +210,162 @@ void Job::_Finish()
 //////CLASS JOBSYSTEM                       //////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-static void GenericJobThread()
+static Job* _StealJob(JobType category, _JobWorker* self)
+{
+	const std::vector<_JobWorker*>& workers = _JobCategories[category].m_workers;
+	const int numWorkers = (int)workers.size();
+	if (numWorkers == 0) {
+		return nullptr;
+	}
+	// xorshift, so thieves do not all hammer the same victim
+	unsigned int seed = self ? self->m_stealSeed : (unsigned int)GetCurrentHPC() | 1u;
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	if (self) {
+		self->m_stealSeed = seed;
+	}
+	const int start = (int)(seed % (unsigned int)numWorkers);
+	for (int i = 0; i < numWorkers; ++i) {
+		_JobWorker* victim = workers[(start + i) % numWorkers];
+		if (victim == self) {
+			continue;
+		}
+		Job* job = nullptr;
+		if (victim->m_deque.Steal(&job)) {
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+////////////////////////////////
+static Job* _FindJob(JobType category, _JobWorker* self)
 {
-	thread_local JobQueue* const genericJobQueue = _JobQueues[JOB_GENERIC];
+	JobQueue* jobQueue = _JobQueues[category];
+	Job* job = nullptr;
+	if (jobQueue->HasUrgentJob()) {
+		job = jobQueue->TryGetNextJob(JOB_PRIORITY_HIGH);
+		if (job) {
+			return job;
+		}
+	}
+	// local deques only ever hold normal priority jobs
+	if (self && self->m_category == category && self->m_deque.Pop(&job)) {
+		return job;
+	}
+	job = jobQueue->TryGetNextJob(JOB_PRIORITY_NORMAL);
+	if (job) {
+		return job;
+	}
+	job = _StealJob(category, self);
+	if (job) {
+		return job;
+	}
+	return jobQueue->TryGetNextJob(JOB_PRIORITY_LOW);
+}
+
+////////////////////////////////
+static void _ApplyThreadSettings(const JobCategoryConfig& config, int index)
+{
+	if (config.affinityMask != 0) {
+		::SetThreadAffinityMask(::GetCurrentThread(), (DWORD_PTR)config.affinityMask);
+	}
+	if (config.threadName) {
+		std::string name = Stringf("%s %d", config.threadName, index);
+		std::wstring wname(name.begin(), name.end());
+		::SetThreadDescription(::GetCurrentThread(), wname.c_str());
+	}
+}
+
+////////////////////////////////
+static void JobWorkerThread(_JobWorker* self, JobCategoryConfig config)
+{
+	t_worker = self;
+	_ApplyThreadSettings(config, self->m_index);
+	const JobType category = self->m_category;
+	JobQueue* const jobQueue = _JobQueues[category];
+	_JobParking& parking = _JobCategories[category].m_parking;
+	int idleRounds = 0;
 	while (g_theJobSystem->IsRunning()) {
-		Job* job = genericJobQueue->PollNextJob();
+		Job* job = _FindJob(category, self);
+		if (job) {
+			idleRounds = 0;
+			jobQueue->Execute(job);
+			continue;
+		}
+
+		// back off: spin a bit, then yield, then park until somebody pushes
+		++idleRounds;
+		if (idleRounds < _WORKER_SPIN_COUNT) {
+			continue;
+		}
+		if (idleRounds < _WORKER_SPIN_COUNT + _WORKER_YIELD_COUNT) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		const unsigned int epoch = parking.m_epoch.load();
+		++parking.m_sleepers;
+		job = _FindJob(category, self);
 		if (job) {
-			job->Run();
-			genericJobQueue->PushFinished(job);
+			--parking.m_sleepers;
+			idleRounds = 0;
+			jobQueue->Execute(job);
+			continue;
 		}
+		{
+			std::unique_lock lk(parking.m_lock);
+			parking.m_cv.wait(lk, [&parking, epoch]() {
+				return parking.m_epoch.load() != epoch || !g_theJobSystem->IsRunning();
+			});
+		}
+		--parking.m_sleepers;
+		idleRounds = _WORKER_SPIN_COUNT;
 	}
+	t_worker = nullptr;
 }
 
 ////////////////////////////////
 void JobSystem::Startup(int nGenericThreads /*=1*/, int numCatagories /*= NUM_JOB_TYPES*/)
 {
+	UNUSED(numCatagories);
+	JobSystemConfig config;
+	config.categories[JOB_GENERIC].numThreads = nGenericThreads;
+	Startup(config);
+}
+
+////////////////////////////////
+void JobSystem::Startup(const JobSystemConfig& config)
+{
+	m_isRunning = true;
+	m_mainThreadID = std::this_thread::get_id();
+	m_frameStartHPC = GetCurrentHPC();
 	for (int i = 0; i < NUM_JOB_TYPES; ++i) {
 		_JobQueues.push_back(new JobQueue());
 	}
-	if (nGenericThreads < 0) {
-		nGenericThreads = std::max(1, (int)std::thread::hardware_concurrency() - (-nGenericThreads));
+	for (int category = 0; category < NUM_JOB_TYPES; ++category) {
+		if (category == JOB_MAIN) {
+			// main jobs only ever run on the main thread
+			continue;
+		}
+		int numThreads = config.categories[category].numThreads;
+		if (numThreads < 0) {
+			numThreads = std::max(1, (int)std::thread::hardware_concurrency() - (-numThreads));
+		}
+		for (int i = 0; i < numThreads; ++i) {
+			_JobWorker* worker = new _JobWorker();
+			worker->m_category = (JobType)category;
+			worker->m_index = i;
+			worker->m_stealSeed = 2463534242u + (unsigned int)(category * 131 + i) * 7919u;
+			_JobCategories[category].m_workers.push_back(worker);
+		}
 	}
-	for (int i = 0; i < nGenericThreads; ++i) {
-		_GeneraicThread.emplace_back(GenericJobThread);
-		std::thread& th = _GeneraicThread[i];
-		th.detach();
+	// all workers must exist before any of them starts stealing
+	for (int category = 0; category < NUM_JOB_TYPES; ++category) {
+		for (auto& each : _JobCategories[category].m_workers) {
+			each->m_thread = std::thread(JobWorkerThread, each, config.categories[category]);
+		}
 	}
 }
 
@@ -99,14 +373,37 @@ void JobSystem::Startup(int nGenericThreads /*=1*/, int numCatagories /*= NUM_JO
 void JobSystem::Shutdown()
 {
 	m_isRunning = false;
+	for (auto& category : _JobCategories) {
+		{
+			std::scoped_lock _(category.m_parking.m_lock);
+		}
+		category.m_parking.m_cv.notify_all();
+	}
+	for (auto& category : _JobCategories) {
+		for (auto& each : category.m_workers) {
+			if (each->m_thread.joinable()) {
+				each->m_thread.join();
+			}
+		}
+	}
+}
+
+////////////////////////////////
+void JobSystem::BeginFrame()
+{
+	m_frameStartHPC = GetCurrentHPC();
 }
 
 ////////////////////////////////
-void JobSystem::Run(Job* job)
+JobHandle JobSystem::Run(Job* job, JobCounter* counter /*= nullptr*/)
 {
-	//JobQueue* jq = _JobQueues[job->m_jobtype];
-	//jq->Push(job);
+	if (counter) {
+		job->m_counter = counter;
+		++counter->m_pending;
+	}
+	++m_numInFlight;
 	job->_TryRun();
+	return counter;
 }
 
 ////////////////////////////////
@@ -115,10 +412,95 @@ void JobSystem::AddDependency(Job* first, Job* second)
 	first->_AddSuccessor(second);
 }
 
+////////////////////////////////
+bool JobSystem::TryRunPendingJob()
+{
+	// never pull IO or other dedicated work onto this thread
+	Job* job = _FindJob(JOB_GENERIC, t_worker);
+	if (job) {
+		_JobQueues[JOB_GENERIC]->Execute(job);
+		return true;
+	}
+	if (std::this_thread::get_id() == m_mainThreadID) {
+		job = _JobQueues[JOB_MAIN]->TryGetNextJob();
+		if (job) {
+			_JobQueues[JOB_MAIN]->Execute(job);
+			return true;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////
+void JobSystem::Wait(JobHandle handle)
+{
+	if (!handle) {
+		return;
+	}
+	int idleRounds = 0;
+	while (!handle->IsDone()) {
+		if (TryRunPendingJob()) {
+			idleRounds = 0;
+			continue;
+		}
+		// whatever is left is running on another thread
+		++idleRounds;
+		if (idleRounds > _WORKER_SPIN_COUNT) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+////////////////////////////////
+bool JobSystem::IsOnThreadOf(JobType category) const
+{
+	if (category == JOB_MAIN) {
+		return std::this_thread::get_id() == m_mainThreadID;
+	}
+	return t_worker && t_worker->m_category == category;
+}
+
 ////////////////////////////////
 bool JobSystem::IsFinished() const
 {
-	return true;
+	return m_numInFlight.load() == 0;
+}
+
+////////////////////////////////
+int JobSystem::GetGenericThreadCount() const
+{
+	return GetThreadCount(JOB_GENERIC);
+}
+
+////////////////////////////////
+int JobSystem::GetThreadCount(JobType category) const
+{
+	return (int)_JobCategories[category].m_workers.size();
+}
+
+////////////////////////////////
+void JobSystem::LogLatencyReport(bool reset /*= false*/)
+{
+	static const char* priorityNames[NUM_JOB_PRIORITIES] = { "HIGH", "NORMAL", "LOW" };
+	Log("", "%-10s %-9s %8s %10s %10s %7s", "CATEGORY", "PRIORITY", "JOBS", "AVG(ms)", "MAX(ms)", "MISSED");
+	for (int category = 0; category < NUM_JOB_TYPES; ++category) {
+		JobQueue* jobQueue = _JobQueues[category];
+		const JobLatencyStats deadline = jobQueue->GetDeadlineLatencyStats();
+		if (deadline.numJobs > 0) {
+			Log("", "%-10s %-9s %8d %10.3f %10.3f %7d", GetJobTypeName((JobType)category), "DEADLINE"
+				, deadline.numJobs, deadline.averageMS, deadline.maxMS, jobQueue->GetNumDeadlineMissed());
+		}
+		for (int priority = 0; priority < NUM_JOB_PRIORITIES; ++priority) {
+			const JobLatencyStats stats = jobQueue->GetLatencyStats((JobPriority)priority);
+			if (stats.numJobs > 0) {
+				Log("", "%-10s %-9s %8d %10.3f %10.3f %7s", GetJobTypeName((JobType)category), priorityNames[priority]
+					, stats.numJobs, stats.averageMS, stats.maxMS, "-");
+			}
+		}
+		if (reset) {
+			jobQueue->ResetLatencyStats();
+		}
+	}
 }
 
 ////////////////////////////////
@@ -133,8 +515,7 @@ int JobSystem::ProcessQueueForMS(JobType jobType, unsigned int ms)
 			break;
 		}
 		++count;
-		job->Run();
-		jobQueue->PushFinished(job);
+		jobQueue->Execute(job);
 	}
 	return count;
 }
@@ -150,8 +531,7 @@ int JobSystem::ProcessQueue(JobType jobType)
 			break;
 		}
 		++count;
-		job->Run();
-		jobQueue->PushFinished(job);
+		jobQueue->Execute(job);
 	}
 	return count;
 }
@@ -171,30 +551,243 @@ void JobSystem::FinishJobsQueue(JobType jobType)
 	}
 }
 
+//////////////////////////////////////////////////////////////////////////
+/////PARALLEL FOR            /////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+static constexpr int _PARALLEL_MAX_HELPERS = 32;
+static constexpr int _PARALLEL_CHUNKS_PER_PARTICIPANT = 4;
+
+// Shared by the caller and its helper jobs; freed by whoever drops the last reference.
+// A helper that has not started yet when the caller runs out of chunks is cancelled,
+// so the caller never waits on a helper stuck behind other work.
+struct _ParallelForState
+{
+	enum SlotState : int { SLOT_QUEUED = 0, SLOT_STARTED, SLOT_CANCELLED };
+
+	JobSystem::ParallelChunkFunc m_chunkFunc = nullptr;
+	void* m_context = nullptr;
+	int m_begin = 0;
+	int m_end = 0;
+	int m_grainSize = 1;
+	int m_numChunks = 0;
+	std::atomic<int> m_nextChunk = 0;
+	std::atomic<int> m_runningHelpers = 0;
+	std::atomic<int> m_refCount = 1;
+	std::atomic<int> m_slots[_PARALLEL_MAX_HELPERS];
+
+	void RunChunks(int participant)
+	{
+		int chunk = m_nextChunk++;
+		while (chunk < m_numChunks) {
+			const int chunkBegin = m_begin + chunk * m_grainSize;
+			const int chunkEnd = std::min(m_end, chunkBegin + m_grainSize);
+			m_chunkFunc(m_context, chunkBegin, chunkEnd, participant);
+			chunk = m_nextChunk++;
+		}
+	}
+
+	void Release()
+	{
+		if (--m_refCount == 0) {
+			delete this;
+		}
+	}
+
+	static void* operator new(size_t size)
+	{
+		static_assert(sizeof(_ParallelForState) <= JOB_RECORD_SIZE, "parallel state must fit a job record");
+		UNUSED(size);
+		return _GetJobPool()->AllocBlock();
+	}
+
+	static void operator delete(void* p)
+	{
+		_GetJobPool()->FreeBlock(p);
+	}
+};
+
+class _ParallelForJob : public Job
+{
+public:
+	_ParallelForJob(_ParallelForState* state, int slot)
+		: m_state(state)
+		, m_slot(slot)
+	{
+	}
+
+	const char* GetName() const override { return "ParallelFor"; }
+
+	void Run() override
+	{
+		int expected = _ParallelForState::SLOT_QUEUED;
+		if (m_state->m_slots[m_slot].compare_exchange_strong(expected, _ParallelForState::SLOT_STARTED)) {
+			m_state->RunChunks(m_slot + 1);
+			--m_state->m_runningHelpers;
+		}
+		m_state->Release();
+	}
+
+private:
+	_ParallelForState* m_state = nullptr;
+	int m_slot = 0;
+};
+
+////////////////////////////////
+static int _GetParallelGrainSize(int count, int grainSize)
+{
+	if (grainSize > 0) {
+		return grainSize;
+	}
+	const int participants = (int)_JobCategories[JOB_GENERIC].m_workers.size() + 1;
+	return std::max(1, count / (participants * _PARALLEL_CHUNKS_PER_PARTICIPANT));
+}
+
+////////////////////////////////
+int JobSystem::GetParallelParticipantCount(int begin, int end, int grainSize) const
+{
+	const int count = end - begin;
+	if (count <= 0) {
+		return 1;
+	}
+	const int grain = _GetParallelGrainSize(count, grainSize);
+	const int numChunks = (count + grain - 1) / grain;
+	const int numHelpers = std::min({ (int)_JobCategories[JOB_GENERIC].m_workers.size(), numChunks - 1, _PARALLEL_MAX_HELPERS });
+	return numHelpers + 1;
+}
+
+////////////////////////////////
+void JobSystem::ParallelForChunks(int begin, int end, int grainSize, ParallelChunkFunc chunkFunc, void* context)
+{
+	const int count = end - begin;
+	if (count <= 0) {
+		return;
+	}
+	const int numHelpers = GetParallelParticipantCount(begin, end, grainSize) - 1;
+	if (numHelpers <= 0 || !IsRunning()) {
+		chunkFunc(context, begin, end, 0);
+		return;
+	}
+
+	_ParallelForState* state = new _ParallelForState();
+	state->m_chunkFunc = chunkFunc;
+	state->m_context = context;
+	state->m_begin = begin;
+	state->m_end = end;
+	state->m_grainSize = _GetParallelGrainSize(count, grainSize);
+	state->m_numChunks = (count + state->m_grainSize - 1) / state->m_grainSize;
+	state->m_runningHelpers = numHelpers;
+	state->m_refCount = numHelpers + 1;
+	for (int i = 0; i < numHelpers; ++i) {
+		state->m_slots[i] = _ParallelForState::SLOT_QUEUED;
+	}
+	for (int i = 0; i < numHelpers; ++i) {
+		// the caller is blocked on these, they go before whatever else is queued
+		Job* helper = new _ParallelForJob(state, i);
+		helper->SetPriority(JOB_PRIORITY_HIGH);
+		Run(helper);
+	}
+
+	state->RunChunks(0);
+
+	for (int i = 0; i < numHelpers; ++i) {
+		int expected = _ParallelForState::SLOT_QUEUED;
+		if (state->m_slots[i].compare_exchange_strong(expected, _ParallelForState::SLOT_CANCELLED)) {
+			--state->m_runningHelpers;
+		}
+	}
+	// only helpers busy with their last chunk are left
+	while (state->m_runningHelpers.load() > 0) {
+		std::this_thread::yield();
+	}
+	state->Release();
+}
+
 //////////////////////////////////////////////////////////////////////////
 /////CLASS JOB QUEUE         /////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////
+static bool _IsDeadlineLater(const Job* a, const Job* b)
+{
+	return a->GetDeadlineHPC() > b->GetDeadlineHPC();
+}
+
+////////////////////////////////
 void JobQueue::Push(Job* job)
 {
-	m_pending.Push(job);
+	std::scoped_lock _(m_pendingLock);
+	if (job->m_deadlineHPC != 0) {
+		m_deadlines.push_back(job);
+		std::push_heap(m_deadlines.begin(), m_deadlines.end(), _IsDeadlineLater);
+		++m_numUrgent;
+	} else {
+		m_pending[job->m_priority].push_back(job);
+		if (job->m_priority == JOB_PRIORITY_HIGH) {
+			++m_numUrgent;
+		}
+	}
+	++m_numPending;
+}
+
+////////////////////////////////
+Job* JobQueue::_PopFront(int priority)
+{
+	Job* job = m_pending[priority].front();
+	m_pending[priority].pop_front();
+	if (priority == JOB_PRIORITY_HIGH) {
+		--m_numUrgent;
+	}
+	--m_numPending;
+	return job;
+}
+
+////////////////////////////////
+void JobQueue::_PopDeadline(Job** out)
+{
+	std::pop_heap(m_deadlines.begin(), m_deadlines.end(), _IsDeadlineLater);
+	*out = m_deadlines.back();
+	m_deadlines.pop_back();
+	--m_numUrgent;
+	--m_numPending;
 }
 
 ////////////////////////////////
-Job* JobQueue::TryGetNextJob()
+Job* JobQueue::TryGetNextJob(JobPriority lowestPriority /*= JOB_PRIORITY_LOW*/)
 {
+	if (m_numPending.load() == 0) {
+		return nullptr;
+	}
+	std::scoped_lock _(m_pendingLock);
 	Job* job = nullptr;
-	if (m_pending.Pop(&job)) {
+	if (!m_deadlines.empty()) {
+		_PopDeadline(&job);
 		return job;
 	}
-	return nullptr;
+	if (!m_pending[JOB_PRIORITY_HIGH].empty()) {
+		return _PopFront(JOB_PRIORITY_HIGH);
+	}
+	if (lowestPriority < JOB_PRIORITY_NORMAL) {
+		return nullptr;
+	}
+	std::deque<Job*>& low = m_pending[JOB_PRIORITY_LOW];
+	if (!low.empty() && HPCToSeconds(GetCurrentHPC() - low.front()->m_readyHPC) > _LOW_PRIORITY_AGING_SECONDS) {
+		return _PopFront(JOB_PRIORITY_LOW);
+	}
+	if (!m_pending[JOB_PRIORITY_NORMAL].empty()) {
+		return _PopFront(JOB_PRIORITY_NORMAL);
+	}
+	if (lowestPriority < JOB_PRIORITY_LOW || low.empty()) {
+		return nullptr;
+	}
+	return _PopFront(JOB_PRIORITY_LOW);
 }
 
 ////////////////////////////////
 Job* JobQueue::PollNextJob()
 {
 	Job* job = nullptr;
-	while (!m_pending.Pop(&job)) {
+	while (!(job = TryGetNextJob())) {
 		if (!g_theJobSystem->IsRunning()) {
 			return nullptr;
 		}
@@ -203,6 +796,43 @@ Job* JobQueue::PollNextJob()
 	return job;
 }
 
+////////////////////////////////
+void JobQueue::Execute(Job* job)
+{
+	const uint64 startHPC = GetCurrentHPC();
+	const uint64 latencyHPC = startHPC - job->m_readyHPC;
+	if (job->m_deadlineHPC != 0) {
+		m_deadlineLatency.Add(latencyHPC);
+	} else {
+		m_latency[job->m_priority].Add(latencyHPC);
+	}
+	const uint64 deadlineHPC = job->m_deadlineHPC;
+	job->Run();
+	if (deadlineHPC != 0 && GetCurrentHPC() > deadlineHPC) {
+		++m_numDeadlineMissed;
+	}
+	if (IsJobTracing()) {
+		JobTraceRecord record;
+		record.name = job->GetName();
+		record.enqueueHPC = job->m_readyHPC;
+		record.startHPC = startHPC;
+		record.endHPC = GetCurrentHPC();
+		record.queueDepth = m_numPending.load() + (t_worker ? (int)t_worker->m_deque.Size() : 0);
+		record.worker = t_worker ? (short)t_worker->m_index : -1;
+		record.category = (unsigned char)job->m_jobtype;
+		record.priority = (unsigned char)job->m_priority;
+		_JobTraceRecord(record);
+	}
+	job->_ReleaseSuccessors();
+	JobCounter* counter = job->m_counter;
+	// the job may be finished and deleted on the main thread as soon as it is pushed
+	PushFinished(job);
+	if (counter) {
+		--counter->m_pending;
+	}
+	--g_theJobSystem->m_numInFlight;
+}
+
 ////////////////////////////////
 void JobQueue::PushFinished(Job* job)
 {
@@ -232,3 +862,54 @@ Job* JobQueue::PollNextFinished()
 	return job;
 }
 
+////////////////////////////////
+JobLatencyStats JobQueue::GetLatencyStats(JobPriority priority) const
+{
+	return m_latency[priority].Get();
+}
+
+////////////////////////////////
+JobLatencyStats JobQueue::GetDeadlineLatencyStats() const
+{
+	return m_deadlineLatency.Get();
+}
+
+////////////////////////////////
+void JobQueue::ResetLatencyStats()
+{
+	for (auto& each : m_latency) {
+		each.Reset();
+	}
+	m_deadlineLatency.Reset();
+	m_numDeadlineMissed = 0;
+}
+
+////////////////////////////////
+void JobQueue::_LatencyCounter::Add(uint64 latencyHPC)
+{
+	++numJobs;
+	totalHPC += latencyHPC;
+	uint64 currentMax = maxHPC.load(std::memory_order_relaxed);
+	while (latencyHPC > currentMax && !maxHPC.compare_exchange_weak(currentMax, latencyHPC)) {
+	}
+}
+
+////////////////////////////////
+JobLatencyStats JobQueue::_LatencyCounter::Get() const
+{
+	JobLatencyStats stats;
+	stats.numJobs = numJobs.load();
+	if (stats.numJobs > 0) {
+		stats.averageMS = HPCToSeconds(totalHPC.load()) * 1000.0 / (double)stats.numJobs;
+		stats.maxMS = HPCToSeconds(maxHPC.load()) * 1000.0;
+	}
+	return stats;
+}
+
+////////////////////////////////
+void JobQueue::_LatencyCounter::Reset()
+{
+	numJobs = 0;
+	totalHPC = 0;
+	maxHPC = 0;
+}
\ No newline at end of file
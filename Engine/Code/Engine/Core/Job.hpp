@@ -1,9 +1,15 @@
 #pragma once
 #include "Engine/Core/EngineCommon.hpp"
 #include "Engine/Core/AsyncQueue.hpp"
+#include "Engine/Core/InlineFunction.hpp"
+#include "Engine/Core/Time.hpp"
 #include <functional>
 #include <atomic>
+#include <mutex>
+#include <deque>
 #include <thread>
+#include <vector>
+#include <type_traits>
 
 class Job;
 class JobSystem;
@@ -18,62 +24,271 @@ enum JobType
 
 	NUM_JOB_TYPES
 };
+const char* GetJobTypeName(JobType type);
+
+// Jobs with a frame deadline run before any priority level, earliest deadline first
+enum JobPriority
+{
+	JOB_PRIORITY_HIGH = 0,
+	JOB_PRIORITY_NORMAL,
+	JOB_PRIORITY_LOW,
+
+	NUM_JOB_PRIORITIES
+};
+
+struct JobLatencyStats
+{
+	int numJobs = 0;
+	double averageMS = 0.0;
+	double maxMS = 0.0;
+};
 
 class JobQueue
 {
 public:
 	void Push(Job* job);
-	Job* TryGetNextJob();
+	/// /param lowestPriority jobs below it stay queued, low priority jobs waiting too long count as normal
+	Job* TryGetNextJob(JobPriority lowestPriority = JOB_PRIORITY_LOW);
 	Job* PollNextJob();
+	/// A deadline or high priority job is queued, cheap enough to ask before every pop
+	bool HasUrgentJob() const { return m_numUrgent.load() > 0; }
+	void Execute(Job* job);
 
 	void PushFinished(Job* job);
 	Job* TryGetNextFinished();
 	Job* PollNextFinished();
+
+	JobLatencyStats GetLatencyStats(JobPriority priority) const;
+	JobLatencyStats GetDeadlineLatencyStats() const;
+	int GetNumDeadlineMissed() const { return m_numDeadlineMissed.load(); }
+	void ResetLatencyStats();
+private:
+	struct _LatencyCounter
+	{
+		std::atomic<int> numJobs = 0;
+		std::atomic<uint64> totalHPC = 0;
+		std::atomic<uint64> maxHPC = 0;
+
+		void Add(uint64 latencyHPC);
+		JobLatencyStats Get() const;
+		void Reset();
+	};
+
+	Job* _PopFront(int priority);
+	void _PopDeadline(Job** out);
 private:
-	AsyncQueue<Job*> m_pending;
+	std::mutex m_pendingLock;
+	std::deque<Job*> m_pending[NUM_JOB_PRIORITIES];
+	// min-heap on m_deadlineHPC
+	std::vector<Job*> m_deadlines;
+	std::atomic<int> m_numUrgent = 0;
+	std::atomic<int> m_numPending = 0;
+
+	_LatencyCounter m_latency[NUM_JOB_PRIORITIES];
+	_LatencyCounter m_deadlineLatency;
+	std::atomic<int> m_numDeadlineMissed = 0;
+
 	AsyncQueue<Job*> m_finished;
 };
 
 void DO_NOTHING(Job*);
 
+// Counts jobs Run() with it that have not finished running yet.
+// Owned by the caller and must outlive those jobs, usually a member or a local you Wait() on.
+class JobCounter
+{
+public:
+	bool IsDone() const { return m_pending.load() == 0; }
+	int GetPending() const { return m_pending.load(); }
+private:
+	std::atomic<int> m_pending = 0;
+
+	friend class JobSystem;
+	friend class JobQueue;
+};
+using JobHandle = JobCounter*;
+
+// Every job up to this size, subclasses included, lives in a recycled record from the job pool
+constexpr size_t JOB_RECORD_SIZE = 256;
+constexpr int JOB_INLINE_SUCCESSORS = 4;
+constexpr size_t JOB_INLINE_CALLBACK_SIZE = 32;
+
 class Job
 {
 public:
-	using JobFinishCallback = std::function<void(Job*)>;
+	using JobFinishCallback = InlineFunction<void(Job*), JOB_INLINE_CALLBACK_SIZE>;
+	virtual ~Job();
 	virtual void Run() = 0;
+	/// Shows up in the job trace
+	virtual const char* GetName() const { return "Job"; }
 	void SetFinishCallback(JobFinishCallback callback);
 	void SetCatagory(JobType type) { m_jobtype = type; }
+	void SetPriority(JobPriority priority) { m_priority = priority; }
+	/// Due this many ms after the start of the current frame, see JobSystem::BeginFrame
+	void SetFrameDeadline(double msIntoFrame);
+	uint64 GetDeadlineHPC() const { return m_deadlineHPC; }
+
+	static void* operator new(size_t size);
+	static void operator delete(void* p, size_t size);
 private:
 	void _AddSuccessor(Job* successor);
 	void _AddPredecessor(Job* predecessor);
 	bool _TryRun();
+	void _ReleaseSuccessors();
 	void _Finish();
 private:
 	JobType m_jobtype = JOB_GENERIC;
-	JobFinishCallback m_callback = DO_NOTHING;
-	std::vector<Job*> m_successors;
 	std::atomic<int> m_predecessorCount = 1;
+	JobCounter* m_counter = nullptr;
+	JobFinishCallback m_callback;
+	int m_numSuccessors = 0;
+	JobPriority m_priority = JOB_PRIORITY_NORMAL;
+	Job* m_successors[JOB_INLINE_SUCCESSORS] = {};
+	std::vector<Job*>* m_moreSuccessors = nullptr;
+	uint64 m_readyHPC = 0;
+	// 0 means no deadline
+	uint64 m_deadlineHPC = 0;
 
 	friend class JobSystem;
 	friend class JobQueue;
 };
 
+// Wraps a callable so small lambdas can be scheduled without writing a Job subclass
+// and without touching the heap: the job comes from the pool and captures stay inline
+constexpr size_t JOB_INLINE_FUNCTION_SIZE = 96;
+class FunctionJob : public Job
+{
+public:
+	using JobFunction = InlineFunction<void(), JOB_INLINE_FUNCTION_SIZE>;
+	FunctionJob(JobFunction function) : m_function(std::move(function)) {}
+	void Run() override { m_function(); }
+	const char* GetName() const override { return "FunctionJob"; }
+private:
+	JobFunction m_function;
+};
+
+struct JobCategoryConfig
+{
+	// same rule as nGenericThreads in Startup, 0 leaves the category to ProcessQueue
+	int numThreads = 0;
+	// 0 keeps the default affinity
+	unsigned long long affinityMask = 0;
+	// shows up in the debugger as "<threadName> <index>"
+	const char* threadName = nullptr;
+};
+
+struct JobSystemConfig
+{
+	// JOB_MAIN always runs on the main thread, its entry is ignored
+	JobCategoryConfig categories[NUM_JOB_TYPES];
+};
+
 class JobSystem
 {
 public:
 	// negative means as many as you can MINUS the value (8 cores, -1 is 7... -2 would be 6.  -20 would be 1)
 	// MINIMUM 1 unless explicitly saying 0; 
 	void Startup(int nGenericThreads = 1, int numCatagories = NUM_JOB_TYPES);
+	void Startup(const JobSystemConfig& config);
 	void Shutdown();
-	void Run(Job* job);
+	/// Frame deadlines are measured from the last call
+	void BeginFrame();
+	uint64 GetFrameStartHPC() const { return m_frameStartHPC.load(); }
+	/// /param counter optional, incremented now and decremented when the job has run
+	JobHandle Run(Job* job, JobCounter* counter = nullptr);
 	void AddDependency(Job* first, Job* second);
+	template<typename Fn>
+	JobHandle RunFunction(Fn&& fn, JobType type = JOB_GENERIC, JobCounter* counter = nullptr);
+	/// Blocks until every job counted by handle has run, executing pending jobs meanwhile
+	void Wait(JobHandle handle);
+	/// Runs one pending job the calling thread is allowed to take, /return false if there was none
+	bool TryRunPendingJob();
 	bool IsRunning() const { return m_isRunning; }
+	/// The calling thread is a worker of that category, or the main thread for JOB_MAIN
+	bool IsOnThreadOf(JobType category) const;
+	/// No job is queued or running
 	bool IsFinished() const;
+	int GetNumJobsInFlight() const { return m_numInFlight.load(); }
+	int GetGenericThreadCount() const;
+	int GetThreadCount(JobType category) const;
 	int ProcessQueueForMS(JobType jobType, unsigned int ms);
 	int ProcessQueue(JobType jobType);
 	void FinishJobsQueue(JobType jobType);
+	/// Time from ready to started, per category and priority, plus deadline misses
+	void LogLatencyReport(bool reset = false);
+
+	// Splits [begin, end) into chunks of grainSize (0 picks one) and runs them on the
+	// generic workers and the calling thread. Returns when the whole range is done.
+	// fn(int index)
+	template<typename Fn>
+	void ParallelFor(int begin, int end, int grainSize, Fn&& fn);
+	// mapFn(int index) -> T, reduceFn(const T&, const T&) -> T, reduceFn must be associative and commutative
+	template<typename T, typename MapFn, typename ReduceFn>
+	T ParallelReduce(int begin, int end, int grainSize, const T& identity, MapFn&& mapFn, ReduceFn&& reduceFn);
+
+	using ParallelChunkFunc = void(*)(void* context, int chunkBegin, int chunkEnd, int participant);
+	/// /return number of participants, the calling thread is always participant 0
+	int GetParallelParticipantCount(int begin, int end, int grainSize) const;
+	void ParallelForChunks(int begin, int end, int grainSize, ParallelChunkFunc chunkFunc, void* context);
 private:
-	bool m_isRunning = true;
+	std::atomic<bool> m_isRunning = true;
+	std::atomic<int> m_numInFlight = 0;
+	std::thread::id m_mainThreadID;
+	std::atomic<uint64> m_frameStartHPC = 0;
+
+	friend class JobQueue;
 };
 
-extern JobSystem* g_theJobSystem;
\ No newline at end of file
+extern JobSystem* g_theJobSystem;
+
+////////////////////////////////
+template<typename Fn>
+JobHandle JobSystem::RunFunction(Fn&& fn, JobType type /*= JOB_GENERIC*/, JobCounter* counter /*= nullptr*/)
+{
+	static_assert(sizeof(FunctionJob) <= JOB_RECORD_SIZE, "FunctionJob must fit a job record");
+	FunctionJob* job = new FunctionJob(std::forward<Fn>(fn));
+	job->SetCatagory(type);
+	return Run(job, counter);
+}
+
+////////////////////////////////
+template<typename Fn>
+void JobSystem::ParallelFor(int begin, int end, int grainSize, Fn&& fn)
+{
+	using FnType = std::remove_reference_t<Fn>;
+	ParallelForChunks(begin, end, grainSize, [](void* context, int chunkBegin, int chunkEnd, int) {
+		FnType& f = *(FnType*)context;
+		for (int i = chunkBegin; i < chunkEnd; ++i) {
+			f(i);
+		}
+	}, (void*)&fn);
+}
+
+////////////////////////////////
+template<typename T, typename MapFn, typename ReduceFn>
+T JobSystem::ParallelReduce(int begin, int end, int grainSize, const T& identity, MapFn&& mapFn, ReduceFn&& reduceFn)
+{
+	struct _Context
+	{
+		std::vector<T> partials;
+		std::remove_reference_t<MapFn>* map;
+		std::remove_reference_t<ReduceFn>* reduce;
+	};
+	_Context context;
+	context.partials.resize(GetParallelParticipantCount(begin, end, grainSize), identity);
+	context.map = &mapFn;
+	context.reduce = &reduceFn;
+	ParallelForChunks(begin, end, grainSize, [](void* pContext, int chunkBegin, int chunkEnd, int participant) {
+		_Context& c = *(_Context*)pContext;
+		T& partial = c.partials[participant];
+		for (int i = chunkBegin; i < chunkEnd; ++i) {
+			partial = (*c.reduce)(partial, (*c.map)(i));
+		}
+	}, &context);
+
+	T result = identity;
+	for (auto& each : context.partials) {
+		result = reduceFn(result, each);
+	}
+	return result;
+}
@@ -0,0 +1,188 @@
+#include "Engine/Core/JobTrace.hpp"
+#include "Engine/Develop/Log.hpp"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+
+std::atomic<bool> g_jobTraceEnabled = false;
+
+//////////////////////////////////////////////////////////////////////////
+// Written only by its own thread. m_written counts every record ever written,
+// readers take the newest min(m_written, capacity) entries.
+struct _JobTraceBuffer
+{
+	JobTraceRecord m_records[JOB_TRACE_RECORDS_PER_THREAD];
+	std::atomic<uint64> m_written = 0;
+	// records before this were written before the last JobTraceStart
+	std::atomic<uint64> m_startIndex = 0;
+	int m_threadIndex = 0;
+	char m_label[32] = {};
+};
+
+// readers skip this many of the oldest records so a writer lapping the ring does not tear them
+static constexpr uint64 _TRACE_READ_MARGIN = 64;
+
+static std::mutex _TraceBuffersLock;
+static std::vector<_JobTraceBuffer*> _TraceBuffers;
+static thread_local _JobTraceBuffer* t_traceBuffer = nullptr;
+static std::atomic<uint64> _TraceStartHPC = 0;
+static std::atomic<uint64> _TraceStopHPC = 0;
+
+////////////////////////////////
+static _JobTraceBuffer* _GetThreadTraceBuffer(const JobTraceRecord& firstRecord)
+{
+	if (!t_traceBuffer) {
+		_JobTraceBuffer* buffer = new _JobTraceBuffer();
+		std::scoped_lock _(_TraceBuffersLock);
+		buffer->m_threadIndex = (int)_TraceBuffers.size();
+		if (firstRecord.worker >= 0) {
+			snprintf(buffer->m_label, sizeof(buffer->m_label), "%s worker %d", GetJobTypeName((JobType)firstRecord.category), firstRecord.worker);
+		} else if (g_theJobSystem->IsOnThreadOf(JOB_MAIN)) {
+			snprintf(buffer->m_label, sizeof(buffer->m_label), "Main thread");
+		} else {
+			snprintf(buffer->m_label, sizeof(buffer->m_label), "Thread %d", buffer->m_threadIndex);
+		}
+		_TraceBuffers.push_back(buffer);
+		t_traceBuffer = buffer;
+	}
+	return t_traceBuffer;
+}
+
+////////////////////////////////
+void _JobTraceRecord(const JobTraceRecord& record)
+{
+	_JobTraceBuffer* buffer = _GetThreadTraceBuffer(record);
+	const uint64 index = buffer->m_written.load(std::memory_order_relaxed);
+	buffer->m_records[index % JOB_TRACE_RECORDS_PER_THREAD] = record;
+	buffer->m_written.store(index + 1, std::memory_order_release);
+}
+
+////////////////////////////////
+void JobTraceStart()
+{
+	{
+		std::scoped_lock _(_TraceBuffersLock);
+		for (auto& each : _TraceBuffers) {
+			each->m_startIndex = each->m_written.load(std::memory_order_acquire);
+		}
+	}
+	_TraceStartHPC = GetCurrentHPC();
+	_TraceStopHPC = 0;
+	g_jobTraceEnabled = true;
+}
+
+////////////////////////////////
+void JobTraceStop()
+{
+	if (g_jobTraceEnabled.exchange(false)) {
+		_TraceStopHPC = GetCurrentHPC();
+	}
+}
+
+////////////////////////////////
+// Copies out what one thread recorded since JobTraceStart
+static void _CollectRecords(_JobTraceBuffer* buffer, std::vector<JobTraceRecord>& out)
+{
+	const uint64 written = buffer->m_written.load(std::memory_order_acquire);
+	uint64 first = buffer->m_startIndex.load();
+	if (written > JOB_TRACE_RECORDS_PER_THREAD - _TRACE_READ_MARGIN) {
+		first = std::max(first, written - (JOB_TRACE_RECORDS_PER_THREAD - _TRACE_READ_MARGIN));
+	}
+	for (uint64 i = first; i < written; ++i) {
+		out.push_back(buffer->m_records[i % JOB_TRACE_RECORDS_PER_THREAD]);
+	}
+}
+
+////////////////////////////////
+static uint64 _GetTraceEndHPC()
+{
+	const uint64 stop = _TraceStopHPC.load();
+	return stop != 0 ? stop : GetCurrentHPC();
+}
+
+////////////////////////////////
+bool JobTraceExport(const char* path)
+{
+	FILE* fp = nullptr;
+	fopen_s(&fp, path, "w");
+	if (!fp) {
+		return false;
+	}
+	const uint64 origin = _TraceStartHPC.load();
+	auto toMicroSecond = [origin](uint64 hpc) {
+		return hpc > origin ? HPCToSeconds(hpc - origin) * 1000000.0 : 0.0;
+	};
+
+	std::vector<JobTraceRecord> records;
+	std::scoped_lock _(_TraceBuffersLock);
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (auto& buffer : _TraceBuffers) {
+		records.clear();
+		_CollectRecords(buffer, records);
+		if (records.empty()) {
+			continue;
+		}
+		const int tid = buffer->m_threadIndex;
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}"
+			, first ? "" : ",\n", tid, buffer->m_label);
+		first = false;
+		for (auto& each : records) {
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f"
+				",\"args\":{\"wait_us\":%.3f,\"priority\":%d}}"
+				, each.name ? each.name : "Job", GetJobTypeName((JobType)each.category), tid
+				, toMicroSecond(each.startHPC), HPCToSeconds(each.endHPC - each.startHPC) * 1000000.0
+				, HPCToSeconds(each.startHPC - each.enqueueHPC) * 1000000.0, (int)each.priority);
+			fprintf(fp, ",\n{\"name\":\"%s queue\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"depth\":%d}}"
+				, GetJobTypeName((JobType)each.category), toMicroSecond(each.endHPC), each.queueDepth);
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	return true;
+}
+
+////////////////////////////////
+void JobTraceLogSummary()
+{
+	const uint64 windowHPC = _GetTraceEndHPC() - _TraceStartHPC.load();
+	const double windowMS = HPCToSeconds(windowHPC) * 1000.0;
+	std::vector<double> waitsMS[NUM_JOB_TYPES];
+	std::vector<JobTraceRecord> records;
+
+	Log("", "Job trace over %.3fms", windowMS);
+	Log("", "%-20s %8s %10s %6s", "THREAD", "JOBS", "BUSY(ms)", "UTIL%");
+	{
+		std::scoped_lock _(_TraceBuffersLock);
+		for (auto& buffer : _TraceBuffers) {
+			records.clear();
+			_CollectRecords(buffer, records);
+			if (records.empty()) {
+				continue;
+			}
+			uint64 busyHPC = 0;
+			for (auto& each : records) {
+				busyHPC += each.endHPC - each.startHPC;
+				waitsMS[each.category].push_back(HPCToSeconds(each.startHPC - each.enqueueHPC) * 1000.0);
+			}
+			const double busyMS = HPCToSeconds(busyHPC) * 1000.0;
+			Log("", "%-20s %8d %10.3f %6.1f", buffer->m_label
+				, (int)records.size(), busyMS, windowMS > 0.0 ? busyMS / windowMS * 100.0 : 0.0);
+		}
+	}
+
+	Log("", "%-10s %8s %10s %10s %10s %10s", "CATEGORY", "JOBS", "P50(ms)", "P90(ms)", "P99(ms)", "MAX(ms)");
+	for (int category = 0; category < NUM_JOB_TYPES; ++category) {
+		std::vector<double>& waits = waitsMS[category];
+		if (waits.empty()) {
+			continue;
+		}
+		std::sort(waits.begin(), waits.end());
+		auto percentile = [&waits](double p) {
+			return waits[std::min(waits.size() - 1, (size_t)(p * (double)waits.size()))];
+		};
+		Log("", "%-10s %8d %10.3f %10.3f %10.3f %10.3f", GetJobTypeName((JobType)category), (int)waits.size()
+			, percentile(0.5), percentile(0.9), percentile(0.99), waits.back());
+	}
+}
\ No newline at end of file
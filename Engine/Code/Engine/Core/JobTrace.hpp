@@ -0,0 +1,36 @@
+#pragma once
+#include "Engine/Core/EngineCommon.hpp"
+#include "Engine/Core/Job.hpp"
+#include "Engine/Core/Time.hpp"
+#include <atomic>
+
+// Per-job timeline for the job system.
+// Each thread appends to its own ring, so recording never takes a lock;
+// when tracing is off the only cost in JobQueue::Execute is the IsJobTracing() branch.
+constexpr size_t JOB_TRACE_RECORDS_PER_THREAD = 16384;
+
+struct JobTraceRecord
+{
+	const char* name = nullptr;
+	uint64 enqueueHPC = 0;
+	uint64 startHPC = 0;
+	uint64 endHPC = 0;
+	int queueDepth = 0;
+	// index inside its category, -1 for threads that only help out
+	short worker = -1;
+	unsigned char category = 0;
+	unsigned char priority = 0;
+};
+
+extern std::atomic<bool> g_jobTraceEnabled;
+inline bool IsJobTracing() { return g_jobTraceEnabled.load(std::memory_order_relaxed); }
+
+/// Clears what was recorded before and starts recording
+void JobTraceStart();
+void JobTraceStop();
+/// Chrome/Perfetto trace event JSON, open with chrome://tracing or ui.perfetto.dev
+bool JobTraceExport(const char* path);
+/// Worker utilization and queue latency percentiles per category
+void JobTraceLogSummary();
+
+void _JobTraceRecord(const JobTraceRecord& record);
\ No newline at end of file
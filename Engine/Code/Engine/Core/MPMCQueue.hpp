@@ -0,0 +1,447 @@
+#pragma once
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+constexpr size_t MPMC_CACHE_LINE = 64;
+
+// Bounded lock-free multi-producer multi-consumer ring (Vyukov).
+// Every cell carries a sequence number telling producers and consumers whose turn it is,
+// so Push and Pop are one CAS on their own cache line in the common case.
+// Push fails when full.
+template<typename T, size_t CAPACITY = 1024>
+class BoundedMPMCQueue
+{
+	static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "BoundedMPMCQueue capacity must be power of two");
+	static constexpr size_t MASK = CAPACITY - 1;
+public:
+	BoundedMPMCQueue();
+	~BoundedMPMCQueue();
+	BoundedMPMCQueue(const BoundedMPMCQueue&) = delete;
+	BoundedMPMCQueue& operator=(const BoundedMPMCQueue&) = delete;
+
+	bool Push(const T& obj);
+	bool Pop(T* out);
+	/// Approximate while other threads push or pop
+	size_t Size() const;
+	bool Empty() const;
+	static constexpr size_t GetCapacity() { return CAPACITY; }
+
+private:
+	struct alignas(MPMC_CACHE_LINE) _Cell
+	{
+		std::atomic<size_t> m_sequence;
+		T m_data;
+	};
+
+	_Cell* m_cells = nullptr;
+	alignas(MPMC_CACHE_LINE) std::atomic<size_t> m_enqueuePos = 0;
+	alignas(MPMC_CACHE_LINE) std::atomic<size_t> m_dequeuePos = 0;
+};
+
+// Unbounded lock-free MPMC queue made of fixed size segments.
+// Producers claim a slot with one fetch_add on the tail segment and append a new segment when it is full.
+// Push/Pop/Size publish the segments they use as hazard pointers, and a consumed segment is freed
+// as soon as no hazard points at it, so memory stays bounded by the peak backlog plus two segments per thread.
+template<typename T, size_t SEGMENT_SIZE = 1024>
+class MPMCQueue
+{
+public:
+	MPMCQueue();
+	~MPMCQueue();
+	MPMCQueue(const MPMCQueue&) = delete;
+	MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+	void Push(const T& obj);
+	bool Pop(T* out);
+	/// Approximate while other threads push or pop
+	size_t Size() const;
+	bool Empty() const;
+	/// Consumed segments that are not freed yet
+	size_t GetRetainedSegments() const { return m_numRetained.load(std::memory_order_relaxed); }
+
+private:
+	enum _SlotState : int
+	{
+		SLOT_EMPTY = 0,
+		SLOT_WRITTEN,
+	};
+
+	struct _Slot
+	{
+		std::atomic<int> m_state = SLOT_EMPTY;
+		T m_data;
+	};
+
+	struct _Segment
+	{
+		alignas(MPMC_CACHE_LINE) std::atomic<size_t> m_enqueueIndex = 0;
+		alignas(MPMC_CACHE_LINE) std::atomic<size_t> m_dequeueIndex = 0;
+		alignas(MPMC_CACHE_LINE) std::atomic<_Segment*> m_next = nullptr;
+		// index of slot 0 in the whole queue, for Size()
+		size_t m_base = 0;
+		_Segment* m_nextRetired = nullptr;
+		_Slot m_slots[SEGMENT_SIZE];
+	};
+
+	enum _HazardSlot : int
+	{
+		HAZARD_HEAD = 0,
+		HAZARD_TAIL,
+		NUM_HAZARD_SLOTS,
+	};
+
+	// The segments the last Push/Pop/Size on this record used, a record belongs to one operation at a time.
+	// They stay published when it returns, so the next one usually finds them in place.
+	struct alignas(MPMC_CACHE_LINE) _HazardRecord
+	{
+		std::atomic<_Segment*> m_segments[NUM_HAZARD_SLOTS] = {};
+		std::atomic<bool> m_used = false;
+		_HazardRecord* m_next = nullptr;
+	};
+
+	// Every Push/Pop/Size holds a hazard record until it returns
+	struct _OpScope
+	{
+		const MPMCQueue* m_queue;
+		_HazardRecord* m_record;
+		_OpScope(const MPMCQueue* queue) : m_queue(queue), m_record(queue->_AcquireHazardRecord()) {}
+		~_OpScope() { m_queue->_ReleaseHazardRecord(m_record); }
+	};
+
+	void _AppendSegment(_Segment* tail);
+	void _Retire(_Segment* segment);
+	_HazardRecord* _AcquireHazardRecord() const;
+	void _ReleaseHazardRecord(_HazardRecord* record) const;
+	static _Segment* _Protect(_HazardRecord* record, _HazardSlot slot, const std::atomic<_Segment*>& source);
+	bool _IsHazard(const _Segment* segment) const;
+	void _PushRetiredChain(_Segment* first);
+
+private:
+	alignas(MPMC_CACHE_LINE) std::atomic<_Segment*> m_head;
+	alignas(MPMC_CACHE_LINE) std::atomic<_Segment*> m_tail;
+	alignas(MPMC_CACHE_LINE) mutable std::atomic<_HazardRecord*> m_hazardRecords = nullptr;
+	std::atomic<_Segment*> m_retired = nullptr;
+	std::atomic<size_t> m_numRetained = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+////////    BoundedMPMCQueue            //////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+BoundedMPMCQueue<T, CAPACITY>::BoundedMPMCQueue()
+{
+	m_cells = new _Cell[CAPACITY];
+	for (size_t i = 0; i < CAPACITY; ++i) {
+		m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+BoundedMPMCQueue<T, CAPACITY>::~BoundedMPMCQueue()
+{
+	delete[] m_cells;
+}
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+bool BoundedMPMCQueue<T, CAPACITY>::Push(const T& obj)
+{
+	size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+	while (true) {
+		_Cell& cell = m_cells[pos & MASK];
+		const size_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+		const intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+		if (diff == 0) {
+			if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				cell.m_data = obj;
+				cell.m_sequence.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			// the consumer of the previous lap has not freed this cell yet
+			return false;
+		} else {
+			pos = m_enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+bool BoundedMPMCQueue<T, CAPACITY>::Pop(T* out)
+{
+	size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+	while (true) {
+		_Cell& cell = m_cells[pos & MASK];
+		const size_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+		const intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+		if (diff == 0) {
+			if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				*out = cell.m_data;
+				cell.m_sequence.store(pos + CAPACITY, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = m_dequeuePos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+size_t BoundedMPMCQueue<T, CAPACITY>::Size() const
+{
+	const size_t dequeuePos = m_dequeuePos.load(std::memory_order_relaxed);
+	const size_t enqueuePos = m_enqueuePos.load(std::memory_order_relaxed);
+	return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+}
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+bool BoundedMPMCQueue<T, CAPACITY>::Empty() const
+{
+	return Size() == 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+////////    MPMCQueue                   //////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+MPMCQueue<T, SEGMENT_SIZE>::MPMCQueue()
+{
+	_Segment* first = new _Segment();
+	m_head.store(first, std::memory_order_relaxed);
+	m_tail.store(first, std::memory_order_relaxed);
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+MPMCQueue<T, SEGMENT_SIZE>::~MPMCQueue()
+{
+	_Segment* segment = m_head.load();
+	while (segment) {
+		_Segment* next = segment->m_next.load();
+		delete segment;
+		segment = next;
+	}
+	segment = m_retired.load();
+	while (segment) {
+		_Segment* next = segment->m_nextRetired;
+		delete segment;
+		segment = next;
+	}
+	_HazardRecord* record = m_hazardRecords.load();
+	while (record) {
+		_HazardRecord* next = record->m_next;
+		delete record;
+		record = next;
+	}
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+void MPMCQueue<T, SEGMENT_SIZE>::Push(const T& obj)
+{
+	_OpScope op(this);
+	while (true) {
+		_Segment* tail = _Protect(op.m_record, HAZARD_TAIL, m_tail);
+		const size_t index = tail->m_enqueueIndex.fetch_add(1, std::memory_order_acq_rel);
+		if (index < SEGMENT_SIZE) {
+			_Slot& slot = tail->m_slots[index];
+			slot.m_data = obj;
+			slot.m_state.store(SLOT_WRITTEN, std::memory_order_release);
+			return;
+		}
+		_AppendSegment(tail);
+	}
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+bool MPMCQueue<T, SEGMENT_SIZE>::Pop(T* out)
+{
+	_OpScope op(this);
+	_Segment* head = _Protect(op.m_record, HAZARD_HEAD, m_head);
+	while (true) {
+		size_t index = head->m_dequeueIndex.load(std::memory_order_acquire);
+		if (index >= SEGMENT_SIZE) {
+			// fully consumed, move on if the producers have
+			_Segment* next = head->m_next.load(std::memory_order_acquire);
+			if (!next) {
+				return false;
+			}
+			// tail must not point at a segment we retire
+			_Segment* expectedTail = head;
+			m_tail.compare_exchange_strong(expectedTail, next);
+			_Segment* expectedHead = head;
+			const bool unlinked = m_head.compare_exchange_strong(expectedHead, next);
+			_Segment* consumed = head;
+			head = _Protect(op.m_record, HAZARD_HEAD, m_head);
+			if (unlinked) {
+				_Retire(consumed);
+			}
+			continue;
+		}
+		const size_t claimed = head->m_enqueueIndex.load(std::memory_order_acquire);
+		if (index >= claimed) {
+			return false;
+		}
+		if (!head->m_dequeueIndex.compare_exchange_weak(index, index + 1, std::memory_order_acq_rel)) {
+			continue;
+		}
+		// the producer owns this slot already but may still be writing it
+		_Slot& slot = head->m_slots[index];
+		while (slot.m_state.load(std::memory_order_acquire) != SLOT_WRITTEN) {
+			std::this_thread::yield();
+		}
+		*out = slot.m_data;
+		return true;
+	}
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+size_t MPMCQueue<T, SEGMENT_SIZE>::Size() const
+{
+	_OpScope op(this);
+	_Segment* head = _Protect(op.m_record, HAZARD_HEAD, m_head);
+	_Segment* tail = _Protect(op.m_record, HAZARD_TAIL, m_tail);
+	const size_t dequeued = head->m_base + std::min(head->m_dequeueIndex.load(), SEGMENT_SIZE);
+	const size_t enqueued = tail->m_base + std::min(tail->m_enqueueIndex.load(), SEGMENT_SIZE);
+	return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+bool MPMCQueue<T, SEGMENT_SIZE>::Empty() const
+{
+	return Size() == 0;
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+void MPMCQueue<T, SEGMENT_SIZE>::_AppendSegment(_Segment* tail)
+{
+	_Segment* next = tail->m_next.load(std::memory_order_acquire);
+	if (!next) {
+		_Segment* fresh = new _Segment();
+		fresh->m_base = tail->m_base + SEGMENT_SIZE;
+		if (tail->m_next.compare_exchange_strong(next, fresh, std::memory_order_acq_rel)) {
+			next = fresh;
+		} else {
+			// somebody else appended first
+			delete fresh;
+		}
+	}
+	_Segment* expectedTail = tail;
+	m_tail.compare_exchange_strong(expectedTail, next);
+}
+
+////////////////////////////////
+// The segment is unlinked from m_head and m_tail already. Frees it and every segment retired before
+// that no hazard points at anymore, the others are kept for a later retire.
+template<typename T, size_t SEGMENT_SIZE>
+void MPMCQueue<T, SEGMENT_SIZE>::_Retire(_Segment* segment)
+{
+	++m_numRetained;
+	segment->m_nextRetired = m_retired.exchange(nullptr, std::memory_order_acquire);
+	_Segment* kept = nullptr;
+	while (segment) {
+		_Segment* next = segment->m_nextRetired;
+		if (_IsHazard(segment)) {
+			segment->m_nextRetired = kept;
+			kept = segment;
+		} else {
+			delete segment;
+			--m_numRetained;
+		}
+		segment = next;
+	}
+	if (kept) {
+		_PushRetiredChain(kept);
+	}
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+typename MPMCQueue<T, SEGMENT_SIZE>::_HazardRecord* MPMCQueue<T, SEGMENT_SIZE>::_AcquireHazardRecord() const
+{
+	for (_HazardRecord* record = m_hazardRecords.load(std::memory_order_acquire); record; record = record->m_next) {
+		if (!record->m_used.load(std::memory_order_relaxed) && !record->m_used.exchange(true, std::memory_order_acquire)) {
+			return record;
+		}
+	}
+	// there are never more records than threads that were inside at once, they live as long as the queue
+	_HazardRecord* record = new _HazardRecord();
+	record->m_used.store(true, std::memory_order_relaxed);
+	_HazardRecord* top = m_hazardRecords.load(std::memory_order_relaxed);
+	do {
+		record->m_next = top;
+	} while (!m_hazardRecords.compare_exchange_weak(top, record, std::memory_order_release, std::memory_order_relaxed));
+	return record;
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+void MPMCQueue<T, SEGMENT_SIZE>::_ReleaseHazardRecord(_HazardRecord* record) const
+{
+	record->m_used.store(false, std::memory_order_release);
+}
+
+////////////////////////////////
+// Publishes the segment source points at in a hazard slot of the record.
+// Both are sequentially consistent with the unlink and the hazard scan of _Retire: once source still
+// points at it after the hazard is published, no retire can free it until the slot changes.
+template<typename T, size_t SEGMENT_SIZE>
+typename MPMCQueue<T, SEGMENT_SIZE>::_Segment* MPMCQueue<T, SEGMENT_SIZE>::_Protect(_HazardRecord* record, _HazardSlot slot, const std::atomic<_Segment*>& source)
+{
+	_Segment* segment = source.load();
+	while (true) {
+		// published and checked by an earlier operation on this record and never cleared since
+		if (record->m_segments[slot].load(std::memory_order_relaxed) == segment) {
+			return segment;
+		}
+		record->m_segments[slot].store(segment);
+		_Segment* again = source.load();
+		if (again == segment) {
+			return segment;
+		}
+		segment = again;
+	}
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+bool MPMCQueue<T, SEGMENT_SIZE>::_IsHazard(const _Segment* segment) const
+{
+	for (_HazardRecord* record = m_hazardRecords.load(std::memory_order_acquire); record; record = record->m_next) {
+		if (record->m_segments[HAZARD_HEAD].load() == segment || record->m_segments[HAZARD_TAIL].load() == segment) {
+			return true;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////
+template<typename T, size_t SEGMENT_SIZE>
+void MPMCQueue<T, SEGMENT_SIZE>::_PushRetiredChain(_Segment* first)
+{
+	_Segment* last = first;
+	while (last->m_nextRetired) {
+		last = last->m_nextRetired;
+	}
+	_Segment* top = m_retired.load(std::memory_order_relaxed);
+	do {
+		last->m_nextRetired = top;
+	} while (!m_retired.compare_exchange_weak(top, first, std::memory_order_release, std::memory_order_relaxed));
+}
\ No newline at end of file
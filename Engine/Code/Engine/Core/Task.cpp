@@ -0,0 +1,83 @@
+#include "Engine/Core/Task.hpp"
+#include "Engine/Develop/Memory.hpp"
+
+//////////////////////////////////////////////////////////////////////////
+// Frame pool, one BlockAllocator per size class
+static constexpr size_t _TASK_FRAME_SIZES[] = { 256, 512, 1024, 2048 };
+static constexpr int _NUM_TASK_FRAME_SIZES = sizeof(_TASK_FRAME_SIZES) / sizeof(_TASK_FRAME_SIZES[0]);
+static constexpr unsigned int _TASK_FRAMES_PER_CHUNK = 64;
+
+////////////////////////////////
+static BlockAllocator* _GetTaskFramePool(int sizeClass)
+{
+	static BlockAllocator* pools[_NUM_TASK_FRAME_SIZES] = {};
+	static bool initialized = [](BlockAllocator** out) {
+		for (int i = 0; i < _NUM_TASK_FRAME_SIZES; ++i) {
+			out[i] = new BlockAllocator();
+			out[i]->Init(GetTrackedAllocator<char>(), _TASK_FRAME_SIZES[i], alignof(std::max_align_t), _TASK_FRAMES_PER_CHUNK);
+		}
+		return true;
+	}(pools);
+	UNUSED(initialized);
+	return pools[sizeClass];
+}
+
+////////////////////////////////
+static int _GetTaskFrameSizeClass(size_t size)
+{
+	for (int i = 0; i < _NUM_TASK_FRAME_SIZES; ++i) {
+		if (size <= _TASK_FRAME_SIZES[i]) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+////////////////////////////////
+void* AllocTaskFrame(size_t size)
+{
+	const int sizeClass = _GetTaskFrameSizeClass(size);
+	if (sizeClass < 0) {
+		return ::operator new(size);
+	}
+	return _GetTaskFramePool(sizeClass)->AllocBlock();
+}
+
+////////////////////////////////
+void FreeTaskFrame(void* frame, size_t size)
+{
+	const int sizeClass = _GetTaskFrameSizeClass(size);
+	if (sizeClass < 0) {
+		::operator delete(frame);
+	} else {
+		_GetTaskFramePool(sizeClass)->FreeBlock(frame);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+class _ResumeCoroutineJob : public Job
+{
+public:
+	_ResumeCoroutineJob(std::coroutine_handle<> handle)
+		: m_handle(handle)
+	{
+	}
+
+	const char* GetName() const override { return "Task"; }
+
+	void Run() override
+	{
+		m_handle.resume();
+	}
+
+private:
+	std::coroutine_handle<> m_handle;
+};
+
+////////////////////////////////
+void ScheduleCoroutine(std::coroutine_handle<> handle, JobType type)
+{
+	Job* job = new _ResumeCoroutineJob(handle);
+	job->SetCatagory(type);
+	g_theJobSystem->Run(job);
+}
\ No newline at end of file
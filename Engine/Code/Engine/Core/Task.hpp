@@ -0,0 +1,241 @@
+#pragma once
+#include "Engine/Core/Job.hpp"
+#include "Engine/Core/ErrorWarningAssert.hpp"
+#include <coroutine>
+#include <atomic>
+#include <optional>
+#include <vector>
+#include <utility>
+
+// Coroutine frames up to this size come from recycled pool blocks
+void* AllocTaskFrame(size_t size);
+void FreeTaskFrame(void* frame, size_t size);
+/// Resumes the coroutine as a job of that category
+void ScheduleCoroutine(std::coroutine_handle<> handle, JobType type);
+
+// Shared by the children of one WhenAll, the last child to finish resumes the parent
+struct _TaskLatch
+{
+	std::atomic<int> m_remaining = 0;
+	std::coroutine_handle<> m_continuation;
+};
+
+class _TaskPromiseBase
+{
+public:
+	static void* operator new(size_t size) { return AllocTaskFrame(size); }
+	static void operator delete(void* frame, size_t size) { FreeTaskFrame(frame, size); }
+
+	struct _FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept { return handle.promise()._OnFinish(); }
+		void await_resume() const noexcept {}
+	};
+
+	// tasks are lazy, nothing runs until Start(), co_await or WhenAll
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	_FinalAwaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() { ERROR_AND_DIE("Unhandled exception in Task"); }
+
+	bool IsDone() const { return m_done.load(std::memory_order_acquire); }
+
+	std::coroutine_handle<> _OnFinish() noexcept
+	{
+		// whoever waits on m_done may destroy the frame right after, read everything first
+		std::coroutine_handle<> continuation = m_continuation;
+		_TaskLatch* latch = m_latch;
+		m_done.store(true, std::memory_order_release);
+		if (latch) {
+			return --latch->m_remaining == 0 ? latch->m_continuation : std::noop_coroutine();
+		}
+		return continuation ? continuation : std::noop_coroutine();
+	}
+
+public:
+	std::coroutine_handle<> m_continuation;
+	_TaskLatch* m_latch = nullptr;
+private:
+	std::atomic<bool> m_done = false;
+};
+
+template<typename T>
+class Task;
+
+template<typename T>
+class _TaskPromise : public _TaskPromiseBase
+{
+public:
+	Task<T> get_return_object();
+	template<typename U>
+	void return_value(U&& value) { m_value.emplace(std::forward<U>(value)); }
+	T& GetValue() { return *m_value; }
+private:
+	std::optional<T> m_value;
+};
+
+template<>
+class _TaskPromise<void> : public _TaskPromiseBase
+{
+public:
+	Task<void> get_return_object();
+	void return_void() {}
+	void GetValue() {}
+};
+
+// Lazily started coroutine running on the job system.
+// Move only, must be finished or never started when destroyed.
+//	Task<Mesh*> LoadMesh(std::string path)
+//	{
+//		co_await ResumeOn(JOB_IO);
+//		std::vector<byte> bytes = ReadFile(path);
+//		co_await ResumeOn(JOB_GENERIC);
+//		co_return ParseMesh(bytes);
+//	}
+template<typename T = void>
+class Task
+{
+public:
+	using promise_type = _TaskPromise<T>;
+	using Handle = std::coroutine_handle<promise_type>;
+
+	Task() = default;
+	explicit Task(Handle handle) : m_handle(handle) {}
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	Task(Task&& moveFrom) noexcept : m_handle(std::exchange(moveFrom.m_handle, nullptr)) {}
+	Task& operator=(Task&& moveFrom) noexcept
+	{
+		if (this != &moveFrom) {
+			_Destroy();
+			m_handle = std::exchange(moveFrom.m_handle, nullptr);
+		}
+		return *this;
+	}
+	~Task() { _Destroy(); }
+
+	bool IsValid() const { return (bool)m_handle; }
+	bool IsDone() const { return m_handle && m_handle.promise().IsDone(); }
+	/// Kicks off a task nobody co_awaits, poll IsDone() or Wait() for it
+	void Start(JobType type = JOB_GENERIC) { ScheduleCoroutine(m_handle, type); }
+	/// Runs pending jobs until the task is done
+	void Wait() const;
+	/// Only after the task is done
+	decltype(auto) Get() { return m_handle.promise().GetValue(); }
+
+	// co_await runs the task right away on the awaiting thread
+	struct _Awaiter
+	{
+		Handle m_handle;
+		bool await_ready() const noexcept { return !m_handle || m_handle.promise().IsDone(); }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			m_handle.promise().m_continuation = awaiting;
+			return m_handle;
+		}
+		decltype(auto) await_resume() { return m_handle.promise().GetValue(); }
+	};
+	_Awaiter operator co_await() const noexcept { return _Awaiter{ m_handle }; }
+
+	std::coroutine_handle<> _GetHandle() const { return m_handle; }
+	_TaskPromiseBase* _GetPromise() const { return m_handle ? &m_handle.promise() : nullptr; }
+private:
+	void _Destroy()
+	{
+		if (m_handle) {
+			m_handle.destroy();
+			m_handle = nullptr;
+		}
+	}
+private:
+	Handle m_handle;
+};
+
+// co_await ResumeOn(JOB_IO) moves the rest of the coroutine to that category.
+// Does not suspend when the thread already belongs to it.
+struct ResumeOn
+{
+	explicit ResumeOn(JobType type) : m_type(type) {}
+	bool await_ready() const { return g_theJobSystem->IsOnThreadOf(m_type); }
+	void await_suspend(std::coroutine_handle<> handle) const { ScheduleCoroutine(handle, m_type); }
+	void await_resume() const {}
+
+	JobType m_type;
+};
+
+// co_await WhenAll(a, b, c) runs the tasks in parallel on generic workers and resumes
+// once all of them are done, on the thread that finished last. Read results with Get().
+class _WhenAllAwaiter
+{
+public:
+	_WhenAllAwaiter() = default;
+	// only ever moved before it is awaited, so the latch has nothing to carry over
+	_WhenAllAwaiter(_WhenAllAwaiter&& moveFrom) noexcept : m_children(std::move(moveFrom.m_children)) {}
+
+	void Add(_TaskPromiseBase* promise, std::coroutine_handle<> handle)
+	{
+		if (promise && !promise->IsDone()) {
+			m_children.emplace_back(promise, handle);
+		}
+	}
+
+	bool await_ready() const noexcept { return m_children.empty(); }
+	bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		// one extra count so no child can resume us before every child is scheduled
+		m_latch.m_remaining = (int)m_children.size() + 1;
+		m_latch.m_continuation = awaiting;
+		for (auto& each : m_children) {
+			each.first->m_latch = &m_latch;
+			ScheduleCoroutine(each.second, JOB_GENERIC);
+		}
+		return --m_latch.m_remaining != 0;
+	}
+	void await_resume() const noexcept {}
+private:
+	_TaskLatch m_latch;
+	std::vector<std::pair<_TaskPromiseBase*, std::coroutine_handle<>>> m_children;
+};
+
+template<typename... Ts>
+_WhenAllAwaiter WhenAll(Task<Ts>&... tasks)
+{
+	_WhenAllAwaiter awaiter;
+	(awaiter.Add(tasks._GetPromise(), tasks._GetHandle()), ...);
+	return awaiter;
+}
+
+template<typename T>
+_WhenAllAwaiter WhenAll(std::vector<Task<T>>& tasks)
+{
+	_WhenAllAwaiter awaiter;
+	for (auto& each : tasks) {
+		awaiter.Add(each._GetPromise(), each._GetHandle());
+	}
+	return awaiter;
+}
+
+////////////////////////////////
+template<typename T>
+Task<T> _TaskPromise<T>::get_return_object()
+{
+	return Task<T>(std::coroutine_handle<_TaskPromise<T>>::from_promise(*this));
+}
+
+////////////////////////////////
+inline Task<void> _TaskPromise<void>::get_return_object()
+{
+	return Task<void>(std::coroutine_handle<_TaskPromise<void>>::from_promise(*this));
+}
+
+////////////////////////////////
+template<typename T>
+void Task<T>::Wait() const
+{
+	while (!IsDone()) {
+		if (!g_theJobSystem->TryRunPendingJob()) {
+			std::this_thread::yield();
+		}
+	}
+}
\ No newline at end of file
@@ -45,3 +45,10 @@ double HPCToSeconds(uint64 hpc)
 {
 	return (double)hpc * secondsPerCount;
 }
+
+
+////////////////////////////////
+uint64 SecondsToHPC(double seconds)
+{
+	return (uint64)(seconds / secondsPerCount);
+}
\ No newline at end of file
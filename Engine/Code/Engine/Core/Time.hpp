@@ -10,4 +10,5 @@ double GetCurrentTimeSeconds();
 using uint64 = unsigned long long int;
 
 uint64 GetCurrentHPC();
-double HPCToSeconds(uint64 hpc);
\ No newline at end of file
+double HPCToSeconds(uint64 hpc);
+uint64 SecondsToHPC(double seconds);
\ No newline at end of file
@@ -2,11 +2,13 @@
 #include "Engine/Core/Vertex_PCU.hpp"
 #include "Engine/Math/AABB2.hpp"
 #include "Engine/Math/Mat4.hpp"
+#include "Engine/Develop/FrameArena.hpp"
 
 //#Todo: All vertices should in CW
 
 ////////////////////////////////
-void AddVerticesOfDisk2D(std::vector<Vertex_PCU>& verts, const Vec2& center, float radius, const Rgba& color, int sides /*= 64 */)
+template<typename Alloc>
+void AddVerticesOfDisk2D(std::vector<Vertex_PCU, Alloc>& verts, const Vec2& center, float radius, const Rgba& color, int sides /*= 64 */)
 {
 	Vec3* diskVerts = new Vec3[sides + 1];
 	for (int i = 0; i < sides; ++i) {
@@ -28,7 +30,8 @@ void AddVerticesOfDisk2D(std::vector<Vertex_PCU>& verts, const Vec2& center, flo
 }
 
 ////////////////////////////////
-void AddVerticesOfLine2D(std::vector<Vertex_PCU>& verts, const Vec2& start, const Vec2& end, float thickness, const Rgba& color)
+template<typename Alloc>
+void AddVerticesOfLine2D(std::vector<Vertex_PCU, Alloc>& verts, const Vec2& start, const Vec2& end, float thickness, const Rgba& color)
 {
 	Vec2 thicknessModifier = end - start;
 	thicknessModifier.SetLength(thickness / 2.f);
@@ -48,7 +51,8 @@ void AddVerticesOfLine2D(std::vector<Vertex_PCU>& verts, const Vec2& start, cons
 }
 
 ////////////////////////////////
-void AddVerticesOfRing2D(std::vector<Vertex_PCU>& verts, const Vec2& center, float radius, float thickness, const Rgba& color, int sides /*= 64 */, float z/*= 0.f*/)
+template<typename Alloc>
+void AddVerticesOfRing2D(std::vector<Vertex_PCU, Alloc>& verts, const Vec2& center, float radius, float thickness, const Rgba& color, int sides /*= 64 */, float z/*= 0.f*/)
 {
 	Vec3* diskVerts = new Vec3[sides + 1];
 	for (int i = 0; i < sides; ++i) {
@@ -83,7 +87,8 @@ void AddVerticesOfRing2D(std::vector<Vertex_PCU>& verts, const Vec2& center, flo
 }
 
 ////////////////////////////////
-void AddVerticesOfAABB2D(std::vector<Vertex_PCU>& verts, const AABB2& box, const Rgba& color /*= Rgba(1.0, 1.0, 1.0)*/, const Vec2& bottomLeftTexCoord /*= Vec2(0.f, 1.f)*/, const Vec2& topRightTexCoord /*= Vec2(1.f, 0.f) */)
+template<typename Alloc>
+void AddVerticesOfAABB2D(std::vector<Vertex_PCU, Alloc>& verts, const AABB2& box, const Rgba& color /*= Rgba(1.0, 1.0, 1.0)*/, const Vec2& bottomLeftTexCoord /*= Vec2(0.f, 1.f)*/, const Vec2& topRightTexCoord /*= Vec2(1.f, 0.f) */)
 {
 	Vec3 bottomLeft(box.Min);
 	Vec3 bottomRight(box.Max.x, box.Min.y, 0);
@@ -99,6 +104,15 @@ void AddVerticesOfAABB2D(std::vector<Vertex_PCU>& verts, const AABB2& box, const
 	verts.push_back(Vertex_PCU(topRight, color, topRightTexCoord));
 }
 
+#define INSTANTIATE_ADD_VERTICES(Alloc)\
+	template void AddVerticesOfDisk2D(std::vector<Vertex_PCU, Alloc>&, const Vec2&, float, const Rgba&, int);\
+	template void AddVerticesOfLine2D(std::vector<Vertex_PCU, Alloc>&, const Vec2&, const Vec2&, float, const Rgba&);\
+	template void AddVerticesOfRing2D(std::vector<Vertex_PCU, Alloc>&, const Vec2&, float, float, const Rgba&, int, float);\
+	template void AddVerticesOfAABB2D(std::vector<Vertex_PCU, Alloc>&, const AABB2&, const Rgba&, const Vec2&, const Vec2&);
+INSTANTIATE_ADD_VERTICES(std::allocator<Vertex_PCU>)
+INSTANTIATE_ADD_VERTICES(FrameAllocator<Vertex_PCU>)
+#undef INSTANTIATE_ADD_VERTICES
+
 ////////////////////////////////
 Vec2 TransformedPosition(const Vec2& position, float uniformScaleXY, float rotationDegreesAboutZ, const Vec2& translationXY)
 {
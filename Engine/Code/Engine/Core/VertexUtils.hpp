@@ -8,30 +8,35 @@ struct Vertex_PCU;
 struct AABB2;
 //////////////////////////////////////////////////////////////////////////
 
+// Instantiated for the default allocator and FrameAllocator
+template<typename Alloc>
 void AddVerticesOfDisk2D(
-	std::vector<Vertex_PCU>& verts,
+	std::vector<Vertex_PCU, Alloc>& verts,
 	const Vec2& center,
 	float radius,
 	const Rgba& color,
 	int sides = 64
 );
+template<typename Alloc>
 void AddVerticesOfLine2D(
-	std::vector<Vertex_PCU>& verts,
+	std::vector<Vertex_PCU, Alloc>& verts,
 	const Vec2& start,
 	const Vec2& end,
 	float thickness,
 	const Rgba& color
 );
+template<typename Alloc>
 void AddVerticesOfRing2D(
-	std::vector<Vertex_PCU>& verts,
+	std::vector<Vertex_PCU, Alloc>& verts,
 	const Vec2& center, float radius,
 	float thickness,
 	const Rgba& color,
 	int sides = 64,
 	float z=0.f
 );
+template<typename Alloc>
 void AddVerticesOfAABB2D(
-	std::vector<Vertex_PCU>& verts,
+	std::vector<Vertex_PCU, Alloc>& verts,
 	const AABB2& box,
 	const Rgba& color = Rgba(1.f, 1.f, 1.f),
 	const Vec2& bottomLeftTexCoord = Vec2(0.f, 1.f),
@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Chase-Lev deque. The owner thread pushes and pops at the bottom (LIFO),
+// any other thread steals from the top (FIFO).
+// Fixed capacity, Push fails when full and the caller has to put the item elsewhere.
+template<typename T, size_t CAPACITY = 4096>
+class WorkStealingDeque
+{
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "WorkStealingDeque capacity must be power of two");
+	static constexpr int64_t MASK = (int64_t)CAPACITY - 1;
+public:
+	/// owner only
+	bool Push(T item);
+	/// owner only
+	bool Pop(T* out);
+	/// any thread
+	bool Steal(T* out);
+
+	bool Empty() const;
+	size_t Size() const;
+
+private:
+	alignas(64) std::atomic<int64_t> m_top = 0;
+	alignas(64) std::atomic<int64_t> m_bottom = 0;
+	alignas(64) std::atomic<T> m_items[CAPACITY];
+};
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+bool WorkStealingDeque<T, CAPACITY>::Push(T item)
+{
+	const int64_t b = m_bottom.load(std::memory_order_relaxed);
+	const int64_t t = m_top.load(std::memory_order_acquire);
+	if (b - t >= (int64_t)CAPACITY) {
+		return false;
+	}
+	m_items[b & MASK].store(item, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+bool WorkStealingDeque<T, CAPACITY>::Pop(T* out)
+{
+	const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+	m_bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = m_top.load(std::memory_order_relaxed);
+	if (t > b) {
+		// empty
+		m_bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+	*out = m_items[b & MASK].load(std::memory_order_relaxed);
+	if (t == b) {
+		// last item, race against thieves
+		const bool won = m_top.compare_exchange_strong(t, t + 1
+			, std::memory_order_seq_cst, std::memory_order_relaxed);
+		m_bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+	return true;
+}
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+bool WorkStealingDeque<T, CAPACITY>::Steal(T* out)
+{
+	int64_t t = m_top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const int64_t b = m_bottom.load(std::memory_order_acquire);
+	if (t >= b) {
+		return false;
+	}
+	T item = m_items[t & MASK].load(std::memory_order_relaxed);
+	if (!m_top.compare_exchange_strong(t, t + 1
+		, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+		return false;
+	}
+	*out = item;
+	return true;
+}
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+bool WorkStealingDeque<T, CAPACITY>::Empty() const
+{
+	return Size() == 0;
+}
+
+////////////////////////////////
+template<typename T, size_t CAPACITY>
+size_t WorkStealingDeque<T, CAPACITY>::Size() const
+{
+	const int64_t b = m_bottom.load(std::memory_order_relaxed);
+	const int64_t t = m_top.load(std::memory_order_relaxed);
+	return b > t ? (size_t)(b - t) : 0;
+}
@@ -51,9 +51,40 @@ std::vector<std::string> CallstackToString(const Callstack& callstack)
 	return xs;
 }
 
+////////////////////////////////
+std::vector<CallstackFrame> ResolveCallstackFrames(void* const* addresses, size_t count)
+{
+	std::vector<CallstackFrame> frames(count);
+	HANDLE currentProcess = GetCurrentProcess();
+	SymSetOptions(SYMOPT_LOAD_LINES);
+	SymInitialize(currentProcess, nullptr, true);
+
+	for (size_t i = 0; i < count; ++i) {
+		char buf[sizeof(SYMBOL_INFO) + 255 * sizeof(char)];
+		SYMBOL_INFO* sym = (SYMBOL_INFO*)buf;
+		sym->SizeOfStruct = sizeof(SYMBOL_INFO);
+		sym->MaxNameLen = 256;
+		DWORD64 disp;
+		if (SymFromAddr(currentProcess, (DWORD64)addresses[i], &disp, sym)) {
+			frames[i].function = sym->Name;
+		}
+		IMAGEHLP_LINE64 line = {};
+		line.SizeOfStruct = sizeof(IMAGEHLP_LINE64);
+		DWORD displine;
+		if (SymGetLineFromAddr64(currentProcess, (DWORD64)addresses[i], &displine, &line)) {
+			frames[i].file = line.FileName;
+			frames[i].line = (int)line.LineNumber;
+		}
+	}
+
+	SymCleanup(currentProcess);
+	return frames;
+}
+
 ////////////////////////////////
 Callstack::Callstack(const Callstack& copyFrom)
 	:m_depth(copyFrom.m_depth)
+	,m_hash(copyFrom.m_hash)
 {
 	for (int i = 0; i < CALLSTACK_MAX_TRACE; ++i)
 	{
@@ -13,6 +13,15 @@ public:
 	Callstack(const Callstack& copyFrom);
 };
 
+struct CallstackFrame
+{
+	std::string function;
+	std::string file;
+	int line = 0;
+};
+
 // /param frameToSkip includes GetCallstack it self
 void GetCallstack(Callstack& out_callstack, int frameToSkip = 1);
-std::vector<std::string> CallstackToString(const Callstack& callstack);
\ No newline at end of file
+std::vector<std::string> CallstackToString(const Callstack& callstack);
+/// Symbols of a batch of return addresses, loaded once for the whole batch. Unknown ones are left empty.
+std::vector<CallstackFrame> ResolveCallstackFrames(void* const* addresses, size_t count);
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "Engine/Develop/FrameArena.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(_DEBUG)
+#define FRAME_ARENA_DEBUG
+#endif
+
+#if defined(FRAME_ARENA_DEBUG)
+static constexpr uint32_t FRAME_ARENA_MAGIC = 0xf4a3e0a1;
+static constexpr unsigned char FRAME_ARENA_POISON = 0xdd;
+// right in front of every allocation, tells ifree which frame it came from
+struct _FrameArenaHeader
+{
+	uint64 frameIndex;
+	uint32_t magic;
+	uint32_t size;
+};
+static constexpr size_t FRAME_ARENA_HEADER_SIZE = sizeof(_FrameArenaHeader);
+#else
+static constexpr size_t FRAME_ARENA_HEADER_SIZE = 0;
+#endif
+
+////////////////////////////////
+FrameArena::FrameArena(size_t bytesPerFrame /*= FRAME_ARENA_SIZE*/)
+	: m_capacity(bytesPerFrame)
+{
+	for (_Frame& each : m_frames) {
+		each.m_buffer = (unsigned char*)TrackedAlloc(bytesPerFrame);
+	}
+}
+
+////////////////////////////////
+FrameArena::~FrameArena()
+{
+	for (_Frame& each : m_frames) {
+		_Release(each);
+		TrackedFree(each.m_buffer);
+		each.m_buffer = nullptr;
+	}
+}
+
+////////////////////////////////
+void* FrameArena::Alloc(size_t size, size_t alignment /*= alignof(std::max_align_t)*/)
+{
+	// room to align whatever the bump pointer is at
+	const size_t reserve = FRAME_ARENA_HEADER_SIZE + size + alignment - 1;
+	_Frame& frame = m_frames[m_current.load(std::memory_order_relaxed)];
+	const size_t offset = frame.m_used.fetch_add(reserve, std::memory_order_relaxed);
+	unsigned char* start = nullptr;
+	if (offset + reserve <= m_capacity) {
+		start = frame.m_buffer + offset;
+	} else {
+		start = (unsigned char*)_AllocInPages(frame, reserve);
+	}
+	const uintptr_t aligned = ((uintptr_t)start + FRAME_ARENA_HEADER_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1);
+#if defined(FRAME_ARENA_DEBUG)
+	_FrameArenaHeader* header = (_FrameArenaHeader*)aligned - 1;
+	header->frameIndex = GetFrameIndex();
+	header->magic = FRAME_ARENA_MAGIC;
+	header->size = (uint32_t)size;
+#endif
+	return (void*)aligned;
+}
+
+////////////////////////////////
+void* FrameArena::ialloc(size_t count)
+{
+	return Alloc(count);
+}
+
+////////////////////////////////
+void FrameArena::ifree(void* p)
+{
+	if (!p) {
+		return;
+	}
+#if defined(FRAME_ARENA_DEBUG)
+	// released memory is poisoned, so the magic is gone
+	const _FrameArenaHeader* header = (const _FrameArenaHeader*)p - 1;
+	ASSERT_OR_DIE(header->magic == FRAME_ARENA_MAGIC && header->frameIndex + 1 >= GetFrameIndex()
+		, "Frame allocation freed after its frame was released");
+#endif
+}
+
+////////////////////////////////
+void FrameArena::EndFrame()
+{
+	const int current = m_current.load(std::memory_order_relaxed);
+	m_highWater = std::max(m_highWater, GetUsedBytes());
+	const int previous = 1 - current;
+	_Release(m_frames[previous]);
+	m_current.store(previous, std::memory_order_release);
+	++m_frameIndex;
+}
+
+////////////////////////////////
+bool FrameArena::IsLive(const void* p) const
+{
+	const unsigned char* byte = (const unsigned char*)p;
+	for (const _Frame& each : m_frames) {
+		const size_t used = std::min(each.m_used.load(std::memory_order_relaxed), m_capacity);
+		if (byte >= each.m_buffer && byte < each.m_buffer + used) {
+			return true;
+		}
+	}
+	std::scoped_lock _(m_pageLock);
+	for (const _Frame& each : m_frames) {
+		for (const _Page* page = each.m_pages; page; page = page->next) {
+			const unsigned char* begin = (const unsigned char*)(page + 1);
+			if (byte >= begin && byte < begin + page->used) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+////////////////////////////////
+size_t FrameArena::GetUsedBytes() const
+{
+	const _Frame& frame = m_frames[m_current.load(std::memory_order_relaxed)];
+	const size_t used = std::min(frame.m_used.load(std::memory_order_relaxed), m_capacity);
+	std::scoped_lock _(m_pageLock);
+	return used + frame.m_pageBytes;
+}
+
+////////////////////////////////
+// The frame outgrew its buffer, pages are a quarter of it or as big as the allocation
+void* FrameArena::_AllocInPages(_Frame& frame, size_t size)
+{
+	std::scoped_lock _(m_pageLock);
+	_Page* page = frame.m_pages;
+	if (!page || page->used + size > page->size) {
+		const size_t pageSize = std::max(size, m_capacity / 4);
+		page = (_Page*)TrackedAlloc(sizeof(_Page) + pageSize);
+		page->next = frame.m_pages;
+		page->size = pageSize;
+		page->used = 0;
+		frame.m_pages = page;
+	}
+	void* allocated = (unsigned char*)(page + 1) + page->used;
+	page->used += size;
+	frame.m_pageBytes += size;
+	return allocated;
+}
+
+////////////////////////////////
+void FrameArena::_Release(_Frame& frame)
+{
+#if defined(FRAME_ARENA_DEBUG)
+	memset(frame.m_buffer, FRAME_ARENA_POISON, std::min(frame.m_used.load(std::memory_order_relaxed), m_capacity));
+#endif
+	std::scoped_lock _(m_pageLock);
+	_Page* page = frame.m_pages;
+	while (page) {
+		_Page* next = page->next;
+#if defined(FRAME_ARENA_DEBUG)
+		memset(page + 1, FRAME_ARENA_POISON, page->used);
+#endif
+		TrackedFree(page);
+		page = next;
+	}
+	frame.m_pages = nullptr;
+	frame.m_pageBytes = 0;
+	frame.m_used.store(0, std::memory_order_relaxed);
+}
+
+////////////////////////////////
+FrameArena* GetFrameArena()
+{
+	static FrameArena* instance = new FrameArena();
+	return instance;
+}
\ No newline at end of file
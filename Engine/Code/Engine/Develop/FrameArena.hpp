@@ -0,0 +1,120 @@
+#pragma once
+#include "Engine/Develop/Memory.hpp"
+#include "Engine/Core/Time.hpp"
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// What one frame gets before it spills into overflow pages
+inline constexpr size_t FRAME_ARENA_SIZE = 4 * 1024 * 1024;
+
+// Bump allocator for garbage that dies with the frame, with two frames alive at once.
+// What frame N allocates stays valid through frame N+1 and is released in bulk by the EndFrame
+// at the end of frame N+1, nothing is freed one by one.
+// Any thread may allocate. EndFrame runs on the main thread while nobody is allocating.
+// Debug builds poison released memory and assert when a released allocation is freed.
+class FrameArena : public IAllocator
+{
+public:
+	explicit FrameArena(size_t bytesPerFrame = FRAME_ARENA_SIZE);
+	~FrameArena();
+
+	void* Alloc(size_t size, size_t alignment = alignof(std::max_align_t));
+	virtual void* ialloc(size_t count) override;
+	/// Nothing to free, only checks that the frame of p was not released yet
+	virtual void ifree(void* p) override;
+
+	/// Releases the frame before this one and starts the next
+	void EndFrame();
+
+	/// p comes from one of the two frames alive now
+	bool IsLive(const void* p) const;
+	uint64 GetFrameIndex() const { return m_frameIndex.load(std::memory_order_relaxed); }
+	/// This frame so far, overflow pages included
+	size_t GetUsedBytes() const;
+	size_t GetHighWaterBytes() const { return m_highWater; }
+
+private:
+	struct _Page
+	{
+		_Page* next;
+		size_t size;
+		size_t used;
+	};
+	struct _Frame
+	{
+		unsigned char* m_buffer = nullptr;
+		// keeps counting past the capacity, those allocations went to pages
+		std::atomic<size_t> m_used = 0;
+		_Page* m_pages = nullptr;
+		size_t m_pageBytes = 0;
+	};
+
+	void* _AllocInPages(_Frame& frame, size_t size);
+	void _Release(_Frame& frame);
+
+private:
+	_Frame m_frames[2];
+	std::atomic<int> m_current = 0;
+	std::atomic<uint64> m_frameIndex = 0;
+	size_t m_capacity = 0;
+	size_t m_highWater = 0;
+	// guards the pages of both frames
+	mutable std::mutex m_pageLock;
+};
+
+FrameArena* GetFrameArena();
+
+// STL allocator on the frame arena. A container must not live past the frame after the one it
+// was made in, debug builds assert when it allocates or frees after that.
+//	FrameVector<Vertex_PCU> verts;
+template<typename T>
+struct FrameAllocator
+{
+	typedef T				value_type;
+	typedef std::true_type	propagate_on_container_move_assignment;
+	typedef std::true_type	is_always_equal;
+
+	FrameAllocator() noexcept : m_frameIndex(GetFrameArena()->GetFrameIndex()) {}
+	template<typename U>
+	FrameAllocator(const FrameAllocator<U>& copyFrom) noexcept : m_frameIndex(copyFrom.m_frameIndex) {}
+
+	// a copy belongs to the frame it is made in
+	FrameAllocator select_on_container_copy_construction() const { return FrameAllocator(); }
+
+	T* allocate(size_t count)
+	{
+		_CheckFrame();
+		return (T*)GetFrameArena()->Alloc(count * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T* p, size_t count)
+	{
+		UNUSED(count);
+		_CheckFrame();
+		GetFrameArena()->ifree(p);
+	}
+
+	void _CheckFrame() const
+	{
+		ASSERT_OR_DIE(GetFrameArena()->GetFrameIndex() <= m_frameIndex + 1, "Frame allocation escaped its frame");
+	}
+
+	uint64 m_frameIndex = 0;
+};
+
+template<typename T1, typename T2>
+constexpr bool operator==(const FrameAllocator<T1>& a, const FrameAllocator<T2>& b)
+{
+	return true;
+}
+
+template<typename T1, typename T2>
+constexpr bool operator!=(const FrameAllocator<T1>& a, const FrameAllocator<T2>& b)
+{
+	return false;
+}
+
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
\ No newline at end of file
@@ -2,10 +2,14 @@
 #include "Engine/Develop/Callstack.hpp"
 #include "Engine/Develop/Memory.hpp"
 #include "Engine/Develop/DevConsole.hpp"
-#include <shared_mutex>
+#include "Engine/Develop/LogSink.hpp"
+#include <map>
 #include <cstdio>
 #include <cstdarg>
+#include <algorithm>
+#include <unordered_map>
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 #include <Windows.h>
 ////////////////////////////////
 LogItem::~LogItem()
@@ -21,59 +25,417 @@ size_t LogItem::GetSize() const
 
 //////////////////////////////////////////////////////////////////////////
 LogSystem* g_logSystem;
-static std::shared_mutex _mapLock;
-FILE* flog = nullptr;
+std::atomic<uint64_t> g_logChannelMask[LOG_MAX_CHANNELS / 64] = {};
+
+// Channel registry, the enabled mask is rebuilt from it whenever a filter changes
+static std::mutex _channelLock;
+static std::map<std::string, LogChannel, std::less<>> _channelIds;
+// fixed storage, so names can be read without the lock
+static std::string _channelNames[LOG_MAX_CHANNELS];
+static bool _channelListed[LOG_MAX_CHANNELS];
+static int _numChannels = 0;
+static bool _unfiltered = true;
+// what a full buffer does to each channel, and how often it happened
+static LogOverflowPolicy _defaultPolicy = LOG_OVERFLOW_BLOCK;
+static std::atomic<unsigned char> _channelPolicy[LOG_MAX_CHANNELS];
+static std::atomic<uint64> _channelDropped[LOG_MAX_CHANNELS];
+static std::atomic<uint64> _channelBlocked[LOG_MAX_CHANNELS];
+static std::atomic<uint64> _channelOverflowed[LOG_MAX_CHANNELS];
+static LogChannel _RegisterChannel(const char* name);
+static const char* const LOG_OVERFLOW_POLICY_NAMES[NUM_LOG_OVERFLOW_POLICIES] = { "block", "drop_newest", "drop_oldest", "secondary" };
+
+// name address -> channel, filled under _channelLock, read without it
+// a hit still compares the name, the same address may hold another string by then
+static constexpr size_t LOG_NAME_CACHE_SIZE = 4096;
+static std::atomic<const char*> _nameKeys[LOG_NAME_CACHE_SIZE];
+static LogChannel _nameChannels[LOG_NAME_CACHE_SIZE];
+// only touched by the log thread
+static FILE* _binaryLog = nullptr;
+static std::unordered_map<const char*, uint32_t> _binaryStringIds;
+
+// Binary log layout: LOG_BINARY_MAGIC, then records starting with a kind byte
+//	LOG_BINARY_STRING	uint32 id, uint32 length, characters
+//	LOG_BINARY_MESSAGE	uint64 hpc, uint32 thread id, uint32 filter id, uint32 format id, uint32 argBytes, arguments
+static constexpr char LOG_BINARY_MAGIC[8] = { 'F', 'C', 'Y', 'F', 'L', 'O', 'G', '1' };
+enum _LogBinaryKind : unsigned char
+{
+	LOG_BINARY_STRING = 1,
+	LOG_BINARY_MESSAGE,
+};
+
+// Overflow buffer records carry either kind of item, 8 bytes so the item stays aligned
+enum _LogOverflowKind : uint32_t
+{
+	LOG_OVERFLOW_ITEM_IMMEDIATE,
+	LOG_OVERFLOW_ITEM_DEFERRED,
+};
+struct _LogOverflowHeader
+{
+	uint32_t kind = LOG_OVERFLOW_ITEM_IMMEDIATE;
+	uint32_t size = 0;
+};
+
 //////////////////////////////////////////////////////////////////////////
-static void LogThread()
+struct _LogThreadBufferOwner
 {
-	char hpc_str[30];
-	fopen_s(&flog, g_logSystem->m_filename.c_str(), "wb");
-	if (!flog)
+	~_LogThreadBufferOwner()
 	{
-		ERROR_AND_DIE("Cannot create log file");
+		if (m_buffer) {
+			m_buffer->m_orphaned = true;
+			m_buffer = nullptr;
+		}
 	}
-	while (g_logSystem->IsRunning()) {
-		g_logSystem->WaitForWork();
-		LogItem* item = nullptr;
-		size_t itemSize = 0;
-		item = (LogItem*)g_logSystem->m_messages->ReserveForPop(&itemSize);
-		while (item) {
-			//sprintf_s(hpc_str, "[%I64d]", item->hpc);
-			//fwrite(i)
-			fwrite(item->message, 1, item->messageSize, flog);
-			fwrite("\n", 1, 1, flog);
+	_LogThreadBuffer* m_buffer = nullptr;
+	// deferred record between _LogBeginDeferred and _LogEndDeferred
+	AsyncCircularQueue* m_pendingQueue = nullptr;
+	void* m_pendingRecord = nullptr;
+};
+static thread_local _LogThreadBufferOwner _threadBuffer;
+
+// Messages waiting for the sinks, texts are packed in _batchText
+static constexpr int LOG_SINK_BATCH = 256;
+static std::vector<LogMessage> _batch;
+static std::vector<size_t> _batchOffsets;
+static std::string _batchText;
+// binary log records of the batch, written with it
+static std::string _batchBinary;
+
+////////////////////////////////
+// m_sinksLock held
+static bool _AnySinkAccepts(const LogMessage& message)
+{
+	for (LogSink* each : g_logSystem->m_sinks) {
+		if (each->Accepts(message)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////
+// m_sinksLock held
+static void _DispatchBatch()
+{
+	if (!_batchBinary.empty()) {
+		fwrite(_batchBinary.data(), 1, _batchBinary.size(), _binaryLog);
+		_batchBinary.clear();
+	}
+	if (_batch.empty()) {
+		return;
+	}
+	for (size_t i = 0; i < _batch.size(); ++i) {
+		_batch[i].text = _batchText.data() + _batchOffsets[i];
+	}
+	for (LogSink* each : g_logSystem->m_sinks) {
+		each->Write(_batch.data(), (int)_batch.size());
+	}
+	_batch.clear();
+	_batchOffsets.clear();
+	_batchText.clear();
+}
+
+////////////////////////////////
+// m_sinksLock held
+static void _QueueMessage(LogMessage& message, const char* text, size_t textSize)
+{
+	_batchOffsets.push_back(_batchText.size());
+	_batchText.append(text, textSize);
+	message.textSize = textSize;
+	_batch.push_back(message);
+}
+
+////////////////////////////////
+static void _QueueLogItem(void* data, size_t)
+{
+	const LogItem* item = (const LogItem*)data;
+	LogMessage message;
+	message.hpc = item->hpc;
+	message.filter = item->filter;
+	message.channel = item->channel.id;
+	if (_AnySinkAccepts(message)) {
+		_QueueMessage(message, item->message, item->messageSize);
+	}
+}
+
+////////////////////////////////
+// Sources are drained with this as a whole; the kind was picked by the producer
+static void _QueueDeferredItem(void* data, size_t size);
+static void _QueueOverflowItem(void* data, size_t size)
+{
+	const _LogOverflowHeader* header = (const _LogOverflowHeader*)data;
+	if (header->kind == LOG_OVERFLOW_ITEM_IMMEDIATE) {
+		_QueueLogItem((void*)(header + 1), header->size);
+	} else {
+		_QueueDeferredItem((void*)(header + 1), header->size);
+	}
+}
+
+////////////////////////////////
+static void _AppendBinary(const void* data, size_t size)
+{
+	_batchBinary.append((const char*)data, size);
+}
+
+////////////////////////////////
+static uint32_t _GetBinaryStringId(const char* str)
+{
+	auto found = _binaryStringIds.find(str);
+	if (found != _binaryStringIds.end()) {
+		return found->second;
+	}
+	const uint32_t id = (uint32_t)_binaryStringIds.size();
+	_binaryStringIds[str] = id;
+	const uint32_t length = (uint32_t)strlen(str);
+	const unsigned char kind = LOG_BINARY_STRING;
+	_AppendBinary(&kind, 1);
+	_AppendBinary(&id, sizeof(id));
+	_AppendBinary(&length, sizeof(length));
+	_AppendBinary(str, length);
+	return id;
+}
+
+////////////////////////////////
+static void _QueueDeferredItem(void* data, size_t)
+{
+	const LogDeferredItem* item = (const LogDeferredItem*)data;
+	const unsigned char* args = (const unsigned char*)(item + 1);
+	LogMessage message;
+	message.hpc = item->hpc;
+	message.filter = LogGetChannelName(item->channel);
+	message.channel = item->channel.id;
+	message.threadId = item->threadId;
+	if (_binaryLog) {
+		const uint32_t filterId = _GetBinaryStringId(message.filter);
+		const uint32_t formatId = _GetBinaryStringId(item->format);
+		const unsigned char kind = LOG_BINARY_MESSAGE;
+		_AppendBinary(&kind, 1);
+		_AppendBinary(&item->hpc, sizeof(item->hpc));
+		_AppendBinary(&item->threadId, sizeof(item->threadId));
+		_AppendBinary(&filterId, sizeof(filterId));
+		_AppendBinary(&formatId, sizeof(formatId));
+		_AppendBinary(&item->argBytes, sizeof(item->argBytes));
+		_AppendBinary(args, item->argBytes);
+		message.binaryLogged = true;
+	}
+	// nobody to format it for
+	if (!_AnySinkAccepts(message)) {
+		return;
+	}
+	const std::string text = LogFormatArgs(item->format, args, item->argBytes);
+	_QueueMessage(message, text.c_str(), text.size());
+}
+
+////////////////////////////////
+static void _UpdateBinaryLog()
+{
+	if (!g_logSystem->m_binaryChanged.exchange(false)) {
+		return;
+	}
+	std::string filename;
+	{
+		std::scoped_lock _(g_logSystem->m_binaryLock);
+		filename = g_logSystem->m_binaryFilename;
+	}
+	if (_binaryLog) {
+		fclose(_binaryLog);
+		_binaryLog = nullptr;
+	}
+	_binaryStringIds.clear();
+	if (!filename.empty()) {
+		fopen_s(&_binaryLog, filename.c_str(), "wb");
+		if (_binaryLog) {
+			fwrite(LOG_BINARY_MAGIC, 1, sizeof(LOG_BINARY_MAGIC), _binaryLog);
+		}
+	}
+}
+
+////////////////////////////////
+struct _LogSource
+{
+	AsyncCircularQueue* m_queue = nullptr;
+	void (*m_queueItem)(void* data, size_t size) = nullptr;
+	// every item starts with its hpc
+	size_t m_hpcOffset = 0;
+};
+
+////////////////////////////////
+// Consumer locks held. Queues up to LOG_SINK_BATCH records, oldest first.
+// /return false when it stopped because the batch is full
+static bool _PopBatch(std::vector<_LogSource>& sources)
+{
+	int numPopped = 0;
+	while (numPopped < LOG_SINK_BATCH) {
+		const uint64 scanHPC = GetCurrentHPC();
+		_LogSource* oldest = nullptr;
+		void* oldestRecord = nullptr;
+		uint64 oldestHPC = 0;
+		int numReady = 0;
+		for (_LogSource& each : sources) {
+			size_t size = 0;
+			void* record = each.m_queue->ReserveForPop(&size);
+			if (!record) {
+				continue;
+			}
+			++numReady;
+			const uint64 hpc = *(const uint64*)((const char*)record + each.m_hpcOffset);
+			if (!oldest || hpc < oldestHPC) {
+				oldest = &each;
+				oldestRecord = record;
+				oldestHPC = hpc;
+			}
+		}
+		if (numReady == 0) {
+			return true;
+		}
+		if (numReady == 1) {
+			const size_t hpcOffset = oldest->m_hpcOffset;
+			const int room = LOG_SINK_BATCH - numPopped;
+			int numAccepted = 0;
+			numPopped += oldest->m_queue->PopRun(oldest->m_queueItem, [scanHPC, hpcOffset, room, &numAccepted](void* record, size_t) {
+				if (numAccepted == room || *(const uint64*)((const char*)record + hpcOffset) > scanHPC) {
+					return false;
+				}
+				++numAccepted;
+				return true;
+			});
+		} else {
+			oldest->m_queueItem(oldestRecord, 0);
+			oldest->m_queue->FinalizePop(oldestRecord);
+			++numPopped;
+		}
+	}
+	return false;
+}
 
-			g_logSystem->m_messages->FinalizePop(item);
-			item = (LogItem*)g_logSystem->m_messages->ReserveForPop(&itemSize);
+////////////////////////////////
+// Hands everything that is ready to the sinks. Sources are merged by timestamp,
+// when only one of them has anything it is drained a whole run at a time, but only
+// up to the time the sources were looked at, so what other threads log meanwhile
+// still merges in order.
+static void _DrainMessages()
+{
+	std::scoped_lock sinksLock(g_logSystem->m_sinksLock);
+	std::vector<_LogThreadBuffer*> buffers;
+	{
+		std::scoped_lock _(g_logSystem->m_threadBuffersLock);
+		buffers = g_logSystem->m_threadBuffers;
+	}
+	// always taken in the same order
+	std::sort(buffers.begin(), buffers.end(), [](const _LogThreadBuffer* a, const _LogThreadBuffer* b) { return a->m_threadId < b->m_threadId; });
+	std::vector<_LogSource> sources;
+	sources.reserve(buffers.size() + 2);
+	sources.push_back({ g_logSystem->m_messages, _QueueLogItem, 0 });
+	sources.push_back({ g_logSystem->m_overflow, _QueueOverflowItem, sizeof(_LogOverflowHeader) });
+	for (_LogThreadBuffer* each : buffers) {
+		sources.push_back({ &each->m_ring, _QueueDeferredItem, 0 });
+	}
 
+	// drop oldest producers pop too, they back off while we have the buffers.
+	// The locks are only held to pop a batch, the sinks write it after they are released.
+	bool drained = false;
+	while (!drained) {
+		g_logSystem->m_messagesConsumerLock.lock();
+		for (_LogThreadBuffer* each : buffers) {
+			each->m_consumerLock.lock();
+		}
+		drained = _PopBatch(sources);
+		for (_LogThreadBuffer* each : buffers) {
+			each->m_consumerLock.unlock();
+		}
+		g_logSystem->m_messagesConsumerLock.unlock();
+		_DispatchBatch();
+	}
+
+	// buffers of finished threads, the thread never pushes again once orphaned
+	std::scoped_lock buffersLock(g_logSystem->m_threadBuffersLock);
+	auto& all = g_logSystem->m_threadBuffers;
+	for (size_t i = 0; i < all.size();) {
+		size_t size = 0;
+		if (all[i]->m_orphaned && !all[i]->m_ring.ReserveForPop(&size)) {
+			delete all[i];
+			all[i] = all.back();
+			all.pop_back();
+		} else {
+			++i;
+		}
+	}
+}
+
+////////////////////////////////
+// /param flushRequested read before draining, so everything logged before LogFlush is in the sinks
+static void _UpdateSinks(uint64 flushRequested)
+{
+	std::scoped_lock _(g_logSystem->m_sinksLock);
+	const bool flush = flushRequested != g_logSystem->m_flushDone.load(std::memory_order_relaxed);
+	for (LogSink* each : g_logSystem->m_sinks) {
+		each->Update();
+		if (flush) {
+			each->Flush();
 		}
 	}
-//	ERROR_AND_DIE("IMHERE");
-	LogItem* item = nullptr;
-	size_t itemSize = 0;
-	item = (LogItem*)g_logSystem->m_messages->ReserveForPop(&itemSize);
-	while (item) {
-		//sprintf_s(hpc_str, "[%I64d]", item->hpc);
-		//fwrite(i)
-		fwrite(item->message, 1, item->messageSize, flog);
-		fwrite("\n", 1, 1, flog);
+	if (flush) {
+		if (_binaryLog) {
+			fflush(_binaryLog);
+		}
+		{
+			std::scoped_lock wakeLock(g_logSystem->m_wakeLock);
+			g_logSystem->m_flushDone = flushRequested;
+		}
+		g_logSystem->m_flushCV.notify_all();
+	}
+}
 
-		g_logSystem->m_messages->FinalizePop(item);
-		item = (LogItem*)g_logSystem->m_messages->ReserveForPop(&itemSize);
+////////////////////////////////
+static void LogThread()
+{
+	MEM_TAG_SCOPE("Log");
+	while (g_logSystem->IsRunning()) {
+		g_logSystem->WaitForWork();
+		const uint64 flushRequested = g_logSystem->m_flushRequested.load();
+		_UpdateBinaryLog();
+		_DrainMessages();
+		_UpdateSinks(flushRequested);
 	}
+	// one more pass for whatever was pushed while shutting down
+	_DrainMessages();
 
-	fflush(flog);
-	fclose(flog);
+	if (_binaryLog) {
+		fclose(_binaryLog);
+		_binaryLog = nullptr;
+	}
+	std::scoped_lock _(g_logSystem->m_sinksLock);
+	for (LogSink* each : g_logSystem->m_sinks) {
+		each->Flush();
+	}
 }
 
 ////////////////////////////////
-void LogStart(const std::string& filename)
+void LogStart(const std::string& filename, const LogConfig& config)
 {
 	g_logSystem = new LogSystem();
 	g_logSystem->m_filename = filename;
-	g_logSystem->m_signal = new Semaphore(0, 1);
+	g_logSystem->m_messages = new AsyncCircularQueue(config.bufferSize);
+	g_logSystem->m_overflow = new AsyncCircularQueue(config.overflowBufferSize);
+	g_logSystem->m_threadBufferSize = config.threadBufferSize;
+	{
+		std::scoped_lock _(_channelLock);
+		_defaultPolicy = config.defaultPolicy;
+		for (int id = 0; id < _numChannels; ++id) {
+			_channelPolicy[id] = (unsigned char)_defaultPolicy;
+		}
+		for (auto& each : config.channelPolicies) {
+			_channelPolicy[_RegisterChannel(each.first.c_str()).id] = (unsigned char)each.second;
+		}
+	}
+
+	LogFileSink* file = new LogFileSink("file", filename);
+	if (!file->IsOpen()) {
+		ERROR_AND_DIE("Cannot create log file");
+	}
+	g_logSystem->m_consoleSink = new LogConsoleSink("console");
+	g_logSystem->m_historySink = new LogHistorySink("history");
+	g_logSystem->m_sinks = { file, g_logSystem->m_consoleSink, new LogStderrSink("stderr"), g_logSystem->m_historySink };
 	g_logSystem->m_logThread = std::thread(LogThread);
-	g_logSystem->m_messages = new AsyncCircularQueue(2048); //2 KiB
 }
 
 ////////////////////////////////
@@ -83,100 +445,603 @@ void LogStop()
 	Log("LogSystem", "Stop logging.");
 	//g_logSystem->SignalWork();
 	g_logSystem->Shutdown();
+	g_logSystem->m_wakeRequested = true;
 	g_logSystem->SignalWork();
 	g_logSystem->m_logThread.join();
+
+	for (LogSink* each : g_logSystem->m_sinks) {
+		delete each;
+	}
+	g_logSystem->m_sinks.clear();
+	g_logSystem->m_consoleSink = nullptr;
+	g_logSystem->m_historySink = nullptr;
 }
 
 ////////////////////////////////
-void Log(const char* filter, const char* fmt, ...)
+// _channelLock held
+static void _RebuildChannelMask()
 {
-	static constexpr size_t headerSize = sizeof(LogItem);
+	uint64_t words[LOG_MAX_CHANNELS / 64] = {};
+	for (int id = 0; id < _numChannels; ++id) {
+		if (_unfiltered || _channelListed[id]) {
+			words[id >> 6] |= 1ull << (id & 63);
+		}
+	}
+	for (int i = 0; i < LOG_MAX_CHANNELS / 64; ++i) {
+		g_logChannelMask[i].store(words[i], std::memory_order_relaxed);
+	}
+}
 
-	// shared lock
+////////////////////////////////
+// _channelLock held
+static LogChannel _RegisterChannel(const char* name)
+{
+	auto found = _channelIds.find(name);
+	if (found != _channelIds.end()) {
+		return found->second;
+	}
+	GUARANTEE_OR_DIE(_numChannels < LOG_MAX_CHANNELS, "Too many log channels");
+	LogChannel channel;
+	channel.id = (uint16_t)_numChannels++;
+	_channelNames[channel.id] = name;
+	_channelListed[channel.id] = false;
+	_channelPolicy[channel.id] = (unsigned char)_defaultPolicy;
+	_channelIds.emplace(_channelNames[channel.id], channel);
+	_RebuildChannelMask();
+	return channel;
+}
+
+////////////////////////////////
+LogChannel LogRegisterChannel(const char* name)
+{
+	std::scoped_lock _(_channelLock);
+	return _RegisterChannel(name);
+}
+
+////////////////////////////////
+const char* LogGetChannelName(LogChannel channel)
+{
+	// written once before the id is handed out
+	return _channelNames[channel.id].c_str();
+}
+
+////////////////////////////////
+bool LogFindChannel(const char* name, LogChannel* out_channel)
+{
+	std::scoped_lock _(_channelLock);
+	auto found = _channelIds.find(name);
+	if (found == _channelIds.end()) {
+		return false;
+	}
+	*out_channel = found->second;
+	return true;
+}
+
+////////////////////////////////
+// _channelLock held
+static LogChannel _NamedChannelLocked(const char* name)
+{
+	auto found = _channelIds.find(name);
+	if (found != _channelIds.end()) {
+		return found->second;
+	}
+	if (_numChannels < LOG_MAX_CHANNELS) {
+		return _RegisterChannel(name);
+	}
+	// a runtime name must not take the game down, it goes to the unnamed channel
+	return _RegisterChannel("");
+}
+
+////////////////////////////////
+LogChannel _LogNamedChannel(const char* name)
+{
+	const size_t start = ((size_t)name >> 3) % LOG_NAME_CACHE_SIZE;
+	for (size_t probe = 0; probe < 16; ++probe) {
+		const size_t slot = (start + probe) % LOG_NAME_CACHE_SIZE;
+		const char* key = _nameKeys[slot].load(std::memory_order_acquire);
+		if (key == name) {
+			const LogChannel channel = _nameChannels[slot];
+			if (strcmp(_channelNames[channel.id].c_str(), name) == 0) {
+				return channel;
+			}
+			// a buffer that held another name, not worth a slot
+			break;
+		}
+		if (!key) {
+			std::scoped_lock _(_channelLock);
+			const LogChannel channel = _NamedChannelLocked(name);
+			// somebody may have taken the slot while we waited for the lock
+			key = _nameKeys[slot].load(std::memory_order_relaxed);
+			if (!key) {
+				_nameChannels[slot] = channel;
+				_nameKeys[slot].store(name, std::memory_order_release);
+			}
+			return channel;
+		}
+	}
+	std::scoped_lock _(_channelLock);
+	return _NamedChannelLocked(name);
+}
+
+////////////////////////////////
+void LogListChannels()
+{
+	std::vector<std::pair<std::string, bool>> channels;
 	{
-		std::shared_lock _(_mapLock);
-		if (!g_logSystem->m_unfiltered &&
-			g_logSystem->m_filters.find(filter) == g_logSystem->m_filters.end())
-		{
-			return;
+		std::scoped_lock _(_channelLock);
+		for (int id = 0; id < _numChannels; ++id) {
+			channels.emplace_back(_channelNames[id], LogIsChannelEnabled(LogChannel{ (uint16_t)id }));
+		}
+	}
+	for (auto& each : channels) {
+		Log("", "%-24s %s", each.first.empty() ? "(none)" : each.first.c_str(), each.second ? "on" : "off");
+	}
+}
+
+////////////////////////////////
+void LogSetChannelPolicy(LogChannel channel, LogOverflowPolicy policy)
+{
+	_channelPolicy[channel.id] = (unsigned char)policy;
+}
+
+////////////////////////////////
+LogOverflowPolicy LogGetChannelPolicy(LogChannel channel)
+{
+	return (LogOverflowPolicy)_channelPolicy[channel.id].load(std::memory_order_relaxed);
+}
+
+////////////////////////////////
+const char* LogGetOverflowPolicyName(LogOverflowPolicy policy)
+{
+	return LOG_OVERFLOW_POLICY_NAMES[policy];
+}
+
+////////////////////////////////
+bool LogParseOverflowPolicy(const std::string& name, LogOverflowPolicy* out_policy)
+{
+	for (int i = 0; i < NUM_LOG_OVERFLOW_POLICIES; ++i) {
+		if (name == LOG_OVERFLOW_POLICY_NAMES[i]) {
+			*out_policy = (LogOverflowPolicy)i;
+			return true;
 		}
 	}
+	return false;
+}
+
+////////////////////////////////
+LogChannelStats LogGetChannelStats(LogChannel channel)
+{
+	LogChannelStats stats;
+	stats.dropped = _channelDropped[channel.id];
+	stats.blocked = _channelBlocked[channel.id];
+	stats.overflowed = _channelOverflowed[channel.id];
+	return stats;
+}
+
+////////////////////////////////
+void LogReportStats()
+{
+	struct Row
+	{
+		std::string name;
+		LogOverflowPolicy policy;
+		LogChannelStats stats;
+	};
+	std::vector<Row> rows;
+	LogChannelStats total;
+	{
+		std::scoped_lock _(_channelLock);
+		for (int id = 0; id < _numChannels; ++id) {
+			const LogChannel channel = { (uint16_t)id };
+			const LogChannelStats stats = LogGetChannelStats(channel);
+			total.dropped += stats.dropped;
+			total.blocked += stats.blocked;
+			total.overflowed += stats.overflowed;
+			if (stats.dropped || stats.blocked || stats.overflowed) {
+				rows.push_back({ _channelNames[id], LogGetChannelPolicy(channel), stats });
+			}
+		}
+	}
+	Log("", "%-24s %-12s %10s %10s %10s", "channel", "policy", "dropped", "blocked", "overflowed");
+	for (auto& each : rows) {
+		Log("", "%-24s %-12s %10llu %10llu %10llu", each.name.empty() ? "(none)" : each.name.c_str(), LogGetOverflowPolicyName(each.policy)
+			, each.stats.dropped, each.stats.blocked, each.stats.overflowed);
+	}
+	Log("", "%-24s %-12s %10llu %10llu %10llu", "total", "", total.dropped, total.blocked, total.overflowed);
+	int consoleDropped = 0;
+	{
+		std::scoped_lock _(g_logSystem->m_sinksLock);
+		if (g_logSystem->m_consoleSink) {
+			consoleDropped = g_logSystem->m_consoleSink->GetNumDropped();
+		}
+	}
+	Log("", "console sink dropped %d lines", consoleDropped);
+}
+
+////////////////////////////////
+// /param isImmediate what the queue holds, LogItem or LogDeferredItem
+static LogChannel _GetRecordChannel(const void* record, bool isImmediate)
+{
+	return isImmediate ? ((const LogItem*)record)->channel : ((const LogDeferredItem*)record)->channel;
+}
+
+////////////////////////////////
+// Room for an item of that channel, following its policy when the queue is full.
+// /return where the item goes, null when the message is dropped
+// /param out_queue, out_record what to FinalizePush, the item sits behind a header in the overflow buffer
+static void* _LogReserve(AsyncCircularQueue* queue, std::mutex& consumerLock, bool isImmediate, LogChannel channel, size_t size
+	, AsyncCircularQueue** out_queue, void** out_record)
+{
+	void* record = queue->ReserveForPush(size);
+	if (!record) {
+		switch (LogGetChannelPolicy(channel)) {
+		case LOG_OVERFLOW_BLOCK:
+			++_channelBlocked[channel.id];
+			record = queue->BlockedReserveForPush(size);
+			break;
+		case LOG_OVERFLOW_DROP_OLDEST:
+			if (consumerLock.try_lock()) {
+				while (!record) {
+					size_t oldestSize = 0;
+					void* oldest = queue->ReserveForPop(&oldestSize);
+					// empty, or the oldest is still being written
+					if (!oldest) {
+						break;
+					}
+					++_channelDropped[_GetRecordChannel(oldest, isImmediate).id];
+					queue->FinalizePop(oldest);
+					record = queue->ReserveForPush(size);
+				}
+				consumerLock.unlock();
+			}
+			break;
+		case LOG_OVERFLOW_SECONDARY: {
+			AsyncCircularQueue* overflow = g_logSystem->m_overflow;
+			const size_t overflowSize = sizeof(_LogOverflowHeader) + size;
+			if (overflowSize <= overflow->GetMaxRecordSize()) {
+				_LogOverflowHeader* header = (_LogOverflowHeader*)overflow->ReserveForPush(overflowSize);
+				if (header) {
+					header->kind = isImmediate ? LOG_OVERFLOW_ITEM_IMMEDIATE : LOG_OVERFLOW_ITEM_DEFERRED;
+					header->size = (uint32_t)size;
+					++_channelOverflowed[channel.id];
+					*out_queue = overflow;
+					*out_record = header;
+					return header + 1;
+				}
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	if (!record) {
+		++_channelDropped[channel.id];
+		return nullptr;
+	}
+	*out_queue = queue;
+	*out_record = record;
+	return record;
+}
+
+////////////////////////////////
+void _LogImmediate(LogChannel channel, const char* fmt, ...)
+{
+	static constexpr size_t headerSize = sizeof(LogItem);
+	const char* filter = LogGetChannelName(channel);
+
 	LogItem* newLogItem = nullptr;
 	newLogItem = new LogItem();
 	newLogItem->hpc = GetCurrentHPC();
 	newLogItem->filter = filter;
+	newLogItem->channel = channel;
 	char msg[LOG_MAX_MESSAGE_LENGTH];
 	va_list vl;
 	va_start(vl, fmt);
 	vsnprintf_s(msg, LOG_MAX_MESSAGE_LENGTH, fmt, vl);
 	va_end(vl);
 	msg[LOG_MAX_MESSAGE_LENGTH - 1] = 0;
-	std::string msgString;
-	if (strlen(filter) == 0) {
-		msgString = msg;
-	} else {
-		msgString = Stringf("[%s]%s", filter, msg);
-	}
 	/*if (IsDebuggerAvailable()) {
 		OutputDebugStringA(msgString.c_str());
 	}*/
-	if (g_logSystem->IsRunning() && g_theConsole)
+	// the console sink picks it up on the log thread
+	newLogItem->messageSize = std::min(strlen(msg), g_logSystem->m_messages->GetMaxRecordSize() - headerSize);
+	size_t msgSize = headerSize + newLogItem->messageSize;
+	AsyncCircularQueue* queue = nullptr;
+	void* record = nullptr;
+	void* buf = _LogReserve(g_logSystem->m_messages, g_logSystem->m_messagesConsumerLock, true, channel, msgSize, &queue, &record);
+	if (buf) {
+		memcpy_s(buf, msgSize, newLogItem, headerSize);
+		((LogItem*)buf)->message = (char*)buf + headerSize;
+		memcpy_s((char*)buf + headerSize, msgSize - headerSize, msg, newLogItem->messageSize);
+		queue->FinalizePush(record);
+		g_logSystem->SignalWork();
+	}
+	delete newLogItem;
+}
+
+////////////////////////////////
+bool _LogBeginDeferred(LogChannel channel, size_t argBytes, LogDeferredItem** out_item)
+{
+	_LogThreadBuffer* buffer = _threadBuffer.m_buffer;
+	if (!buffer) {
+		std::scoped_lock _(g_logSystem->m_threadBuffersLock);
+		buffer = new _LogThreadBuffer(g_logSystem->m_threadBufferSize, g_logSystem->m_nextThreadId++);
+		g_logSystem->m_threadBuffers.push_back(buffer);
+		_threadBuffer.m_buffer = buffer;
+	}
+	const size_t size = sizeof(LogDeferredItem) + argBytes;
+	if (size > buffer->m_ring.GetMaxRecordSize()) {
+		return false;
+	}
+	LogDeferredItem* item = (LogDeferredItem*)_LogReserve(&buffer->m_ring, buffer->m_consumerLock, false, channel, size
+		, &_threadBuffer.m_pendingQueue, &_threadBuffer.m_pendingRecord);
+	if (item) {
+		item->hpc = GetCurrentHPC();
+		item->threadId = buffer->m_threadId;
+		item->argBytes = (uint32_t)argBytes;
+		item->channel = channel;
+	}
+	*out_item = item;
+	return true;
+}
+
+////////////////////////////////
+// the record starts before the item when it went to the overflow buffer
+void _LogEndDeferred(LogDeferredItem*)
+{
+	_threadBuffer.m_pendingQueue->FinalizePush(_threadBuffer.m_pendingRecord);
+	g_logSystem->SignalWork();
+}
+
+////////////////////////////////
+void LogSetMode(LogMode mode)
+{
+	g_logSystem->m_mode = mode;
+}
+
+////////////////////////////////
+LogMode LogGetMode()
+{
+	return g_logSystem->m_mode;
+}
+
+////////////////////////////////
+void LogSetBinaryFile(const std::string& filename)
+{
 	{
-		g_theConsole->Print(msgString);
+		std::scoped_lock _(g_logSystem->m_binaryLock);
+		g_logSystem->m_binaryFilename = filename;
 	}
-	newLogItem->messageSize = msgString.size();
-	size_t msgSize = headerSize + newLogItem->messageSize;
-	void* buf = g_logSystem->m_messages->BlockedReserveForPush(msgSize);
-	memcpy_s(buf, msgSize, newLogItem, headerSize);
-	((LogItem*)buf)->message = (char*)buf + headerSize;
-	memcpy_s((char*)buf + headerSize, msgSize - headerSize, msgString.c_str(), newLogItem->messageSize);
-	g_logSystem->m_messages->FinalizePush(buf);
+	g_logSystem->m_binaryChanged = true;
+	g_logSystem->m_wakeRequested = true;
 	g_logSystem->SignalWork();
-	delete newLogItem;
+}
+
+////////////////////////////////
+bool LogDecodeBinaryFile(const std::string& binaryFilename, const std::string& textFilename)
+{
+	FILE* in = nullptr;
+	fopen_s(&in, binaryFilename.c_str(), "rb");
+	if (!in) {
+		return false;
+	}
+	char magic[sizeof(LOG_BINARY_MAGIC)];
+	if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) != 0) {
+		fclose(in);
+		return false;
+	}
+	FILE* out = nullptr;
+	fopen_s(&out, textFilename.c_str(), "wb");
+	if (!out) {
+		fclose(in);
+		return false;
+	}
+
+	std::vector<std::string> strings;
+	std::vector<unsigned char> args;
+	bool ok = true;
+	unsigned char kind = 0;
+	while (ok && fread(&kind, 1, 1, in) == 1) {
+		if (kind == LOG_BINARY_STRING) {
+			uint32_t id = 0;
+			uint32_t length = 0;
+			ok = fread(&id, sizeof(id), 1, in) == 1 && fread(&length, sizeof(length), 1, in) == 1;
+			if (ok) {
+				if (strings.size() <= id) {
+					strings.resize(id + 1);
+				}
+				strings[id].resize(length);
+				ok = length == 0 || fread(strings[id].data(), 1, length, in) == length;
+			}
+		} else if (kind == LOG_BINARY_MESSAGE) {
+			LogDeferredItem item;
+			uint32_t filterId = 0;
+			uint32_t formatId = 0;
+			ok = fread(&item.hpc, sizeof(item.hpc), 1, in) == 1
+				&& fread(&item.threadId, sizeof(item.threadId), 1, in) == 1
+				&& fread(&filterId, sizeof(filterId), 1, in) == 1
+				&& fread(&formatId, sizeof(formatId), 1, in) == 1
+				&& fread(&item.argBytes, sizeof(item.argBytes), 1, in) == 1
+				&& filterId < strings.size() && formatId < strings.size();
+			if (ok) {
+				args.resize(item.argBytes);
+				ok = item.argBytes == 0 || fread(args.data(), 1, item.argBytes, in) == item.argBytes;
+			}
+			if (ok) {
+				const std::string message = LogFormatArgs(strings[formatId].c_str(), args.data(), args.size());
+				if (!strings[filterId].empty()) {
+					fprintf(out, "[%s]", strings[filterId].c_str());
+				}
+				fwrite(message.c_str(), 1, message.size(), out);
+				fwrite("\n", 1, 1, out);
+			}
+		} else {
+			ok = false;
+		}
+	}
+	fclose(out);
+	fclose(in);
+	return ok;
 }
 
 ////////////////////////////////
 void LogFilterEnableAll()
 {
-	g_logSystem->m_unfiltered = true;
+	std::scoped_lock _(_channelLock);
+	_unfiltered = true;
+	_RebuildChannelMask();
 }
 
 ////////////////////////////////
 void LogFilterDisableAll()
 {
-	g_logSystem->m_unfiltered = false;
+	std::scoped_lock _(_channelLock);
+	_unfiltered = false;
+	_RebuildChannelMask();
 }
 
 ////////////////////////////////
 void LogFilterEnable(const std::string& filter)
 {
-	std::scoped_lock<std::shared_mutex> _(_mapLock);
-	g_logSystem->m_filters.insert(filter);
+	std::scoped_lock _(_channelLock);
+	_channelListed[_RegisterChannel(filter.c_str()).id] = true;
+	_RebuildChannelMask();
 }
 
 ////////////////////////////////
 void LogFilterDisable(const std::string& filter)
 {
-	std::scoped_lock<std::shared_mutex> _(_mapLock);
-	g_logSystem->m_filters.erase(filter);
+	std::scoped_lock _(_channelLock);
+	_channelListed[_RegisterChannel(filter.c_str()).id] = false;
+	_RebuildChannelMask();
 }
 
 ////////////////////////////////
 void LogFlush()
 {
-	fflush(flog);
+	if (!g_logSystem->IsRunning()) {
+		return;
+	}
+	const uint64 request = ++g_logSystem->m_flushRequested;
+	g_logSystem->m_wakeRequested = true;
+	{
+		std::scoped_lock _(g_logSystem->m_wakeLock);
+	}
+	g_logSystem->m_wakeCV.notify_one();
+	std::unique_lock lk(g_logSystem->m_wakeLock);
+	g_logSystem->m_flushCV.wait(lk, [request]() { return g_logSystem->m_flushDone.load() >= request || !g_logSystem->IsRunning(); });
+}
+
+////////////////////////////////
+void LogAddSink(LogSink* sink)
+{
+	std::scoped_lock _(g_logSystem->m_sinksLock);
+	g_logSystem->m_sinks.push_back(sink);
+}
+
+////////////////////////////////
+void LogRemoveSink(LogSink* sink)
+{
+	std::scoped_lock _(g_logSystem->m_sinksLock);
+	auto& sinks = g_logSystem->m_sinks;
+	sinks.erase(std::remove(sinks.begin(), sinks.end(), sink), sinks.end());
+	if (sink == g_logSystem->m_consoleSink) {
+		g_logSystem->m_consoleSink = nullptr;
+	}
+	if (sink == g_logSystem->m_historySink) {
+		g_logSystem->m_historySink = nullptr;
+	}
+}
+
+////////////////////////////////
+LogSink* LogFindSink(const char* name)
+{
+	std::scoped_lock _(g_logSystem->m_sinksLock);
+	for (LogSink* each : g_logSystem->m_sinks) {
+		if (strcmp(each->GetName(), name) == 0) {
+			return each;
+		}
+	}
+	return nullptr;
+}
+
+////////////////////////////////
+void LogDrainConsole()
+{
+	// the sink has its own lock, the log thread keeps dispatching while the console prints
+	LogConsoleSink* console = nullptr;
+	{
+		std::scoped_lock _(g_logSystem->m_sinksLock);
+		console = g_logSystem->m_consoleSink;
+	}
+	if (console) {
+		console->DrainToConsole();
+	}
+}
+
+////////////////////////////////
+std::vector<LogHistoryLine> LogGetHistory(uint64 beginHPC, uint64 endHPC)
+{
+	LogFlush();
+	std::scoped_lock _(g_logSystem->m_sinksLock);
+	if (!g_logSystem->m_historySink) {
+		return {};
+	}
+	return g_logSystem->m_historySink->GetLines(beginHPC, endHPC);
+}
+
+////////////////////////////////
+// CanPop looks at the record header, which a drop oldest producer may be clearing
+static bool _CanPop(AsyncCircularQueue& queue, std::mutex& consumerLock)
+{
+	std::unique_lock lk(consumerLock, std::try_to_lock);
+	return !lk || queue.CanPop();
+}
+
+////////////////////////////////
+bool LogSystem::HasWork()
+{
+	if (m_wakeRequested.exchange(false) || m_overflow->CanPop() || m_flushRequested.load() != m_flushDone.load()
+		|| _CanPop(*m_messages, m_messagesConsumerLock)) {
+		return true;
+	}
+	std::scoped_lock _(m_threadBuffersLock);
+	for (_LogThreadBuffer* each : m_threadBuffers) {
+		if (each->m_orphaned || _CanPop(each->m_ring, each->m_consumerLock)) {
+			return true;
+		}
+	}
+	return false;
 }
 
 ////////////////////////////////
 void LogSystem::WaitForWork()
 {
-	m_signal->BlockedAcquire();
+	if (HasWork()) {
+		return;
+	}
+	m_sleeping = true;
+	// pairs with the fence in SignalWork: either we see the message or the producer sees us sleeping
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	{
+		std::unique_lock lk(m_wakeLock);
+		// sinks get their Update even when nothing is logged
+		m_wakeCV.wait_for(lk, std::chrono::milliseconds(LOG_SINK_UPDATE_MS), [this]() { return HasWork(); });
+	}
+	m_sleeping = false;
 }
 
 ////////////////////////////////
 void LogSystem::SignalWork()
 {
-	m_signal->Release();
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_sleeping.load(std::memory_order_relaxed)) {
+		{
+			std::scoped_lock _(m_wakeLock);
+		}
+		m_wakeCV.notify_one();
+	}
 }
 
 ////////////////////////////////
@@ -188,5 +1053,9 @@ bool LogSystem::IsRunning() const
 ////////////////////////////////
 void LogSystem::Shutdown()
 {
-	m_running = false;
-}
+	{
+		std::scoped_lock _(m_wakeLock);
+		m_running = false;
+	}
+	m_flushCV.notify_all();
+}
\ No newline at end of file
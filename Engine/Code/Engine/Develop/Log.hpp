@@ -1,18 +1,46 @@
 #pragma once
 #include "Engine/Core/EngineCommon.hpp"
-#include "Engine/Core/Semaphore.hpp"
 //#include "Engine/Core/AsyncQueue.hpp"
 #include "Engine/Core/AsyncCircularQueue.hpp"
 #include "Engine/Core/Time.hpp"
+#include "Engine/Develop/LogArgs.hpp"
 #include <thread>
-#include <set>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <utility>
 
 class Callstack;
+class LogSink;
+class LogConsoleSink;
+class LogHistorySink;
 inline constexpr int LOG_MAX_MESSAGE_LENGTH = 2048;
+// a message record is at most half of it
+inline constexpr size_t LOG_BUFFER_SIZE = 64 * 1024;
+// every thread logging in deferred mode gets one of these
+inline constexpr size_t LOG_THREAD_BUFFER_SIZE = 64 * 1024;
+// shared by every channel with LOG_OVERFLOW_SECONDARY
+inline constexpr size_t LOG_OVERFLOW_BUFFER_SIZE = 256 * 1024;
+inline constexpr int LOG_MAX_CHANNELS = 1024;
+
+// Interned filter. The id indexes the enabled bitmask, the name lives as long as the program.
+struct LogChannel
+{
+	uint16_t id = 0;
+};
+// bit per channel: enabled when everything is unfiltered or the channel's filter is on
+extern std::atomic<uint64_t> g_logChannelMask[LOG_MAX_CHANNELS / 64];
+
+// Caches the channel id at the call site, a disabled channel costs one atomic load:
+//	Log(LOG_CHANNEL("Physics"), "%d contacts", count);
+#define LOG_CHANNEL(name) ([]() { static const LogChannel _logChannel = LogRegisterChannel(name); return _logChannel; }())
+
 struct LogItem
 {
 	uint64 hpc = 0;
 	const char* filter = nullptr;
+	LogChannel channel;
 	Callstack* callstack = nullptr;
 	size_t messageSize = 0;
 	char* message = nullptr; //
@@ -21,6 +49,77 @@ struct LogItem
 	size_t GetSize() const;
 };
 
+// Deferred mode record, followed by argBytes of LogArgs encoded arguments.
+// The format is a LogFormat, so it outlives the log thread.
+struct LogDeferredItem
+{
+	uint64 hpc = 0;
+	const char* format = nullptr;
+	uint32_t threadId = 0;
+	uint32_t argBytes = 0;
+	LogChannel channel;
+};
+
+// What a channel does when its buffer is full
+enum LogOverflowPolicy
+{
+	// wait for the log thread to make room
+	LOG_OVERFLOW_BLOCK,
+	// lose the message being logged
+	LOG_OVERFLOW_DROP_NEWEST,
+	// throw away the oldest messages still in the buffer. When the log thread is
+	// draining that buffer at the moment the newest is dropped instead.
+	LOG_OVERFLOW_DROP_OLDEST,
+	// spill into the shared overflow buffer, drop when that is full too
+	LOG_OVERFLOW_SECONDARY,
+	NUM_LOG_OVERFLOW_POLICIES
+};
+
+struct LogConfig
+{
+	size_t bufferSize = LOG_BUFFER_SIZE;
+	size_t threadBufferSize = LOG_THREAD_BUFFER_SIZE;
+	size_t overflowBufferSize = LOG_OVERFLOW_BUFFER_SIZE;
+	LogOverflowPolicy defaultPolicy = LOG_OVERFLOW_BLOCK;
+	// rather lose debug output than hitch a frame
+	std::vector<std::pair<std::string, LogOverflowPolicy>> channelPolicies = { { "debug", LOG_OVERFLOW_DROP_NEWEST } };
+};
+
+// Messages a channel lost or waited for since LogStart
+struct LogChannelStats
+{
+	uint64 dropped = 0;
+	uint64 blocked = 0;
+	uint64 overflowed = 0;
+};
+
+// A line as the history sink remembers it
+struct LogHistoryLine
+{
+	uint64 hpc = 0;
+	std::string text;
+};
+
+enum LogMode
+{
+	// format on the calling thread and print to the console right away
+	LOG_MODE_IMMEDIATE,
+	// only capture the format and the arguments, the log thread formats
+	LOG_MODE_DEFERRED,
+};
+
+struct _LogThreadBuffer
+{
+	_LogThreadBuffer(size_t size, uint32_t threadId) : m_ring(size), m_threadId(threadId) {}
+
+	AsyncCircularQueue m_ring;
+	// held by whoever pops: the log thread, or the owner making room for a drop oldest channel
+	std::mutex m_consumerLock;
+	uint32_t m_threadId = 0;
+	// set when the thread exits, the log thread frees it once drained
+	std::atomic<bool> m_orphaned = false;
+};
+
 struct LogSystem
 {
 public:
@@ -28,24 +127,181 @@ public:
 	void SignalWork();
 	bool IsRunning() const;
 	void Shutdown();
+	bool HasWork();
 
 	std::thread m_logThread;
 	std::string m_filename;
-	Semaphore* m_signal = nullptr;
 	//AsyncQueue<LogItem*> m_messages;
 	AsyncCircularQueue* m_messages;
-	bool m_running = true;
-	std::set<std::string> m_filters;
-	bool m_unfiltered = true;
+	std::mutex m_messagesConsumerLock;
+	// records start with a _LogOverflowHeader telling which kind of item follows
+	AsyncCircularQueue* m_overflow;
+	size_t m_threadBufferSize = LOG_THREAD_BUFFER_SIZE;
+	std::atomic<bool> m_running = true;
+	std::atomic<LogMode> m_mode = LOG_MODE_IMMEDIATE;
+
+	std::mutex m_threadBuffersLock;
+	std::vector<_LogThreadBuffer*> m_threadBuffers;
+	uint32_t m_nextThreadId = 1;
+
+	std::mutex m_binaryLock;
+	std::string m_binaryFilename;
+	std::atomic<bool> m_binaryChanged = false;
+
+	// sinks are only used by the log thread while it holds the lock
+	std::mutex m_sinksLock;
+	std::vector<LogSink*> m_sinks;
+	LogConsoleSink* m_consoleSink = nullptr;
+	LogHistorySink* m_historySink = nullptr;
+	std::atomic<uint64> m_flushRequested = 0;
+	std::atomic<uint64> m_flushDone = 0;
+
+	std::mutex m_wakeLock;
+	// only the log thread waits here
+	std::condition_variable m_wakeCV;
+	// LogFlush callers wait here for m_flushDone
+	std::condition_variable m_flushCV;
+	std::atomic<bool> m_sleeping = false;
+	std::atomic<bool> m_wakeRequested = false;
+};
+extern LogSystem* g_logSystem;
+
+// Format of a Log() call. Only a constant expression converts: a string literal, or another array
+// with static storage, so deferred mode can keep the address for the log thread.
+// A local buffer does not compile, wrap formats only known at runtime in LogRuntimeFormat.
+struct LogFormat
+{
+	template<size_t N>
+	consteval LogFormat(const char (&literal)[N]) : text(literal) {}
+	const char* text;
+};
+
+// A format only known at runtime, formatted right away whatever the mode
+struct LogRuntimeFormat
+{
+	explicit LogRuntimeFormat(const char* format) : text(format) {}
+	const char* text;
 };
 
-void LogStart(const std::string& filename);
+void LogStart(const std::string& filename, const LogConfig& config = LogConfig());
 void LogStop();
-void Log(const char* filter, const char* fmt, ...);
+
+/// Goes through the deferred path when it is on
+template<typename Filter, typename... Args>
+void Log(const Filter& filter, LogFormat format, const Args&... args);
+/// Always formatted on the calling thread
+template<typename Filter, typename... Args>
+void Log(const Filter& filter, LogRuntimeFormat format, const Args&... args);
 //void LogWithCallstack(const char* filter, const char* fmt, ...);
 
+/// Same name, same channel. Dies past LOG_MAX_CHANNELS.
+LogChannel LogRegisterChannel(const char* name);
+/// False when nothing registered the name yet
+bool LogFindChannel(const char* name, LogChannel* out_channel);
+const char* LogGetChannelName(LogChannel channel);
+inline bool LogIsChannelEnabled(LogChannel channel)
+{
+	return (g_logChannelMask[channel.id >> 6].load(std::memory_order_relaxed) >> (channel.id & 63)) & 1;
+}
+/// Logs every channel and whether it is on
+void LogListChannels();
+
+void LogSetChannelPolicy(LogChannel channel, LogOverflowPolicy policy);
+LogOverflowPolicy LogGetChannelPolicy(LogChannel channel);
+const char* LogGetOverflowPolicyName(LogOverflowPolicy policy);
+/// "block", "drop_newest", "drop_oldest" or "secondary"
+bool LogParseOverflowPolicy(const std::string& name, LogOverflowPolicy* out_policy);
+LogChannelStats LogGetChannelStats(LogChannel channel);
+/// Logs the policy and the counters of every channel that dropped or waited
+void LogReportStats();
+
+void LogSetMode(LogMode mode);
+LogMode LogGetMode();
+/// Deferred messages go to this file as binary records instead of the text log, empty turns it off
+void LogSetBinaryFile(const std::string& filename);
+/// Turns a binary log back into the text the text log would have had
+bool LogDecodeBinaryFile(const std::string& binaryFilename, const std::string& textFilename);
+
 void LogFilterEnableAll();
 void LogFilterDisableAll();
 void LogFilterEnable(const std::string& filter);
 void LogFilterDisable(const std::string& filter);
-void LogFlush();
\ No newline at end of file
+/// Writes out what every sink is holding, returns once it is on disk
+void LogFlush();
+
+/// The log system owns the sink from now on
+void LogAddSink(LogSink* sink);
+/// Hands ownership back to the caller
+void LogRemoveSink(LogSink* sink);
+/// Default sinks are "file", "console", "stderr" and "history"
+LogSink* LogFindSink(const char* name);
+/// Main thread, prints what the console sink collected since last time
+void LogDrainConsole();
+/// Flushes, then gives the lines logged from beginHPC to endHPC that the history sink still remembers
+std::vector<LogHistoryLine> LogGetHistory(uint64 beginHPC, uint64 endHPC);
+
+// Used by Log()
+/// Channel of a filter name, cached by address. Past LOG_MAX_CHANNELS new names go to the unnamed channel.
+LogChannel _LogNamedChannel(const char* name);
+void _LogImmediate(LogChannel channel, const char* fmt, ...);
+/// False when the record does not fit a thread buffer, out_item is null when it was dropped
+bool _LogBeginDeferred(LogChannel channel, size_t argBytes, LogDeferredItem** out_item);
+void _LogEndDeferred(LogDeferredItem* item);
+
+////////////////////////////////
+template<typename T>
+decltype(auto) _LogVarArg(const T& arg)
+{
+	if constexpr (std::is_same_v<T, std::string>) {
+		return arg.c_str();
+	} else {
+		return arg;
+	}
+}
+
+////////////////////////////////
+template<typename Filter>
+LogChannel _LogFilterChannel(const Filter& filter)
+{
+	if constexpr (std::is_same_v<Filter, LogChannel>) {
+		return filter;
+	} else {
+		return _LogNamedChannel(filter);
+	}
+}
+
+////////////////////////////////
+template<typename Filter, typename... Args>
+void Log(const Filter& filter, LogFormat format, const Args&... args)
+{
+	const LogChannel channel = _LogFilterChannel(filter);
+	if (!LogIsChannelEnabled(channel)) {
+		return;
+	}
+
+	if (g_logSystem->m_mode.load(std::memory_order_relaxed) == LOG_MODE_DEFERRED) {
+		const size_t argBytes = (size_t(0) + ... + LogArgSize(args));
+		LogDeferredItem* item = nullptr;
+		if (_LogBeginDeferred(channel, argBytes, &item)) {
+			if (item) {
+				item->format = format.text;
+				unsigned char* cursor = (unsigned char*)(item + 1);
+				((cursor = LogWriteArg(cursor, args)), ...);
+				_LogEndDeferred(item);
+			}
+			return;
+		}
+		// too big for a thread buffer record
+	}
+	_LogImmediate(channel, format.text, _LogVarArg(args)...);
+}
+
+////////////////////////////////
+template<typename Filter, typename... Args>
+void Log(const Filter& filter, LogRuntimeFormat format, const Args&... args)
+{
+	const LogChannel channel = _LogFilterChannel(filter);
+	if (LogIsChannelEnabled(channel)) {
+		_LogImmediate(channel, format.text, _LogVarArg(args)...);
+	}
+}
\ No newline at end of file
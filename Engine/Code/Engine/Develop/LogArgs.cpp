@@ -0,0 +1,217 @@
+#include "Engine/Develop/LogArgs.hpp"
+#include <cstdio>
+
+namespace {
+
+struct _LogArg
+{
+	LogArgTag tag = LOG_ARG_INT;
+	int64_t i = 0;
+	uint64_t u = 0;
+	double d = 0.0;
+	const char* str = nullptr;
+	uint32_t length = 0;
+	// bytes printf would have been passed for an integer
+	uint32_t width = sizeof(uint64_t);
+
+	int64_t AsInt() const
+	{
+		switch (tag) {
+		case LOG_ARG_UINT: case LOG_ARG_POINTER: return (int64_t)u;
+		case LOG_ARG_DOUBLE: return (int64_t)d;
+		case LOG_ARG_STRING: return 0;
+		default: return i;
+		}
+	}
+
+	uint64_t AsUInt() const
+	{
+		return tag == LOG_ARG_INT ? (uint64_t)i : tag == LOG_ARG_DOUBLE ? (uint64_t)d : tag == LOG_ARG_STRING ? 0 : u;
+	}
+
+	double AsDouble() const
+	{
+		return tag == LOG_ARG_DOUBLE ? d : tag == LOG_ARG_INT ? (double)i : (double)u;
+	}
+};
+
+class _LogArgReader
+{
+public:
+	_LogArgReader(const unsigned char* args, size_t argBytes) : m_cursor(args), m_end(args + argBytes) {}
+
+	/// /return false once the arguments run out
+	bool Next(_LogArg* out)
+	{
+		if (m_cursor >= m_end) {
+			return false;
+		}
+		out->tag = (LogArgTag)*m_cursor++;
+		out->width = sizeof(uint64_t);
+		if (out->tag == LOG_ARG_INT32 || out->tag == LOG_ARG_UINT32) {
+			out->tag = out->tag == LOG_ARG_INT32 ? LOG_ARG_INT : LOG_ARG_UINT;
+			out->width = sizeof(int32_t);
+		}
+		if (out->tag == LOG_ARG_STRING) {
+			memcpy(&out->length, m_cursor, sizeof(out->length));
+			out->str = (const char*)m_cursor + sizeof(out->length);
+			m_cursor += sizeof(out->length) + out->length + 1;
+			return true;
+		}
+		switch (out->tag) {
+		case LOG_ARG_INT: memcpy(&out->i, m_cursor, sizeof(out->i)); break;
+		case LOG_ARG_DOUBLE: memcpy(&out->d, m_cursor, sizeof(out->d)); break;
+		default: memcpy(&out->u, m_cursor, sizeof(out->u)); break;
+		}
+		m_cursor += sizeof(uint64_t);
+		return true;
+	}
+
+private:
+	const unsigned char* m_cursor;
+	const unsigned char* m_end;
+};
+
+}
+
+////////////////////////////////
+std::string LogFormatArgs(const char* format, const unsigned char* args, size_t argBytes)
+{
+	std::string result;
+	_LogArgReader reader(args, argBytes);
+	char spec[64];
+	char piece[512];
+	const char* cursor = format;
+	while (*cursor) {
+		if (*cursor != '%') {
+			const char* next = strchr(cursor, '%');
+			if (!next) {
+				result.append(cursor);
+				break;
+			}
+			result.append(cursor, next - cursor);
+			cursor = next;
+			continue;
+		}
+		if (cursor[1] == '%') {
+			result.push_back('%');
+			cursor += 2;
+			continue;
+		}
+
+		// %[flags][width][.precision][length]conversion, rebuilt with our own length modifier
+		int specLength = 0;
+		spec[specLength++] = *cursor++;
+		auto copySpecChar = [&](char c) {
+			if (specLength < (int)sizeof(spec) - 4) {
+				spec[specLength++] = c;
+			}
+		};
+		auto copyStarArg = [&]() {
+			_LogArg star;
+			const int value = reader.Next(&star) ? (int)star.AsInt() : 0;
+			specLength += snprintf(spec + specLength, sizeof(spec) - 4 - specLength, "%d", value);
+		};
+		while (*cursor && strchr("-+ #0", *cursor)) {
+			copySpecChar(*cursor++);
+		}
+		if (*cursor == '*') {
+			copyStarArg();
+			++cursor;
+		}
+		while (*cursor >= '0' && *cursor <= '9') {
+			copySpecChar(*cursor++);
+		}
+		if (*cursor == '.') {
+			copySpecChar(*cursor++);
+			if (*cursor == '*') {
+				copyStarArg();
+				++cursor;
+			}
+			while (*cursor >= '0' && *cursor <= '9') {
+				copySpecChar(*cursor++);
+			}
+		}
+		int numH = 0;
+		while (*cursor && strchr("hlLqjztI", *cursor)) {
+			numH += *cursor == 'h';
+			if (*cursor == 'I' && ((cursor[1] == '6' && cursor[2] == '4') || (cursor[1] == '3' && cursor[2] == '2'))) {
+				cursor += 2;
+			}
+			++cursor;
+		}
+		const char conversion = *cursor;
+		if (!conversion) {
+			break;
+		}
+		++cursor;
+
+		_LogArg arg;
+		if (conversion != 'n' && !reader.Next(&arg)) {
+			result.append("<missing>");
+			continue;
+		}
+		spec[specLength] = 0;
+		switch (conversion) {
+		case 'd': case 'i': {
+			// cut like printf would, to the passed width and then to %h/%hh
+			int64_t value = arg.width == sizeof(int32_t) ? (int32_t)arg.AsInt() : arg.AsInt();
+			value = numH >= 2 ? (signed char)value : numH == 1 ? (short)value : value;
+			spec[specLength++] = 'l';
+			spec[specLength++] = 'l';
+			spec[specLength++] = 'd';
+			spec[specLength] = 0;
+			snprintf(piece, sizeof(piece), spec, (long long)value);
+			break;
+		}
+		case 'u': case 'o': case 'x': case 'X': {
+			uint64_t value = arg.width == sizeof(int32_t) ? (uint32_t)arg.AsUInt() : arg.AsUInt();
+			value = numH >= 2 ? (unsigned char)value : numH == 1 ? (unsigned short)value : value;
+			spec[specLength++] = 'l';
+			spec[specLength++] = 'l';
+			spec[specLength++] = conversion;
+			spec[specLength] = 0;
+			snprintf(piece, sizeof(piece), spec, (unsigned long long)value);
+			break;
+		}
+		case 'c':
+			spec[specLength++] = 'c';
+			spec[specLength] = 0;
+			snprintf(piece, sizeof(piece), spec, (int)arg.AsInt());
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			spec[specLength++] = conversion;
+			spec[specLength] = 0;
+			snprintf(piece, sizeof(piece), spec, arg.AsDouble());
+			break;
+		case 's':
+			if (arg.tag == LOG_ARG_POINTER && arg.u == 0) {
+				// what printf prints for a null string, width and precision still apply
+				arg.tag = LOG_ARG_STRING;
+				arg.str = "(null)";
+				arg.length = 6;
+			}
+			if (arg.tag != LOG_ARG_STRING) {
+				result.append("<not a string>");
+				continue;
+			}
+			if (specLength == 1) {
+				// plain %s, no need to go through snprintf and its buffer
+				result.append(arg.str, arg.length);
+				continue;
+			}
+			spec[specLength++] = 's';
+			spec[specLength] = 0;
+			snprintf(piece, sizeof(piece), spec, arg.str);
+			break;
+		case 'p':
+			snprintf(piece, sizeof(piece), "%p", (void*)(uintptr_t)arg.AsUInt());
+			break;
+		default:
+			// %n and unknown conversions print nothing
+			continue;
+		}
+		result.append(piece);
+	}
+	return result;
+}
\ No newline at end of file
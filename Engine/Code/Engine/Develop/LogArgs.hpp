@@ -0,0 +1,115 @@
+#pragma once
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+// Type tagged encoding of printf arguments, so a message can be formatted later on another thread.
+// Every argument is one tag byte followed by its payload, unaligned:
+//	integers, doubles and pointers take 8 bytes,
+//	strings take a 4 byte length, the characters and a terminating 0, a null string is a null pointer.
+// Integers that printf would pass as a 32 bit int keep that in their tag, so %x and %u print them at that width.
+enum LogArgTag : unsigned char
+{
+	LOG_ARG_INT = 0,
+	LOG_ARG_UINT,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_POINTER,
+	LOG_ARG_STRING,
+	LOG_ARG_INT32,
+	LOG_ARG_UINT32,
+};
+
+// longer string arguments are cut
+inline constexpr size_t LOG_MAX_STRING_ARG = 1024;
+
+/// Formats the encoded arguments with a printf format string.
+/// MSVC length modifiers (%I64u) are understood, a mismatched argument is converted rather than misread.
+std::string LogFormatArgs(const char* format, const unsigned char* args, size_t argBytes);
+
+////////////////////////////////
+template<typename T>
+constexpr LogArgTag _LogArgTagOf()
+{
+	using U = std::decay_t<T>;
+	if constexpr (std::is_same_v<U, std::string> || std::is_same_v<U, const char*> || std::is_same_v<U, char*>) {
+		return LOG_ARG_STRING;
+	} else if constexpr (std::is_floating_point_v<U>) {
+		return LOG_ARG_DOUBLE;
+	} else if constexpr (std::is_pointer_v<U> || std::is_null_pointer_v<U>) {
+		return LOG_ARG_POINTER;
+	} else if constexpr (std::is_enum_v<U> || (std::is_integral_v<U> && std::is_signed_v<U>) || std::is_same_v<U, bool>) {
+		return sizeof(U) <= sizeof(int32_t) ? LOG_ARG_INT32 : LOG_ARG_INT;
+	} else {
+		static_assert(std::is_integral_v<U>, "Log argument must be a number, a pointer or a string");
+		// narrower unsigned types promote to int
+		return sizeof(U) < sizeof(int32_t) ? LOG_ARG_INT32 : sizeof(U) == sizeof(int32_t) ? LOG_ARG_UINT32 : LOG_ARG_UINT;
+	}
+}
+
+////////////////////////////////
+inline size_t _LogStringArgLength(const char* str)
+{
+	if (!str) {
+		return 0;
+	}
+	const size_t length = strlen(str);
+	return length < LOG_MAX_STRING_ARG ? length : LOG_MAX_STRING_ARG;
+}
+
+////////////////////////////////
+inline const char* _LogStringArg(const char* str) { return str; }
+inline const char* _LogStringArg(const std::string& str) { return str.c_str(); }
+
+////////////////////////////////
+template<typename T>
+size_t LogArgSize(const T& arg)
+{
+	if constexpr (_LogArgTagOf<T>() == LOG_ARG_STRING) {
+		const char* str = _LogStringArg(arg);
+		return str ? 1 + sizeof(uint32_t) + _LogStringArgLength(str) + 1 : 1 + sizeof(uint64_t);
+	} else {
+		return 1 + sizeof(uint64_t);
+	}
+}
+
+////////////////////////////////
+/// /return the end of what was written
+template<typename T>
+unsigned char* LogWriteArg(unsigned char* cursor, const T& arg)
+{
+	constexpr LogArgTag tag = _LogArgTagOf<T>();
+	if constexpr (tag == LOG_ARG_STRING) {
+		const char* str = _LogStringArg(arg);
+		if (!str) {
+			*cursor++ = LOG_ARG_POINTER;
+			memset(cursor, 0, sizeof(uint64_t));
+			return cursor + sizeof(uint64_t);
+		}
+		*cursor++ = tag;
+		const uint32_t length = (uint32_t)_LogStringArgLength(str);
+		memcpy(cursor, &length, sizeof(length));
+		cursor += sizeof(length);
+		if (length > 0) {
+			memcpy(cursor, str, length);
+		}
+		cursor[length] = 0;
+		return cursor + length + 1;
+	} else {
+		*cursor++ = tag;
+		if constexpr (tag == LOG_ARG_DOUBLE) {
+			const double value = (double)arg;
+			memcpy(cursor, &value, sizeof(value));
+		} else if constexpr (tag == LOG_ARG_POINTER) {
+			const uint64_t value = (uint64_t)(uintptr_t)arg;
+			memcpy(cursor, &value, sizeof(value));
+		} else if constexpr (tag == LOG_ARG_INT || tag == LOG_ARG_INT32) {
+			const int64_t value = (int64_t)arg;
+			memcpy(cursor, &value, sizeof(value));
+		} else {
+			const uint64_t value = (uint64_t)arg;
+			memcpy(cursor, &value, sizeof(value));
+		}
+		return cursor + sizeof(uint64_t);
+	}
+}
\ No newline at end of file
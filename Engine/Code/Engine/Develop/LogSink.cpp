@@ -0,0 +1,211 @@
+#include "Engine/Develop/LogSink.hpp"
+#include "Engine/Develop/Log.hpp"
+#include "Engine/Develop/DevConsole.hpp"
+#include <vector>
+
+////////////////////////////////
+LogSink::LogSink(const char* name, bool allChannels)
+	: m_name(name)
+{
+	for (auto& each : m_channelMask) {
+		each = allChannels ? ~0ull : 0ull;
+	}
+}
+
+////////////////////////////////
+void LogSink::SetChannelEnabled(const LogChannel& channel, bool enabled)
+{
+	const uint64_t bit = 1ull << (channel.id & 63);
+	if (enabled) {
+		m_channelMask[channel.id >> 6].fetch_or(bit, std::memory_order_relaxed);
+	} else {
+		m_channelMask[channel.id >> 6].fetch_and(~bit, std::memory_order_relaxed);
+	}
+}
+
+////////////////////////////////
+void LogSink::SetAllChannelsEnabled(bool enabled)
+{
+	for (auto& each : m_channelMask) {
+		each.store(enabled ? ~0ull : 0ull, std::memory_order_relaxed);
+	}
+}
+
+////////////////////////////////
+void LogSink::AppendLine(std::string& out, const LogMessage& message)
+{
+	if (message.filter[0]) {
+		out.push_back('[');
+		out.append(message.filter);
+		out.push_back(']');
+	}
+	out.append(message.text, message.textSize);
+	out.push_back('\n');
+}
+
+////////////////////////////////
+LogFileSink::LogFileSink(const char* name, const std::string& filename, const LogFileSinkConfig& config)
+	: LogSink(name)
+	, m_config(config)
+{
+	fopen_s(&m_file, filename.c_str(), "wb");
+	if (m_file) {
+		// m_pending is the buffer, every write goes straight to the file
+		setvbuf(m_file, nullptr, _IONBF, 0);
+	}
+	m_flushChannel = config.flushChannel ? LogRegisterChannel(config.flushChannel).id : (uint16_t)0xffff;
+	m_pending.reserve(config.flushBytes + LOG_MAX_MESSAGE_LENGTH);
+}
+
+////////////////////////////////
+LogFileSink::~LogFileSink()
+{
+	if (m_file) {
+		Flush();
+		fclose(m_file);
+	}
+}
+
+////////////////////////////////
+void LogFileSink::Write(const LogMessage* messages, int count)
+{
+	if (!m_file) {
+		return;
+	}
+	bool flushNow = false;
+	for (int i = 0; i < count; ++i) {
+		if (!Accepts(messages[i])) {
+			continue;
+		}
+		if (m_pending.empty()) {
+			m_pendingSinceHPC = GetCurrentHPC();
+		}
+		AppendLine(m_pending, messages[i]);
+		flushNow = flushNow || messages[i].channel == m_flushChannel;
+	}
+	if (flushNow || m_pending.size() >= m_config.flushBytes) {
+		Flush();
+	}
+}
+
+////////////////////////////////
+void LogFileSink::Update()
+{
+	if (!m_pending.empty() && HPCToSeconds(GetCurrentHPC() - m_pendingSinceHPC) >= m_config.flushSeconds) {
+		Flush();
+	}
+}
+
+////////////////////////////////
+void LogFileSink::Flush()
+{
+	if (m_file && !m_pending.empty()) {
+		fwrite(m_pending.data(), 1, m_pending.size(), m_file);
+		m_pending.clear();
+	}
+}
+
+////////////////////////////////
+LogConsoleSink::LogConsoleSink(const char* name, size_t capacity)
+	: LogSink(name)
+	, m_capacity(capacity)
+{
+}
+
+////////////////////////////////
+void LogConsoleSink::Write(const LogMessage* messages, int count)
+{
+	std::scoped_lock _(m_lock);
+	for (int i = 0; i < count; ++i) {
+		if (!Accepts(messages[i])) {
+			continue;
+		}
+		if (m_lines.size() >= m_capacity) {
+			m_lines.pop_front();
+			++m_numDropped;
+		}
+		std::string& line = m_lines.emplace_back();
+		AppendLine(line, messages[i]);
+		line.pop_back();
+	}
+}
+
+////////////////////////////////
+void LogConsoleSink::DrainToConsole()
+{
+	std::deque<std::string> lines;
+	{
+		std::scoped_lock _(m_lock);
+		lines.swap(m_lines);
+	}
+	if (!g_theConsole) {
+		return;
+	}
+	for (auto& each : lines) {
+		g_theConsole->Print(std::move(each));
+	}
+}
+
+////////////////////////////////
+LogHistorySink::LogHistorySink(const char* name, size_t capacity)
+	: LogSink(name)
+	, m_capacity(capacity)
+{
+}
+
+////////////////////////////////
+void LogHistorySink::Write(const LogMessage* messages, int count)
+{
+	std::scoped_lock _(m_lock);
+	for (int i = 0; i < count; ++i) {
+		if (!Accepts(messages[i])) {
+			continue;
+		}
+		if (m_lines.size() >= m_capacity) {
+			m_lines.pop_front();
+		}
+		LogHistoryLine& line = m_lines.emplace_back();
+		line.hpc = messages[i].hpc;
+		AppendLine(line.text, messages[i]);
+		line.text.pop_back();
+	}
+}
+
+////////////////////////////////
+std::vector<LogHistoryLine> LogHistorySink::GetLines(uint64 beginHPC, uint64 endHPC)
+{
+	std::vector<LogHistoryLine> lines;
+	std::scoped_lock _(m_lock);
+	for (const LogHistoryLine& each : m_lines) {
+		if (each.hpc >= beginHPC && each.hpc <= endHPC) {
+			lines.push_back(each);
+		}
+	}
+	return lines;
+}
+
+////////////////////////////////
+LogStderrSink::LogStderrSink(const char* name)
+	: LogSink(name, false)
+{
+}
+
+////////////////////////////////
+void LogStderrSink::Write(const LogMessage* messages, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		if (Accepts(messages[i])) {
+			AppendLine(m_batch, messages[i]);
+		}
+	}
+	Flush();
+}
+
+////////////////////////////////
+void LogStderrSink::Flush()
+{
+	if (!m_batch.empty()) {
+		fwrite(m_batch.data(), 1, m_batch.size(), stderr);
+		m_batch.clear();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#pragma once
+#include "Engine/Develop/Log.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One formatted message as the log thread hands it to the sinks
+struct LogMessage
+{
+	uint64 hpc = 0;
+	const char* filter = "";
+	uint16_t channel = 0;
+	uint32_t threadId = 0;
+	// already written to the binary log
+	bool binaryLogged = false;
+	const char* text = nullptr;
+	size_t textSize = 0;
+};
+
+// Output of the log system. Write and Update run on the log thread only,
+// the channel filter can be changed from any thread.
+class LogSink
+{
+public:
+	explicit LogSink(const char* name, bool allChannels = true);
+	virtual ~LogSink() = default;
+
+	/// A batch of messages, in timestamp order. Skip the ones Accepts() refuses.
+	virtual void Write(const LogMessage* messages, int count) = 0;
+	/// Called every time the log thread wakes up, at least every LOG_SINK_UPDATE_MS
+	virtual void Update() {}
+	virtual void Flush() {}
+	/// Whether messages that already went to the binary log should come here too
+	virtual bool WantsBinaryLogged() const { return true; }
+
+	const char* GetName() const { return m_name.c_str(); }
+	bool Accepts(uint16_t channel) const { return (m_channelMask[channel >> 6].load(std::memory_order_relaxed) >> (channel & 63)) & 1; }
+	bool Accepts(const LogMessage& message) const { return Accepts(message.channel) && (!message.binaryLogged || WantsBinaryLogged()); }
+	void SetChannelEnabled(const LogChannel& channel, bool enabled);
+	void SetAllChannelsEnabled(bool enabled);
+
+protected:
+	static void AppendLine(std::string& out, const LogMessage& message);
+
+private:
+	std::string m_name;
+	std::atomic<uint64_t> m_channelMask[LOG_MAX_CHANNELS / 64];
+};
+
+inline constexpr int LOG_SINK_UPDATE_MS = 100;
+
+struct LogFileSinkConfig
+{
+	// write out once this much text is waiting
+	size_t flushBytes = 64 * 1024;
+	// or once the oldest waiting line is this old
+	double flushSeconds = 0.5;
+	// or right away after a message on this channel
+	const char* flushChannel = "Error";
+};
+
+// Text log file. Lines are gathered into one buffer and written with a single call.
+class LogFileSink : public LogSink
+{
+public:
+	LogFileSink(const char* name, const std::string& filename, const LogFileSinkConfig& config = LogFileSinkConfig());
+	~LogFileSink() override;
+
+	void Write(const LogMessage* messages, int count) override;
+	void Update() override;
+	void Flush() override;
+	// the binary log replaces the text log for deferred messages
+	bool WantsBinaryLogged() const override { return false; }
+
+	bool IsOpen() const { return m_file != nullptr; }
+
+private:
+	FILE* m_file = nullptr;
+	LogFileSinkConfig m_config;
+	uint16_t m_flushChannel = 0;
+	std::string m_pending;
+	uint64 m_pendingSinceHPC = 0;
+};
+
+// Keeps the latest lines for the dev console, the main thread drains them with DrainToConsole
+class LogConsoleSink : public LogSink
+{
+public:
+	LogConsoleSink(const char* name, size_t capacity = 4096);
+
+	void Write(const LogMessage* messages, int count) override;
+	/// Main thread
+	void DrainToConsole();
+	int GetNumDropped() const { return m_numDropped; }
+
+private:
+	std::mutex m_lock;
+	std::deque<std::string> m_lines;
+	size_t m_capacity = 0;
+	std::atomic<int> m_numDropped = 0;
+};
+
+// Remembers the latest lines with their time, for whoever wants the lines of a time window
+class LogHistorySink : public LogSink
+{
+public:
+	LogHistorySink(const char* name, size_t capacity = 4096);
+
+	void Write(const LogMessage* messages, int count) override;
+	/// Lines logged from beginHPC to endHPC that are still remembered, oldest first
+	std::vector<LogHistoryLine> GetLines(uint64 beginHPC, uint64 endHPC);
+
+private:
+	std::mutex m_lock;
+	std::deque<LogHistoryLine> m_lines;
+	size_t m_capacity = 0;
+};
+
+// stderr, off for every channel until enabled
+class LogStderrSink : public LogSink
+{
+public:
+	explicit LogStderrSink(const char* name);
+
+	void Write(const LogMessage* messages, int count) override;
+	void Flush() override;
+
+private:
+	std::string m_batch;
+};
\ No newline at end of file
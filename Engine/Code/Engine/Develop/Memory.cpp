@@ -1,37 +1,336 @@
 #include "Engine/Develop/Memory.hpp"
 #include "Engine/Develop/Log.hpp"
+#include "Engine/Develop/SmallObjectAllocator.hpp"
+#include "Engine/Core/Time.hpp"
 #include <mutex>
-#include <map>
 #include <algorithm>
+#include <type_traits>
+#include <cmath>
+#include <cstring>
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 #include <windows.h>
 #include <dbghelp.h>
+#include <psapi.h>
 #pragma comment(lib, "DbgHelp.lib")
+#pragma comment(lib, "Psapi.lib")
 
 std::atomic<size_t> g_allocationCounter = 0;
 std::atomic<size_t> g_allocatedSize = 0;
+
+// Live allocations are spread over stripes by address, each one an open addressing table
+// with its own lock. Everything the tracker owns comes from UntrackedAlloc.
+static constexpr int MEM_TRACKER_STRIPES = 64;
+static constexpr size_t MEM_TRACKER_STRIPE_CAPACITY = 1024;
+// Interned callstacks, found without a lock. Past the limit allocations are reported without a callstack.
+static constexpr size_t MEM_CALLSTACK_TABLE_SIZE = 1 << 17;
+static constexpr size_t MEM_CALLSTACK_CHUNK_SIZE = 256;
+static constexpr size_t MEM_MAX_CALLSTACKS = MEM_CALLSTACK_TABLE_SIZE / 2;
+
+#if !defined(MEM_TRACKING_SAMPLE_BYTES)
+#define MEM_TRACKING_SAMPLE_BYTES 0
+#endif
+static std::atomic<size_t> s_sampleBytes = MEM_TRACKING_SAMPLE_BYTES;
+// Poisson sampling state of this thread, bytes left until the next sampled allocation
+static thread_local int64_t t_bytesUntilSample = 0;
+static thread_local size_t t_sampleBytes = 0;
+static thread_local uint64_t t_sampleRandom = 0;
+
+// Tags are registered under the lock, the names come from UntrackedAlloc and are never freed
+struct alignas(64) _MemTagCounters
+{
+	std::atomic<int64_t> m_liveBytes = 0;
+	std::atomic<int64_t> m_liveCount = 0;
+	std::atomic<int64_t> m_highWaterBytes = 0;
+	std::atomic<uint64_t> m_totalAllocs = 0;
+	std::atomic<size_t> m_budgetBytes = 0;
+	// set by the allocation that went over, cleared by MemCheckTagBudgets
+	std::atomic<bool> m_overBudget = false;
+	// main thread only, so a tag staying over is warned about once
+	bool m_warned = false;
+};
+static std::mutex s_tagLock;
+static const char* s_tagNames[MEM_MAX_TAGS] = { "Untagged" };
+static std::atomic<int> s_numTags = 1;
+static _MemTagCounters s_tagCounters[MEM_MAX_TAGS];
+static thread_local uint8_t t_tagStack[MEM_TAG_STACK_DEPTH];
+static thread_local int t_tagDepth = 0;
+
+////////////////////////////////
+static size_t __HashKey(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ull;
+	key ^= key >> 33;
+	return (size_t)key;
+}
+
+// Linear probing with backward shift deletion, so there are no tombstones to clean up
+template<typename Value>
+class __UntrackedHashMap
+{
+	static_assert(std::is_trivially_copyable_v<Value>, "Slots are moved with plain copies");
+public:
+	struct Slot
+	{
+		uint64_t key;
+		Value value;
+		bool used;
+	};
+
+	~__UntrackedHashMap()
+	{
+		UntrackedFree(m_slots);
+	}
+
+	// /param capacity power of two
+	void Init(size_t capacity)
+	{
+		m_slots = (Slot*)UntrackedAlloc(capacity * sizeof(Slot));
+		memset((void*)m_slots, 0, capacity * sizeof(Slot));
+		m_mask = capacity - 1;
+		m_size = 0;
+	}
+
+	// /param out_inserted whether the key was not there yet
+	Value* Insert(uint64_t key, bool* out_inserted)
+	{
+		if ((m_size + 1) * 4 > (m_mask + 1) * 3) {
+			_Grow();
+		}
+		for (size_t i = __HashKey(key) & m_mask;; i = (i + 1) & m_mask) {
+			Slot& slot = m_slots[i];
+			if (!slot.used) {
+				slot.used = true;
+				slot.key = key;
+				++m_size;
+				*out_inserted = true;
+				return &slot.value;
+			}
+			if (slot.key == key) {
+				*out_inserted = false;
+				return &slot.value;
+			}
+		}
+	}
+
+	bool Erase(uint64_t key, Value* out_value)
+	{
+		size_t hole = __HashKey(key) & m_mask;
+		while (true) {
+			if (!m_slots[hole].used) {
+				return false;
+			}
+			if (m_slots[hole].key == key) {
+				break;
+			}
+			hole = (hole + 1) & m_mask;
+		}
+		*out_value = m_slots[hole].value;
+		// pull back every later entry of the cluster whose home is not between the hole and itself
+		for (size_t i = (hole + 1) & m_mask; m_slots[i].used; i = (i + 1) & m_mask) {
+			const size_t home = __HashKey(m_slots[i].key) & m_mask;
+			if (((i - home) & m_mask) >= ((i - hole) & m_mask)) {
+				m_slots[hole] = m_slots[i];
+				hole = i;
+			}
+		}
+		m_slots[hole].used = false;
+		--m_size;
+		return true;
+	}
+
+	template<typename Fn>
+	void ForEach(Fn&& fn) const
+	{
+		for (size_t i = 0; i <= m_mask; ++i) {
+			if (m_slots[i].used) {
+				fn(m_slots[i].key, m_slots[i].value);
+			}
+		}
+	}
+
+private:
+	void _Grow()
+	{
+		Slot* old = m_slots;
+		const size_t oldCapacity = m_mask + 1;
+		Init(oldCapacity * 2);
+		for (size_t i = 0; i < oldCapacity; ++i) {
+			if (old[i].used) {
+				bool inserted = false;
+				*Insert(old[i].key, &inserted) = old[i].value;
+			}
+		}
+		UntrackedFree(old);
+	}
+
+private:
+	Slot* m_slots = nullptr;
+	size_t m_mask = 0;
+	size_t m_size = 0;
+};
+
+////////////////////////////////
+// Exponentially distributed with mean sampleBytes, so allocated bytes hit samples as a Poisson process
+static int64_t __NextSampleInterval(size_t sampleBytes)
+{
+	if (t_sampleRandom == 0) {
+		t_sampleRandom = __HashKey((uint64_t)(uintptr_t)&t_sampleRandom ^ GetCurrentHPC()) | 1;
+	}
+	// xorshift64
+	t_sampleRandom ^= t_sampleRandom << 13;
+	t_sampleRandom ^= t_sampleRandom >> 7;
+	t_sampleRandom ^= t_sampleRandom << 17;
+	const double uniform = ((double)(t_sampleRandom >> 11) + 1.0) / 9007199254740993.0;
+	return (int64_t)(-std::log(uniform) * (double)sampleBytes) + 1;
+}
+
+////////////////////////////////
+// An allocation of size is sampled with probability 1 - exp(-size / sampleBytes)
+static bool __ShouldSample(size_t size, size_t sampleBytes)
+{
+	if (sampleBytes == 0) {
+		return true;
+	}
+	if (t_sampleBytes != sampleBytes) {
+		t_sampleBytes = sampleBytes;
+		t_bytesUntilSample = __NextSampleInterval(sampleBytes);
+	}
+	t_bytesUntilSample -= (int64_t)size;
+	if (t_bytesUntilSample > 0) {
+		return false;
+	}
+	t_bytesUntilSample = __NextSampleInterval(sampleBytes);
+	return true;
+}
+
+////////////////////////////////
+// How many allocations of that size one sample stands for
+static double __SampleWeight(size_t size, size_t sampleBytes)
+{
+	if (sampleBytes == 0) {
+		return 1.0;
+	}
+	return 1.0 / (1.0 - std::exp(-(double)size / (double)sampleBytes));
+}
+
+struct alignas(64) __TrackerStripe
+{
+	std::mutex m_lock;
+	__UntrackedHashMap<MemoryAllocationInfo> m_allocations;
+};
+
 struct __Tracker
 {
-	using __TrackerMap = std::map<
-		void*, MemoryAllocationInfo
-		, std::less<void*>
-		, UntrackedAllocator<std::pair<void* const, MemoryAllocationInfo>>
-	>;
-	static std::mutex& GetLock()
+	__Tracker()
 	{
-		static std::mutex _trackerLock;
-		return _trackerLock;
+		for (auto& each : m_stripes) {
+			each.m_allocations.Init(MEM_TRACKER_STRIPE_CAPACITY);
+		}
+		m_callstackSlots = (std::atomic<uint64_t>*)UntrackedAlloc(MEM_CALLSTACK_TABLE_SIZE * sizeof(std::atomic<uint64_t>));
+		for (size_t i = 0; i < MEM_CALLSTACK_TABLE_SIZE; ++i) {
+			new (&m_callstackSlots[i]) std::atomic<uint64_t>(0);
+		}
 	}
-	static __TrackerMap& GetMap()
+
+	__TrackerStripe& GetStripe(void* p)
 	{
-		static __TrackerMap _map;
-		return _map;
+		return m_stripes[__HashKey((uint64_t)(uintptr_t)p) >> 58];
 	}
+
+	// 64 bit hash of the frames, the hash CaptureStackBackTrace gives is only 32 bits
+	static uint64_t HashCallstack(const Callstack& callstack)
+	{
+		uint64_t hash = (uint64_t)callstack.m_depth;
+		for (int i = 0; i < callstack.m_depth; ++i) {
+			hash = __HashKey(hash ^ (uint64_t)(uintptr_t)callstack.m_trace[i]);
+		}
+		return hash;
+	}
+
+	// Whether the slot holds that callstack, the tag only rules most of them out
+	bool IsCallstackSlot(uint64_t slot, uint32_t tag, const Callstack& callstack) const
+	{
+		if ((uint32_t)(slot >> 32) != tag) {
+			return false;
+		}
+		const Callstack& interned = *GetCallstack((uint32_t)slot - 1);
+		return interned.m_depth == callstack.m_depth
+			&& memcmp(interned.m_trace, callstack.m_trace, callstack.m_depth * sizeof(void*)) == 0;
+	}
+
+	// Slots hold the high half of the callstack hash in the high half and id + 1 in the low half, zero is empty.
+	// The low half of the hash picks the slot. Slots and chunks are only written under m_callstackLock,
+	// and never change once published.
+	uint32_t InternCallstack(const Callstack& callstack)
+	{
+		const uint64_t hash = HashCallstack(callstack);
+		const uint32_t tag = (uint32_t)(hash >> 32);
+		const size_t mask = MEM_CALLSTACK_TABLE_SIZE - 1;
+		size_t i = (size_t)hash & mask;
+		for (;; i = (i + 1) & mask) {
+			const uint64_t slot = m_callstackSlots[i].load(std::memory_order_acquire);
+			if (slot == 0) {
+				break;
+			}
+			if (IsCallstackSlot(slot, tag, callstack)) {
+				return (uint32_t)slot - 1;
+			}
+		}
+
+		std::scoped_lock _(m_callstackLock);
+		// somebody may have added it, or something else, while we waited
+		for (;; i = (i + 1) & mask) {
+			const uint64_t slot = m_callstackSlots[i].load(std::memory_order_relaxed);
+			if (slot == 0) {
+				break;
+			}
+			if (IsCallstackSlot(slot, tag, callstack)) {
+				return (uint32_t)slot - 1;
+			}
+		}
+		if (m_numCallstacks >= MEM_MAX_CALLSTACKS) {
+			return MEM_CALLSTACK_NONE;
+		}
+		const uint32_t id = m_numCallstacks++;
+		Callstack*& chunk = m_callstackChunks[id / MEM_CALLSTACK_CHUNK_SIZE];
+		if (!chunk) {
+			chunk = (Callstack*)UntrackedAlloc(MEM_CALLSTACK_CHUNK_SIZE * sizeof(Callstack));
+		}
+		new (&chunk[id % MEM_CALLSTACK_CHUNK_SIZE]) Callstack(callstack);
+		m_callstackSlots[i].store(((uint64_t)tag << 32) | (id + 1), std::memory_order_release);
+		return id;
+	}
+
+	const Callstack* GetCallstack(uint32_t id) const
+	{
+		if (id == MEM_CALLSTACK_NONE) {
+			return nullptr;
+		}
+		return &m_callstackChunks[id / MEM_CALLSTACK_CHUNK_SIZE][id % MEM_CALLSTACK_CHUNK_SIZE];
+	}
+
+	static __Tracker& Get()
+	{
+		// never destroyed, frees keep coming in after static destructors ran
+		static __Tracker* instance = new (UntrackedAlloc(sizeof(__Tracker))) __Tracker();
+		return *instance;
+	}
+
+	__TrackerStripe m_stripes[MEM_TRACKER_STRIPES];
+
+	std::mutex m_callstackLock;
+	std::atomic<uint64_t>* m_callstackSlots = nullptr;
+	Callstack* m_callstackChunks[MEM_MAX_CALLSTACKS / MEM_CALLSTACK_CHUNK_SIZE] = {};
+	uint32_t m_numCallstacks = 0;
 };
 
 //////////////////////////////////////////////////////////////////////////
-void _NotifyAllocToProfiler(size_t bytes);
-void _NotifyFreeToProfiler(size_t bytes);
+void _NotifyAllocToProfiler(size_t bytes, MemTag tag);
+void _NotifyFreeToProfiler(size_t bytes, MemTag tag);
 //////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////
@@ -67,47 +366,103 @@ size_t GetLiveAllocationSize()
 {
 	return g_allocatedSize;
 }
-using UntrackedString = std::basic_string<char, std::char_traits<char>, UntrackedAllocator<char>>;
-void __print_grouped_details()
+////////////////////////////////
+void _MemCollectCallsites(MemCallsiteList* out_callsites, size_t* out_numUnsampled)
 {
-	struct _LogEntry {
-		size_t size;
-		int allocs;
-		UntrackedString str_callstack;
+	out_callsites->clear();
+	*out_numUnsampled = 0;
+#if (MEM_TRACKING >= MEM_TRACKING_VERBOSE)
+	struct _Totals
+	{
+		double bytes;
+		double count;
 	};
-	std::map<int, _LogEntry, std::less<int>, UntrackedAllocator<std::pair<const int, _LogEntry>>> logmap;
-	for (auto& each : __Tracker::GetMap()) {
-		if (logmap.find(each.second.m_callstack.m_hash) == logmap.end()) {
-			_LogEntry data = _LogEntry();
-			data.size = each.second.m_sizeByte;
-			data.allocs = 1;
-			auto cs = CallstackToString(each.second.m_callstack);
-			for (auto& eachFrame : cs) {
-				UntrackedString s = "\t";
-				s.append(eachFrame.c_str());
-				s.append("\n");
-				data.str_callstack.append(s.c_str());
+	// keyed by callstack id and tag, nothing in here allocates through the tracker
+	__UntrackedHashMap<_Totals> totals;
+	totals.Init(1024);
+	size_t numUnsampled = 0;
+	__Tracker& tracker = __Tracker::Get();
+	for (auto& stripe : tracker.m_stripes) {
+		std::scoped_lock _(stripe.m_lock);
+		stripe.m_allocations.ForEach([&totals, &numUnsampled](uint64_t, const MemoryAllocationInfo& info) {
+			if (info.m_callstackId == MEM_CALLSTACK_UNSAMPLED) {
+				++numUnsampled;
+				return;
+			}
+			const double weight = __SampleWeight(info.m_sizeByte, info.m_sampleBytes);
+			bool inserted = false;
+			_Totals* entry = totals.Insert(((uint64_t)info.m_callstackId << 8) | info.m_tag, &inserted);
+			if (inserted) {
+				*entry = _Totals{ 0.0, 0.0 };
 			}
-			logmap[each.second.m_callstack.m_hash] = data;
+			entry->bytes += weight * (double)info.m_sizeByte;
+			entry->count += weight;
+		});
+	}
+	totals.ForEach([out_callsites](uint64_t key, const _Totals& each) {
+		MemCallsite callsite;
+		callsite.callstackId = (uint32_t)(key >> 8);
+		callsite.tag.id = (uint8_t)key;
+		callsite.bytes = each.bytes;
+		callsite.count = each.count;
+		out_callsites->push_back(callsite);
+	});
+	*out_numUnsampled = numUnsampled;
+#endif
+}
+
+////////////////////////////////
+const Callstack* _MemGetCallstack(uint32_t callstackId)
+{
+#if (MEM_TRACKING >= MEM_TRACKING_VERBOSE)
+	return __Tracker::Get().GetCallstack(callstackId);
+#else
+	UNUSED(callstackId);
+	return nullptr;
+#endif
+}
+
+using UntrackedString = std::basic_string<char, std::char_traits<char>, UntrackedAllocator<char>>;
+void __print_grouped_details()
+{
+	MemCallsiteList callsites;
+	size_t numUnsampled = 0;
+	_MemCollectCallsites(&callsites, &numUnsampled);
+	if (numUnsampled > 0) {
+		DebuggerPrintf("(sampled: %d allocations without callstack, sizes below are estimates)\n", (int)numUnsampled);
+	}
+	// one entry per callstack whatever the tags
+	std::sort(callsites.begin(), callsites.end(), [](const MemCallsite& a, const MemCallsite& b) {
+		return a.callstackId < b.callstackId;
+	});
+	MemCallsiteList merged;
+	for (const MemCallsite& each : callsites) {
+		if (!merged.empty() && merged.back().callstackId == each.callstackId) {
+			merged.back().bytes += each.bytes;
+			merged.back().count += each.count;
 		} else {
-			logmap[each.second.m_callstack.m_hash].allocs += 1;
-			logmap[each.second.m_callstack.m_hash].size += each.second.m_sizeByte;
+			merged.push_back(each);
 		}
 	}
-	std::vector<std::pair<size_t, _LogEntry>, UntrackedAllocator<std::pair<size_t, _LogEntry>>> lk;
-	for (auto& each : logmap) {
-		lk.push_back(std::make_pair(each.second.size, each.second));
-	}
-	logmap.clear();
-
-	auto cmp = [=](const std::pair<size_t, _LogEntry>& a, const std::pair<size_t, _LogEntry>& b) -> bool {
-		return a.first > b.first;
-	};
-	std::sort(std::begin(lk), std::end(lk), cmp);
+	std::sort(merged.begin(), merged.end(), [](const MemCallsite& a, const MemCallsite& b) {
+		return a.bytes > b.bytes;
+	});
 
-	for (auto& each : lk) {
-		DebuggerPrintf(">>> %s from %d allocs <<<\n", GetByteSizeString(each.second.size).c_str(), each.second.allocs);
-		DebuggerPrintf("%s\n", each.second.str_callstack.c_str());
+	// symbols are resolved outside the stripe locks, that allocates
+	for (const MemCallsite& each : merged) {
+		DebuggerPrintf(">>> %s from %d allocs <<<\n", GetByteSizeString((ptrdiff_t)each.bytes).c_str(), (int)(each.count + 0.5));
+		const Callstack* callstack = _MemGetCallstack(each.callstackId);
+		if (!callstack) {
+			DebuggerPrintf("\t(callstack table full)\n\n");
+			continue;
+		}
+		UntrackedString text;
+		for (auto& eachFrame : CallstackToString(*callstack)) {
+			text.append("\t");
+			text.append(eachFrame.c_str());
+			text.append("\n");
+		}
+		DebuggerPrintf("%s\n", text.c_str());
 	}
 }
 
@@ -127,6 +482,18 @@ void LogLiveAllocations()
 #endif
 }
 
+////////////////////////////////
+void SetMemTrackingSampleBytes(size_t sampleBytes)
+{
+	s_sampleBytes = std::min(sampleBytes, (size_t)UINT32_MAX);
+}
+
+////////////////////////////////
+size_t GetMemTrackingSampleBytes()
+{
+	return s_sampleBytes;
+}
+
 ////////////////////////////////
 void* UntrackedAlloc(size_t size)
 {
@@ -146,15 +513,52 @@ BlockAllocator* GetBlockAllocator()
 	return instance;
 }
 
+////////////////////////////////
+// Where operator new and TrackedAlloc get their memory
+static void* _HeapAlloc(size_t size)
+{
+#if defined(MEM_SMALL_OBJECT_ALLOCATOR)
+	return GetSmallObjectAllocator()->ialloc(size);
+#else
+	return UntrackedAlloc(size);
+#endif
+}
+
+////////////////////////////////
+static void _HeapFree(void* p)
+{
+#if defined(MEM_SMALL_OBJECT_ALLOCATOR)
+	GetSmallObjectAllocator()->ifree(p);
+#else
+	UntrackedFree(p);
+#endif
+}
+
 ////////////////////////////////
 void* TrackedAlloc(size_t size)
 {
 #if (MEM_TRACKING > MEM_TRACKING_DISABLE)
-	void* p = UntrackedAlloc(size);
+	void* p = _HeapAlloc(size);
 	TrackAllocation(p, size);
 	return p;
 #else
-	return UntrackedAlloc(size);
+	return _HeapAlloc(size);
+#endif
+}
+
+////////////////////////////////
+void* TrackedAlloc(size_t size, MemTag tag)
+{
+#if (MEM_TRACKING > MEM_TRACKING_DISABLE)
+	void* p = _HeapAlloc(size);
+	// pushed here rather than through the other TrackAllocation so the callstack skips as many frames
+	MemPushTag(tag);
+	TrackAllocation(p, size);
+	MemPopTag();
+	return p;
+#else
+	UNUSED(tag);
+	return _HeapAlloc(size);
 #endif
 }
 
@@ -163,12 +567,22 @@ void TrackedFree(void* p)
 {
 #if (MEM_TRACKING > MEM_TRACKING_DISABLE)
 	UntrackAllocation(p);
-	UntrackedFree(p);
+	_HeapFree(p);
 #else
-	return UntrackedFree(p);
+	return _HeapFree(p);
 #endif
 }
 
+////////////////////////////////
+size_t GetProcessResidentBytes()
+{
+	PROCESS_MEMORY_COUNTERS counters = {};
+	if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.WorkingSetSize;
+}
+
 ////////////////////////////////
 void TrackAllocation(void* p, size_t size)
 {
@@ -176,14 +590,38 @@ void TrackAllocation(void* p, size_t size)
 	++g_allocationCounter;
 #if (MEM_TRACKING > MEM_TRACKING_COUNTING)
 	g_allocatedSize += size;
-	_NotifyAllocToProfiler(size);
+	const MemTag tag = MemGetCurrentTag();
+	_NotifyAllocToProfiler(size, tag);
+	_MemTagCounters& counters = s_tagCounters[tag.id];
+	const int64_t live = counters.m_liveBytes.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+	counters.m_liveCount.fetch_add(1, std::memory_order_relaxed);
+	counters.m_totalAllocs.fetch_add(1, std::memory_order_relaxed);
+	int64_t highWater = counters.m_highWaterBytes.load(std::memory_order_relaxed);
+	while (live > highWater && !counters.m_highWaterBytes.compare_exchange_weak(highWater, live, std::memory_order_relaxed)) {
+	}
+	// warned about by MemCheckTagBudgets, logging from in here could allocate
+	const size_t budget = counters.m_budgetBytes.load(std::memory_order_relaxed);
+	if (budget > 0 && live > (int64_t)budget) {
+		counters.m_overBudget.store(true, std::memory_order_relaxed);
+	}
+
+	__Tracker& tracker = __Tracker::Get();
 	MemoryAllocationInfo info;
 	info.m_originalPointer = p;
 	info.m_sizeByte = size;
-	GetCallstack(info.m_callstack, 4);
-	__Tracker::GetLock().lock();
-	__Tracker::GetMap()[p] = info;
-	__Tracker::GetLock().unlock();
+	info.m_tag = tag.id;
+	info.m_sampleBytes = (uint32_t)s_sampleBytes.load(std::memory_order_relaxed);
+	info.m_callstackId = MEM_CALLSTACK_UNSAMPLED;
+	// the callstack is most of the cost, unsampled allocations are only counted
+	if (__ShouldSample(size, info.m_sampleBytes)) {
+		Callstack callstack;
+		GetCallstack(callstack, 4);
+		info.m_callstackId = tracker.InternCallstack(callstack);
+	}
+	__TrackerStripe& stripe = tracker.GetStripe(p);
+	bool inserted = false;
+	std::scoped_lock _(stripe.m_lock);
+	*stripe.m_allocations.Insert((uint64_t)(uintptr_t)p, &inserted) = info;
 #endif
 #endif
 }
@@ -194,20 +632,161 @@ void UntrackAllocation(void* p)
 #if (MEM_TRACKING > MEM_TRACKING_DISABLE)
 	--g_allocationCounter;
 #if (MEM_TRACKING > MEM_TRACKING_COUNTING)
-	__Tracker::GetLock().lock();
-	auto found = __Tracker::GetMap().find(p);
-	if (found != __Tracker::GetMap().end())
+	__TrackerStripe& stripe = __Tracker::Get().GetStripe(p);
+	MemoryAllocationInfo info;
+	bool found = false;
 	{
-		auto size = __Tracker::GetMap()[p].m_sizeByte;
-		g_allocatedSize -= size;
-		_NotifyFreeToProfiler(size);
-		__Tracker::GetMap().erase(p);
+		std::scoped_lock _(stripe.m_lock);
+		found = stripe.m_allocations.Erase((uint64_t)(uintptr_t)p, &info);
+	}
+	if (found) {
+		g_allocatedSize -= info.m_sizeByte;
+		MemTag tag;
+		tag.id = info.m_tag;
+		_NotifyFreeToProfiler(info.m_sizeByte, tag);
+		_MemTagCounters& counters = s_tagCounters[info.m_tag];
+		counters.m_liveBytes.fetch_sub((int64_t)info.m_sizeByte, std::memory_order_relaxed);
+		counters.m_liveCount.fetch_sub(1, std::memory_order_relaxed);
 	}
-	__Tracker::GetLock().unlock();
 #endif
 #endif
 }
 
+////////////////////////////////
+void TrackAllocation(void* p, size_t size, MemTag tag)
+{
+	MemPushTag(tag);
+	TrackAllocation(p, size);
+	MemPopTag();
+}
+
+////////////////////////////////
+MemTag MemRegisterTag(const char* name)
+{
+	std::scoped_lock _(s_tagLock);
+	const int numTags = s_numTags.load(std::memory_order_relaxed);
+	MemTag tag;
+	for (int i = 0; i < numTags; ++i) {
+		if (strcmp(s_tagNames[i], name) == 0) {
+			tag.id = (uint8_t)i;
+			return tag;
+		}
+	}
+	GUARANTEE_OR_DIE(numTags < MEM_MAX_TAGS, "Too many memory tags, raise MEM_MAX_TAGS");
+	const size_t length = strlen(name);
+	char* copied = (char*)UntrackedAlloc(length + 1);
+	memcpy(copied, name, length + 1);
+	s_tagNames[numTags] = copied;
+	s_numTags.store(numTags + 1, std::memory_order_release);
+	tag.id = (uint8_t)numTags;
+	return tag;
+}
+
+////////////////////////////////
+const char* MemGetTagName(MemTag tag)
+{
+	// written once before the id is handed out
+	return s_tagNames[tag.id];
+}
+
+////////////////////////////////
+int MemGetNumTags()
+{
+	return s_numTags.load(std::memory_order_acquire);
+}
+
+////////////////////////////////
+void MemPushTag(MemTag tag)
+{
+	ASSERT_OR_DIE(t_tagDepth < MEM_TAG_STACK_DEPTH, "Memory tag stack overflow, raise MEM_TAG_STACK_DEPTH");
+	t_tagStack[t_tagDepth++] = tag.id;
+}
+
+////////////////////////////////
+void MemPopTag()
+{
+	ASSERT_OR_DIE(t_tagDepth > 0, "Memory tag popped without a push");
+	--t_tagDepth;
+}
+
+////////////////////////////////
+MemTag MemGetCurrentTag()
+{
+	MemTag tag;
+	if (t_tagDepth > 0) {
+		tag.id = t_tagStack[t_tagDepth - 1];
+	}
+	return tag;
+}
+
+////////////////////////////////
+MemTagStats MemGetTagStats(MemTag tag)
+{
+	const _MemTagCounters& counters = s_tagCounters[tag.id];
+	MemTagStats stats;
+	stats.liveBytes = counters.m_liveBytes.load(std::memory_order_relaxed);
+	stats.liveCount = counters.m_liveCount.load(std::memory_order_relaxed);
+	stats.highWaterBytes = counters.m_highWaterBytes.load(std::memory_order_relaxed);
+	stats.totalAllocs = counters.m_totalAllocs.load(std::memory_order_relaxed);
+	stats.budgetBytes = counters.m_budgetBytes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+////////////////////////////////
+void MemSetTagBudget(MemTag tag, size_t budgetBytes)
+{
+	_MemTagCounters& counters = s_tagCounters[tag.id];
+	counters.m_budgetBytes.store(budgetBytes, std::memory_order_relaxed);
+	counters.m_overBudget.store(budgetBytes > 0 && counters.m_liveBytes.load(std::memory_order_relaxed) > (int64_t)budgetBytes, std::memory_order_relaxed);
+	counters.m_warned = false;
+}
+
+////////////////////////////////
+void MemCheckTagBudgets()
+{
+	const int numTags = MemGetNumTags();
+	for (int i = 0; i < numTags; ++i) {
+		_MemTagCounters& counters = s_tagCounters[i];
+		const size_t budget = counters.m_budgetBytes.load(std::memory_order_relaxed);
+		const int64_t live = counters.m_liveBytes.load(std::memory_order_relaxed);
+		if (counters.m_overBudget.exchange(false, std::memory_order_relaxed) && !counters.m_warned) {
+			counters.m_warned = true;
+			Log("memory", "Memory tag %s went over its budget of %s: %s live, high water %s"
+				, s_tagNames[i]
+				, GetByteSizeString((ptrdiff_t)budget).c_str()
+				, GetByteSizeString((ptrdiff_t)live).c_str()
+				, GetByteSizeString((ptrdiff_t)counters.m_highWaterBytes.load(std::memory_order_relaxed)).c_str());
+		}
+		if (budget == 0 || live <= (int64_t)budget) {
+			counters.m_warned = false;
+		}
+	}
+}
+
+////////////////////////////////
+void MemLogTagTable()
+{
+#if (MEM_TRACKING >= MEM_TRACKING_VERBOSE)
+	Log("memory", "%-20s %14s %10s %14s %12s %14s", "TAG", "LIVE", "COUNT", "HIGH WATER", "ALLOCS", "BUDGET");
+	const int numTags = MemGetNumTags();
+	for (int i = 0; i < numTags; ++i) {
+		MemTag tag;
+		tag.id = (uint8_t)i;
+		const MemTagStats stats = MemGetTagStats(tag);
+		Log("memory", "%-20s %14s %10lld %14s %12llu %14s%s"
+			, MemGetTagName(tag)
+			, GetByteSizeString((ptrdiff_t)stats.liveBytes).c_str()
+			, (long long)stats.liveCount
+			, GetByteSizeString((ptrdiff_t)stats.highWaterBytes).c_str()
+			, (unsigned long long)stats.totalAllocs
+			, stats.budgetBytes > 0 ? GetByteSizeString((ptrdiff_t)stats.budgetBytes).c_str() : "-"
+			, stats.budgetBytes > 0 && stats.liveBytes > (int64_t)stats.budgetBytes ? " OVER" : "");
+	}
+#else
+	Log("memory", "Memory tags are counted with MEM_TRACKING_VERBOSE only");
+#endif
+}
+
 ////////////////////////////////
 void* operator new(size_t size)
 {
@@ -221,12 +800,112 @@ void operator delete(void* p)
 }
 
 ////////////////////////////////
-bool BlockAllocator::Init(IAllocator* base, size_t blockSize, size_t alignment, unsigned int blocksPerChunk)
+// operator new is not always malloc, the library's sized delete must not get it
+void operator delete(void* p, size_t size)
+{
+	UNUSED(size);
+	TrackedFree(p);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Per thread block caches, every allocator has its own slot so finding its magazine is one lookup
+static constexpr int BLOCK_MAGAZINE_SLOTS = 64;
+// epochs are unique across allocators, a new allocator at a dead one's address does not inherit its magazines
+static std::atomic<unsigned int> s_nextBlockEpoch = 1;
+// Which slots are taken and the epoch of the allocator in each, 0 once it is closed.
+// Exiting threads check it under the lock before touching an allocator, Close takes the lock to free the slot.
+static std::mutex s_magazineSlotLock;
+static uint64_t s_usedMagazineSlots = 0;
+static unsigned int s_magazineSlotEpochs[BLOCK_MAGAZINE_SLOTS] = {};
+struct _BlockMagazine
+{
+	BlockAllocator* m_owner = nullptr;
+	unsigned int m_epoch = 0;
+	BlockAllocator::Block* m_head = nullptr;
+	int m_count = 0;
+};
+
+struct _BlockMagazines
+{
+	// an exiting thread hands its blocks back, to the allocators that are still open
+	~_BlockMagazines()
+	{
+		std::scoped_lock _(s_magazineSlotLock);
+		for (int slot = 0; slot < BLOCK_MAGAZINE_SLOTS; ++slot) {
+			_BlockMagazine& each = m_slots[slot];
+			if (each.m_head && each.m_epoch == s_magazineSlotEpochs[slot]) {
+				BlockAllocator::Block* tail = each.m_head;
+				while (tail->next) {
+					tail = tail->next;
+				}
+				each.m_owner->PushFreeBlocks(each.m_head, tail);
+			}
+			each = _BlockMagazine();
+		}
+	}
+	_BlockMagazine m_slots[BLOCK_MAGAZINE_SLOTS];
+};
+static thread_local _BlockMagazines t_blockMagazines;
+
+////////////////////////////////
+// What this thread still holds from an older epoch, or from the slot's last owner, belonged to memory that is gone
+static _BlockMagazine* _GetBlockMagazine(BlockAllocator* allocator)
+{
+	const unsigned int epoch = allocator->m_epoch.load(std::memory_order_relaxed);
+	_BlockMagazine& slot = t_blockMagazines.m_slots[allocator->m_magazineSlot];
+	if (slot.m_epoch != epoch) {
+		slot.m_owner = allocator;
+		slot.m_epoch = epoch;
+		slot.m_head = nullptr;
+		slot.m_count = 0;
+	}
+	return &slot;
+}
+
+////////////////////////////////
+// /return -1 when every slot is taken
+static int _AcquireMagazineSlot(unsigned int epoch)
+{
+	std::scoped_lock _(s_magazineSlotLock);
+	for (int slot = 0; slot < BLOCK_MAGAZINE_SLOTS; ++slot) {
+		if (!(s_usedMagazineSlots & (1ull << slot))) {
+			s_usedMagazineSlots |= 1ull << slot;
+			s_magazineSlotEpochs[slot] = epoch;
+			return slot;
+		}
+	}
+	return -1;
+}
+
+////////////////////////////////
+static void _ReleaseMagazineSlot(int slot)
+{
+	std::scoped_lock _(s_magazineSlotLock);
+	s_usedMagazineSlots &= ~(1ull << slot);
+	s_magazineSlotEpochs[slot] = 0;
+}
+
+////////////////////////////////
+bool BlockAllocator::Init(IAllocator* base, size_t blockSize, size_t alignment, unsigned int blocksPerChunk, int magazineSize /*= BLOCK_MAGAZINE_SIZE*/)
 {
 	m_base = base;
 	m_blockSize = blockSize;
 	m_alignment = alignment;
 	m_blocksPerChunk = blocksPerChunk;
+	m_magazineSize = magazineSize;
+	m_epoch = s_nextBlockEpoch++;
+	if (m_magazineSlot >= 0) {
+		_ReleaseMagazineSlot(m_magazineSlot);
+		m_magazineSlot = -1;
+	}
+	if (m_magazineSize > 0) {
+		m_magazineSlot = _AcquireMagazineSlot(m_epoch);
+		if (m_magazineSlot < 0) {
+			DebuggerPrintf("BlockAllocator: all %d magazine slots are taken, blocks of %d bytes go through the shared list\n"
+				, BLOCK_MAGAZINE_SLOTS, (int)blockSize);
+			m_magazineSize = 0;
+		}
+	}
 	AllocChunk();
 	return true;
 }
@@ -241,13 +920,27 @@ bool BlockAllocator::Init(void* buffer, size_t bufferSize, size_t blockSize, siz
 	
 	m_base = nullptr;
 	m_freeBlocks = nullptr;
+	m_magazineSize = 0;
 	BreakChunk(buffer);
 	return true;
 }
 
+////////////////////////////////
+BlockAllocator::~BlockAllocator()
+{
+	if (m_magazineSlot >= 0) {
+		_ReleaseMagazineSlot(m_magazineSlot);
+	}
+}
+
 ////////////////////////////////
 void BlockAllocator::Close()
 {
+	m_epoch = s_nextBlockEpoch++;
+	if (m_magazineSlot >= 0) {
+		_ReleaseMagazineSlot(m_magazineSlot);
+		m_magazineSlot = -1;
+	}
 	if (m_base) {
 		Chunk* p = m_chunkList;
 		while (p) {
@@ -265,13 +958,35 @@ void BlockAllocator::Close()
 ////////////////////////////////
 void* BlockAllocator::AllocBlock()
 {
-	Block* block = PopFreeBlock();
-	while (!block) {
-		if (!AllocChunk()) {
-			return nullptr;
+	_BlockMagazine* magazine = m_magazineSize > 0 ? _GetBlockMagazine(this) : nullptr;
+	if (!magazine) {
+		Block* block = PopFreeBlock();
+		while (!block) {
+			if (!AllocChunk()) {
+				return nullptr;
+			}
+			block = PopFreeBlock();
+		}
+		return block;
+	}
+
+	// refills and spills move half a magazine
+	const int batch = std::max(m_magazineSize / 2, 1);
+	if (!magazine->m_head) {
+		int count = 0;
+		Block* refill = PopFreeBlocks(batch, &count);
+		while (!refill) {
+			if (!AllocChunk()) {
+				return nullptr;
+			}
+			refill = PopFreeBlocks(batch, &count);
 		}
-		block = PopFreeBlock();
+		magazine->m_head = refill;
+		magazine->m_count = count;
 	}
+	Block* block = magazine->m_head;
+	magazine->m_head = block->next;
+	--magazine->m_count;
 	return block;
 }
 
@@ -279,7 +994,31 @@ void* BlockAllocator::AllocBlock()
 void BlockAllocator::FreeBlock(void* block)
 {
 	Block* p = (Block*)block;
-	PushFreeBlock(p);
+	_BlockMagazine* magazine = m_magazineSize > 0 ? _GetBlockMagazine(this) : nullptr;
+	if (!magazine) {
+		PushFreeBlock(p);
+		return;
+	}
+
+	p->next = magazine->m_head;
+	magazine->m_head = p;
+	++magazine->m_count;
+	if (magazine->m_count > m_magazineSize) {
+		// keep half, the other half goes back in one go
+		const int keep = std::max(m_magazineSize / 2, 1);
+		Block* lastKept = magazine->m_head;
+		for (int i = 1; i < keep; ++i) {
+			lastKept = lastKept->next;
+		}
+		Block* spillHead = lastKept->next;
+		Block* spillTail = spillHead;
+		while (spillTail->next) {
+			spillTail = spillTail->next;
+		}
+		lastKept->next = nullptr;
+		magazine->m_count = keep;
+		PushFreeBlocks(spillHead, spillTail);
+	}
 }
 
 ////////////////////////////////
@@ -301,6 +1040,35 @@ void BlockAllocator::PushFreeBlock(Block* block)
 	m_freeBlocks = block;
 }
 
+////////////////////////////////
+BlockAllocator::Block* BlockAllocator::PopFreeBlocks(int maxCount, int* out_count)
+{
+	std::scoped_lock lk(m_blockLock);
+	Block* head = m_freeBlocks;
+	if (!head) {
+		*out_count = 0;
+		return nullptr;
+	}
+	Block* tail = head;
+	int count = 1;
+	while (count < maxCount && tail->next) {
+		tail = tail->next;
+		++count;
+	}
+	m_freeBlocks = tail->next;
+	tail->next = nullptr;
+	*out_count = count;
+	return head;
+}
+
+////////////////////////////////
+void BlockAllocator::PushFreeBlocks(Block* head, Block* tail)
+{
+	std::scoped_lock lk(m_blockLock);
+	tail->next = m_freeBlocks;
+	m_freeBlocks = head;
+}
+
 ////////////////////////////////
 bool BlockAllocator::AllocChunk()
 {
@@ -309,7 +1077,9 @@ bool BlockAllocator::AllocChunk()
 	}
 
 	if (m_chunkLock.try_lock()) {
-		size_t size = m_blocksPerChunk * m_blockSize + sizeof(Block);
+		// blocks start at the first aligned address after the chunk header
+		const size_t alignment = m_alignment > 0 ? m_alignment : alignof(Block);
+		size_t size = m_blocksPerChunk * m_blockSize + sizeof(Chunk) + alignment - 1;
 		Chunk* chunk = (Chunk*)m_base->ialloc(size);
 		if (!chunk) {
 			m_chunkLock.unlock();
@@ -318,7 +1088,8 @@ bool BlockAllocator::AllocChunk()
 		chunk->next = m_chunkList;
 		m_chunkList = chunk;
 
-		BreakChunk(chunk + 1);
+		const uintptr_t firstBlock = ((uintptr_t)(chunk + 1) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		BreakChunk((void*)firstBlock);
 		m_chunkLock.unlock();
 	}
 	return true;
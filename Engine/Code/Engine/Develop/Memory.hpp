@@ -4,18 +4,40 @@
 #include "Engine/Develop/Callstack.hpp"
 #include <atomic>
 #include <mutex>
+#include <vector>
 
 extern std::atomic<size_t> g_allocationCounter;
 
+inline constexpr int MEM_MAX_TAGS = 64;
+inline constexpr int MEM_TAG_STACK_DEPTH = 32;
+
+// Interned allocation tag, the subsystem an allocation is charged to. Id 0 is "Untagged".
+struct MemTag
+{
+	uint8_t id = 0;
+};
+
+// Caches the tag at the call site like LOG_CHANNEL
+#define MEM_TAG(name) ([]() { static const MemTag _memTag = MemRegisterTag(name); return _memTag; }())
+#define __MEM_CONCAT_IMPL(a, b) a##b
+#define __MEM_CONCAT(a, b) __MEM_CONCAT_IMPL(a, b)
+// Charges what this thread allocates until the end of the scope to the tag:
+//	MEM_TAG_SCOPE("Physics");
+#define MEM_TAG_SCOPE(name) MemTagScope __MEM_CONCAT(__mem_tag_scope_, __LINE__)(MEM_TAG(name))
+
 void* UntrackedAlloc(size_t size);
 void  UntrackedFree(void* p);
 void* TrackedAlloc(size_t size);
+/// Charged to tag whatever tag this thread has pushed
+void* TrackedAlloc(size_t size, MemTag tag);
 void  TrackedFree(void* p);
 void TrackAllocation(void* p, size_t size);
+void TrackAllocation(void* p, size_t size, MemTag tag);
 void UntrackAllocation(void* p);
 
 void* operator new(size_t size);
 void operator delete(void* p);
+void operator delete(void* p, size_t size);
 
 
 std::string GetByteSizeString(ptrdiff_t size);
@@ -23,12 +45,69 @@ std::string GetByteSizeString(ptrdiff_t size);
 size_t GetLiveAllocationCount();
 size_t GetLiveAllocationSize();
 void LogLiveAllocations();
+/// Working set of the whole process, 0 when the OS would not tell
+size_t GetProcessResidentBytes();
+/// MEM_TRACKING_VERBOSE records a callstack for about one allocation per sampleBytes allocated,
+/// 0 records every one. Live counts and sizes stay exact, the per callstack report is scaled up.
+void SetMemTrackingSampleBytes(size_t sampleBytes);
+size_t GetMemTrackingSampleBytes();
+
+// Tag counters need the size of what is freed, they are kept with MEM_TRACKING_VERBOSE
+struct MemTagStats
+{
+	int64_t liveBytes = 0;
+	int64_t liveCount = 0;
+	int64_t highWaterBytes = 0;
+	uint64_t totalAllocs = 0;
+	// 0 for none
+	size_t budgetBytes = 0;
+};
+
+/// Same name, same tag. Dies past MEM_MAX_TAGS, the name must outlive the program.
+MemTag MemRegisterTag(const char* name);
+const char* MemGetTagName(MemTag tag);
+int MemGetNumTags();
+/// What this thread allocates is charged to the innermost pushed tag
+void MemPushTag(MemTag tag);
+void MemPopTag();
+MemTag MemGetCurrentTag();
+MemTagStats MemGetTagStats(MemTag tag);
+/// 0 removes the budget
+void MemSetTagBudget(MemTag tag, size_t budgetBytes);
+/// Once a frame, warns about every tag that went over its budget since the last check
+void MemCheckTagBudgets();
+/// Logs the counters and budget of every tag
+void MemLogTagTable();
+
+struct MemTagScope
+{
+	explicit MemTagScope(MemTag tag) { MemPushTag(tag); }
+	~MemTagScope() { MemPopTag(); }
+};
+
+// the allocation did not get a callstack, the interned table was full
+inline constexpr uint32_t MEM_CALLSTACK_NONE = 0xffffffffu;
+// counted but not picked by sampling
+inline constexpr uint32_t MEM_CALLSTACK_UNSAMPLED = 0xfffffffeu;
 
 struct MemoryAllocationInfo
 {
 	void* m_originalPointer;
 	size_t m_sizeByte;
-	Callstack m_callstack;
+	// interned by callstack hash, identical callstacks share the id
+	uint32_t m_callstackId;
+	// sampling rate when it was allocated, 0 when every allocation had its callstack
+	uint32_t m_sampleBytes;
+	uint8_t m_tag;
+};
+
+// Live allocations of one callstack charged to one tag, sampled ones scaled up to what they stand for
+struct MemCallsite
+{
+	uint32_t callstackId = MEM_CALLSTACK_NONE;
+	MemTag tag;
+	double bytes = 0.0;
+	double count = 0.0;
 };
 
 template <typename T>
@@ -129,6 +208,13 @@ constexpr bool operator!=(const UntrackedAllocator<T1>& a, const UntrackedAlloca
 	return false;
 }
 
+using MemCallsiteList = std::vector<MemCallsite, UntrackedAllocator<MemCallsite>>;
+/// Live allocations grouped by callstack and tag, nothing unless MEM_TRACKING_VERBOSE.
+/// out_numUnsampled gets the allocations sampling left without a callstack.
+void _MemCollectCallsites(MemCallsiteList* out_callsites, size_t* out_numUnsampled);
+/// null for MEM_CALLSTACK_NONE
+const Callstack* _MemGetCallstack(uint32_t callstackId);
+
 template<typename T>
 struct TrackedAllocator : public IAllocator
 {
@@ -166,6 +252,11 @@ TrackedAllocator<T>* GetTrackedAllocator()
 	return instance;
 }
 
+// Blocks a thread keeps for itself before it goes to the shared free list, it moves half of it at once
+inline constexpr int BLOCK_MAGAZINE_SIZE = 32;
+
+// Every thread caches free blocks in a magazine, the shared list is only locked once per batch.
+// A block can be freed on any thread, it joins that thread's magazine.
 struct BlockAllocator : public IAllocator
 {
 	struct Block
@@ -177,13 +268,22 @@ struct BlockAllocator : public IAllocator
 		Chunk* next;
 	};
 public:
-	bool Init(IAllocator* base, size_t blockSize, size_t alignment, unsigned int blocksPerChunk);
+	BlockAllocator() = default;
+	~BlockAllocator();
+	/// /param magazineSize 0 makes every thread use the shared list directly, so does running out of magazine slots
+	bool Init(IAllocator* base, size_t blockSize, size_t alignment, unsigned int blocksPerChunk, int magazineSize = BLOCK_MAGAZINE_SIZE);
+	/// A fixed buffer has no magazines, blocks cached by one thread would be out of reach for the others
 	bool Init(void* buffer, size_t bufferSize, size_t blockSize, size_t alignment);
+	/// Blocks still cached by other threads are dropped by them on their next use, or when they exit. Gives the magazine slot back.
 	void Close();
 	void* AllocBlock();
 	void FreeBlock(void* block);
 	Block* PopFreeBlock();
 	void PushFreeBlock(Block* block);
+	/// Up to maxCount blocks from the shared list, linked through next
+	Block* PopFreeBlocks(int maxCount, int* out_count);
+	/// Links a chain from head to tail into the shared list
+	void PushFreeBlocks(Block* head, Block* tail);
 
 	virtual void* ialloc(size_t count) override final
 	{
@@ -212,6 +312,11 @@ public:
 	size_t m_blockSize = 0;
 	size_t m_bufferSize = 0;
 	int m_blocksPerChunk = 0;
+	int m_magazineSize = 0;
+	// index of this allocator's magazine on every thread, owned until Close
+	int m_magazineSlot = -1;
+	// renewed by Init and Close, magazines from before that are stale
+	std::atomic<unsigned int> m_epoch = 0;
 
 	std::mutex m_chunkLock;
 	std::mutex m_blockLock;
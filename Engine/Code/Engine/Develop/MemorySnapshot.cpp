@@ -0,0 +1,433 @@
+#include "Engine/Develop/MemorySnapshot.hpp"
+#include "Engine/Develop/Log.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+// Frames of every callsite shown by MemLogSnapshotDiff
+static constexpr int MEM_SNAPSHOT_DIFF_FRAMES = 3;
+
+struct _MemSnapshot
+{
+	std::string m_name;
+	int64_t m_timeNanos = 0;
+	size_t m_sampleBytes = 0;
+	size_t m_numUnsampled = 0;
+	// sorted by callstack id then tag
+	MemCallsiteList m_callsites;
+};
+static std::mutex s_snapshotLock;
+static std::vector<_MemSnapshot*> s_snapshots;
+
+////////////////////////////////
+static bool _IsCallsiteBefore(const MemCallsite& a, const MemCallsite& b)
+{
+	return a.callstackId < b.callstackId || (a.callstackId == b.callstackId && a.tag.id < b.tag.id);
+}
+
+////////////////////////////////
+// /return null when there is none, call with s_snapshotLock held
+static _MemSnapshot* _FindSnapshot(const std::string& name)
+{
+	for (_MemSnapshot* each : s_snapshots) {
+		if (each->m_name == name) {
+			return each;
+		}
+	}
+	return nullptr;
+}
+
+////////////////////////////////
+static std::string _SignedByteSizeString(double bytes)
+{
+	return (bytes < 0.0 ? "-" : "+") + GetByteSizeString((ptrdiff_t)std::abs(bytes));
+}
+
+////////////////////////////////
+bool MemTakeSnapshot(const std::string& name)
+{
+#if (MEM_TRACKING >= MEM_TRACKING_VERBOSE)
+	_MemSnapshot* snapshot = new _MemSnapshot();
+	snapshot->m_name = name;
+	snapshot->m_timeNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	snapshot->m_sampleBytes = GetMemTrackingSampleBytes();
+	_MemCollectCallsites(&snapshot->m_callsites, &snapshot->m_numUnsampled);
+	std::sort(snapshot->m_callsites.begin(), snapshot->m_callsites.end(), _IsCallsiteBefore);
+
+	std::scoped_lock _(s_snapshotLock);
+	for (_MemSnapshot*& each : s_snapshots) {
+		if (each->m_name == name) {
+			delete each;
+			each = snapshot;
+			return true;
+		}
+	}
+	s_snapshots.push_back(snapshot);
+	return true;
+#else
+	UNUSED(name);
+	return false;
+#endif
+}
+
+////////////////////////////////
+bool MemDeleteSnapshot(const std::string& name)
+{
+	std::scoped_lock _(s_snapshotLock);
+	for (auto it = s_snapshots.begin(); it != s_snapshots.end(); ++it) {
+		if ((*it)->m_name == name) {
+			delete *it;
+			s_snapshots.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////
+void MemListSnapshots()
+{
+	std::scoped_lock _(s_snapshotLock);
+	Log("memory", "%-20s %10s %14s %12s", "SNAPSHOT", "CALLSITES", "BYTES", "ALLOCS");
+	for (const _MemSnapshot* each : s_snapshots) {
+		double bytes = 0.0;
+		double count = 0.0;
+		for (const MemCallsite& callsite : each->m_callsites) {
+			bytes += callsite.bytes;
+			count += callsite.count;
+		}
+		Log("memory", "%-20s %10d %14s %12.0f%s"
+			, each->m_name.c_str()
+			, (int)each->m_callsites.size()
+			, GetByteSizeString((ptrdiff_t)bytes).c_str()
+			, count
+			, each->m_sampleBytes > 0 ? " (sampled)" : "");
+	}
+}
+
+////////////////////////////////
+bool MemDiffSnapshots(const std::string& before, const std::string& after, std::vector<MemSnapshotDiff>* out_diff)
+{
+	out_diff->clear();
+	std::scoped_lock _(s_snapshotLock);
+	const _MemSnapshot* from = _FindSnapshot(before);
+	const _MemSnapshot* to = _FindSnapshot(after);
+	if (!from || !to) {
+		return false;
+	}
+
+	// both are sorted, walk them side by side
+	auto fromIt = from->m_callsites.begin();
+	auto toIt = to->m_callsites.begin();
+	while (fromIt != from->m_callsites.end() || toIt != to->m_callsites.end()) {
+		MemSnapshotDiff diff;
+		if (toIt == to->m_callsites.end() || (fromIt != from->m_callsites.end() && _IsCallsiteBefore(*fromIt, *toIt))) {
+			diff.callstackId = fromIt->callstackId;
+			diff.tag = fromIt->tag;
+			diff.deltaBytes = -fromIt->bytes;
+			diff.deltaCount = -fromIt->count;
+			++fromIt;
+		} else if (fromIt == from->m_callsites.end() || _IsCallsiteBefore(*toIt, *fromIt)) {
+			diff.callstackId = toIt->callstackId;
+			diff.tag = toIt->tag;
+			diff.deltaBytes = toIt->bytes;
+			diff.deltaCount = toIt->count;
+			++toIt;
+		} else {
+			diff.callstackId = toIt->callstackId;
+			diff.tag = toIt->tag;
+			diff.deltaBytes = toIt->bytes - fromIt->bytes;
+			diff.deltaCount = toIt->count - fromIt->count;
+			++fromIt;
+			++toIt;
+		}
+		if (std::abs(diff.deltaBytes) >= 0.5 || std::abs(diff.deltaCount) >= 0.5) {
+			out_diff->push_back(diff);
+		}
+	}
+	std::sort(out_diff->begin(), out_diff->end(), [](const MemSnapshotDiff& a, const MemSnapshotDiff& b) {
+		return std::abs(a.deltaBytes) > std::abs(b.deltaBytes);
+	});
+	return true;
+}
+
+////////////////////////////////
+bool MemLogSnapshotDiff(const std::string& before, const std::string& after, int maxRows /*= 20*/)
+{
+	std::vector<MemSnapshotDiff> diff;
+	if (!MemDiffSnapshots(before, after, &diff)) {
+		return false;
+	}
+	double totalBytes = 0.0;
+	double totalCount = 0.0;
+	for (const MemSnapshotDiff& each : diff) {
+		totalBytes += each.deltaBytes;
+		totalCount += each.deltaCount;
+	}
+	Log("memory", "%s -> %s: %s in %+.0f allocations over %d callsites"
+		, before.c_str(), after.c_str(), _SignedByteSizeString(totalBytes).c_str(), totalCount, (int)diff.size());
+	if ((int)diff.size() > maxRows) {
+		diff.resize(maxRows);
+	}
+
+	// symbols of every frame shown, loaded in one go
+	std::vector<void*> addresses;
+	for (const MemSnapshotDiff& each : diff) {
+		const Callstack* callstack = _MemGetCallstack(each.callstackId);
+		const int depth = callstack ? std::min(callstack->m_depth, MEM_SNAPSHOT_DIFF_FRAMES) : 0;
+		for (int i = 0; i < depth; ++i) {
+			addresses.push_back(callstack->m_trace[i]);
+		}
+	}
+	const std::vector<CallstackFrame> frames = ResolveCallstackFrames(addresses.data(), addresses.size());
+
+	size_t nextFrame = 0;
+	for (const MemSnapshotDiff& each : diff) {
+		const Callstack* callstack = _MemGetCallstack(each.callstackId);
+		const int depth = callstack ? std::min(callstack->m_depth, MEM_SNAPSHOT_DIFF_FRAMES) : 0;
+		std::string where = callstack ? "" : "(callstack table full)";
+		for (int i = 0; i < depth; ++i, ++nextFrame) {
+			const CallstackFrame& frame = frames[nextFrame];
+			if (i > 0) {
+				where.append(" <- ");
+			}
+			where.append(frame.function.empty() ? Stringf("%p", callstack->m_trace[i]) : frame.function);
+			if (!frame.file.empty()) {
+				where.append(Stringf(" (%s:%d)", frame.file.c_str(), frame.line));
+			}
+		}
+		Log("memory", "%14s %+10.0f %-16s %s"
+			, _SignedByteSizeString(each.deltaBytes).c_str(), each.deltaCount, MemGetTagName(each.tag), where.c_str());
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// pprof export
+//////////////////////////////////////////////////////////////////////////
+
+// Just enough protobuf encoding for profile.proto
+struct _ProtoWriter
+{
+	void WriteVarint(uint64_t value)
+	{
+		while (value >= 0x80) {
+			m_bytes.push_back((char)((value & 0x7f) | 0x80));
+			value >>= 7;
+		}
+		m_bytes.push_back((char)value);
+	}
+
+	void WriteVarintField(int field, uint64_t value)
+	{
+		WriteVarint((uint64_t)field << 3);
+		WriteVarint(value);
+	}
+
+	void WriteBytesField(int field, const void* data, size_t size)
+	{
+		WriteVarint(((uint64_t)field << 3) | 2);
+		WriteVarint(size);
+		m_bytes.append((const char*)data, size);
+	}
+
+	void WriteMessageField(int field, const _ProtoWriter& message)
+	{
+		WriteBytesField(field, message.m_bytes.data(), message.m_bytes.size());
+	}
+
+	/// repeated scalars go packed
+	void WritePackedField(int field, const std::vector<uint64_t>& values)
+	{
+		_ProtoWriter packed;
+		for (uint64_t each : values) {
+			packed.WriteVarint(each);
+		}
+		WriteMessageField(field, packed);
+	}
+
+	std::string m_bytes;
+};
+
+// Field numbers of profile.proto
+enum _PprofField
+{
+	PPROF_PROFILE_SAMPLE_TYPE = 1,
+	PPROF_PROFILE_SAMPLE = 2,
+	PPROF_PROFILE_LOCATION = 4,
+	PPROF_PROFILE_FUNCTION = 5,
+	PPROF_PROFILE_STRING_TABLE = 6,
+	PPROF_PROFILE_TIME_NANOS = 9,
+	PPROF_PROFILE_PERIOD_TYPE = 11,
+	PPROF_PROFILE_PERIOD = 12,
+	PPROF_PROFILE_DEFAULT_SAMPLE_TYPE = 14,
+
+	PPROF_VALUE_TYPE_TYPE = 1,
+	PPROF_VALUE_TYPE_UNIT = 2,
+
+	PPROF_SAMPLE_LOCATION_ID = 1,
+	PPROF_SAMPLE_VALUE = 2,
+	PPROF_SAMPLE_LABEL = 3,
+
+	PPROF_LABEL_KEY = 1,
+	PPROF_LABEL_STR = 2,
+
+	PPROF_LOCATION_ID = 1,
+	PPROF_LOCATION_ADDRESS = 3,
+	PPROF_LOCATION_LINE = 4,
+
+	PPROF_LINE_FUNCTION_ID = 1,
+	PPROF_LINE_LINE = 2,
+
+	PPROF_FUNCTION_ID = 1,
+	PPROF_FUNCTION_NAME = 2,
+	PPROF_FUNCTION_SYSTEM_NAME = 3,
+	PPROF_FUNCTION_FILENAME = 4,
+};
+
+// Index 0 is the empty string, as pprof wants
+struct _PprofStrings
+{
+	_PprofStrings() { Intern(""); }
+
+	uint64_t Intern(const std::string& str)
+	{
+		auto found = m_ids.find(str);
+		if (found != m_ids.end()) {
+			return found->second;
+		}
+		const uint64_t id = m_strings.size();
+		m_ids.emplace(str, id);
+		m_strings.push_back(str);
+		return id;
+	}
+
+	std::unordered_map<std::string, uint64_t> m_ids;
+	std::vector<std::string> m_strings;
+};
+
+////////////////////////////////
+static _ProtoWriter _PprofValueType(_PprofStrings& strings, const char* type, const char* unit)
+{
+	_ProtoWriter valueType;
+	valueType.WriteVarintField(PPROF_VALUE_TYPE_TYPE, strings.Intern(type));
+	valueType.WriteVarintField(PPROF_VALUE_TYPE_UNIT, strings.Intern(unit));
+	return valueType;
+}
+
+////////////////////////////////
+bool MemExportSnapshotPprof(const std::string& name, const std::string& filename)
+{
+	_MemSnapshot snapshot;
+	{
+		std::scoped_lock _(s_snapshotLock);
+		const _MemSnapshot* found = _FindSnapshot(name);
+		if (!found) {
+			return false;
+		}
+		snapshot = *found;
+	}
+
+	// one location per return address, in the order they are first seen
+	std::unordered_map<void*, uint64_t> locationIds;
+	std::vector<void*> addresses;
+	for (const MemCallsite& each : snapshot.m_callsites) {
+		const Callstack* callstack = _MemGetCallstack(each.callstackId);
+		const int depth = callstack ? callstack->m_depth : 0;
+		for (int i = 0; i < depth; ++i) {
+			if (locationIds.emplace(callstack->m_trace[i], addresses.size() + 1).second) {
+				addresses.push_back(callstack->m_trace[i]);
+			}
+		}
+	}
+	// callsites the callstack table had no room for all get this one
+	const uint64_t unknownLocationId = addresses.size() + 1;
+	const std::vector<CallstackFrame> frames = ResolveCallstackFrames(addresses.data(), addresses.size());
+
+	_PprofStrings strings;
+	_ProtoWriter profile;
+	profile.WriteMessageField(PPROF_PROFILE_SAMPLE_TYPE, _PprofValueType(strings, "inuse_objects", "count"));
+	profile.WriteMessageField(PPROF_PROFILE_SAMPLE_TYPE, _PprofValueType(strings, "inuse_space", "bytes"));
+
+	const uint64_t tagKey = strings.Intern("tag");
+	std::vector<uint64_t> locations;
+	for (const MemCallsite& each : snapshot.m_callsites) {
+		locations.clear();
+		const Callstack* callstack = _MemGetCallstack(each.callstackId);
+		if (callstack) {
+			// innermost frame first, like pprof
+			for (int i = 0; i < callstack->m_depth; ++i) {
+				locations.push_back(locationIds[callstack->m_trace[i]]);
+			}
+		} else {
+			locations.push_back(unknownLocationId);
+		}
+		_ProtoWriter label;
+		label.WriteVarintField(PPROF_LABEL_KEY, tagKey);
+		label.WriteVarintField(PPROF_LABEL_STR, strings.Intern(MemGetTagName(each.tag)));
+
+		_ProtoWriter sample;
+		sample.WritePackedField(PPROF_SAMPLE_LOCATION_ID, locations);
+		sample.WritePackedField(PPROF_SAMPLE_VALUE, { (uint64_t)std::llround(each.count), (uint64_t)std::llround(each.bytes) });
+		sample.WriteMessageField(PPROF_SAMPLE_LABEL, label);
+		profile.WriteMessageField(PPROF_PROFILE_SAMPLE, sample);
+	}
+
+	// functions are shared by every address inside them
+	std::map<std::pair<std::string, std::string>, uint64_t> functionIds;
+	std::vector<std::pair<std::string, std::string>> functions;
+	auto internFunction = [&functionIds, &functions](const std::string& function, const std::string& file) {
+		auto inserted = functionIds.emplace(std::make_pair(function, file), functions.size() + 1);
+		if (inserted.second) {
+			functions.emplace_back(function, file);
+		}
+		return inserted.first->second;
+	};
+	for (size_t i = 0; i <= addresses.size(); ++i) {
+		const bool isUnknown = i == addresses.size();
+		_ProtoWriter line;
+		if (isUnknown) {
+			line.WriteVarintField(PPROF_LINE_FUNCTION_ID, internFunction("(callstack table full)", ""));
+		} else {
+			const CallstackFrame& frame = frames[i];
+			const std::string function = frame.function.empty() ? Stringf("%p", addresses[i]) : frame.function;
+			line.WriteVarintField(PPROF_LINE_FUNCTION_ID, internFunction(function, frame.file));
+			line.WriteVarintField(PPROF_LINE_LINE, (uint64_t)frame.line);
+		}
+		_ProtoWriter location;
+		location.WriteVarintField(PPROF_LOCATION_ID, i + 1);
+		location.WriteVarintField(PPROF_LOCATION_ADDRESS, isUnknown ? 0 : (uint64_t)(uintptr_t)addresses[i]);
+		location.WriteMessageField(PPROF_LOCATION_LINE, line);
+		profile.WriteMessageField(PPROF_PROFILE_LOCATION, location);
+	}
+	for (size_t i = 0; i < functions.size(); ++i) {
+		const uint64_t nameId = strings.Intern(functions[i].first);
+		_ProtoWriter function;
+		function.WriteVarintField(PPROF_FUNCTION_ID, i + 1);
+		function.WriteVarintField(PPROF_FUNCTION_NAME, nameId);
+		function.WriteVarintField(PPROF_FUNCTION_SYSTEM_NAME, nameId);
+		function.WriteVarintField(PPROF_FUNCTION_FILENAME, strings.Intern(functions[i].second));
+		profile.WriteMessageField(PPROF_PROFILE_FUNCTION, function);
+	}
+
+	profile.WriteVarintField(PPROF_PROFILE_TIME_NANOS, (uint64_t)snapshot.m_timeNanos);
+	profile.WriteMessageField(PPROF_PROFILE_PERIOD_TYPE, _PprofValueType(strings, "space", "bytes"));
+	profile.WriteVarintField(PPROF_PROFILE_PERIOD, snapshot.m_sampleBytes > 0 ? snapshot.m_sampleBytes : 1);
+	profile.WriteVarintField(PPROF_PROFILE_DEFAULT_SAMPLE_TYPE, strings.Intern("inuse_space"));
+	// last, every string is interned by now
+	for (const std::string& each : strings.m_strings) {
+		profile.WriteBytesField(PPROF_PROFILE_STRING_TABLE, each.data(), each.size());
+	}
+
+	FILE* fp = nullptr;
+	fopen_s(&fp, filename.c_str(), "wb");
+	if (!fp) {
+		return false;
+	}
+	const bool written = fwrite(profile.m_bytes.data(), 1, profile.m_bytes.size(), fp) == profile.m_bytes.size();
+	fclose(fp);
+	return written;
+}
\ No newline at end of file
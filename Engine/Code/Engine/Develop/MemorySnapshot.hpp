@@ -0,0 +1,29 @@
+#pragma once
+#include "Engine/Develop/Memory.hpp"
+#include <string>
+#include <vector>
+
+// How much one callsite grew from one snapshot to the next, negative when it shrank
+struct MemSnapshotDiff
+{
+	uint32_t callstackId = MEM_CALLSTACK_NONE;
+	MemTag tag;
+	double deltaBytes = 0.0;
+	double deltaCount = 0.0;
+};
+
+// A heap snapshot is the live allocations grouped by callstack and tag at one moment.
+// They need the callstacks of MEM_TRACKING_VERBOSE, with sampling on the numbers are estimates.
+
+/// Replaces the snapshot with the same name, false without MEM_TRACKING_VERBOSE
+bool MemTakeSnapshot(const std::string& name);
+bool MemDeleteSnapshot(const std::string& name);
+/// Logs every snapshot with its totals
+void MemListSnapshots();
+/// Callsites that changed from before to after, the biggest change in bytes first
+bool MemDiffSnapshots(const std::string& before, const std::string& after, std::vector<MemSnapshotDiff>* out_diff);
+/// Logs the first maxRows callsites of the diff with their innermost frames
+bool MemLogSnapshotDiff(const std::string& before, const std::string& after, int maxRows = 20);
+/// Writes an uncompressed pprof profile.proto with inuse_objects and inuse_space, the tag is a sample label:
+///	pprof -http=: heap.pb	or	pprof -diff_base before.pb after.pb
+bool MemExportSnapshotPprof(const std::string& name, const std::string& filename);
\ No newline at end of file
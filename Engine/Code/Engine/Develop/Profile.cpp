@@ -2,18 +2,124 @@
 #include "Engine/Develop/Log.hpp"
 #include "Engine/Develop/Memory.hpp"
 #include "Game/EngineBuildPreferences.hpp"
-#include <shared_mutex>
+#include <atomic>
+#include <mutex>
 #include <cstring>
+#include <cstdio>
 #include <algorithm>
 #include <queue>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <cfloat>
+#include <cmath>
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 #include <windows.h>
+#endif
+
+// Where the hardware counters come from. The Windows build reads the thread's cycles, a Linux build of the engine
+// opens perf events when the kernel headers are there, anything else has none.
+#if defined(_WIN32)
+#define PROFILER_HW_THREAD_CYCLES
+#elif defined(__linux__) && __has_include(<linux/perf_event.h>)
+#define PROFILER_HW_PERF_EVENTS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
 //////////////////////////////////////////////////////////////////////////
-static thread_local ProfilerNode* t_activeNode = nullptr;
+// Push and pop only write events into a ring of their own thread, nothing is locked or allocated.
+// A tree is built from the events of a root when a report asks for it.
+enum _ProfilerEventType : uint8_t
+{
+	PROFILER_EVENT_BEGIN,
+	PROFILER_EVENT_END,
+	// follows the end event of a scope, one per memory tag it used
+	PROFILER_EVENT_TAG,
+	// follows the tag events, hardware counters tag and tag + 1 in hpc and deltaByte, allocs has a bit for each that was read
+	PROFILER_EVENT_HARDWARE,
+};
+
+struct _ProfilerEvent
+{
+	const char* label;
+	uint64 hpc;
+	ptrdiff_t deltaByte;
+	unsigned int allocs;
+	unsigned int frees;
+	uint8_t type;
+	uint8_t tag;
+};
+
+// What a scope allocated itself, written out with its end event
+struct _ProfilerScopeCounters
+{
+	unsigned int allocs = 0;
+	unsigned int frees = 0;
+	ptrdiff_t deltaByte = 0;
+	ProfilerTagCounters tagCounters[PROFILER_TAGS_PER_NODE];
+	int numTags = 0;
+	// hardware counters at the push
+	uint64 hardwareBegin[NUM_PROFILER_HW_COUNTERS];
+	bool hardwareValid = false;
+};
+
+struct _ProfilerRoot
+{
+	const char* label;
+	uint64 firstEvent;
+	uint64 endEvent;
+	uint64 beginHPC;
+	uint64 endHPC;
+};
+
+// Only the owning thread writes. A writer bumps the count before it overwrites a slot,
+// a report copies what it needs and throws the copy away when the count says it was overwritten.
+struct _ProfilerThreadBuffer
+{
+	std::thread::id m_threadID;
+	int m_threadIndex = 0;
+	bool m_inUse = true;
+	std::atomic<uint64> m_numEvents = 0;
+	// roots being written and roots done
+	std::atomic<uint64> m_numRootsWriting = 0;
+	std::atomic<uint64> m_numRoots = 0;
+	// roots before this one were left by a thread that exited
+	uint64 m_firstRoot = 0;
+	_ProfilerEvent m_events[PROFILER_EVENTS_PER_THREAD];
+	_ProfilerRoot m_roots[PROFILER_MAX_RECORD];
+};
+static_assert((PROFILER_EVENTS_PER_THREAD & (PROFILER_EVENTS_PER_THREAD - 1)) == 0);
+
+// Hands the buffer to the next thread when this one exits
+struct _ProfilerThreadSlot
+{
+	_ProfilerThreadBuffer* m_buffer = nullptr;
+	~_ProfilerThreadSlot();
+};
+
+static thread_local _ProfilerThreadBuffer* t_buffer = nullptr;
+static thread_local _ProfilerThreadSlot t_slot;
 static thread_local bool t_pause = false;
+// every push, the skipped ones too
 static thread_local int t_depth = 0;
-static std::vector<std::pair<ProfilerTreeInfo, ProfilerNode*>> g_profileHistory;
-static std::shared_mutex g_historyLock;
+// pushes that wrote an event
+static thread_local int t_recordDepth = 0;
+static thread_local uint64 t_rootFirstEvent = 0;
+static thread_local uint64 t_rootBeginHPC = 0;
+static thread_local const char* t_rootLabel = nullptr;
+static thread_local _ProfilerScopeCounters t_counters[PROFILER_MAX_DEPTH];
+// whether the root being recorded reads the hardware counters, decided at its push
+static thread_local bool t_rootHardware = false;
+static std::atomic<bool> g_hardwareEnabled = false;
+// guards the list, the buffers themselves are never freed
+static std::mutex g_bufferLock;
+static std::vector<_ProfilerThreadBuffer*> g_threadBuffers;
+// the thread that called ProfileInit
+static std::thread::id g_mainThreadID;
 ////////////////////////////////
 ScopeProfiler::ScopeProfiler(const char* scopeName)
 {
@@ -32,11 +138,12 @@ void ProfilerNode::AddChild(ProfilerNode* child)
 	if (child->GetParent() != this)
 	{
 		child->SetParent(this);
-		if (m_firstChild == nullptr) {
+		if (m_lastChild) {
+			m_lastChild->SetNextSibling(child);
+		} else {
 			m_firstChild = child;
 		}
-		ProfilerNode* p = m_firstChild->GetLastSibling();
-		p->SetNextSibling(child);
+		m_lastChild = child;
 	}
 
 }
@@ -104,9 +211,354 @@ static void DeleteNode(ProfilerNode* node)
 	//delete node;
 }
 
+////////////////////////////////
+_ProfilerThreadSlot::~_ProfilerThreadSlot()
+{
+	if (m_buffer) {
+		std::scoped_lock _(g_bufferLock);
+		m_buffer->m_inUse = false;
+	}
+}
+
+////////////////////////////////
+// The first push of a thread, takes over the buffer of a thread that exited if there is one
+static _ProfilerThreadBuffer* _AcquireThreadBuffer()
+{
+	std::scoped_lock _(g_bufferLock);
+	_ProfilerThreadBuffer* buffer = nullptr;
+	for (_ProfilerThreadBuffer* each : g_threadBuffers) {
+		if (!each->m_inUse) {
+			buffer = each;
+			break;
+		}
+	}
+	if (buffer) {
+		buffer->m_firstRoot = buffer->m_numRoots.load(std::memory_order_relaxed);
+	} else {
+		buffer = new (UntrackedAlloc(sizeof(_ProfilerThreadBuffer))) _ProfilerThreadBuffer();
+		buffer->m_threadIndex = (int)g_threadBuffers.size();
+		g_threadBuffers.push_back(buffer);
+	}
+	buffer->m_inUse = true;
+	buffer->m_threadID = std::this_thread::get_id();
+	t_slot.m_buffer = buffer;
+	t_buffer = buffer;
+	return buffer;
+}
+
+////////////////////////////////
+static void _WriteEvent(_ProfilerThreadBuffer* buffer, const _ProfilerEvent& event)
+{
+	const uint64 index = buffer->m_numEvents.load(std::memory_order_relaxed);
+	buffer->m_numEvents.store(index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	buffer->m_events[index & (PROFILER_EVENTS_PER_THREAD - 1)] = event;
+}
+
+////////////////////////////////
+static void _WriteRoot(_ProfilerThreadBuffer* buffer, const _ProfilerRoot& root)
+{
+	const uint64 index = buffer->m_numRoots.load(std::memory_order_relaxed);
+	buffer->m_numRootsWriting.store(index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	buffer->m_roots[index % PROFILER_MAX_RECORD] = root;
+	buffer->m_numRoots.store(index + 1, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// HARDWARE COUNTERS
+//////////////////////////////////////////////////////////////////////////
+static const char* const PROFILER_HW_NAMES[NUM_PROFILER_HW_COUNTERS] = {
+	"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+#if defined(PROFILER_HW_PERF_EVENTS)
+static const struct
+{
+	uint32_t type;
+	uint64_t config;
+} PROFILER_HW_EVENTS[NUM_PROFILER_HW_COUNTERS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+// One perf_event_open group per thread, a single read gives every counter in it
+struct _ProfilerHardwareCounters
+{
+	bool m_tried = false;
+	int m_groupFd = -1;
+	int m_numSlots = 0;
+	int m_fds[NUM_PROFILER_HW_COUNTERS];
+	// the counter of every value a read gives, in the order they were opened
+	uint8_t m_slotCounter[NUM_PROFILER_HW_COUNTERS];
+	uint8_t m_mask = 0;
+	// errno of the counters that could not be opened
+	int m_errors[NUM_PROFILER_HW_COUNTERS] = {};
+	~_ProfilerHardwareCounters();
+};
+static thread_local _ProfilerHardwareCounters t_hardware;
+
+////////////////////////////////
+_ProfilerHardwareCounters::~_ProfilerHardwareCounters()
+{
+	for (int i = 0; i < m_numSlots; ++i) {
+		close(m_fds[i]);
+	}
+}
+
+////////////////////////////////
+// Opens the counters of this thread the first time, the ones the CPU or the kernel refuse are left out.
+// /return false when none could be opened
+static bool _OpenHardwareCounters()
+{
+	_ProfilerHardwareCounters& hardware = t_hardware;
+	if (!hardware.m_tried) {
+		hardware.m_tried = true;
+		for (int counter = 0; counter < NUM_PROFILER_HW_COUNTERS; ++counter) {
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PROFILER_HW_EVENTS[counter].type;
+			attr.config = PROFILER_HW_EVENTS[counter].config;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			// the times tell how long the group was actually counting when the PMU is shared
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			// this thread on any cpu, in the group of the first counter that opened
+			const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, hardware.m_groupFd, 0);
+			if (fd < 0) {
+				hardware.m_errors[counter] = errno;
+				continue;
+			}
+			if (hardware.m_groupFd < 0) {
+				hardware.m_groupFd = fd;
+			}
+			hardware.m_fds[hardware.m_numSlots] = fd;
+			hardware.m_slotCounter[hardware.m_numSlots++] = (uint8_t)counter;
+			hardware.m_mask |= (uint8_t)(1 << counter);
+		}
+	}
+	return hardware.m_groupFd >= 0;
+}
+
+////////////////////////////////
+// When other groups share the PMU the group only counts part of the time, the values are scaled up to
+// the time it was enabled. A group that has not counted at all yet gives nothing rather than zeros.
+// /return a bit for every counter written to out_values, 0 when the read failed
+static uint8_t _ReadHardwareCounters(uint64* out_values)
+{
+	// number of values, time enabled, time running, then the values
+	uint64 values[3 + NUM_PROFILER_HW_COUNTERS];
+	const ssize_t size = read(t_hardware.m_groupFd, values, sizeof(values));
+	if (size < (ssize_t)(3 * sizeof(uint64)) || values[0] != (uint64)t_hardware.m_numSlots) {
+		return 0;
+	}
+	const uint64 enabled = values[1];
+	const uint64 running = values[2];
+	if (running == 0) {
+		return 0;
+	}
+	const double scale = running < enabled ? (double)enabled / (double)running : 1.0;
+	for (int i = 0; i < t_hardware.m_numSlots; ++i) {
+		out_values[t_hardware.m_slotCounter[i]] = scale == 1.0 ? values[3 + i] : (uint64)((double)values[3 + i] * scale);
+	}
+	return t_hardware.m_mask;
+}
+#elif defined(PROFILER_HW_THREAD_CYCLES)
+////////////////////////////////
+// User mode gets no PMU counters on Windows, only the cycles QueryThreadCycleTime gives
+static bool _OpenHardwareCounters()
+{
+	return true;
+}
+
+////////////////////////////////
+static uint8_t _ReadHardwareCounters(uint64* out_values)
+{
+	ULONG64 cycles = 0;
+	if (!::QueryThreadCycleTime(::GetCurrentThread(), &cycles)) {
+		return 0;
+	}
+	out_values[PROFILER_HW_CYCLES] = cycles;
+	return (uint8_t)(1 << PROFILER_HW_CYCLES);
+}
+#else
+////////////////////////////////
+static bool _OpenHardwareCounters()
+{
+	return false;
+}
+
+////////////////////////////////
+static uint8_t _ReadHardwareCounters(uint64*)
+{
+	return 0;
+}
+#endif
+
+////////////////////////////////
+// Two counters per event, scopes that read none get no event
+static void _WriteHardwareEvents(_ProfilerThreadBuffer* buffer, const _ProfilerScopeCounters& counters, const uint64* endValues, uint8_t mask)
+{
+	// scaled values are estimates, one can come out a little below the one before
+	auto delta = [&](int counter) -> uint64 {
+		if (counter >= NUM_PROFILER_HW_COUNTERS || !((mask >> counter) & 1) || endValues[counter] < counters.hardwareBegin[counter]) {
+			return 0;
+		}
+		return endValues[counter] - counters.hardwareBegin[counter];
+	};
+	for (int counter = 0; counter < NUM_PROFILER_HW_COUNTERS; counter += 2) {
+		const unsigned int bits = (mask >> counter) & 3;
+		if (bits) {
+			_WriteEvent(buffer, {nullptr, delta(counter), (ptrdiff_t)delta(counter + 1), bits, 0, PROFILER_EVENT_HARDWARE, (uint8_t)counter});
+		}
+	}
+}
+
+////////////////////////////////
+// /return the second counter of a hardware event when second is set
+static uint64 _GetHardwareValue(const _ProfilerEvent& event, bool second)
+{
+	return second ? (uint64)event.deltaByte : event.hpc;
+}
+
+////////////////////////////////
+bool ProfileSetHardwareCounters(bool enabled)
+{
+	if (!enabled) {
+		g_hardwareEnabled = false;
+		return true;
+	}
+#if defined(PROFILER_HW_PERF_EVENTS)
+	if (!_OpenHardwareCounters()) {
+		Log("", "No hardware counter could be opened: %s. perf_event_paranoid, a container or a VM can keep them away"
+			, strerror(t_hardware.m_errors[PROFILER_HW_CYCLES]));
+		return false;
+	}
+	for (int counter = 0; counter < NUM_PROFILER_HW_COUNTERS; ++counter) {
+		if (!((t_hardware.m_mask >> counter) & 1)) {
+			Log("", "Hardware counter %s is not available: %s", PROFILER_HW_NAMES[counter], strerror(t_hardware.m_errors[counter]));
+		}
+	}
+	g_hardwareEnabled = true;
+	return true;
+#elif defined(PROFILER_HW_THREAD_CYCLES)
+	Log("", "Only %s are counted on Windows, from QueryThreadCycleTime", PROFILER_HW_NAMES[PROFILER_HW_CYCLES]);
+	g_hardwareEnabled = true;
+	return true;
+#else
+	Log("", "No hardware counters on this platform");
+	return false;
+#endif
+}
+
+////////////////////////////////
+bool IsProfilingHardwareCounters()
+{
+	return g_hardwareEnabled;
+}
+
+////////////////////////////////
+const char* GetProfilerHardwareCounterName(ProfilerHardwareCounter counter)
+{
+	return counter < NUM_PROFILER_HW_COUNTERS ? PROFILER_HW_NAMES[counter] : "";
+}
+
+////////////////////////////////
+// /return false when the root was overwritten while it was copied, call with g_bufferLock held
+static bool _CopyRoot(const _ProfilerThreadBuffer* buffer, uint64 rootIndex, _ProfilerRoot* out_root)
+{
+	*out_root = buffer->m_roots[rootIndex % PROFILER_MAX_RECORD];
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return buffer->m_numRootsWriting.load(std::memory_order_relaxed) <= rootIndex + PROFILER_MAX_RECORD;
+}
+
+////////////////////////////////
+// Index of the oldest root still remembered and one past the newest
+static void _GetRootRange(const _ProfilerThreadBuffer* buffer, uint64* out_first, uint64* out_end)
+{
+	*out_end = buffer->m_numRoots.load(std::memory_order_acquire);
+	*out_first = std::max(buffer->m_firstRoot, *out_end > PROFILER_MAX_RECORD ? *out_end - PROFILER_MAX_RECORD : 0);
+}
+
+////////////////////////////////
+static bool _CopyEvents(const _ProfilerThreadBuffer* buffer, const _ProfilerRoot& root, std::vector<_ProfilerEvent>* out_events)
+{
+	const uint64 count = root.endEvent - root.firstEvent;
+	if (count > PROFILER_EVENTS_PER_THREAD) {
+		return false;
+	}
+	out_events->resize((size_t)count);
+	const size_t first = (size_t)(root.firstEvent & (PROFILER_EVENTS_PER_THREAD - 1));
+	const size_t untilWrap = std::min<size_t>((size_t)count, PROFILER_EVENTS_PER_THREAD - first);
+	memcpy(out_events->data(), buffer->m_events + first, untilWrap * sizeof(_ProfilerEvent));
+	memcpy(out_events->data() + untilWrap, buffer->m_events, ((size_t)count - untilWrap) * sizeof(_ProfilerEvent));
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return buffer->m_numEvents.load(std::memory_order_relaxed) <= root.firstEvent + PROFILER_EVENTS_PER_THREAD;
+}
+
+////////////////////////////////
+static ProfilerNode* _BuildTree(const std::vector<_ProfilerEvent>& events)
+{
+	ProfilerNode* root = nullptr;
+	ProfilerNode* lastEnded = nullptr;
+	std::vector<ProfilerNode*> open;
+	for (const _ProfilerEvent& event : events) {
+		if (event.type == PROFILER_EVENT_BEGIN) {
+			ProfilerNode* node = NewNode();
+			node->label = event.label;
+			node->beginHPC = event.hpc;
+			if (open.empty()) {
+				root = node;
+			} else {
+				open.back()->AddChild(node);
+			}
+			open.push_back(node);
+		} else if (event.type == PROFILER_EVENT_END) {
+			lastEnded = open.back();
+			open.pop_back();
+			lastEnded->endHPC = event.hpc;
+			lastEnded->allocs = event.allocs;
+			lastEnded->frees = event.frees;
+			lastEnded->deltaByte = event.deltaByte;
+		} else if (event.type == PROFILER_EVENT_HARDWARE) {
+			for (int second = 0; second < 2; ++second) {
+				if ((event.allocs >> second) & 1) {
+					lastEnded->hardwareCounters[event.tag + second] = _GetHardwareValue(event, second);
+					lastEnded->hardwareMask |= (uint8_t)(1 << (event.tag + second));
+				}
+			}
+		} else {
+			ProfilerTagCounters& counters = lastEnded->tagCounters[lastEnded->numTags++];
+			counters.tag = event.tag;
+			counters.allocs = event.allocs;
+			counters.frees = event.frees;
+			counters.deltaByte = event.deltaByte;
+		}
+	}
+	return root;
+}
+
+////////////////////////////////
+// /return the buffer the thread writes now, or one it left when it exited, call with g_bufferLock held
+static const _ProfilerThreadBuffer* _FindThreadBuffer(std::thread::id threadID)
+{
+	const _ProfilerThreadBuffer* found = nullptr;
+	for (const _ProfilerThreadBuffer* each : g_threadBuffers) {
+		if (each->m_threadID == threadID && (!found || each->m_inUse)) {
+			found = each;
+		}
+	}
+	return found;
+}
+
 ////////////////////////////////
 void ProfileInit()
 {
+	g_mainThreadID = std::this_thread::get_id();
 	GetBlockAllocator()->Init(GetTrackedAllocator<char*>()
 		, sizeof(ProfilerNode)
 		, alignof(ProfilerNode)
@@ -117,14 +569,27 @@ void ProfileInit()
 ////////////////////////////////
 int GetTotalProfiledFrames()
 {
-	std::scoped_lock<std::shared_mutex> _(g_historyLock);
-	return g_profileHistory.size();
+	std::scoped_lock _(g_bufferLock);
+	int total = 0;
+	for (const _ProfilerThreadBuffer* each : g_threadBuffers) {
+		uint64 first, end;
+		_GetRootRange(each, &first, &end);
+		total += (int)(end - first);
+	}
+	return total;
 }
 
 ////////////////////////////////
 void ProfileReleaseTree(ProfilerNode* node)
 {
+	if (!node) {
+		return;
+	}
+#if defined(_WIN32)
 	int newRefCount = ::InterlockedDecrement(const_cast<volatile long int*>(&(node->refCount)));
+#else
+	int newRefCount = (int)__atomic_sub_fetch(&node->refCount, 1, __ATOMIC_ACQ_REL);
+#endif
 	if (newRefCount == 0) {
 		ProfileFreeTree(node);
 	}
@@ -133,57 +598,81 @@ void ProfileReleaseTree(ProfilerNode* node)
 ////////////////////////////////
 void ProfilePush(const char* tag)
 {
-
-	if ((!t_activeNode && t_pause) || (!t_activeNode && t_depth != 0)) {
+	if ((t_recordDepth == 0 && t_pause) || (t_recordDepth == 0 && t_depth != 0)) {
 		++t_depth;
 		return;
 	}
 	++t_depth;
-	ProfilerNode* newNode = NewNode();
-	//t_activeNode->AddChild(newNode);
-	newNode->beginHPC = GetCurrentHPC();
-	strncpy_s(newNode->label, tag, std::min<size_t>(strlen(tag), PROFILER_LABEL_SIZE));
-	if (t_activeNode) {
-		t_activeNode->AddChild(newNode);
+	_ProfilerThreadBuffer* buffer = t_buffer ? t_buffer : _AcquireThreadBuffer();
+	const uint64 hpc = GetCurrentHPC();
+	if (t_recordDepth == 0) {
+		t_rootFirstEvent = buffer->m_numEvents.load(std::memory_order_relaxed);
+		t_rootBeginHPC = hpc;
+		t_rootLabel = tag;
+		t_rootHardware = g_hardwareEnabled.load(std::memory_order_relaxed) && _OpenHardwareCounters();
+	}
+	++t_recordDepth;
+	_WriteEvent(buffer, {tag, hpc, 0, 0, 0, PROFILER_EVENT_BEGIN, 0});
+	if (t_rootHardware && t_recordDepth <= PROFILER_MAX_DEPTH) {
+		_ProfilerScopeCounters& counters = t_counters[t_recordDepth - 1];
+		counters.hardwareValid = _ReadHardwareCounters(counters.hardwareBegin) != 0;
 	}
-	t_activeNode = newNode;
 }
 
 ////////////////////////////////
 void ProfilePop()
 {
 	--t_depth;
-	if (!t_activeNode) {
+	if (t_recordDepth == 0) {
 		return;
 	}
-	t_activeNode->endHPC = GetCurrentHPC();
+	if (t_recordDepth > PROFILER_MAX_DEPTH) {
+		// no counters this deep, what these scopes allocate stays with the deepest one that has them
+		_WriteEvent(t_buffer, {nullptr, GetCurrentHPC(), 0, 0, 0, PROFILER_EVENT_END, 0});
+		--t_recordDepth;
+		return;
+	}
+	_ProfilerScopeCounters& counters = t_counters[t_recordDepth - 1];
+	uint64 hardwareEnd[NUM_PROFILER_HW_COUNTERS];
+	uint8_t hardwareMask = 0;
+	if (counters.hardwareValid) {
+		hardwareMask = _ReadHardwareCounters(hardwareEnd);
+		counters.hardwareValid = false;
+	}
+	const uint64 hpc = GetCurrentHPC();
+	_ProfilerThreadBuffer* buffer = t_buffer;
+	_WriteEvent(buffer, {nullptr, hpc, counters.deltaByte, counters.allocs, counters.frees, PROFILER_EVENT_END, 0});
+	for (int i = 0; i < counters.numTags; ++i) {
+		const ProfilerTagCounters& tagCounters = counters.tagCounters[i];
+		_WriteEvent(buffer, {nullptr, 0, tagCounters.deltaByte, tagCounters.allocs, tagCounters.frees, PROFILER_EVENT_TAG, tagCounters.tag});
+	}
+	if (hardwareMask) {
+		_WriteHardwareEvents(buffer, counters, hardwareEnd, hardwareMask);
+	}
+	counters.allocs = 0;
+	counters.frees = 0;
+	counters.deltaByte = 0;
+	counters.numTags = 0;
 
-	if (t_activeNode->GetParent()) {
-		t_activeNode = t_activeNode->GetParent();
-	} else {
-		std::scoped_lock<std::shared_mutex> _(g_historyLock);
-		g_profileHistory.emplace_back(std::this_thread::get_id(), t_activeNode);
-		if (g_profileHistory.size() > PROFILER_MAX_RECORD) {
-			auto& release = g_profileHistory.front();
-			ProfileReleaseTree(release.second);
-			g_profileHistory.erase(g_profileHistory.begin());
-		}
-		t_activeNode = nullptr;
+	--t_recordDepth;
+	if (t_recordDepth == 0) {
+		_WriteRoot(buffer, {t_rootLabel, t_rootFirstEvent, buffer->m_numEvents.load(std::memory_order_relaxed), t_rootBeginHPC, hpc});
 	}
 }
 
 ////////////////////////////////
 void ProfileFreeTree(ProfilerNode* root)
 {
-	if (root->m_firstChild) {
-		ProfileFreeTree(root->m_firstChild);
-		root->m_firstChild = nullptr;
-	}
-	if (root->GetNextSibling()) {
-		ProfileFreeTree(root->GetNextSibling());
-		root->SetNextSibling(nullptr);
+	// siblings in a loop, a wide scope would go too deep otherwise
+	ProfilerNode* node = root;
+	while (node) {
+		ProfilerNode* next = node->GetNextSibling();
+		if (node->m_firstChild) {
+			ProfileFreeTree(node->m_firstChild);
+		}
+		DeleteNode(node);
+		node = next;
 	}
-	DeleteNode(root);
 }
 
 ////////////////////////////////
@@ -201,32 +690,891 @@ void ProfileResume()
 ////////////////////////////////
 ProfilerNode* RequireReferenceOfProfileTree(std::thread::id threadID, int nFromBack/*=0*/)
 {
-	std::scoped_lock<std::shared_mutex> _(g_historyLock);
-	int nCount = 0;
-	for (int i = g_profileHistory.size() - 1; i >= 0; --i) {
-		auto& hist = g_profileHistory[i];
-		if (hist.first.threadID == threadID) {
-			if (nCount == nFromBack) {
-				::InterlockedIncrement(const_cast<volatile long int*>(&(hist.second->refCount)));
-				return hist.second;
-			}
-			++nCount;
+	std::vector<_ProfilerEvent> events;
+	{
+		std::scoped_lock _(g_bufferLock);
+		const _ProfilerThreadBuffer* buffer = _FindThreadBuffer(threadID);
+		if (!buffer || nFromBack < 0) {
+			return nullptr;
+		}
+		uint64 first, end;
+		_GetRootRange(buffer, &first, &end);
+		if ((uint64)nFromBack >= end - first) {
+			return nullptr;
+		}
+		_ProfilerRoot root;
+		if (!_CopyRoot(buffer, end - 1 - nFromBack, &root) || !_CopyEvents(buffer, root, &events)) {
+			return nullptr;
 		}
 	}
-	return nullptr;
+	return _BuildTree(events);
 }
 
 ////////////////////////////////
 std::vector<float> GetFrameTimeList()
 {
-	std::lock_guard<std::shared_mutex> lk(g_historyLock);
+	// roots of every thread in the order they ended
+	std::vector<std::pair<uint64, float>> roots;
+	{
+		std::scoped_lock _(g_bufferLock);
+		for (const _ProfilerThreadBuffer* each : g_threadBuffers) {
+			uint64 first, end;
+			_GetRootRange(each, &first, &end);
+			for (uint64 i = first; i < end; ++i) {
+				_ProfilerRoot root;
+				if (_CopyRoot(each, i, &root)) {
+					roots.emplace_back(root.endHPC, (float)(HPCToSeconds(root.endHPC - root.beginHPC) * 1000000));
+				}
+			}
+		}
+	}
+	std::sort(roots.begin(), roots.end());
 	std::vector<float> ret;
-	for (auto& each : g_profileHistory) {
-		ret.push_back((float)each.second->GetTimeMicroSecond());
+	const size_t first = roots.size() > PROFILER_MAX_RECORD ? roots.size() - PROFILER_MAX_RECORD : 0;
+	for (size_t i = first; i < roots.size(); ++i) {
+		ret.push_back(roots[i].second);
 	}
 	return ret;
 }
 
+////////////////////////////////
+// Calls onRoot with the events of every root that ended since the cursors, one cursor per thread.
+// /return the roots that were overwritten before they could be read, call with g_bufferLock held
+template<typename ON_ROOT>
+static int _ConsumeNewRoots(std::vector<uint64>& nextRoot, ON_ROOT onRoot)
+{
+	int numDropped = 0;
+	nextRoot.resize(g_threadBuffers.size(), 0);
+	std::vector<_ProfilerEvent> events;
+	for (const _ProfilerThreadBuffer* buffer : g_threadBuffers) {
+		uint64& next = nextRoot[buffer->m_threadIndex];
+		uint64 first, end;
+		_GetRootRange(buffer, &first, &end);
+		if (next < first) {
+			numDropped += (int)(first - next);
+			next = first;
+		}
+		for (; next < end; ++next) {
+			_ProfilerRoot root;
+			if (!_CopyRoot(buffer, next, &root) || !_CopyEvents(buffer, root, &events)) {
+				++numDropped;
+				continue;
+			}
+			onRoot(buffer, events);
+		}
+	}
+	return numDropped;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// TRACE EXPORT
+//////////////////////////////////////////////////////////////////////////
+struct _ProfilerStream
+{
+	FILE* m_file = nullptr;
+	uint64 m_originHPC = 0;
+	uint64 m_stopHPC = 0;
+	bool m_first = true;
+	int m_numRoots = 0;
+	int m_numDropped = 0;
+	// by thread index, the next root to write and whether its thread was named yet
+	std::vector<uint64> m_nextRoot;
+	std::vector<bool> m_named;
+};
+static std::mutex g_streamLock;
+static _ProfilerStream* g_stream = nullptr;
+
+////////////////////////////////
+static void _WriteTraceThreadName(FILE* fp, int tid, bool mainThread, bool* inout_first)
+{
+	if (mainThread) {
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Main thread\"}}"
+			, *inout_first ? "" : ",\n", tid);
+	} else {
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}"
+			, *inout_first ? "" : ",\n", tid, tid);
+	}
+	*inout_first = false;
+}
+
+////////////////////////////////
+// Labels are whatever the code passed to PROFILE_SCOPE, quotes and control characters are escaped
+static void _WriteJsonString(FILE* fp, const char* text)
+{
+	for (; *text; ++text) {
+		const char c = *text;
+		if (c == '"' || c == '\\') {
+			fprintf(fp, "\\%c", c);
+		} else if ((unsigned char)c < 0x20) {
+			fprintf(fp, "\\u%04x", (unsigned char)c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+}
+
+////////////////////////////////
+// One complete event per scope, its allocations, the bytes of every memory tag and its hardware counters as args
+static void _WriteTraceEvents(FILE* fp, int tid, uint64 originHPC, const std::vector<_ProfilerEvent>& events, bool* inout_first)
+{
+	auto toMicroSecond = [originHPC](uint64 hpc) {
+		return hpc > originHPC ? HPCToSeconds(hpc - originHPC) * 1000000.0 : 0.0;
+	};
+	std::vector<const _ProfilerEvent*> open;
+	for (size_t i = 0; i < events.size(); ++i) {
+		const _ProfilerEvent& event = events[i];
+		if (event.type == PROFILER_EVENT_BEGIN) {
+			open.push_back(&event);
+			continue;
+		}
+		if (event.type != PROFILER_EVENT_END || open.empty()) {
+			continue;
+		}
+		const _ProfilerEvent& begin = *open.back();
+		open.pop_back();
+		fprintf(fp, "%s{\"name\":\"", *inout_first ? "" : ",\n");
+		_WriteJsonString(fp, begin.label);
+		fprintf(fp, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f"
+			, tid, toMicroSecond(begin.hpc), HPCToSeconds(event.hpc - begin.hpc) * 1000000.0);
+		*inout_first = false;
+		bool hasArgs = false;
+		auto beginArg = [fp, &hasArgs]() {
+			fprintf(fp, hasArgs ? "," : ",\"args\":{");
+			hasArgs = true;
+		};
+		if (event.allocs != 0 || event.frees != 0) {
+			beginArg();
+			fprintf(fp, "\"allocs\":%u,\"frees\":%u,\"bytes\":%lld", event.allocs, event.frees, (long long)event.deltaByte);
+		}
+		for (; i + 1 < events.size() && (events[i + 1].type == PROFILER_EVENT_TAG || events[i + 1].type == PROFILER_EVENT_HARDWARE); ++i) {
+			const _ProfilerEvent& extra = events[i + 1];
+			if (extra.type == PROFILER_EVENT_TAG) {
+				MemTag tag;
+				tag.id = extra.tag;
+				beginArg();
+				fprintf(fp, "\"bytes ");
+				_WriteJsonString(fp, extra.tag == PROFILER_TAG_OTHER ? "(other)" : MemGetTagName(tag));
+				fprintf(fp, "\":%lld", (long long)extra.deltaByte);
+				continue;
+			}
+			for (int second = 0; second < 2; ++second) {
+				if ((extra.allocs >> second) & 1) {
+					beginArg();
+					fprintf(fp, "\"%s\":%llu", PROFILER_HW_NAMES[extra.tag + second], _GetHardwareValue(extra, second));
+				}
+			}
+		}
+		fprintf(fp, hasArgs ? "}}" : "}");
+	}
+}
+
+////////////////////////////////
+bool ProfileExportChromeTrace(const char* path, int frames /*= 0*/)
+{
+	FILE* fp = nullptr;
+	fopen_s(&fp, path, "w");
+	if (!fp) {
+		return false;
+	}
+
+	std::scoped_lock _(g_bufferLock);
+	// the last frames roots of the main thread give the window, every thread is cut to it
+	uint64 windowHPC = 0;
+	const _ProfilerThreadBuffer* mainBuffer = _FindThreadBuffer(g_mainThreadID);
+	if (frames > 0 && mainBuffer) {
+		uint64 first, end;
+		_GetRootRange(mainBuffer, &first, &end);
+		_ProfilerRoot root;
+		if (end - first >= (uint64)frames && _CopyRoot(mainBuffer, end - frames, &root)) {
+			windowHPC = root.beginHPC;
+		}
+	}
+
+	std::vector<std::pair<const _ProfilerThreadBuffer*, _ProfilerRoot>> roots;
+	uint64 originHPC = UINT64_MAX;
+	for (const _ProfilerThreadBuffer* each : g_threadBuffers) {
+		uint64 first, end;
+		_GetRootRange(each, &first, &end);
+		for (uint64 i = first; i < end; ++i) {
+			_ProfilerRoot root;
+			if (_CopyRoot(each, i, &root) && root.endHPC >= windowHPC) {
+				roots.emplace_back(each, root);
+				originHPC = std::min(originHPC, root.beginHPC);
+			}
+		}
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	const _ProfilerThreadBuffer* named = nullptr;
+	std::vector<_ProfilerEvent> events;
+	for (auto& each : roots) {
+		if (each.first != named) {
+			_WriteTraceThreadName(fp, each.first->m_threadIndex, each.first->m_threadID == g_mainThreadID, &first);
+			named = each.first;
+		}
+		if (_CopyEvents(each.first, each.second, &events)) {
+			_WriteTraceEvents(fp, each.first->m_threadIndex, originHPC, events, &first);
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	return true;
+}
+
+////////////////////////////////
+bool ProfileStreamStart(const char* path, double seconds)
+{
+	ProfileStreamStop();
+	FILE* fp = nullptr;
+	fopen_s(&fp, path, "w");
+	if (!fp) {
+		return false;
+	}
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	_ProfilerStream* stream = new _ProfilerStream();
+	stream->m_file = fp;
+	stream->m_originHPC = GetCurrentHPC();
+	stream->m_stopHPC = stream->m_originHPC + SecondsToHPC(seconds);
+	{
+		// only roots that end from now on
+		std::scoped_lock _(g_bufferLock);
+		for (const _ProfilerThreadBuffer* each : g_threadBuffers) {
+			stream->m_nextRoot.push_back(each->m_numRoots.load(std::memory_order_acquire));
+		}
+	}
+	std::scoped_lock _(g_streamLock);
+	g_stream = stream;
+	return true;
+}
+
+////////////////////////////////
+// /call with g_streamLock held
+static void _UpdateStream(_ProfilerStream* stream)
+{
+	std::scoped_lock _(g_bufferLock);
+	stream->m_named.resize(g_threadBuffers.size(), false);
+	stream->m_numDropped += _ConsumeNewRoots(stream->m_nextRoot, [stream](const _ProfilerThreadBuffer* buffer, const std::vector<_ProfilerEvent>& events) {
+		const int index = buffer->m_threadIndex;
+		if (!stream->m_named[index]) {
+			_WriteTraceThreadName(stream->m_file, index, buffer->m_threadID == g_mainThreadID, &stream->m_first);
+			stream->m_named[index] = true;
+		}
+		_WriteTraceEvents(stream->m_file, index, stream->m_originHPC, events, &stream->m_first);
+		++stream->m_numRoots;
+	});
+}
+
+////////////////////////////////
+void ProfileStreamStop()
+{
+	std::scoped_lock _(g_streamLock);
+	if (!g_stream) {
+		return;
+	}
+	_UpdateStream(g_stream);
+	fprintf(g_stream->m_file, "\n]}\n");
+	fclose(g_stream->m_file);
+	Log("", "Profiler stream wrote %d roots, %d were overwritten before they were written", g_stream->m_numRoots, g_stream->m_numDropped);
+	delete g_stream;
+	g_stream = nullptr;
+}
+
+////////////////////////////////
+bool IsProfileStreaming()
+{
+	std::scoped_lock _(g_streamLock);
+	return g_stream != nullptr;
+}
+
+////////////////////////////////
+void ProfileStreamUpdate()
+{
+	bool done = false;
+	{
+		std::scoped_lock _(g_streamLock);
+		if (!g_stream) {
+			return;
+		}
+		_UpdateStream(g_stream);
+		done = GetCurrentHPC() >= g_stream->m_stopHPC;
+	}
+	if (done) {
+		ProfileStreamStop();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// CROSS FRAME STATS
+//////////////////////////////////////////////////////////////////////////
+// Log spaced buckets, quantiles come out within half a bucket, 2%.
+// The first bucket takes everything under the minimum, the last everything over 150s.
+static constexpr double PROFILER_SKETCH_MIN_US = 0.1;
+static constexpr double PROFILER_SKETCH_GROWTH = 1.04;
+static constexpr int PROFILER_SKETCH_BUCKETS = 540;
+
+struct _ProfilerSketch
+{
+	uint32_t m_buckets[PROFILER_SKETCH_BUCKETS] = {};
+	uint64 m_count = 0;
+	double m_sum = 0.0;
+	double m_min = DBL_MAX;
+	double m_max = 0.0;
+
+	void Add(double microSecond)
+	{
+		int bucket = 0;
+		if (microSecond > PROFILER_SKETCH_MIN_US) {
+			bucket = 1 + (int)(std::log(microSecond / PROFILER_SKETCH_MIN_US) / std::log(PROFILER_SKETCH_GROWTH));
+			bucket = std::min(bucket, PROFILER_SKETCH_BUCKETS - 1);
+		}
+		++m_buckets[bucket];
+		++m_count;
+		m_sum += microSecond;
+		m_min = std::min(m_min, microSecond);
+		m_max = std::max(m_max, microSecond);
+	}
+
+	double GetQuantile(double q) const
+	{
+		const double rank = q * (double)(m_count - 1);
+		uint64 below = 0;
+		int bucket = 0;
+		for (; bucket < PROFILER_SKETCH_BUCKETS - 1; ++bucket) {
+			below += m_buckets[bucket];
+			if ((double)below > rank) {
+				break;
+			}
+		}
+		// geometric middle of the bucket, the exact ends where they are tighter
+		const double middle = bucket == 0 ? PROFILER_SKETCH_MIN_US : PROFILER_SKETCH_MIN_US * std::pow(PROFILER_SKETCH_GROWTH, bucket - 0.5);
+		return std::clamp(middle, m_min, m_max);
+	}
+
+	ProfilerTimeStats GetStats() const
+	{
+		ProfilerTimeStats stats;
+		if (m_count == 0) {
+			return stats;
+		}
+		stats.minMicroSecond = m_min;
+		stats.meanMicroSecond = m_sum / (double)m_count;
+		stats.p50MicroSecond = GetQuantile(0.5);
+		stats.p95MicroSecond = GetQuantile(0.95);
+		stats.p99MicroSecond = GetQuantile(0.99);
+		stats.maxMicroSecond = m_max;
+		return stats;
+	}
+};
+
+struct _ProfilerLabelStats
+{
+	std::string m_label;
+	_ProfilerSketch m_inclusive;
+	_ProfilerSketch m_self;
+};
+
+struct _ProfilerStatsOpenScope
+{
+	const char* label;
+	uint64 beginHPC;
+	uint64 childrenHPC;
+};
+
+// guards everything below, taken before g_bufferLock
+static std::mutex g_statsLock;
+static std::vector<uint64> g_statsNextRoot;
+// same text from different places is one label, the pointer map only saves the string compare
+static std::map<std::string, _ProfilerLabelStats*> g_statsByLabel;
+static std::unordered_map<const char*, _ProfilerLabelStats*> g_statsByPointer;
+static int g_statsDropped = 0;
+
+////////////////////////////////
+static _ProfilerLabelStats* _GetLabelStats(const char* label)
+{
+	auto found = g_statsByPointer.find(label);
+	if (found != g_statsByPointer.end()) {
+		return found->second;
+	}
+	_ProfilerLabelStats*& byLabel = g_statsByLabel[label];
+	if (!byLabel) {
+		byLabel = new _ProfilerLabelStats();
+		byLabel->m_label = label;
+	}
+	g_statsByPointer[label] = byLabel;
+	return byLabel;
+}
+
+////////////////////////////////
+// /call with g_statsLock held
+static void _UpdateStats()
+{
+	std::scoped_lock _(g_bufferLock);
+	std::vector<_ProfilerStatsOpenScope> open;
+	g_statsDropped += _ConsumeNewRoots(g_statsNextRoot, [&open](const _ProfilerThreadBuffer*, const std::vector<_ProfilerEvent>& events) {
+		open.clear();
+		for (const _ProfilerEvent& event : events) {
+			if (event.type == PROFILER_EVENT_BEGIN) {
+				open.push_back({event.label, event.hpc, 0});
+			} else if (event.type == PROFILER_EVENT_END && !open.empty()) {
+				const _ProfilerStatsOpenScope scope = open.back();
+				open.pop_back();
+				const uint64 inclusiveHPC = event.hpc - scope.beginHPC;
+				_ProfilerLabelStats* stats = _GetLabelStats(scope.label);
+				stats->m_inclusive.Add(HPCToSeconds(inclusiveHPC) * 1000000.0);
+				stats->m_self.Add(HPCToSeconds(inclusiveHPC - std::min(scope.childrenHPC, inclusiveHPC)) * 1000000.0);
+				if (!open.empty()) {
+					open.back().childrenHPC += inclusiveHPC;
+				}
+			}
+		}
+	});
+}
+
+////////////////////////////////
+void ProfileStatsUpdate()
+{
+	std::scoped_lock _(g_statsLock);
+	_UpdateStats();
+}
+
+////////////////////////////////
+void ProfileStatsReset()
+{
+	std::scoped_lock _(g_statsLock);
+	{
+		// what ended so far is not counted
+		std::scoped_lock __(g_bufferLock);
+		g_statsNextRoot.resize(g_threadBuffers.size(), 0);
+		for (const _ProfilerThreadBuffer* each : g_threadBuffers) {
+			g_statsNextRoot[each->m_threadIndex] = each->m_numRoots.load(std::memory_order_acquire);
+		}
+	}
+	for (auto& each : g_statsByLabel) {
+		delete each.second;
+	}
+	g_statsByLabel.clear();
+	g_statsByPointer.clear();
+	g_statsDropped = 0;
+}
+
+////////////////////////////////
+std::vector<ProfilerScopeStats> GetProfileStats()
+{
+	std::scoped_lock _(g_statsLock);
+	_UpdateStats();
+	std::vector<ProfilerScopeStats> ret;
+	for (auto& each : g_statsByLabel) {
+		ProfilerScopeStats stats;
+		stats.label = each.first;
+		stats.count = each.second->m_inclusive.m_count;
+		stats.inclusive = each.second->m_inclusive.GetStats();
+		stats.self = each.second->m_self.GetStats();
+		ret.push_back(stats);
+	}
+	return ret;
+}
+
+////////////////////////////////
+void ShowStatsView(bool self /*= false*/, int maxRows /*= 30*/)
+{
+	std::vector<ProfilerScopeStats> stats = GetProfileStats();
+	// the long tail first
+	std::sort(stats.begin(), stats.end(), [self](const ProfilerScopeStats& a, const ProfilerScopeStats& b) {
+		return (self ? a.self : a.inclusive).p99MicroSecond > (self ? b.self : b.inclusive).p99MicroSecond;
+	});
+	int dropped;
+	{
+		std::scoped_lock _(g_statsLock);
+		dropped = g_statsDropped;
+	}
+	Log("", "%s time of every label, %d roots were overwritten before they were counted", self ? "Self" : "Inclusive", dropped);
+	Log("", "%-36.36s %10s %10s %10s %10s %10s %10s %10s", "LABEL", "CAL", "MIN(us)", "AVG(us)", "P50(us)", "P95(us)", "P99(us)", "MAX(us)");
+	for (int i = 0; i < (int)stats.size() && i < maxRows; ++i) {
+		const ProfilerTimeStats& time = self ? stats[i].self : stats[i].inclusive;
+		Log("", "%-36.36s %10llu %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f", stats[i].label.c_str(), stats[i].count
+			, time.minMicroSecond, time.meanMicroSecond, time.p50MicroSecond, time.p95MicroSecond, time.p99MicroSecond, time.maxMicroSecond);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// HITCH CAPTURE
+//////////////////////////////////////////////////////////////////////////
+// A root copied out of its ring, the ring can lap it from now on
+struct _ProfilerPinnedRoot
+{
+	int m_threadIndex = 0;
+	bool m_mainThread = false;
+	const char* m_label = nullptr;
+	uint64 m_beginHPC = 0;
+	uint64 m_endHPC = 0;
+	std::vector<_ProfilerEvent> m_events;
+};
+
+struct _ProfilerHitch
+{
+	int m_id = 0;
+	const char* m_label = nullptr;
+	uint64 m_beginHPC = 0;
+	uint64 m_endHPC = 0;
+	// from the first frame kept before the hitch to the last one after it
+	uint64 m_windowBeginHPC = 0;
+	uint64 m_windowEndHPC = 0;
+	int m_framesBefore = 0;
+	int m_framesAfter = 0;
+	// main thread frames that still have to end before it is written
+	int m_framesLeft = 0;
+	bool m_written = false;
+	// by thread index, the first root not pinned yet
+	std::vector<uint64> m_nextRoot;
+	std::vector<_ProfilerPinnedRoot> m_roots;
+	int m_numLogLines = 0;
+	std::string m_path;
+};
+
+// guards everything below, taken before g_bufferLock
+static std::mutex g_hitchLock;
+static uint64 g_hitchBudgetHPC = 0;
+static std::string g_hitchLabel;
+static int g_hitchSurroundingFrames = 2;
+static uint64 g_hitchNextMainRoot = 0;
+static int g_nextHitchID = 1;
+// when the last hitches were written, a frame that spans it is not a hitch of its own
+static uint64 g_hitchWriteBeginHPC = 0;
+static uint64 g_hitchWriteEndHPC = 0;
+// oldest first
+static std::deque<_ProfilerHitch*> g_hitches;
+
+////////////////////////////////
+static bool _IsSameLabel(const char* a, const char* b)
+{
+	return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+////////////////////////////////
+// Main thread roots that count as frames, every one of them when no label is set
+static bool _IsHitchFrame(const char* label)
+{
+	return g_hitchLabel.empty() || _IsSameLabel(label, g_hitchLabel.c_str());
+}
+
+////////////////////////////////
+// Copies the roots of every thread that ended since the last call and do not end before the window,
+// the ones that begin after it are thrown away when the hitch is written. Call with g_bufferLock held
+static void _PinHitchRoots(_ProfilerHitch* hitch)
+{
+	hitch->m_nextRoot.resize(g_threadBuffers.size(), 0);
+	for (const _ProfilerThreadBuffer* buffer : g_threadBuffers) {
+		uint64& next = hitch->m_nextRoot[buffer->m_threadIndex];
+		uint64 first, end;
+		_GetRootRange(buffer, &first, &end);
+		for (next = std::max(next, first); next < end; ++next) {
+			_ProfilerRoot root;
+			if (!_CopyRoot(buffer, next, &root) || root.endHPC < hitch->m_windowBeginHPC) {
+				continue;
+			}
+			_ProfilerPinnedRoot& pinned = hitch->m_roots.emplace_back();
+			if (!_CopyEvents(buffer, root, &pinned.m_events)) {
+				hitch->m_roots.pop_back();
+				continue;
+			}
+			pinned.m_threadIndex = buffer->m_threadIndex;
+			pinned.m_mainThread = buffer->m_threadID == g_mainThreadID;
+			pinned.m_label = root.label;
+			pinned.m_beginHPC = root.beginHPC;
+			pinned.m_endHPC = root.endHPC;
+		}
+	}
+}
+
+////////////////////////////////
+// /call with g_bufferLock held
+static _ProfilerHitch* _BeginHitch(const _ProfilerThreadBuffer* mainBuffer, uint64 rootIndex, const _ProfilerRoot& root)
+{
+	_ProfilerHitch* hitch = new _ProfilerHitch();
+	hitch->m_id = g_nextHitchID++;
+	hitch->m_label = root.label;
+	hitch->m_beginHPC = root.beginHPC;
+	hitch->m_endHPC = root.endHPC;
+	hitch->m_windowBeginHPC = root.beginHPC;
+	hitch->m_windowEndHPC = root.endHPC;
+	hitch->m_framesLeft = g_hitchSurroundingFrames;
+	// as many frames before it as the ring still remembers
+	uint64 first, end;
+	_GetRootRange(mainBuffer, &first, &end);
+	for (uint64 i = rootIndex; i > first && hitch->m_framesBefore < g_hitchSurroundingFrames; --i) {
+		_ProfilerRoot before;
+		if (_CopyRoot(mainBuffer, i - 1, &before) && _IsHitchFrame(before.label)) {
+			hitch->m_windowBeginHPC = before.beginHPC;
+			++hitch->m_framesBefore;
+		}
+	}
+	g_hitches.push_back(hitch);
+	return hitch;
+}
+
+////////////////////////////////
+// Trace of the window with the log lines as instant events on the main thread.
+// /call with g_hitchLock held, not g_bufferLock, the log is flushed first
+static void _WriteHitch(_ProfilerHitch* hitch)
+{
+	hitch->m_written = true;
+	const uint64 windowEndHPC = hitch->m_windowEndHPC;
+	hitch->m_roots.erase(std::remove_if(hitch->m_roots.begin(), hitch->m_roots.end(), [windowEndHPC](const _ProfilerPinnedRoot& each) {
+		return each.m_beginHPC > windowEndHPC;
+	}), hitch->m_roots.end());
+	std::stable_sort(hitch->m_roots.begin(), hitch->m_roots.end(), [](const _ProfilerPinnedRoot& a, const _ProfilerPinnedRoot& b) {
+		return a.m_threadIndex != b.m_threadIndex ? a.m_threadIndex < b.m_threadIndex : a.m_beginHPC < b.m_beginHPC;
+	});
+
+	const std::vector<LogHistoryLine> lines = LogGetHistory(hitch->m_windowBeginHPC, hitch->m_windowEndHPC);
+	hitch->m_numLogLines = (int)lines.size();
+
+	const std::string path = Stringf("logs/hitch_%d.json", hitch->m_id);
+	FILE* fp = nullptr;
+	fopen_s(&fp, path.c_str(), "w");
+	if (!fp) {
+		Log("", "Hitch %d: cannot write %s", hitch->m_id, path.c_str());
+		return;
+	}
+	const uint64 originHPC = hitch->m_windowBeginHPC;
+	auto toMicroSecond = [originHPC](uint64 hpc) {
+		return hpc > originHPC ? HPCToSeconds(hpc - originHPC) * 1000000.0 : 0.0;
+	};
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	int named = -1;
+	int mainIndex = 0;
+	for (const _ProfilerPinnedRoot& each : hitch->m_roots) {
+		if (each.m_threadIndex != named) {
+			_WriteTraceThreadName(fp, each.m_threadIndex, each.m_mainThread, &first);
+			named = each.m_threadIndex;
+		}
+		if (each.m_mainThread) {
+			mainIndex = each.m_threadIndex;
+		}
+		_WriteTraceEvents(fp, each.m_threadIndex, originHPC, each.m_events, &first);
+	}
+	fprintf(fp, "%s{\"name\":\"Hitch %.3fms\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}"
+		, first ? "" : ",\n", HPCToSeconds(hitch->m_endHPC - hitch->m_beginHPC) * 1000.0, mainIndex, toMicroSecond(hitch->m_beginHPC));
+	for (const LogHistoryLine& line : lines) {
+		fprintf(fp, ",\n{\"name\":\"");
+		_WriteJsonString(fp, line.text.c_str());
+		fprintf(fp, "\",\"cat\":\"log\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", mainIndex, toMicroSecond(line.hpc));
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	hitch->m_path = path;
+	Log("", "Hitch %d: %s took %.3fms, %d roots and %d log lines written to %s", hitch->m_id, hitch->m_label
+		, HPCToSeconds(hitch->m_endHPC - hitch->m_beginHPC) * 1000.0, (int)hitch->m_roots.size(), hitch->m_numLogLines, path.c_str());
+}
+
+////////////////////////////////
+// Forgets the oldest written hitch when the list is full, the ones still capturing are kept.
+// /return false when every kept hitch is still capturing, call with g_hitchLock held
+static bool _MakeRoomForHitch()
+{
+	if ((int)g_hitches.size() < PROFILER_MAX_HITCHES) {
+		return true;
+	}
+	for (auto it = g_hitches.begin(); it != g_hitches.end(); ++it) {
+		if ((*it)->m_written) {
+			delete *it;
+			g_hitches.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////
+void ProfileSetHitchBudget(double milliSecond, const char* rootLabel /*= "App::RunFrame"*/, int surroundingFrames /*= 2*/)
+{
+	std::scoped_lock _(g_hitchLock);
+	g_hitchBudgetHPC = milliSecond > 0 ? std::max<uint64>(SecondsToHPC(milliSecond / 1000.0), 1) : 0;
+	g_hitchLabel = rootLabel ? rootLabel : "";
+	g_hitchSurroundingFrames = std::max(surroundingFrames, 0);
+	// frames that ended before this are not looked at
+	std::scoped_lock __(g_bufferLock);
+	const _ProfilerThreadBuffer* mainBuffer = _FindThreadBuffer(g_mainThreadID);
+	g_hitchNextMainRoot = mainBuffer ? mainBuffer->m_numRoots.load(std::memory_order_acquire) : 0;
+}
+
+////////////////////////////////
+void ProfileHitchUpdate()
+{
+	std::scoped_lock _(g_hitchLock);
+	std::vector<_ProfilerHitch*> done;
+	{
+		std::scoped_lock __(g_bufferLock);
+		const _ProfilerThreadBuffer* mainBuffer = _FindThreadBuffer(g_mainThreadID);
+		if (!mainBuffer) {
+			return;
+		}
+		uint64 first, end;
+		_GetRootRange(mainBuffer, &first, &end);
+		for (g_hitchNextMainRoot = std::max(g_hitchNextMainRoot, first); g_hitchNextMainRoot < end; ++g_hitchNextMainRoot) {
+			_ProfilerRoot root;
+			if (!_CopyRoot(mainBuffer, g_hitchNextMainRoot, &root) || !_IsHitchFrame(root.label)) {
+				continue;
+			}
+			for (_ProfilerHitch* each : g_hitches) {
+				if (each->m_framesLeft > 0 && root.beginHPC >= each->m_endHPC) {
+					++each->m_framesAfter;
+					each->m_windowEndHPC = root.endHPC;
+					if (--each->m_framesLeft == 0) {
+						done.push_back(each);
+					}
+				}
+			}
+			const bool spansWrite = root.beginHPC <= g_hitchWriteEndHPC && root.endHPC >= g_hitchWriteBeginHPC;
+			if (g_hitchBudgetHPC > 0 && root.endHPC - root.beginHPC > g_hitchBudgetHPC && !spansWrite && _MakeRoomForHitch()) {
+				_ProfilerHitch* hitch = _BeginHitch(mainBuffer, g_hitchNextMainRoot, root);
+				if (hitch->m_framesLeft == 0) {
+					done.push_back(hitch);
+				}
+			}
+		}
+		// the new hitches pin what is left of their past, the others what ended since last frame
+		for (_ProfilerHitch* each : g_hitches) {
+			if (!each->m_written) {
+				_PinHitchRoots(each);
+			}
+		}
+	}
+	if (done.empty()) {
+		return;
+	}
+	g_hitchWriteBeginHPC = GetCurrentHPC();
+	for (_ProfilerHitch* each : done) {
+		_WriteHitch(each);
+	}
+	g_hitchWriteEndHPC = GetCurrentHPC();
+}
+
+////////////////////////////////
+void ProfileClearHitches()
+{
+	std::scoped_lock _(g_hitchLock);
+	for (_ProfilerHitch* each : g_hitches) {
+		delete each;
+	}
+	g_hitches.clear();
+}
+
+////////////////////////////////
+std::vector<ProfilerHitchInfo> GetProfileHitches()
+{
+	std::scoped_lock _(g_hitchLock);
+	std::vector<ProfilerHitchInfo> ret;
+	for (const _ProfilerHitch* each : g_hitches) {
+		ProfilerHitchInfo info;
+		info.id = each->m_id;
+		info.label = each->m_label ? each->m_label : "";
+		info.milliSecond = HPCToSeconds(each->m_endHPC - each->m_beginHPC) * 1000.0;
+		info.framesBefore = each->m_framesBefore;
+		info.framesAfter = each->m_framesAfter;
+		info.numRoots = (int)each->m_roots.size();
+		info.numLogLines = each->m_numLogLines;
+		info.path = each->m_path;
+		ret.push_back(info);
+	}
+	return ret;
+}
+
+////////////////////////////////
+void ShowHitchesView()
+{
+	const std::vector<ProfilerHitchInfo> hitches = GetProfileHitches();
+	Log("", "%d hitches kept, the oldest first", (int)hitches.size());
+	Log("", "%6s %-36.36s %10s %8s %8s %8s %8s %s", "ID", "LABEL", "TIME(ms)", "BEFORE", "AFTER", "ROOTS", "LOGS", "FILE");
+	for (const ProfilerHitchInfo& each : hitches) {
+		Log("", "%6d %-36.36s %10.3f %8d %8d %8d %8d %s", each.id, each.label.c_str(), each.milliSecond
+			, each.framesBefore, each.framesAfter, each.numRoots, each.numLogLines, each.path.empty() ? "(capturing)" : each.path.c_str());
+	}
+}
+
+////////////////////////////////
+// The main thread root of a frame of the hitch and the roots of the other threads overlapping it.
+// /return false when there is no such frame, call with g_hitchLock held
+static bool _GetHitchFrame(int hitchID, int frame, std::vector<const _ProfilerPinnedRoot*>* out_roots)
+{
+	const _ProfilerHitch* hitch = nullptr;
+	for (const _ProfilerHitch* each : g_hitches) {
+		if (each->m_id == hitchID) {
+			hitch = each;
+		}
+	}
+	if (!hitch) {
+		return false;
+	}
+	// pinned roots are in begin order within a thread once written, not before
+	std::vector<const _ProfilerPinnedRoot*> frames;
+	for (const _ProfilerPinnedRoot& each : hitch->m_roots) {
+		if (each.m_mainThread && _IsSameLabel(each.m_label, hitch->m_label) && each.m_beginHPC <= hitch->m_windowEndHPC) {
+			frames.push_back(&each);
+		}
+	}
+	std::sort(frames.begin(), frames.end(), [](const _ProfilerPinnedRoot* a, const _ProfilerPinnedRoot* b) {
+		return a->m_beginHPC < b->m_beginHPC;
+	});
+	int hitchFrame = -1;
+	for (int i = 0; i < (int)frames.size(); ++i) {
+		if (frames[i]->m_beginHPC == hitch->m_beginHPC) {
+			hitchFrame = i;
+		}
+	}
+	if (hitchFrame < 0 || hitchFrame + frame < 0 || hitchFrame + frame >= (int)frames.size()) {
+		return false;
+	}
+	const _ProfilerPinnedRoot* main = frames[hitchFrame + frame];
+	out_roots->push_back(main);
+	for (const _ProfilerPinnedRoot& each : hitch->m_roots) {
+		if (!each.m_mainThread && each.m_endHPC >= main->m_beginHPC && each.m_beginHPC <= main->m_endHPC) {
+			out_roots->push_back(&each);
+		}
+	}
+	return true;
+}
+
+////////////////////////////////
+ProfilerNode* RequireReferenceOfHitchTree(int hitchID, int frame /*= 0*/)
+{
+	std::scoped_lock _(g_hitchLock);
+	std::vector<const _ProfilerPinnedRoot*> roots;
+	if (!_GetHitchFrame(hitchID, frame, &roots)) {
+		return nullptr;
+	}
+	return _BuildTree(roots.front()->m_events);
+}
+
+////////////////////////////////
+void ShowHitchTreeView(int hitchID, int frame /*= 0*/, bool flat /*= false*/, bool sortBySelf /*= true*/)
+{
+	std::vector<std::pair<int, ProfilerNode*>> trees;
+	{
+		std::scoped_lock _(g_hitchLock);
+		std::vector<const _ProfilerPinnedRoot*> roots;
+		if (!_GetHitchFrame(hitchID, frame, &roots)) {
+			Log("", "No frame %d in hitch %d, it was forgotten or is still being captured", frame, hitchID);
+			return;
+		}
+		for (const _ProfilerPinnedRoot* each : roots) {
+			trees.emplace_back(each->m_threadIndex, _BuildTree(each->m_events));
+		}
+	}
+	for (int i = 0; i < (int)trees.size(); ++i) {
+		Log("", "Hitch %d frame %d, %s %d", hitchID, frame, i == 0 ? "main thread" : "thread", trees[i].first);
+		if (flat) {
+			ShowFlatView(trees[i].second, sortBySelf);
+		} else {
+			ShowTreeView(trees[i].second, sortBySelf);
+		}
+		ProfileReleaseTree(trees[i].second);
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////
 // PROFILE REPORT
 //////////////////////////////////////////////////////////////////////////
@@ -234,11 +1582,11 @@ std::vector<float> GetFrameTimeList()
 //////////////////////////////////////////////////////////////////////////
 #if MEM_TRACKING > MEM_TRACKING_DISABLE
 
-#define PROFILE_REPORT_HEAD_FMT "%-36.36s %12.12s %12.12s %12.12s %12.12s %12.12s %9.9s %9.9s %18.18s"
-#define PROFILE_REPORT_FMT      "%-36.36s %12d %9.3fs %11.2f%% %9.3fs %11.2f%% %9d %9d %18.18s"
+#define PROFILE_REPORT_HEAD_FMT "%-36.36s %12.12s %12.12s %12.12s %12.12s %12.12s %9.9s %9.9s %18.18s%s"
+#define PROFILE_REPORT_FMT      "%-36.36s %12d %9.3fs %11.2f%% %9.3fs %11.2f%% %9d %9d %18.18s%s"
 #else
-#define PROFILE_REPORT_HEAD_FMT "%-36.36s %12.12s %12.12s %12.12s %12.12s %12.12s"
-#define PROFILE_REPORT_FMT      "%-36.36s %12d %10.3fs %11.2f%% %10.3fs %11.2f%%"
+#define PROFILE_REPORT_HEAD_FMT "%-36.36s %12.12s %12.12s %12.12s %12.12s %12.12s%s"
+#define PROFILE_REPORT_FMT      "%-36.36s %12d %10.3fs %11.2f%% %10.3fs %11.2f%%%s"
 #endif
 
 struct ProfilerReportNode
@@ -253,6 +1601,9 @@ struct ProfilerReportNode
 	int totalAllocs = 0;
 	int totalFrees = 0;
 	int deltaBytes = 0;
+	// summed over the calls, children included like the enclosed time
+	uint64 hardwareCounters[NUM_PROFILER_HW_COUNTERS] = {};
+	uint8_t hardwareMask = 0;
 
 	ProfilerReportNode* firstChild = nullptr;
 	ProfilerReportNode* nextSibling = nullptr;
@@ -288,22 +1639,82 @@ static bool _IsTotalTimeGreater(ProfilerReportNode*& a, ProfilerReportNode*& b)
 }
 
 
+////////////////////////////////
+static void _AddHardwareCounters(ProfilerReportNode* report, const ProfilerNode* node)
+{
+	for (int counter = 0; counter < NUM_PROFILER_HW_COUNTERS; ++counter) {
+		report->hardwareCounters[counter] += node->hardwareCounters[counter];
+	}
+	report->hardwareMask |= node->hardwareMask;
+}
+
+////////////////////////////////
+// Counters any scope of the tree read
+static uint8_t _GetHardwareMask(const ProfilerNode* profileTree)
+{
+	uint8_t mask = profileTree->hardwareMask;
+	for (const ProfilerNode* child = profileTree->m_firstChild; child; child = child->m_nextSibling) {
+		mask |= _GetHardwareMask(child);
+	}
+	return mask;
+}
+
+////////////////////////////////
+// Nothing when the tree read no hardware counter
+static std::string _GetHardwareHead(uint8_t treeMask)
+{
+	if (!treeMask) {
+		return "";
+	}
+	return Stringf(" %12s %12s %6s %12s %12s %12s", "CYC", "INS", "IPC", "L1DM", "LLCM", "BRM");
+}
+
+////////////////////////////////
+static std::string _GetHardwareColumns(const ProfilerReportNode* report, uint8_t treeMask)
+{
+	if (!treeMask) {
+		return "";
+	}
+	std::string columns;
+	for (int counter = 0; counter < NUM_PROFILER_HW_COUNTERS; ++counter) {
+		if ((report->hardwareMask >> counter) & 1) {
+			columns += Stringf(" %12llu", report->hardwareCounters[counter]);
+		} else {
+			columns += Stringf(" %12s", "-");
+		}
+		if (counter == PROFILER_HW_INSTRUCTIONS) {
+			const uint64 cycles = report->hardwareCounters[PROFILER_HW_CYCLES];
+			if ((report->hardwareMask & 3) == 3 && cycles > 0) {
+				columns += Stringf(" %6.2f", (double)report->hardwareCounters[PROFILER_HW_INSTRUCTIONS] / (double)cycles);
+			} else {
+				columns += Stringf(" %6s", "-");
+			}
+		}
+	}
+	return columns;
+}
+
 ////////////////////////////////
 static void _Free_View(ProfilerReportNode* view);
 static void _Gen_TreeView(ProfilerNode* profileTree, ProfilerReportNode* writeTo);
-static void _ShowTreeView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf = true);
+static void _ShowTreeView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf = true, uint8_t treeMask = 0);
 static void _Gen_FlatView(ProfilerNode* profileTree, ProfilerReportNode* writeTo);
-static void _ShowFlatView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf = true);
+static void _ShowFlatView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf = true, uint8_t treeMask = 0);
 ////////////////////////////////
 void ShowTreeView(ProfilerNode* profileTree, bool sortBySelf)
 {
+	if (!profileTree) {
+		Log("", "No such profiled frame, it was overwritten or never recorded");
+		return;
+	}
+	const uint8_t treeMask = _GetHardwareMask(profileTree);
 #if MEM_TRACKING > MEM_TRACKING_DISABLE
 	Log("", PROFILE_REPORT_HEAD_FMT
-		, "LABEL", "CAL", "ENC", "ENC%", "SLF", "SLF%", "ALC", "FRE", "DLT"
+		, "LABEL", "CAL", "ENC", "ENC%", "SLF", "SLF%", "ALC", "FRE", "DLT", _GetHardwareHead(treeMask).c_str()
 	);
 #else
 	Log("", PROFILE_REPORT_HEAD_FMT
-		, "LABEL", "CAL", "ENC", "ENC%", "SLF", "SLF%"
+		, "LABEL", "CAL", "ENC", "ENC%", "SLF", "SLF%", _GetHardwareHead(treeMask).c_str()
 	);
 #endif
 	ProfilerReportNode* report = new ProfilerReportNode();
@@ -312,20 +1723,25 @@ void ShowTreeView(ProfilerNode* profileTree, bool sortBySelf)
 	report->parent = nullptr;
 	report->enclosedMicroSecond = profileTree->GetTimeMicroSecond();
 	_Gen_TreeView(profileTree, report);
-	_ShowTreeView_Impl(report, 0, sortBySelf);
+	_ShowTreeView_Impl(report, 0, sortBySelf, treeMask);
 	_Free_View(report);
 }
 
 ////////////////////////////////
 void ShowFlatView(ProfilerNode* profileTree, bool sortBySelf)
 {
+	if (!profileTree) {
+		Log("", "No such profiled frame, it was overwritten or never recorded");
+		return;
+	}
+	const uint8_t treeMask = _GetHardwareMask(profileTree);
 #if MEM_TRACKING > MEM_TRACKING_DISABLE
 	Log("", PROFILE_REPORT_HEAD_FMT
-		, "LABEL", "CAL", "ENC", "ENC%", "SLF", "SLF%", "ALC", "FRE", "DLT"
+		, "LABEL", "CAL", "ENC", "ENC%", "SLF", "SLF%", "ALC", "FRE", "DLT", _GetHardwareHead(treeMask).c_str()
 	);
 #else
 	Log("", PROFILE_REPORT_HEAD_FMT
-		, "LABEL", "CAL", "ENC", "ENC%", "SLF", "SLF%"
+		, "LABEL", "CAL", "ENC", "ENC%", "SLF", "SLF%", _GetHardwareHead(treeMask).c_str()
 	);
 #endif
 	ProfilerReportNode* report = new ProfilerReportNode();
@@ -337,8 +1753,9 @@ void ShowFlatView(ProfilerNode* profileTree, bool sortBySelf)
 	report->firstChild->parent = report;
 	report->firstChild->label = profileTree->label;
 	report->firstChild->enclosedMicroSecond = profileTree->GetTimeMicroSecond();
+	_AddHardwareCounters(report->firstChild, profileTree);
 	_Gen_FlatView(profileTree, report);
-	_ShowFlatView_Impl(report, 0, sortBySelf);
+	_ShowFlatView_Impl(report, 0, sortBySelf, treeMask);
 	_Free_View(report);
 }
 
@@ -352,6 +1769,7 @@ void _Gen_TreeView(ProfilerNode* profileTree, ProfilerReportNode* writeTo)
 		writeTo = new ProfilerReportNode();
 	}*/
 	++writeTo->calls;
+	_AddHardwareCounters(writeTo, profileTree);
 	writeTo->totalAllocs += profileTree->allocs;
 	writeTo->totalFrees += profileTree->frees;
 	writeTo->deltaBytes += profileTree->deltaByte;
@@ -405,7 +1823,7 @@ void _Free_View(ProfilerReportNode* view)
 }
 
 ////////////////////////////////
-void _ShowTreeView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf)
+void _ShowTreeView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf, uint8_t treeMask)
 {
 	if (!report) {
 		return;
@@ -429,6 +1847,7 @@ void _ShowTreeView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf)
 		, report->totalAllocs
 		, report->totalFrees
 		, GetByteSizeString(report->deltaBytes).c_str()
+		, _GetHardwareColumns(report, treeMask).c_str()
 	);
 #else
 	Log(""
@@ -439,6 +1858,7 @@ void _ShowTreeView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf)
 		, report->parent ? report->enclosedMicroSecond / report->parent->enclosedMicroSecond * 100.0 : 100.00
 		, report->enclosedMicroSecond - report->childrenMicroSecond
 		, (report->enclosedMicroSecond - report->childrenMicroSecond) / report->enclosedMicroSecond * 100.0
+		, _GetHardwareColumns(report, treeMask).c_str()
 	);
 #endif
 	//Log("P", "%s%s\t%.5fus", pre.c_str(), report->label, report->GetTimeMicroSecond());
@@ -456,7 +1876,7 @@ void _ShowTreeView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf)
 		std::sort(std::begin(children), std::end(children), _IsTotalTimeGreater);
 	}
 	for (auto& each : children) {
-		_ShowTreeView_Impl(each, depth + 1, sortBySelf);
+		_ShowTreeView_Impl(each, depth + 1, sortBySelf, treeMask);
 	}
 }
 
@@ -491,6 +1911,7 @@ void _Gen_FlatView(ProfilerNode* profileTree, ProfilerReportNode* writeTo)
 		pReport->totalFrees += pChild->frees;
 		pReport->deltaBytes += pChild->deltaByte;
 		++pReport->calls;
+		_AddHardwareCounters(pReport, pChild);
 		pReport->enclosedMicroSecond += pChild->GetTimeMicroSecond();
 		writeTo->childrenMicroSecond += pChild->GetTimeMicroSecond();
 		_Gen_FlatView(pChild, writeTo);
@@ -500,7 +1921,7 @@ void _Gen_FlatView(ProfilerNode* profileTree, ProfilerReportNode* writeTo)
 }
 
 ////////////////////////////////
-void _ShowFlatView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf)
+void _ShowFlatView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf, uint8_t treeMask)
 {
 	if (!report) {
 		return;
@@ -524,6 +1945,7 @@ void _ShowFlatView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf)
 			, report->totalAllocs
 			, report->totalFrees
 			, GetByteSizeString(report->deltaBytes).c_str()
+			, _GetHardwareColumns(report, treeMask).c_str()
 		);
 #else
 		Log(""
@@ -534,6 +1956,7 @@ void _ShowFlatView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf)
 			, report->parent ? report->enclosedMicroSecond / report->parent->enclosedMicroSecond * 100.0 : 100.00
 			, report->enclosedMicroSecond - report->childrenMicroSecond
 			, (report->enclosedMicroSecond - report->childrenMicroSecond) / report->enclosedMicroSecond * 100.0
+			, _GetHardwareColumns(report, treeMask).c_str()
 		);
 #endif
 	}
@@ -553,30 +1976,117 @@ void _ShowFlatView_Impl(ProfilerReportNode* report, int depth, bool sortBySelf)
 		std::sort(std::begin(children), std::end(children), _IsTotalTimeGreater);
 	}
 	for (auto& each : children) {
-		_ShowFlatView_Impl(each, depth + 1, sortBySelf);
+		_ShowFlatView_Impl(each, depth + 1, sortBySelf, treeMask);
+	}
+}
+
+////////////////////////////////
+static void _Gen_TagView(ProfilerNode* profileTree, std::map<std::pair<std::string, uint8_t>, ProfilerTagCounters>& writeTo)
+{
+	for (ProfilerNode* node = profileTree; node; node = node->m_nextSibling) {
+		for (int i = 0; i < node->numTags; ++i) {
+			const ProfilerTagCounters& counters = node->tagCounters[i];
+			ProfilerTagCounters& total = writeTo[std::make_pair(std::string(node->label), counters.tag)];
+			total.tag = counters.tag;
+			total.allocs += counters.allocs;
+			total.frees += counters.frees;
+			total.deltaByte += counters.deltaByte;
+		}
+		_Gen_TagView(node->m_firstChild, writeTo);
+	}
+}
+
+////////////////////////////////
+void ShowTagView(ProfilerNode* profileTree)
+{
+	if (!profileTree) {
+		Log("", "No such profiled frame, it was overwritten or never recorded");
+		return;
 	}
+#if MEM_TRACKING >= MEM_TRACKING_VERBOSE
+	Log("", "%-36.36s %-20.20s %9.9s %9.9s %18.18s", "LABEL", "TAG", "ALC", "FRE", "DLT");
+	std::map<std::pair<std::string, uint8_t>, ProfilerTagCounters> totals;
+	for (int i = 0; i < profileTree->numTags; ++i) {
+		totals[std::make_pair(std::string(profileTree->label), profileTree->tagCounters[i].tag)] = profileTree->tagCounters[i];
+	}
+	_Gen_TagView(profileTree->m_firstChild, totals);
+
+	std::vector<std::pair<const std::string*, const ProfilerTagCounters*>> rows;
+	for (auto& each : totals) {
+		rows.emplace_back(&each.first.first, &each.second);
+	}
+	std::sort(rows.begin(), rows.end(), [](auto& a, auto& b) {
+		return std::abs(a.second->deltaByte) > std::abs(b.second->deltaByte);
+	});
+	for (auto& each : rows) {
+		MemTag tag;
+		tag.id = each.second->tag;
+		Log("", "%-36.36s %-20.20s %9d %9d %18.18s"
+			, each.first->c_str()
+			, each.second->tag == PROFILER_TAG_OTHER ? "(other)" : MemGetTagName(tag)
+			, each.second->allocs
+			, each.second->frees
+			, GetByteSizeString(each.second->deltaByte).c_str()
+		);
+	}
+#else
+	UNUSED(profileTree);
+	Log("", "Memory tags are counted with MEM_TRACKING_VERBOSE only");
+#endif
 }
 
 //////////////////////////////////////////////////////////////////////////
 // This functions is for Memory TranckedAllocator to report allocation
 //////////////////////////////////////////////////////////////////////////
-void _NotifyAllocToProfiler(size_t bytes);
-void _NotifyFreeToProfiler(size_t bytes);
+void _NotifyAllocToProfiler(size_t bytes, MemTag tag);
+void _NotifyFreeToProfiler(size_t bytes, MemTag tag);
+
+////////////////////////////////
+static ProfilerTagCounters& _GetTagCounters(ProfilerTagCounters* tagCounters, int& numTags, MemTag tag)
+{
+	for (int i = 0; i < numTags; ++i) {
+		if (tagCounters[i].tag == tag.id) {
+			return tagCounters[i];
+		}
+	}
+	if (numTags < PROFILER_TAGS_PER_NODE - 1) {
+		ProfilerTagCounters& added = tagCounters[numTags++];
+		added = ProfilerTagCounters();
+		added.tag = tag.id;
+		return added;
+	}
+	// the last slot only ever holds OTHER, so no real tag's counts get relabeled
+	ProfilerTagCounters& other = tagCounters[PROFILER_TAGS_PER_NODE - 1];
+	if (numTags < PROFILER_TAGS_PER_NODE) {
+		other = ProfilerTagCounters();
+		other.tag = PROFILER_TAG_OTHER;
+		numTags = PROFILER_TAGS_PER_NODE;
+	}
+	return other;
+}
 
 ////////////////////////////////
-void _NotifyFreeToProfiler(size_t bytes)
+void _NotifyFreeToProfiler(size_t bytes, MemTag tag)
 {
-	if (t_activeNode) {
-		++t_activeNode->frees;
-		t_activeNode->deltaByte -= bytes;
+	if (t_recordDepth > 0) {
+		_ProfilerScopeCounters& scope = t_counters[std::min(t_recordDepth, PROFILER_MAX_DEPTH) - 1];
+		++scope.frees;
+		scope.deltaByte -= bytes;
+		ProfilerTagCounters& counters = _GetTagCounters(scope.tagCounters, scope.numTags, tag);
+		++counters.frees;
+		counters.deltaByte -= bytes;
 	}
 }
 
 ////////////////////////////////
-void _NotifyAllocToProfiler(size_t bytes)
+void _NotifyAllocToProfiler(size_t bytes, MemTag tag)
 {
-	if (t_activeNode) {
-		++t_activeNode->allocs;
-		t_activeNode->deltaByte += bytes;
+	if (t_recordDepth > 0) {
+		_ProfilerScopeCounters& scope = t_counters[std::min(t_recordDepth, PROFILER_MAX_DEPTH) - 1];
+		++scope.allocs;
+		scope.deltaByte += bytes;
+		ProfilerTagCounters& counters = _GetTagCounters(scope.tagCounters, scope.numTags, tag);
+		++counters.allocs;
+		counters.deltaByte += bytes;
 	}
 }
\ No newline at end of file
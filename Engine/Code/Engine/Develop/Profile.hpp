@@ -1,10 +1,19 @@
 #pragma once
 #include "Engine/Core/EngineCommon.hpp"
 #include "Engine/Core/Time.hpp"
+#include <string>
 #include <thread>
+#include <vector>
 using uint64 = unsigned long long int;
+// Roots every thread remembers, older ones are gone even when their events are still there
 constexpr size_t PROFILER_MAX_RECORD = 1024;
-constexpr size_t PROFILER_LABEL_SIZE = 64;
+// Ring of begin and end events of every thread, a power of 2
+constexpr size_t PROFILER_EVENTS_PER_THREAD = 1 << 16;
+// Scopes deeper than this are still timed, their allocations count for the one above
+constexpr int PROFILER_MAX_DEPTH = 64;
+// Hitches kept at once, the oldest written one is forgotten for a new one.
+// While all of them are still capturing, new hitches are not captured
+constexpr int PROFILER_MAX_HITCHES = 16;
 struct ScopeProfiler
 {
 	//uint64 m_hpc;
@@ -19,15 +28,40 @@ private:
 #define ___CONCAT(a, b) ___CONCAT___(a, b)
 #define __PROFILE_SCOPE_IMPL(scope_name, line)\
 	ScopeProfiler ___CONCAT(__scope_profiler_, line)(scope_name);
+// Only the pointer is kept, the name has to be a literal or live as long as the program
 #define PROFILE_SCOPE(scope_name) __PROFILE_SCOPE_IMPL(scope_name, __LINE__)
 #define PROFILED_FUNCTION PROFILE_SCOPE(__FUNCTION__);
+// Tags a node keeps apart, the last slot is kept for PROFILER_TAG_OTHER where the tags past the others go
+constexpr int PROFILER_TAGS_PER_NODE = 4;
+constexpr uint8_t PROFILER_TAG_OTHER = 0xff;
+struct ProfilerTagCounters
+{
+	uint8_t tag = 0;
+	unsigned int allocs = 0;
+	unsigned int frees = 0;
+	ptrdiff_t deltaByte = 0;
+};
+
+// Counters read at push and pop when ProfileSetHardwareCounters is on.
+// perf_event_open gives all of them on Linux, Windows only has the cycles of QueryThreadCycleTime
+enum ProfilerHardwareCounter : uint8_t
+{
+	PROFILER_HW_CYCLES,
+	PROFILER_HW_INSTRUCTIONS,
+	PROFILER_HW_L1D_MISSES,
+	PROFILER_HW_LLC_MISSES,
+	PROFILER_HW_BRANCH_MISSES,
+	NUM_PROFILER_HW_COUNTERS
+};
+
 struct ProfilerNode
 {
 	ProfilerNode* m_parent = nullptr;
 	ProfilerNode* m_firstChild = nullptr;
 	ProfilerNode* m_nextSibling = nullptr;
+	ProfilerNode* m_lastChild = nullptr;
 
-	char label[PROFILER_LABEL_SIZE];
+	const char* label = nullptr;
 	uint64 beginHPC = 0;
 	uint64 endHPC;
 	long int refCount = 0;
@@ -35,6 +69,12 @@ struct ProfilerNode
 	unsigned int allocs = 0;
 	unsigned int frees = 0;
 	ptrdiff_t deltaByte = 0;
+	// allocs, frees and deltaByte again, by memory tag
+	ProfilerTagCounters tagCounters[PROFILER_TAGS_PER_NODE];
+	int numTags = 0;
+	// children included, a bit in hardwareMask for every counter that was read
+	uint64 hardwareCounters[NUM_PROFILER_HW_COUNTERS] = {};
+	uint8_t hardwareMask = 0;
 
 
 	void AddChild(ProfilerNode* child);
@@ -47,25 +87,92 @@ struct ProfilerNode
 	double GetTimeMicroSecond() const;
 };
 
-struct ProfilerTreeInfo
+// Over every call since the last reset, in microseconds
+struct ProfilerTimeStats
+{
+	double minMicroSecond = 0;
+	double meanMicroSecond = 0;
+	double p50MicroSecond = 0;
+	double p95MicroSecond = 0;
+	double p99MicroSecond = 0;
+	double maxMicroSecond = 0;
+};
+
+struct ProfilerScopeStats
 {
-	std::thread::id threadID;
-	ProfilerTreeInfo() = default;
-	ProfilerTreeInfo(std::thread::id&& id)
-		:threadID(id)
-	{
-	}
+	std::string label;
+	uint64 count = 0;
+	ProfilerTimeStats inclusive;
+	ProfilerTimeStats self;
+};
+
+struct ProfilerHitchInfo
+{
+	int id = 0;
+	std::string label;
+	double milliSecond = 0;
+	// main thread frames kept before and after it
+	int framesBefore = 0;
+	int framesAfter = 0;
+	int numRoots = 0;
+	int numLogLines = 0;
+	// empty until the frames after it ended and the file was written
+	std::string path;
 };
 
 void ProfileInit();
 int GetTotalProfiledFrames();
 void ProfileReleaseTree(ProfilerNode* node);
+/// Never locks or allocates, tag is kept as a pointer
 void ProfilePush(const char* tag);
 void ProfilePop();
 void ProfileFreeTree(ProfilerNode* root);
 void ProfilePause();
 void ProfileResume();
+/// Builds the tree of a root from its events, null when it was overwritten. Release it with ProfileReleaseTree.
 ProfilerNode* RequireReferenceOfProfileTree(std::thread::id threadID, int nFromBack=0);
+/// Roots that begin from now on read the hardware counters of their thread at every push and pop.
+/// /return false, and it stays off, when none of the counters can be opened
+bool ProfileSetHardwareCounters(bool enabled);
+bool IsProfilingHardwareCounters();
+const char* GetProfilerHardwareCounterName(ProfilerHardwareCounter counter);
+/// Trees with hardware counters get a column for each, children included
 void ShowTreeView(ProfilerNode* profileTree, bool sortBySelf = true);
 void ShowFlatView(ProfilerNode* profileTree, bool sortBySelf = true);
+/// Allocations of every label by memory tag, biggest change first
+void ShowTagView(ProfilerNode* profileTree);
 std::vector<float> GetFrameTimeList();
+/// Chrome/Perfetto trace event JSON of every thread, open with chrome://tracing or ui.perfetto.dev.
+/// Cut to the last frames roots of the main thread, 0 keeps every root still remembered.
+bool ProfileExportChromeTrace(const char* path, int frames = 0);
+/// Writes the roots of every thread to path as they end, until seconds went by or ProfileStreamStop
+bool ProfileStreamStart(const char* path, double seconds);
+void ProfileStreamStop();
+bool IsProfileStreaming();
+/// Once a frame, appends what ended since the last call
+void ProfileStreamUpdate();
+/// Once a frame, adds the scopes that ended since the last call to the stats of their labels.
+/// Roots lapped in the ring before that are not counted.
+void ProfileStatsUpdate();
+/// Forgets the stats, counting starts again from the roots that end after this
+void ProfileStatsReset();
+/// Every label of every thread, updated first
+std::vector<ProfilerScopeStats> GetProfileStats();
+/// The labels with the worst p99 first
+void ShowStatsView(bool self = false, int maxRows = 30);
+
+/// A main thread root with this label taking longer than milliSecond is a hitch, no label takes every root, 0 turns it off.
+/// The roots of every thread from surroundingFrames frames before it to as many after are copied out of the rings,
+/// then written to logs/hitch_<id>.json with the log lines of the same time.
+void ProfileSetHitchBudget(double milliSecond, const char* rootLabel = "App::RunFrame", int surroundingFrames = 2);
+/// Once a frame, looks for hitches in the roots that ended since the last call.
+/// Call it outside the frame root: writing a hitch flushes the log, a frame that spans the write is not taken as a hitch
+void ProfileHitchUpdate();
+/// Forgets every hitch kept, the ones still capturing too. Their files stay
+void ProfileClearHitches();
+std::vector<ProfilerHitchInfo> GetProfileHitches();
+void ShowHitchesView();
+/// Main thread tree of a frame of a hitch, 0 is the hitch itself, negative before it. Release it with ProfileReleaseTree.
+ProfilerNode* RequireReferenceOfHitchTree(int hitchID, int frame = 0);
+/// Trees of the main thread and of the roots other threads ran during a frame of a hitch
+void ShowHitchTreeView(int hitchID, int frame = 0, bool flat = false, bool sortBySelf = true);
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "Engine/Develop/SmallObjectAllocator.hpp"
+#include <new>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+// 16 byte steps while that is fine grained, a quarter to a half apart above
+static constexpr size_t SMALL_OBJECT_CLASS_SIZES[NUM_SMALL_OBJECT_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 256, 320, 384, 512, 768, 1024
+};
+static_assert(SMALL_OBJECT_CLASS_SIZES[NUM_SMALL_OBJECT_CLASSES - 1] == SMALL_OBJECT_MAX_SIZE);
+
+////////////////////////////////
+void* _SmallObjectChunkSource::ialloc(size_t count)
+{
+	GUARANTEE_OR_DIE(count <= SMALL_OBJECT_CHUNK_SIZE, "Size class asked for a chunk bigger than SMALL_OBJECT_CHUNK_SIZE");
+	return m_owner->_CommitChunk(m_sizeClass);
+}
+
+////////////////////////////////
+void _SmallObjectChunkSource::ifree(void* p)
+{
+	m_owner->_DecommitChunk(p);
+}
+
+////////////////////////////////
+SmallObjectAllocator::SmallObjectAllocator()
+{
+	m_region = (unsigned char*)::VirtualAlloc(nullptr, SMALL_OBJECT_REGION_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+
+	int sizeClass = 0;
+	for (size_t i = 0; i <= SMALL_OBJECT_MAX_SIZE / SMALL_OBJECT_ALIGNMENT; ++i) {
+		while (SMALL_OBJECT_CLASS_SIZES[sizeClass] < i * SMALL_OBJECT_ALIGNMENT) {
+			++sizeClass;
+		}
+		m_classOfSize[i] = (uint8_t)sizeClass;
+	}
+
+	// the chunk header and the alignment padding come out of the chunk
+	const size_t usable = SMALL_OBJECT_CHUNK_SIZE - sizeof(BlockAllocator::Chunk) - (SMALL_OBJECT_ALIGNMENT - 1);
+	for (int i = 0; i < NUM_SMALL_OBJECT_CLASSES; ++i) {
+		m_sources[i].m_owner = this;
+		m_sources[i].m_sizeClass = (uint8_t)i;
+		const size_t blockSize = SMALL_OBJECT_CLASS_SIZES[i];
+		m_classes[i].Init(&m_sources[i], blockSize, SMALL_OBJECT_ALIGNMENT, (unsigned int)(usable / blockSize));
+	}
+}
+
+////////////////////////////////
+void* SmallObjectAllocator::ialloc(size_t count)
+{
+	if (count > SMALL_OBJECT_MAX_SIZE) {
+		return UntrackedAlloc(count);
+	}
+	const int sizeClass = m_classOfSize[(count + SMALL_OBJECT_ALIGNMENT - 1) / SMALL_OBJECT_ALIGNMENT];
+	void* block = m_classes[sizeClass].AllocBlock();
+	if (!block) {
+		// out of reserved space
+		return UntrackedAlloc(count);
+	}
+	return block;
+}
+
+////////////////////////////////
+void SmallObjectAllocator::ifree(void* p)
+{
+	if (!p) {
+		return;
+	}
+	if (Owns(p)) {
+		const size_t chunk = ((unsigned char*)p - m_region) / SMALL_OBJECT_CHUNK_SIZE;
+		m_classes[m_chunkClass[chunk]].FreeBlock(p);
+	} else {
+		UntrackedFree(p);
+	}
+}
+
+////////////////////////////////
+bool SmallObjectAllocator::Owns(const void* p) const
+{
+	const unsigned char* byte = (const unsigned char*)p;
+	return m_region && byte >= m_region && byte < m_region + SMALL_OBJECT_REGION_SIZE;
+}
+
+////////////////////////////////
+size_t SmallObjectAllocator::GetClassSize(size_t count) const
+{
+	if (count > SMALL_OBJECT_MAX_SIZE) {
+		return 0;
+	}
+	return SMALL_OBJECT_CLASS_SIZES[m_classOfSize[(count + SMALL_OBJECT_ALIGNMENT - 1) / SMALL_OBJECT_ALIGNMENT]];
+}
+
+////////////////////////////////
+size_t SmallObjectAllocator::GetCommittedBytes() const
+{
+	return m_committedChunks.load(std::memory_order_relaxed) * SMALL_OBJECT_CHUNK_SIZE;
+}
+
+////////////////////////////////
+void* SmallObjectAllocator::_CommitChunk(uint8_t sizeClass)
+{
+	if (!m_region) {
+		return nullptr;
+	}
+	const size_t chunk = m_numChunks.fetch_add(1, std::memory_order_relaxed);
+	if (chunk >= SMALL_OBJECT_REGION_SIZE / SMALL_OBJECT_CHUNK_SIZE) {
+		return nullptr;
+	}
+	unsigned char* address = m_region + chunk * SMALL_OBJECT_CHUNK_SIZE;
+	if (!::VirtualAlloc(address, SMALL_OBJECT_CHUNK_SIZE, MEM_COMMIT, PAGE_READWRITE)) {
+		return nullptr;
+	}
+	m_chunkClass[chunk] = sizeClass;
+	++m_committedChunks;
+	return address;
+}
+
+////////////////////////////////
+// The address range is not reused, a closed class would only happen at shutdown
+void SmallObjectAllocator::_DecommitChunk(void* chunk)
+{
+	::VirtualFree(chunk, SMALL_OBJECT_CHUNK_SIZE, MEM_DECOMMIT);
+	--m_committedChunks;
+}
+
+////////////////////////////////
+SmallObjectAllocator* GetSmallObjectAllocator()
+{
+	// not new, that is the operator new this backs
+	static SmallObjectAllocator* instance = new (UntrackedAlloc(sizeof(SmallObjectAllocator))) SmallObjectAllocator();
+	return instance;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+#include "Engine/Develop/Memory.hpp"
+#include <atomic>
+
+// Biggest request served by a size class, anything bigger goes to the system heap
+inline constexpr size_t SMALL_OBJECT_MAX_SIZE = 1024;
+// Size classes carve their blocks out of chunks this big
+inline constexpr size_t SMALL_OBJECT_CHUNK_SIZE = 64 * 1024;
+// Address space reserved up front, chunks are committed as the classes grow.
+// Once it is used up small requests go to the system heap too.
+inline constexpr size_t SMALL_OBJECT_REGION_SIZE = (size_t)1 << 30;
+inline constexpr int NUM_SMALL_OBJECT_CLASSES = 16;
+inline constexpr size_t SMALL_OBJECT_ALIGNMENT = 16;
+
+struct SmallObjectAllocator;
+
+// Chunks of one size class, committed in the shared region
+struct _SmallObjectChunkSource : public IAllocator
+{
+	virtual void* ialloc(size_t count) override;
+	virtual void ifree(void* p) override;
+
+	SmallObjectAllocator* m_owner = nullptr;
+	uint8_t m_sizeClass = 0;
+};
+
+// Small requests are rounded up to a size class, each class is a BlockAllocator with per thread magazines.
+// Every chunk lives in one reserved range, a free finds its class from the address alone.
+struct SmallObjectAllocator : public IAllocator
+{
+public:
+	SmallObjectAllocator();
+
+	virtual void* ialloc(size_t count) override;
+	virtual void ifree(void* p) override;
+
+	/// p was handed out by a size class
+	bool Owns(const void* p) const;
+	/// Block size count is rounded up to, 0 when it is too big for a class
+	size_t GetClassSize(size_t count) const;
+	size_t GetCommittedBytes() const;
+
+	void* _CommitChunk(uint8_t sizeClass);
+	void _DecommitChunk(void* chunk);
+
+public:
+	unsigned char* m_region = nullptr;
+	std::atomic<size_t> m_numChunks = 0;
+	std::atomic<size_t> m_committedChunks = 0;
+	// size class of every chunk, by offset in the region
+	uint8_t m_chunkClass[SMALL_OBJECT_REGION_SIZE / SMALL_OBJECT_CHUNK_SIZE] = {};
+	// size class of every multiple of SMALL_OBJECT_ALIGNMENT
+	uint8_t m_classOfSize[SMALL_OBJECT_MAX_SIZE / SMALL_OBJECT_ALIGNMENT + 1] = {};
+	BlockAllocator m_classes[NUM_SMALL_OBJECT_CLASSES];
+	_SmallObjectChunkSource m_sources[NUM_SMALL_OBJECT_CLASSES];
+};
+
+/// Never destroyed, global operator new may still run after static destructors
+SmallObjectAllocator* GetSmallObjectAllocator();
\ No newline at end of file
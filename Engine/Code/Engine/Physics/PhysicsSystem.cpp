@@ -9,6 +9,7 @@
 #include "Engine/Math/MathUtils.hpp"
 #include "Engine/Math/OBB2.hpp"
 #include "Engine/Event/EventSystem.hpp"
+#include "Engine/Develop/Memory.hpp"
 //////////////////////////////////////////////////////////////////////////
 STATIC Vec2 PhysicsSystem::GRAVATY(0, -9.8f);
 
@@ -55,6 +56,7 @@ void PhysicsSystem::BeginFrame()
 ////////////////////////////////
 void PhysicsSystem::Update(float deltaSeconds)
 {
+	MEM_TAG_SCOPE("Physics");
 	// Pre update
 	for (auto eachRigidbody : m_rigidbodies) {
 		eachRigidbody->UpdateFromTransform();